@@ -95,6 +95,8 @@ for module in "${modules[@]}"; do
     cp -r overlays/overlays-$module/* $BUILD_DIR/src/overlays/
     # cp -r overlays/overlays-$module/* $BUILD_DIR/debian/tmp/usr/src/vc-mipi-driver-$module-${VERSION_DEB_PACKAGE}/overlays/
     rsync -a --exclude='.env' src/ $BUILD_DIR/src/
+    # vc_pipeline for the udev rules, built on the target by debian/rules
+    rsync -a --exclude='*.o' --exclude='*.a' tools/ $BUILD_DIR/tools/
 
     DEB_BUILD_OPTIONS="KERNEL_HEADERS=$KERNEL_HEADERS" 
     envsubst '$VERSION_DEB_PACKAGE $MODULE_VERSION' < dkms.conf > $BUILD_DIR/dkms.conf
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""
+Capture with the vcmipi extension module (tools/python)
+
+Frames are NumPy views of the V4L2 buffers, nothing is copied, and waiting
+for a frame does not hold the GIL. The sensor controls are attributes of
+vcmipi.Sensor.
+
+Requirements:
+    pip install numpy
+    cd ../tools/python && pip install .
+    pip install opencv-python    # optional, for the preview window
+
+Usage:
+    python3 vcmipi_preview.py --count 100 --exposure 10000 --gain 6000
+    python3 vcmipi_preview.py --device replay:capture.vcraw --show
+"""
+
+import argparse
+import sys
+import time
+
+import numpy as np
+
+import vcmipi
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Capture with zero-copy NumPy frames")
+    parser.add_argument("--device", default="/dev/video0", help="Video device or replay:<file>")
+    parser.add_argument("--subdev", default=None, help="Sensor subdevice (auto-detected if omitted)")
+    parser.add_argument("--count", type=int, default=100, help="Number of frames, 0 = until Ctrl+C")
+    parser.add_argument("--exposure", type=int, help="Exposure in us")
+    parser.add_argument("--gain", type=int, help="Analogue gain in mdB")
+    parser.add_argument("--show", action="store_true", help="Show a 4x preview with OpenCV")
+    args = parser.parse_args()
+
+    subdev = args.subdev
+    if not args.device.startswith("replay:"):
+        with vcmipi.Sensor(subdev) as sensor:
+            subdev = sensor.path
+            controls = {}
+            if args.exposure is not None:
+                controls["exposure"] = args.exposure
+            if args.gain is not None:
+                controls["gain"] = args.gain
+            sensor.set(**controls)
+            print(f"Sensor {sensor.name} on {sensor.path}: exposure {sensor.exposure} us, "
+                  f"gain {sensor.gain} mdB")
+
+    cv2 = None
+    if args.show:
+        try:
+            import cv2
+        except ImportError:
+            print("OpenCV not installed, no preview")
+
+    with vcmipi.Capture(args.device, subdev) as cap:
+        print(f"Capturing {cap.fourcc} {cap.width}x{cap.height} ({cap.bits} bit"
+              f"{', packed' if cap.packed else ''})")
+        n = 0
+        start = time.monotonic()
+        try:
+            for frame in cap:
+                with frame:
+                    # frame.array views the buffer, it is only valid inside the with block
+                    mean = float(np.mean(frame.array[::8, ::8]))
+                    if cv2 is not None:
+                        cv2.imshow("vcmipi", frame.preview(4, rgb=cap.bayer is not None))
+                        if cv2.waitKey(1) == 27:
+                            break
+                    if n % 30 == 0:
+                        print(f"Frame {frame.sequence}: mean {mean:.1f}, exposure {frame.exposure}, "
+                              f"gain {frame.gain}")
+                n += 1
+                if args.count and n >= args.count:
+                    break
+        except KeyboardInterrupt:
+            pass
+        elapsed = time.monotonic() - start
+
+        stats = cap.stats()
+        print(f"{n} frames in {elapsed:.1f} s ({n / elapsed if elapsed else 0:.1f} fps), "
+              f"{stats['dropped']} dropped, latency {stats['latency_ms']:.2f} ms")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -14,6 +14,8 @@
 #define VERSION_CAMERA "0.6.11"
 
 int debug = 3;
+// Logs the wall clock time of the I2C heavy paths (probe, set_fmt, stream on)
+static bool timing;
 // --- Prototypes --------------------------------------------------------------
 static int vc_sd_s_power(struct v4l2_subdev *sd, int on);
 static int vc_sd_s_ctrl(struct v4l2_subdev *sd, struct v4l2_control *control);
@@ -47,6 +49,8 @@ enum private_cids
         V4L2_CID_VC_BINNING_MODE,
         V4L2_CID_LIVE_ROI,
         V4L2_CID_VC_NAME,
+        V4L2_CID_VC_RESTART_STREAM,
+        V4L2_CID_VC_RESTART_COUNT,
 };
 
 enum pad_types {
@@ -54,6 +58,25 @@ enum pad_types {
 	METADATA_PAD,
 	NUM_PADS
 };
+// Startup preset read from the device tree (vc,* properties). Unset values
+// are VC_PRESET_UNSET and keep the sensor defaults.
+#define VC_PRESET_UNSET U32_MAX
+
+struct vc_preset {
+        u32 mbus_code;
+        u32 left;
+        u32 top;
+        u32 width;
+        u32 height;
+        u32 binning_mode;
+        u32 frame_rate;
+        u32 trigger_mode;
+        u32 io_mode;
+        u32 exposure;
+        u32 gain;
+        u32 blacklevel;
+};
+
 struct vc_control_int_menu {
         struct v4l2_ctrl *ctrl;
         const struct v4l2_ctrl_ops *ops;
@@ -70,14 +93,61 @@ struct vc_device
         struct vc_cam cam;
         bool libcamera_enabled;
         u32 force_color_mode;
+        bool hmax_crop_scaling;
+        bool auto_link_rate;
+        u32 max_lanes;                  // wired lanes, from the DT endpoint
+        struct vc_preset preset;
         __u32 supported_mbus_codes[MAX_MBUS_CODES];
         struct v4l2_ctrl *hblank_ctrl;
         struct v4l2_ctrl *vblank_ctrl;
+        struct v4l2_ctrl *exposure_ctrl;
         struct v4l2_ctrl *blacklevel_ctrl;
+        struct v4l2_ctrl *link_freq_ctrl;
+        struct v4l2_ctrl *pixel_rate_ctrl;
+        // Link and blanking of the current mode, from vc_update_clk_rates().
+        // Per camera, each one only holds its own control handler lock.
+        struct vc_control pixel_rate;
+        struct vc_control64 linkfreq;
+        struct vc_control hblank;
+        struct vc_control vblank;
+        struct v4l2_ctrl *frame_rate_ctrl;
+        // Link frequencies of all modes in the module descriptor, ascending
+        s64 link_freqs[MAX_VC_DESC_MODES];
+        u32 num_link_freqs;
+        // Frame size the receiver was set up for at stream on
+        u32 stream_width;
+        u32 stream_height;
+        // Successful restarts through V4L2_CID_VC_RESTART_STREAM since probe
+        u32 restart_count;
 
 };
 static void vc_update_clk_rates(struct vc_device *device, struct vc_cam *cam);
+static void vc_sync_clk_rates(struct vc_device *device);
+static void vc_ctrl_update_range(struct v4l2_ctrl *ctrl, struct vc_control *control);
+static void vc_update_exposure_range(struct vc_device *device, u32 vmax);
 static void vc_update_blacklevel_ctrl(struct vc_device *device, struct vc_cam *cam);
+static int vc_sd_switch_binning(struct vc_device *device, int binning_mode);
+static int vc_sd_restart_stream(struct vc_device *device);
+static u32 __vc_get_optimized_hmax(struct vc_device *device, vc_mode *mode, u32 active_width, u32 rate);
+static u32 vc_get_optimized_hmax(struct vc_device *device, vc_mode *mode, u32 active_width);
+static void vc_select_link_rate(struct vc_device *device);
+static void vc_publish_link_config(struct vc_device *device);
+static int vc_link_freq_index(struct vc_device *device, s64 freq);
+static int vc_get_bit_depth(__u8 mipi_format);
+
+// Path time measurement, enabled with the module parameter 'timing'. This is
+// wall clock time, not bus time: it includes vc_core's sleeps and the polling
+// for the module to become ready, besides the I2C transfers.
+static inline ktime_t vc_timing_start(void)
+{
+        return timing ? ktime_get() : 0;
+}
+
+static inline void vc_timing_end(struct device *dev, const char *what, ktime_t start)
+{
+        if (timing)
+                dev_notice(dev, "timing: %s took %lld us (wall clock)\n", what, ktime_us_delta(ktime_get(), start));
+}
 
 static inline struct vc_device *to_vc_device(struct v4l2_subdev *sd)
 {
@@ -91,21 +161,12 @@ static inline struct vc_cam *to_vc_cam(struct v4l2_subdev *sd)
 }
 
 
-static        struct vc_control hblank; 
-static        struct vc_control vblank; 
-static        struct vc_control pixel_rate; 
 // Unsupported mbus codes for libcamera
 static int unsupported_mbus_codes[1]=
 {
         MEDIA_BUS_FMT_Y14_1X14
 };
 
-static struct vc_control64 linkfreq  = {
-        .min = 0,
-        .max = 0,
-        .def = 0,
-    };
-
 static void update_frame_rate_ctrl(struct vc_cam *cam, struct vc_device *device);
 int vc_sd_update_fmt(struct vc_device *device);
 
@@ -234,13 +295,13 @@ static int vc_sd_s_ctrl(struct v4l2_subdev *sd, struct v4l2_control *control)
         {
 
         case V4L2_CID_HBLANK:
-                if (cam->ctrl.clk_pixel > 0 && pixel_rate.max > 0) {
+                if (cam->ctrl.clk_pixel > 0 && device->pixel_rate.max > 0) {
                         u32 active_width = cam->state.frame.width > 0
                                            ? cam->state.frame.width
                                            : cam->ctrl.frame.width;
                         u32 new_hmax = (u32)div_u64(
                                 (u64)(active_width + control->value) * cam->ctrl.clk_pixel,
-                                pixel_rate.max);
+                                device->pixel_rate.max);
                         vc_core_set_hmax_overwrite(cam, new_hmax);
                 } else {
                         vc_core_set_hmax_overwrite(cam, mode->hmax.def + (control->value & ~num_lanes) / num_lanes);
@@ -253,12 +314,14 @@ static int vc_sd_s_ctrl(struct v4l2_subdev *sd, struct v4l2_control *control)
                 /* Use the active (crop) height, not the full sensor native height.
                  * vblank is always expressed as (VMAX - active_height), so VMAX must
                  * be reconstructed with the same active_height used when the range
-                 * was reported (see vblank.min/max/def calculation above). */
+                 * was reported (see the vblank calculation in vc_update_clk_rates()). */
                 u32 active_height = cam->state.frame.height > 0
                                     ? cam->state.frame.height
                                     : cam->ctrl.frame.height;
                 vc_core_set_vmax_overwrite(cam, active_height + control->value);
                 vc_sen_write_vmax(&cam->ctrl, cam->state.vmax_overwrite);
+                // The longest exposure follows the frame length
+                vc_update_exposure_range(device, active_height + control->value);
                 return 0;
         }
         case V4L2_CID_HFLIP:
@@ -292,21 +355,31 @@ static int vc_sd_s_ctrl(struct v4l2_subdev *sd, struct v4l2_control *control)
         case V4L2_CID_VC_FRAME_RATE:
         
                 ret =  vc_core_set_framerate(cam, control->value);                
-                vc_update_clk_rates(device, cam);
+                vc_publish_link_config(device);
                 return ret;
 
         case V4L2_CID_VC_SINGLE_TRIGGER:
                 return vc_mod_set_single_trigger(cam);
 
         case V4L2_CID_VC_BINNING_MODE:
-                ret = vc_core_set_binning_mode(cam, control->value);
-                vc_sd_update_fmt(device);
-                vc_update_blacklevel_ctrl(device, cam);
+                // Same order as s_stream: control handler lock, then device->mutex
+                mutex_lock(&device->mutex);
+                if (cam->state.streaming) {
+                        ret = vc_sd_switch_binning(device, control->value);
+                } else {
+                        ret = vc_core_set_binning_mode(cam, control->value);
+                        vc_sd_update_fmt(device);
+                        vc_update_blacklevel_ctrl(device, cam);
+                }
+                mutex_unlock(&device->mutex);
                 return ret;
 
         case V4L2_CID_LIVE_ROI:
                 return vc_core_live_roi(cam, control->value);
 
+        case V4L2_CID_VC_RESTART_STREAM:
+                return vc_sd_restart_stream(device);
+
 
         default:
                 vc_warn(dev, "%s(): Unkown control 0x%08x\n", __func__, control->id);
@@ -320,20 +393,44 @@ static int vc_sd_s_ctrl(struct v4l2_subdev *sd, struct v4l2_control *control)
 
 
 
+// Narrow crops get a shorter line if the device tree allows it
+static void vc_apply_optimized_hmax(struct vc_device *device)
+{
+        struct vc_cam *cam = &device->cam;
+        vc_mode *mode = vc_get_mode(cam);
+        u32 hmax;
+
+        if (!device->hmax_crop_scaling || !mode)
+                return;
+
+        hmax = vc_get_optimized_hmax(device, mode, cam->state.frame.width);
+        if (hmax != mode->hmax.def)
+                vc_notice(vc_core_get_sen_device(cam), "%s(): HMAX %u for crop width %u\n", __func__,
+                          hmax, cam->state.frame.width);
+
+        // The default is written too, it resets the shorter line of an earlier crop
+        vc_core_set_hmax_overwrite(cam, hmax);
+        vc_sen_set_hmax(cam);
+}
+
 static int vc_sd_s_stream(struct v4l2_subdev *sd, int enable)
 {
         struct vc_device *device = to_vc_device(sd);
         struct vc_cam *cam = to_vc_cam(sd);
         struct vc_state *state = &cam->state;
         struct device *dev = sd->dev;
+        ktime_t start;
         int ret = 0;
 
         vc_dbg(dev, "%s(): Set streaming: %s\n", __func__, enable ? "on" : "off");
 
+        // Control handler lock first, the stream on updates controls. s_ctrl
+        // and the pad ops take the locks in the same order.
+        mutex_lock(device->ctrl_handler.lock);
+        mutex_lock(&device->mutex);
         if (state->streaming == enable)
-                return 0;
+                goto err_unlock;
 
-        mutex_lock(&device->mutex);
         if (enable)
         {
                 ret = pm_runtime_get_sync(dev);
@@ -344,6 +441,11 @@ static int vc_sd_s_stream(struct v4l2_subdev *sd, int enable)
                         goto err_unlock;
                 }
 
+                // The link rate was selected and published to the receiver
+                // while the stream was off, see vc_publish_link_config()
+                start = vc_timing_start();
+                vc_apply_optimized_hmax(device);
+
                                         ret = vc_sen_set_exposure(cam, cam->state.exposure);
                         if (ret < 0) {
                                 vc_err(dev, "%s(): Failed to set exposure: %d\n", __func__, ret);
@@ -356,9 +458,12 @@ static int vc_sd_s_stream(struct v4l2_subdev *sd, int enable)
                         vc_err(dev, "%s(): Failed to start stream: %d\n", __func__, ret);
                         goto err_rpm_put;
                 }
+                vc_timing_end(dev, "stream on", start);
 
                 update_frame_rate_ctrl(cam,device);
 
+                device->stream_width = cam->state.frame.width;
+                device->stream_height = cam->state.frame.height;
         }
         else
         {
@@ -368,6 +473,7 @@ static int vc_sd_s_stream(struct v4l2_subdev *sd, int enable)
 
         state->streaming = enable;
         mutex_unlock(&device->mutex);
+        mutex_unlock(device->ctrl_handler.lock);
 
         return 0;
 err_rpm_put:
@@ -375,9 +481,158 @@ err_rpm_put:
         pm_runtime_put(dev);
 err_unlock:
         mutex_unlock(&device->mutex);
+        mutex_unlock(device->ctrl_handler.lock);
         return ret;
 }
 
+// Geometry changes while streaming. Only the sensor readout is restarted, the
+// receiver keeps streaming into the buffers it allocated at stream on. So the
+// new frame must not be larger than the frame at stream on. Subscribers of
+// V4L2_EVENT_SOURCE_CHANGE on the subdevice are told to re-read the format.
+
+static void vc_sd_notify_source_change(struct vc_device *device)
+{
+        static const struct v4l2_event event = {
+                .type = V4L2_EVENT_SOURCE_CHANGE,
+                .u.src_change.changes = V4L2_EVENT_SRC_CH_RESOLUTION,
+        };
+
+        v4l2_subdev_notify_event(&device->sd, &event);
+}
+
+static bool vc_sd_fits_stream(struct vc_device *device)
+{
+        struct vc_frame *frame = vc_core_get_frame(&device->cam);
+
+        return frame->width <= device->stream_width && frame->height <= device->stream_height;
+}
+
+static int vc_sd_restart_readout(struct vc_device *device)
+{
+        struct vc_cam *cam = &device->cam;
+        struct device *dev = vc_core_get_sen_device(cam);
+        int ret;
+
+        vc_apply_optimized_hmax(device);
+
+        ret = vc_sen_set_exposure(cam, cam->state.exposure);
+        if (ret == 0)
+                ret = vc_sen_start_stream(cam);
+        if (ret < 0)
+                vc_err(dev, "%s(): Failed to restart stream: %d\n", __func__, ret);
+
+        // Runs under the control handler lock, only cached controls are updated
+        vc_update_clk_rates(device, cam);
+        vc_sd_notify_source_change(device);
+
+        return ret;
+}
+
+// Recovery after receiver errors or a stalled stream. The sensor readout is
+// stopped and started again with the cached mode, frame and exposure. The
+// format is unchanged, so unlike vc_sd_restart_readout() no source change is
+// signalled and the receiver keeps its buffers.
+// Called with the control handler lock held. device->mutex is taken here, in
+// the same order as s_stream, and the stream state is checked under it.
+static int vc_sd_restart_stream(struct vc_device *device)
+{
+        struct vc_cam *cam = &device->cam;
+        struct device *dev = vc_core_get_sen_device(cam);
+        ktime_t start;
+        int ret;
+
+        mutex_lock(&device->mutex);
+        if (!cam->state.streaming) {
+                ret = -EINVAL;
+                goto out;
+        }
+
+        start = vc_timing_start();
+        vc_sen_stop_stream(cam);
+        vc_apply_optimized_hmax(device);
+
+        ret = vc_sen_set_exposure(cam, cam->state.exposure);
+        if (ret == 0)
+                ret = vc_sen_start_stream(cam);
+        if (ret < 0) {
+                vc_err(dev, "%s(): Failed to restart stream: %d\n", __func__, ret);
+                goto out;
+        }
+        device->restart_count++;
+        vc_timing_end(dev, "stream restart", start);
+        vc_notice(dev, "%s(): Stream restarted (%u)\n", __func__, device->restart_count);
+
+out:
+        mutex_unlock(&device->mutex);
+        return ret;
+}
+
+// Called with the control handler lock and device->mutex held, while streaming
+static int vc_sd_switch_binning(struct vc_device *device, int binning_mode)
+{
+        struct vc_cam *cam = &device->cam;
+        struct device *dev = vc_core_get_sen_device(cam);
+        struct vc_frame old_frame = *vc_core_get_frame(cam);
+        int old_mode = cam->state.binning_mode;
+        int ret;
+
+        vc_sen_stop_stream(cam);
+
+        ret = vc_core_set_binning_mode(cam, binning_mode);
+        if (ret == 0) {
+                vc_sd_update_fmt(device);
+                if (!vc_sd_fits_stream(device))
+                        ret = -EBUSY;
+        }
+        if (ret < 0) {
+                vc_warn(dev, "%s(): Binning mode %d not possible while streaming\n", __func__, binning_mode);
+                vc_core_set_binning_mode(cam, old_mode);
+                vc_core_set_frame(cam, old_frame.left, old_frame.top, old_frame.width, old_frame.height);
+                vc_sd_restart_readout(device);
+                return ret;
+        }
+
+        vc_update_blacklevel_ctrl(device, cam);
+        return vc_sd_restart_readout(device);
+}
+
+// Called with the control handler lock and device->mutex held, while streaming
+static int vc_sd_switch_crop(struct vc_device *device, struct v4l2_rect *rect)
+{
+        struct vc_cam *cam = &device->cam;
+        struct device *dev = vc_core_get_sen_device(cam);
+        struct vc_frame *frame = vc_core_get_frame(cam);
+        struct vc_frame old_frame = *frame;
+        int ret;
+
+        // Moving a window of the same size does not need a restart
+        if (rect->width == frame->width && rect->height == frame->height &&
+            vc_core_live_roi(cam, cam->state.binning_mode * 100000000 + rect->left * 10000 + rect->top) == 0)
+                goto out;
+
+        vc_sen_stop_stream(cam);
+
+        vc_core_set_frame(cam, rect->left, rect->top, rect->width, rect->height);
+        if (!vc_sd_fits_stream(device)) {
+                vc_warn(dev, "%s(): Crop %ux%u larger than the stream (%ux%u)\n", __func__,
+                        frame->width, frame->height, device->stream_width, device->stream_height);
+                vc_core_set_frame(cam, old_frame.left, old_frame.top, old_frame.width, old_frame.height);
+                vc_sd_restart_readout(device);
+                return -EBUSY;
+        }
+
+        ret = vc_sd_restart_readout(device);
+        if (ret < 0)
+                return ret;
+
+out:
+        rect->left = frame->left;
+        rect->top = frame->top;
+        rect->width = frame->width;
+        rect->height = frame->height;
+        return 0;
+}
+
 // --- v4l2_subdev_pad_ops ---------------------------------------------------
 
 static int vc_sd_get_fmt(struct v4l2_subdev *sd, struct v4l2_subdev_state *state, struct v4l2_subdev_format *format)
@@ -403,26 +658,41 @@ static int vc_sd_get_fmt(struct v4l2_subdev *sd, struct v4l2_subdev_state *state
         return 0;
 }
 
-static int vc_sd_set_fmt(struct v4l2_subdev *sd, struct v4l2_subdev_state *state, struct v4l2_subdev_format *format)
+// Called with the control handler lock and device->mutex held
+static void __vc_sd_set_fmt(struct vc_device *device, struct v4l2_mbus_framefmt *mf)
 {
-        struct vc_device *device = to_vc_device(sd);
-        struct vc_cam *cam = to_vc_cam(sd);
-        struct v4l2_mbus_framefmt *mf = &format->format;
-
-        
-        mutex_lock(&device->mutex);
-        
-
+        struct vc_cam *cam = &device->cam;
+        ktime_t start;
 
+        start = vc_timing_start();
         vc_core_set_format(cam, mf->code);
         // TODO vc_core_set_frame(cam, mf->top, mf->left, mf->width, mf->height);
         vc_core_set_frame(cam, 0, 0, mf->width, mf->height);
+        vc_timing_end(device->sd.dev, "set_fmt", start);
         mf->field = V4L2_FIELD_NONE;
         mf->colorspace = V4L2_COLORSPACE_SRGB;
 
+        vc_publish_link_config(device);
+}
+
+static int vc_sd_set_fmt(struct v4l2_subdev *sd, struct v4l2_subdev_state *state, struct v4l2_subdev_format *format)
+{
+        struct vc_device *device = to_vc_device(sd);
+        int ret = 0;
+
+        // Publishing the link configuration updates controls
+        mutex_lock(device->ctrl_handler.lock);
+        mutex_lock(&device->mutex);
+        // The receiver's buffers are sized for the format at stream on.
+        // Binning and crop have their own switch while streaming.
+        if (device->cam.state.streaming)
+                ret = -EBUSY;
+        else
+                __vc_sd_set_fmt(device, &format->format);
         mutex_unlock(&device->mutex);
-        
-        return 0;
+        mutex_unlock(device->ctrl_handler.lock);
+
+        return ret;
 }
 
 int vc_sd_enum_mbus_code(struct v4l2_subdev *sd, struct v4l2_subdev_state *state, struct v4l2_subdev_mbus_code_enum *code)
@@ -539,11 +809,25 @@ static int vc_sd_set_selection(struct v4l2_subdev *sd,
         struct vc_device *device = to_vc_device(sd);
         struct vc_cam *cam = to_vc_cam(sd);
         struct device *dev = &device->cam.ctrl.client_sen->dev;
+        int ret;
 
         if (sel->target != V4L2_SEL_TGT_CROP)
                 return -EINVAL;
 
+        // The restart and the link configuration update controls
+        mutex_lock(device->ctrl_handler.lock);
+        mutex_lock(&device->mutex);
+        if (cam->state.streaming) {
+                ret = vc_sd_switch_crop(device, &sel->r);
+                mutex_unlock(&device->mutex);
+                mutex_unlock(device->ctrl_handler.lock);
+                return ret;
+        }
+
         vc_core_set_frame(cam, sel->r.left, sel->r.top, sel->r.width, sel->r.height);
+        vc_publish_link_config(device);
+        mutex_unlock(&device->mutex);
+        mutex_unlock(device->ctrl_handler.lock);
 
         vc_dbg(dev, "Rect: left=%d, top=%d, width=%d, height=%d\n",
                 sel->r.left, sel->r.top, sel->r.width, sel->r.height);
@@ -560,6 +844,7 @@ int vc_ctrl_s_ctrl(struct v4l2_ctrl *ctrl)
         struct vc_device *device = container_of(ctrl->handler, struct vc_device, ctrl_handler);
         struct i2c_client *client = device->cam.ctrl.client_sen;
         struct v4l2_control control;
+        int ret;
 
         // V4L2 controls values will be applied only when power is already up
         if (!pm_runtime_get_if_in_use(&client->dev))
@@ -571,10 +856,15 @@ int vc_ctrl_s_ctrl(struct v4l2_ctrl *ctrl)
 
         control.id = ctrl->id;
         control.value = ctrl->val;
-        vc_sd_s_ctrl(&device->sd, &control);
+        ret = vc_sd_s_ctrl(&device->sd, &control);
 
 	pm_runtime_put(&client->dev);
 
+        // A geometry change that does not fit into the running stream is
+        // rejected, other errors are only logged as before. A failed stream
+        // restart is reported, so a watchdog can fall back to a full restart.
+        if (ret == -EBUSY || ctrl->id == V4L2_CID_VC_RESTART_STREAM)
+                return ret;
         return 0;
 }
 
@@ -592,6 +882,10 @@ static int vc_ctrl_g_volatile_ctrl(struct v4l2_ctrl *ctrl)
                         cam->state.frame.top;
                 return 0;
         }
+        if (ctrl->id == V4L2_CID_VC_RESTART_COUNT) {
+                ctrl->val = device->restart_count;
+                return 0;
+        }
     return -EINVAL;
 }
 
@@ -624,6 +918,174 @@ static int vc_get_bit_depth(__u8 mipi_format)
 
 
 
+// --- Boot preset ------------------------------------------------------------
+
+static const struct {
+        const char *name;
+        u32 code;
+} preset_formats[] = {
+        { "Y8",      MEDIA_BUS_FMT_Y8_1X8 },
+        { "Y10",     MEDIA_BUS_FMT_Y10_1X10 },
+        { "Y12",     MEDIA_BUS_FMT_Y12_1X12 },
+        { "Y14",     MEDIA_BUS_FMT_Y14_1X14 },
+        { "SRGGB8",  MEDIA_BUS_FMT_SRGGB8_1X8 },
+        { "SRGGB10", MEDIA_BUS_FMT_SRGGB10_1X10 },
+        { "SRGGB12", MEDIA_BUS_FMT_SRGGB12_1X12 },
+        { "SRGGB14", MEDIA_BUS_FMT_SRGGB14_1X14 },
+        { "SGBRG8",  MEDIA_BUS_FMT_SGBRG8_1X8 },
+        { "SGBRG10", MEDIA_BUS_FMT_SGBRG10_1X10 },
+        { "SGBRG12", MEDIA_BUS_FMT_SGBRG12_1X12 },
+        { "SGBRG14", MEDIA_BUS_FMT_SGBRG14_1X14 },
+        { "SGRBG8",  MEDIA_BUS_FMT_SGRBG8_1X8 },
+        { "SGRBG10", MEDIA_BUS_FMT_SGRBG10_1X10 },
+        { "SGRBG12", MEDIA_BUS_FMT_SGRBG12_1X12 },
+        { "SGRBG14", MEDIA_BUS_FMT_SGRBG14_1X14 },
+        { "SBGGR8",  MEDIA_BUS_FMT_SBGGR8_1X8 },
+        { "SBGGR10", MEDIA_BUS_FMT_SBGGR10_1X10 },
+        { "SBGGR12", MEDIA_BUS_FMT_SBGGR12_1X12 },
+        { "SBGGR14", MEDIA_BUS_FMT_SBGGR14_1X14 },
+};
+
+static u32 vc_preset_format_code(const char *name)
+{
+        int i;
+
+        for (i = 0; i < ARRAY_SIZE(preset_formats); i++) {
+                // "RGGB10" is accepted as well as "SRGGB10" (vc-config naming)
+                if (!strcasecmp(name, preset_formats[i].name) ||
+                    (preset_formats[i].name[0] == 'S' && !strcasecmp(name, preset_formats[i].name + 1)))
+                        return preset_formats[i].code;
+        }
+        return VC_PRESET_UNSET;
+}
+
+static void vc_read_preset(struct device *dev, struct vc_preset *preset)
+{
+        const char *format;
+
+        memset(preset, 0xff, sizeof(*preset));
+
+        if (!device_property_read_string(dev, "vc,format", &format)) {
+                preset->mbus_code = vc_preset_format_code(format);
+                if (preset->mbus_code == VC_PRESET_UNSET)
+                        dev_warn(dev, "Unknown preset format '%s' ignored\n", format);
+        }
+        device_property_read_u32(dev, "vc,crop-left", &preset->left);
+        device_property_read_u32(dev, "vc,crop-top", &preset->top);
+        device_property_read_u32(dev, "vc,width", &preset->width);
+        device_property_read_u32(dev, "vc,height", &preset->height);
+        device_property_read_u32(dev, "vc,binning-mode", &preset->binning_mode);
+        device_property_read_u32(dev, "vc,frame-rate", &preset->frame_rate);
+        device_property_read_u32(dev, "vc,trigger-mode", &preset->trigger_mode);
+        device_property_read_u32(dev, "vc,io-mode", &preset->io_mode);
+        device_property_read_u32(dev, "vc,exposure", &preset->exposure);
+        device_property_read_u32(dev, "vc,gain", &preset->gain);
+        device_property_read_u32(dev, "vc,black-level", &preset->blacklevel);
+}
+
+// Makes the applied preset value the control's default and current value
+// without calling s_ctrl again.
+static void vc_preset_ctrl(struct vc_device *device, u32 id, s32 value)
+{
+        struct v4l2_ctrl *ctrl = v4l2_ctrl_find(&device->ctrl_handler, id);
+
+        if (!ctrl)
+                return;
+
+        value = clamp_t(s32, value, ctrl->minimum, ctrl->maximum);
+        ctrl->default_value = value;
+        ctrl->val           = value;
+        ctrl->cur.val       = value;
+}
+
+static bool vc_preset_format_supported(struct vc_device *device, u32 code)
+{
+        int i;
+
+        for (i = 0; i < MAX_MBUS_CODES && device->supported_mbus_codes[i]; i++) {
+                if (device->supported_mbus_codes[i] == code)
+                        return true;
+        }
+        return false;
+}
+
+// Applies the device tree preset at probe time, so that the active format,
+// the sensor registers and the control defaults already match it and no
+// userspace setup is needed before the first stream.
+static void vc_apply_preset(struct vc_device *device)
+{
+        struct vc_preset *preset = &device->preset;
+        struct vc_cam *cam = &device->cam;
+        struct device *dev = vc_core_get_sen_device(cam);
+        struct vc_frame *frame;
+        u32 left, top, width, height;
+        int ret;
+
+        if (preset->binning_mode != VC_PRESET_UNSET) {
+                ret = vc_core_set_binning_mode(cam, preset->binning_mode);
+                if (ret)
+                        vc_warn(dev, "%s(): Preset binning mode %u rejected\n", __func__, preset->binning_mode);
+                mutex_lock(device->ctrl_handler.lock);
+                mutex_lock(&device->mutex);
+                vc_sd_update_fmt(device);
+                mutex_unlock(&device->mutex);
+                mutex_unlock(device->ctrl_handler.lock);
+                vc_update_blacklevel_ctrl(device, cam);
+                vc_preset_ctrl(device, V4L2_CID_VC_BINNING_MODE, cam->state.binning_mode);
+        }
+
+        if (preset->mbus_code != VC_PRESET_UNSET) {
+                if (vc_preset_format_supported(device, preset->mbus_code))
+                        vc_core_set_format(cam, preset->mbus_code);
+                else
+                        vc_warn(dev, "%s(): Preset format 0x%04x not supported\n", __func__, preset->mbus_code);
+        }
+
+        if (preset->left != VC_PRESET_UNSET || preset->top != VC_PRESET_UNSET ||
+            preset->width != VC_PRESET_UNSET || preset->height != VC_PRESET_UNSET) {
+                frame = vc_core_get_frame(cam);
+                left = preset->left != VC_PRESET_UNSET ? preset->left : 0;
+                top = preset->top != VC_PRESET_UNSET ? preset->top : 0;
+                width = preset->width != VC_PRESET_UNSET ? preset->width : frame->width;
+                height = preset->height != VC_PRESET_UNSET ? preset->height : frame->height;
+                vc_core_set_frame(cam, left, top, width, height);
+        }
+
+        if (preset->frame_rate != VC_PRESET_UNSET) {
+                vc_core_set_framerate(cam, preset->frame_rate);
+                vc_preset_ctrl(device, V4L2_CID_VC_FRAME_RATE, cam->state.framerate);
+        }
+        // The blanking limits depend on format, crop and frame rate
+        vc_sync_clk_rates(device);
+
+        if (preset->trigger_mode != VC_PRESET_UNSET &&
+            !vc_mod_set_trigger_mode(cam, preset->trigger_mode))
+                vc_preset_ctrl(device, V4L2_CID_VC_TRIGGER_MODE, preset->trigger_mode);
+
+        if (preset->io_mode != VC_PRESET_UNSET && !vc_mod_set_io_mode(cam, preset->io_mode))
+                vc_preset_ctrl(device, V4L2_CID_VC_IO_MODE, preset->io_mode);
+
+        // vc,exposure is in us, the control counts lines with libcamera
+        if (preset->exposure != VC_PRESET_UNSET && !vc_sen_set_exposure(cam, preset->exposure)) {
+                u32 line_ns = vc_core_get_time_per_line_ns(cam);
+
+                if (device->libcamera_enabled && line_ns)
+                        vc_preset_ctrl(device, V4L2_CID_EXPOSURE, preset->exposure * 1000 / line_ns);
+                else
+                        vc_preset_ctrl(device, V4L2_CID_EXPOSURE, preset->exposure);
+        }
+
+        if (preset->gain != VC_PRESET_UNSET && !vc_sen_set_gain(cam, preset->gain, true))
+                vc_preset_ctrl(device, V4L2_CID_ANALOGUE_GAIN, preset->gain);
+
+        if (preset->blacklevel != VC_PRESET_UNSET && !vc_sen_set_blacklevel(cam, preset->blacklevel))
+                vc_preset_ctrl(device, V4L2_CID_BLACK_LEVEL, preset->blacklevel);
+
+        frame = vc_core_get_frame(cam);
+        vc_notice(dev, "%s(): Preset applied: code 0x%04x, %ux%u+%u+%u\n", __func__,
+                  vc_core_get_format(cam), frame->width, frame->height, frame->left, frame->top);
+}
+
 static int vc_check_hwcfg(struct vc_cam *cam, struct device *dev, struct vc_device *device)
 {
         struct fwnode_handle *endpoint;
@@ -656,7 +1118,20 @@ static int vc_check_hwcfg(struct vc_cam *cam, struct device *dev, struct vc_devi
                 dev_info(dev, "force-color-mode enabled\n");
         }
 
+        if (device_property_read_bool(dev, "vc,hmax-crop-scaling")) {
+                device->hmax_crop_scaling = true;
+                dev_info(dev, "HMAX crop scaling enabled\n");
+        }
+
+        vc_read_preset(dev, &device->preset);
+
+        if (device_property_read_bool(dev, "vc,auto-link-rate")) {
+                device->auto_link_rate = true;
+                dev_info(dev, "Automatic link rate selection enabled\n");
+        }
+
         /* Set and check the number of MIPI CSI2 data lanes */
+        device->max_lanes = ep_cfg.bus.mipi_csi2.num_data_lanes;
         ret = vc_core_set_num_lanes(cam, ep_cfg.bus.mipi_csi2.num_data_lanes);
 
 error_out:
@@ -666,9 +1141,18 @@ error_out:
         return ret;
 }
 
+static int vc_sd_subscribe_event(struct v4l2_subdev *sd, struct v4l2_fh *fh,
+                                 struct v4l2_event_subscription *sub)
+{
+        if (sub->type == V4L2_EVENT_SOURCE_CHANGE)
+                return v4l2_src_change_event_subdev_subscribe(sd, fh, sub);
+
+        return v4l2_ctrl_subdev_subscribe_event(sd, fh, sub);
+}
+
 static const struct v4l2_subdev_core_ops vc_core_ops = {
     .s_power = vc_sd_s_power,
-    .subscribe_event = v4l2_ctrl_subdev_subscribe_event,
+    .subscribe_event = vc_sd_subscribe_event,
     .unsubscribe_event = v4l2_event_subdev_unsubscribe,
 };
 
@@ -676,7 +1160,24 @@ static const struct v4l2_subdev_video_ops vc_video_ops = {
     .s_stream          = vc_sd_s_stream,
 };
 
+static int vc_sd_get_mbus_config(struct v4l2_subdev *sd, unsigned int pad, struct v4l2_mbus_config *config)
+{
+        struct vc_cam *cam = to_vc_cam(sd);
+        vc_mode *mode = vc_get_mode(cam);
+        u32 lanes = mode ? mode->num_lanes : to_vc_device(sd)->max_lanes;
+
+        config->type = V4L2_MBUS_CSI2_DPHY;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+        config->bus.mipi_csi2.num_data_lanes = lanes;
+        config->bus.mipi_csi2.flags = 0;
+#else
+        config->flags = V4L2_MBUS_CSI2_CONTINUOUS_CLOCK | (V4L2_MBUS_CSI2_1_LANE << (lanes - 1));
+#endif
+        return 0;
+}
+
 static const struct v4l2_subdev_pad_ops vc_pad_ops = {
+    .get_mbus_config = vc_sd_get_mbus_config,
     .get_fmt = vc_sd_get_fmt,
     .set_fmt = vc_sd_set_fmt,
     .enum_mbus_code = vc_sd_enum_mbus_code,
@@ -731,22 +1232,23 @@ static int vc_ctrl_init_ctrl_special(struct vc_device *device, struct v4l2_ctrl_
 }
 
 
-static int vc_ctrl_init_ctrl_lfreq(struct vc_device *device, struct v4l2_ctrl_handler *hdl, int id, struct vc_control64 *control)
+static int vc_ctrl_init_ctrl_lfreq(struct vc_device *device, struct v4l2_ctrl_handler *hdl, int id)
 {
         struct i2c_client *client = device->cam.ctrl.client_sen;
         struct device *dev = &client->dev;
         struct v4l2_ctrl *ctrl;
 
-        // CAUTION: only ONE element in linkfreq array used !
-        ctrl = v4l2_ctrl_new_int_menu(&device->ctrl_handler, &vc_ctrl_ops, id, 0, 0, &control->def);
+        // One entry per link frequency of the module, the driver selects it
+        ctrl = v4l2_ctrl_new_int_menu(&device->ctrl_handler, &vc_ctrl_ops, id, device->num_link_freqs - 1,
+                                      vc_link_freq_index(device, device->linkfreq.def), device->link_freqs);
         if (ctrl == NULL)
         {
                 vc_err(dev, "%s(): Failed to init 0x%08x ctrl\n", __func__, id);
                 return -EIO;
         }
 
-        if (ctrl)
-                ctrl->flags |= V4L2_CTRL_FLAG_READ_ONLY;
+        ctrl->flags |= V4L2_CTRL_FLAG_READ_ONLY;
+        device->link_freq_ctrl = ctrl;
 
         return 0;
 }
@@ -923,6 +1425,30 @@ static const struct v4l2_ctrl_config ctrl_live_roi = {
         .def = 0,
 };
 
+static const struct v4l2_ctrl_config ctrl_restart_stream = {
+        .ops = &vc_ctrl_ops,
+        .id = V4L2_CID_VC_RESTART_STREAM,
+        .name = "Restart Stream",
+        .type = V4L2_CTRL_TYPE_BUTTON,
+        .flags = V4L2_CTRL_FLAG_EXECUTE_ON_WRITE,
+        .min = 0,
+        .max = 0,
+        .step = 0,
+        .def = 0,
+};
+
+static const struct v4l2_ctrl_config ctrl_restart_count = {
+        .ops = &vc_ctrl_ops,
+        .id = V4L2_CID_VC_RESTART_COUNT,
+        .name = "Restart Count",
+        .type = V4L2_CTRL_TYPE_INTEGER,
+        .flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+        .min = 0,
+        .max = S32_MAX,
+        .step = 1,
+        .def = 0,
+};
+
 /* Non-const: def is updated by vc_update_clk_rates() to match the current mode */
 static struct v4l2_ctrl_config ctrl_blacklevel = {
     .ops = &vc_ctrl_ops,
@@ -948,8 +1474,8 @@ static const struct v4l2_ctrl_config ctrl_name = {
     .def = 0,
 };
 
-/* Non-const: min/max/def are updated by vc_update_clk_rates() before ctrl creation */
-static struct v4l2_ctrl_config ctrl_hblank = {
+/* Template, vc_sd_init() sets min/max/def from the camera's current mode */
+static const struct v4l2_ctrl_config ctrl_hblank = {
     .ops   = &vc_ctrl_ops,
     .id    = V4L2_CID_HBLANK,
     .name  = "Horizontal Blanking",
@@ -961,8 +1487,8 @@ static struct v4l2_ctrl_config ctrl_hblank = {
     .def   = 0,
 };
 
-/* Non-const: min/max/def are updated by vc_update_clk_rates() before ctrl creation */
-static struct v4l2_ctrl_config ctrl_vblank = {
+/* Template, vc_sd_init() sets min/max/def from the camera's current mode */
+static const struct v4l2_ctrl_config ctrl_vblank = {
     .ops   = &vc_ctrl_ops,
     .id    = V4L2_CID_VBLANK,
     .name  = "Vertical Blanking",
@@ -988,22 +1514,200 @@ struct v4l2_subdev_format fmt = {
 };
 
 
+static vc_mode *vc_get_desc_mode(struct vc_cam *cam, struct vc_desc_mode *desc)
+{
+        int i;
+
+        for (i = 0; i < MAX_VC_DESC_MODES; i++) {
+                if (desc->format == cam->ctrl.mode[i].format &&
+                    desc->num_lanes == cam->ctrl.mode[i].num_lanes &&
+                    desc->binning == cam->ctrl.mode[i].binning)
+                        return &cam->ctrl.mode[i];
+        }
+        return NULL;
+}
+
 static vc_mode *vc_get_mode(struct vc_cam *cam)
 {
-        struct vc_desc_mode *mode_desc = &cam->desc.modes[cam->state.mode];
-        vc_mode *mode = NULL;
+        return vc_get_desc_mode(cam, &cam->desc.modes[cam->state.mode]);
+}
 
-        for(int i = 0; i < MAX_VC_DESC_MODES; i++)
-        {
-                if(mode_desc->format == cam->ctrl.mode[i].format && 
-                        mode_desc->num_lanes == cam->ctrl.mode[i].num_lanes && 
-                        mode_desc->binning == cam->ctrl.mode[i].binning)
-                {
-                        mode = &cam->ctrl.mode[i];
-                        break;
+/* data_rate is stored in the ROM as a little-endian u32 in bps.
+ * Link frequency = serial bit rate / 2 (CSI-2 DDR). */
+static s64 vc_desc_mode_link_freq(struct vc_desc_mode *mode_desc)
+{
+        u32 data_rate_mbps = (*(__u32 *)mode_desc->data_rate) / 1000000;
+
+        return (s64)data_rate_mbps * 1000000 / 2;
+}
+
+static void vc_init_link_freqs(struct vc_device *device)
+{
+        struct vc_cam *cam = &device->cam;
+        s64 freq;
+        int i, j;
+
+        device->num_link_freqs = 0;
+        for (i = 0; i < MAX_VC_DESC_MODES; i++) {
+                freq = vc_desc_mode_link_freq(&cam->desc.modes[i]);
+                if (freq <= 0)
+                        continue;
+
+                // Insert sorted, without duplicates
+                for (j = device->num_link_freqs; j > 0 && device->link_freqs[j - 1] > freq; j--)
+                        ;
+                if (j > 0 && device->link_freqs[j - 1] == freq)
+                        continue;
+                memmove(&device->link_freqs[j + 1], &device->link_freqs[j],
+                        (device->num_link_freqs - j) * sizeof(device->link_freqs[0]));
+                device->link_freqs[j] = freq;
+                device->num_link_freqs++;
+        }
+
+        if (device->num_link_freqs == 0) {
+                device->link_freqs[0] = device->linkfreq.def;
+                device->num_link_freqs = 1;
+        }
+}
+
+static int vc_link_freq_index(struct vc_device *device, s64 freq)
+{
+        int i;
+
+        for (i = 0; i < device->num_link_freqs; i++) {
+                if (device->link_freqs[i] == freq)
+                        return i;
+        }
+        return 0;
+}
+
+/* Shortest frame period in ns of a descriptor mode for the active frame, from
+ * its line length (HMAX) and frame length (VMAX) as in vc_update_clk_rates().
+ * 0 if the mode or the sensor clock is unknown. */
+static u64 vc_get_min_frame_period_ns(struct vc_device *device, struct vc_desc_mode *desc)
+{
+        struct vc_cam *cam = &device->cam;
+        vc_mode *mode = vc_get_desc_mode(cam, desc);
+        u32 width = cam->state.frame.width > 0 ? cam->state.frame.width : cam->ctrl.frame.width;
+        u32 height = cam->state.frame.height > 0 ? cam->state.frame.height : cam->ctrl.frame.height;
+        int bit_depth;
+        u32 vmax, rate;
+        u64 line_ns;
+
+        if (!mode || !cam->ctrl.clk_pixel)
+                return 0;
+
+        bit_depth = vc_get_bit_depth(mode->format);
+        if (bit_depth <= 0)
+                return 0;
+        // Pixel rate of this mode, as in vc_update_clk_rates()
+        rate = (u32)((u64)((*(__u32 *)desc->data_rate) / 1000000) * desc->num_lanes / bit_depth * 1000000);
+
+        vmax = mode->vmax.def;
+        if ((cam->ctrl.flags & FLAG_INCREASE_FRAME_RATE) && height < cam->ctrl.frame.height)
+                vmax -= min_t(u32, vmax, cam->ctrl.frame.height - height);
+        vmax = max_t(u32, vmax, mode->vmax.min);
+
+        line_ns = div_u64((u64)__vc_get_optimized_hmax(device, mode, width, rate) * 1000000000ULL,
+                          cam->ctrl.clk_pixel);
+        return line_ns * vmax;
+}
+
+/* Selects the mode with the lowest total CSI-2 bit rate (data rate x lanes)
+ * whose frame timing (HMAX x VMAX for the active frame) still reaches the
+ * requested frame rate, out of the descriptor modes with the current format
+ * and binning. More lanes than wired are never used. With frame rate 0 (=
+ * maximum) all wired lanes are used. Must be called while the stream is off,
+ * see vc_publish_link_config(). */
+static void vc_select_link_rate(struct vc_device *device)
+{
+        struct vc_cam *cam = &device->cam;
+        struct device *dev = vc_core_get_sen_device(cam);
+        struct vc_desc_mode *current_desc = &cam->desc.modes[cam->state.mode];
+        vc_mode *mode = vc_get_mode(cam);
+        u64 period_ns, rate, best_rate = U64_MAX;
+        u32 lanes = device->max_lanes;
+        int i, ret = 0;
+
+        if (!device->auto_link_rate || !mode)
+                return;
+
+        if (cam->state.framerate > 0) {
+                for (i = 0; i < MAX_VC_DESC_MODES; i++) {
+                        struct vc_desc_mode *desc = &cam->desc.modes[i];
+
+                        if (desc->format != current_desc->format || desc->binning != current_desc->binning ||
+                            desc->num_lanes == 0 || desc->num_lanes > device->max_lanes)
+                                continue;
+
+                        period_ns = vc_get_min_frame_period_ns(device, desc);
+                        // frame_rate is in mHz
+                        if (period_ns == 0 || period_ns * cam->state.framerate > 1000000000000ULL)
+                                continue;
+
+                        rate = (u64)(*(__u32 *)desc->data_rate) * desc->num_lanes;
+                        if (rate < best_rate) {
+                                best_rate = rate;
+                                lanes = desc->num_lanes;
+                        }
                 }
         }
-        return mode;
+
+        if (lanes == mode->num_lanes)
+                return;
+
+        vc_notice(dev, "%s(): Switching to %u lanes for %u mHz\n", __func__, lanes, cam->state.framerate);
+        vc_core_set_num_lanes(cam, lanes);
+        vc_mod_set_mode(cam, &ret);
+        if (ret) {
+                vc_err(dev, "%s(): Failed to set mode: %d\n", __func__, ret);
+                return;
+        }
+
+        // VMAX was derived from the line length of the previous mode
+        ret = vc_core_set_framerate(cam, cam->state.framerate);
+        if (ret)
+                vc_err(dev, "%s(): Failed to set frame rate: %d\n", __func__, ret);
+}
+
+/* Unicam and rp1-cfe read get_mbus_config, LINK_FREQ and PIXEL_RATE before
+ * they call s_stream, so the link rate is selected and published whenever
+ * format, crop or frame rate change while the stream is off. s_stream only
+ * applies it. While streaming the receiver keeps its configuration.
+ * Must be called with the control handler lock held. */
+static void vc_publish_link_config(struct vc_device *device)
+{
+        if (!device->cam.state.streaming)
+                vc_select_link_rate(device);
+        vc_update_clk_rates(device, &device->cam);
+}
+
+/* Line length (HMAX) for the active crop width.
+ * Without vc,hmax-crop-scaling the mode's default HMAX is used. With it, the
+ * line is shortened by the pixels that are not read out. That only works for
+ * sensors whose line time scales with the readout width, so it is opt-in per
+ * device tree. The horizontal blanking itself is kept. */
+static u32 __vc_get_optimized_hmax(struct vc_device *device, vc_mode *mode, u32 active_width, u32 rate)
+{
+        struct vc_cam *cam = &device->cam;
+        u32 skipped_width, skipped_clk;
+
+        if (!device->hmax_crop_scaling || !rate || !cam->ctrl.clk_pixel ||
+            active_width >= cam->ctrl.frame.width)
+                return mode->hmax.def;
+
+        skipped_width = cam->ctrl.frame.width - active_width;
+        skipped_clk = (u32)div_u64((u64)skipped_width * cam->ctrl.clk_pixel, rate);
+        if (mode->hmax.def < mode->hmax.min + skipped_clk)
+                return mode->hmax.min;
+
+        return mode->hmax.def - skipped_clk;
+}
+
+// Line length of the active mode at the current pixel rate
+static u32 vc_get_optimized_hmax(struct vc_device *device, vc_mode *mode, u32 active_width)
+{
+        return __vc_get_optimized_hmax(device, mode, active_width, device->pixel_rate.max);
 }
 
 static void vc_update_clk_rates(struct vc_device *device, struct vc_cam *cam)
@@ -1012,18 +1716,28 @@ static void vc_update_clk_rates(struct vc_device *device, struct vc_cam *cam)
         struct vc_desc_mode *mode_desc = &cam->desc.modes[cam->state.mode];
         int num_lanes = mode->num_lanes;
         int bit_depth = vc_get_bit_depth(mode->format);
+        u32 active_width = cam->state.frame.width > 0
+                           ? cam->state.frame.width
+                           : cam->ctrl.frame.width;
+        u32 active_height = cam->state.frame.height > 0
+                            ? cam->state.frame.height
+                            : cam->ctrl.frame.height;
+        u32 hmax_opt;
+        u32 vmax_sensor;
         /* data_rate is stored in the ROM as a little-endian u32 in bps */
         u32 data_rate_mbps = (*(__u32 *)mode_desc->data_rate) / 1000000;
 
         /* CSI-2 DDR: serial bit rate per lane = data_rate_mbps.
          * Link frequency = serial bit rate / 2 (both edges of clock used). */
-        linkfreq.max = (u64)data_rate_mbps * 1000000ULL / 2;
-        linkfreq.def = linkfreq.max;
-        linkfreq.min = linkfreq.max;
+        device->linkfreq.max = vc_desc_mode_link_freq(mode_desc);
+        device->linkfreq.def = device->linkfreq.max;
+        device->linkfreq.min = device->linkfreq.max;
 
         /* Pixel rate = (data_rate_per_lane * num_lanes) / bits_per_pixel */
-        pixel_rate.max = (u32)((u64)data_rate_mbps * num_lanes / bit_depth * 1000000);
-        pixel_rate.def = pixel_rate.max;
+        device->pixel_rate.max = (u32)((u64)data_rate_mbps * num_lanes / bit_depth * 1000000);
+        device->pixel_rate.def = device->pixel_rate.max;
+
+        hmax_opt = vc_get_optimized_hmax(device, mode, active_width);
 
 
         /* Compute actual vblank at the current operating point so that
@@ -1041,15 +1755,15 @@ static void vc_update_clk_rates(struct vc_device *device, struct vc_cam *cam)
 
                 /* VBLANK control = blanking lines = VMAX - active_height.
                  * mode->vmax.{min,max} are raw VMAX totals, so subtract height. */
-                vblank.min = mode->vmax.min > height ? mode->vmax.min - height : 0;
-                vblank.max = mode->vmax.max > height ? mode->vmax.max - height : 0;
+                device->vblank.min = mode->vmax.min > height ? mode->vmax.min - height : 0;
+                device->vblank.max = mode->vmax.max > height ? mode->vmax.max - height : 0;
 
                 if (cam->state.framerate > 0 && cam->ctrl.clk_pixel > 0) {
                         /* frame_period_ns = 1e12 / framerate_mHz */
                         u32 frame_period_ns = (u32)div_u64(1000000000000ULL,
                                                            cam->state.framerate);
                         u32 period_1H_ns = (u32)div_u64(
-                                (u64)mode->hmax.def * 1000000000ULL,
+                                (u64)hmax_opt * 1000000000ULL,
                                 cam->ctrl.clk_pixel);
                         vmax_actual = period_1H_ns > 0
                                       ? frame_period_ns / period_1H_ns
@@ -1062,11 +1776,15 @@ static void vc_update_clk_rates(struct vc_device *device, struct vc_cam *cam)
                                 vmax_actual -= (cam->ctrl.frame.height - height);
                 }
 
-                vblank.def = vmax_actual > height
+                /* The exposure limit follows the VMAX the sensor runs with,
+                 * not the padded vblank below. */
+                vmax_sensor = clamp_t(u32, vmax_actual, mode->vmax.min, mode->vmax.max);
+
+                device->vblank.def = vmax_actual > height
                              ? vmax_actual - height
-                             : vblank.min;
-                if (vblank.def < vblank.min)
-                        vblank.def = vblank.min;
+                             : device->vblank.min;
+                if (device->vblank.def < device->vblank.min)
+                        device->vblank.def = device->vblank.min;
 
                 /* seninf (MTK Genio) clamps calc_buffered_pixel_rate to an
                  * internal floor of ~408 MHz.  When (w+hb)*(h+vb)*fps < 408
@@ -1081,24 +1799,25 @@ static void vc_update_clk_rates(struct vc_device *device, struct vc_cam *cam)
                  * floor = 408279424  (~408 MHz, observed in seninf logs)
                  * vb_min = ceil(floor / ((width+hblank) * fps_Hz)) - height
                  */
-                if (cam->state.framerate > 0 && hblank.min > 0) {
+                if (cam->state.framerate > 0 && device->hblank.min > 0) {
                         u32 fps_hz_x1000 = cam->state.framerate; /* milli-fps */
                         /* Use the active (crop) width — seninf computes its frame monitor
                          * period as (crop_w + hblank) × (crop_h + vblank) × fps.
                          * Using cam->ctrl.frame.width (full-sensor width) here gives a
                          * row_pixels that is ~2× too large, making needed_total too small
                          * and suppressing the floor padding when cropped. */
-                        u32 active_width = cam->state.frame.width > 0
-                                           ? cam->state.frame.width
-                                           : cam->ctrl.frame.width;
-                        u32 row_pixels = active_width + hblank.min;
+                        u32 row_pixels = active_width + device->hblank.min;
                         /* needed_total = ceil(408279424 * 1000 / (row_pixels * fps_hz_x1000)) */
                         u32 needed_total = (u32)div_u64(
                                 408279424ULL * 1000 + (u64)row_pixels * fps_hz_x1000 - 1,
                                 (u64)row_pixels * fps_hz_x1000);
-                        if (needed_total > height + vblank.def)
-                                vblank.def = needed_total - height;
+                        if (needed_total > height + device->vblank.def)
+                                device->vblank.def = needed_total - height;
                 }
+
+                /* Low frame rates and the padding can go beyond VMAX max,
+                 * the control can not hold that. */
+                device->vblank.def = clamp_t(u32, device->vblank.def, device->vblank.min, max_t(u32, device->vblank.min, device->vblank.max));
         }
 
         /* hblank in output-pixel units (what seninf expects for V4L2_CID_HBLANK).
@@ -1108,62 +1827,137 @@ static void vc_update_clk_rates(struct vc_device *device, struct vc_cam *cam)
          * Then: hblank = hmax_output - active_width.
          * Example – IMX900 mode 7 (4-lane 10bit):
          *   HMAX=364, pixel_rate=594 MHz, clk_pixel=74.25 MHz
-         *   hmax_output = 364 * 8 = 2912, hblank = 2912 - 2048 = 864 */
+         *   hmax_output = 364 * 8 = 2912, hblank = 2912 - 2048 = 864
+         * The active (crop) width is used, like the HBLANK s_ctrl path does
+         * when it converts hblank back to HMAX. */
         if (cam->ctrl.clk_pixel > 0) {
-                u32 hmax_min_out = (u32)div_u64((u64)mode->hmax.min * pixel_rate.max,
+                u32 hmax_min_out = (u32)div_u64((u64)mode->hmax.min * device->pixel_rate.max,
                                                cam->ctrl.clk_pixel);
-                u32 hmax_max_out = (u32)div_u64((u64)mode->hmax.max * pixel_rate.max,
+                u32 hmax_max_out = (u32)div_u64((u64)mode->hmax.max * device->pixel_rate.max,
                                                cam->ctrl.clk_pixel);
-                u32 hmax_def_out = (u32)div_u64((u64)mode->hmax.def * pixel_rate.max,
+                u32 hmax_def_out = (u32)div_u64((u64)hmax_opt * device->pixel_rate.max,
                                                cam->ctrl.clk_pixel);
-                hblank.min = (hmax_min_out > cam->ctrl.frame.width)
-                             ? hmax_min_out - cam->ctrl.frame.width : 0;
-                hblank.max = (hmax_max_out > cam->ctrl.frame.width)
-                             ? hmax_max_out - cam->ctrl.frame.width : 0;
-                hblank.def = (hmax_def_out > cam->ctrl.frame.width)
-                             ? hmax_def_out - cam->ctrl.frame.width : 0;
+                device->hblank.min = (hmax_min_out > active_width)
+                             ? hmax_min_out - active_width : 0;
+                device->hblank.max = (hmax_max_out > active_width)
+                             ? hmax_max_out - active_width : 0;
+                device->hblank.def = (hmax_def_out > active_width)
+                             ? hmax_def_out - active_width : 0;
         } else {
-                hblank.min = 0;
-                hblank.max = 0;
-                hblank.def = 0;
+                device->hblank.min = 0;
+                device->hblank.max = 0;
+                device->hblank.def = 0;
         }
-        /* Keep config structs in sync so ctrl_hblank/ctrl_vblank hold the correct
-         * values at init time (vc_update_clk_rates is called before ctrl creation).
-         * Mark hblank read-only when the sensor does not allow hmax manipulation. */
-        ctrl_hblank.min = hblank.min;
-        ctrl_hblank.max = hblank.max;
-        ctrl_hblank.def = hblank.def;
-        if (mode->hmax.min == mode->hmax.max)
-                ctrl_hblank.flags |= V4L2_CTRL_FLAG_READ_ONLY;
-        else
-                ctrl_hblank.flags &= ~V4L2_CTRL_FLAG_READ_ONLY;
-        ctrl_vblank.min = vblank.min;
-        ctrl_vblank.max = vblank.max;
-        ctrl_vblank.def = vblank.def;
-
         /* Reflect updated hblank into the live V4L2 control so seninf's
          * get_buffered_pixel_rate() reads the correct value instantly.
          * Use the cached pointer — never call v4l2_ctrl_find() here because
-         * this function runs inside s_ctrl which already holds
-         * ctrl_handler->lock, and v4l2_ctrl_find() would try to acquire
-         * the same lock → deadlock. */
-        if (device->hblank_ctrl) {
-                device->hblank_ctrl->minimum       = hblank.min;
-                device->hblank_ctrl->maximum       = hblank.max;
-                device->hblank_ctrl->default_value = hblank.def;
-                device->hblank_ctrl->val           = hblank.def;
-                device->hblank_ctrl->cur.val       = hblank.def;
+         * this function runs with ctrl_handler->lock held (inside s_ctrl or
+         * via vc_sync_clk_rates()), and v4l2_ctrl_find() would
+         * try to acquire the same lock → deadlock.
+         * The value is set first without calling s_ctrl, vc_core already
+         * programmed the sensor. The range update then only sends
+         * V4L2_EVENT_CTRL_CH_RANGE to the subscribers. */
+        vc_ctrl_update_range(device->hblank_ctrl, &hblank);
+
+        /* The link frequency menu shows the frequency of the selected mode */
+        if (device->link_freq_ctrl) {
+                device->link_freq_ctrl->val     = vc_link_freq_index(device, device->linkfreq.def);
+                device->link_freq_ctrl->cur.val = device->link_freq_ctrl->val;
+        }
+
+        /* The pixel rate follows the lane count, set like the blanking */
+        if (device->pixel_rate_ctrl) {
+                s64 rate = device->pixel_rate.max;
+
+                *device->pixel_rate_ctrl->p_new.p_s64 = rate;
+                *device->pixel_rate_ctrl->p_cur.p_s64 = rate;
+                __v4l2_ctrl_modify_range(device->pixel_rate_ctrl, rate, rate, 1, rate);
         }
 
         /* Update live V4L2_CID_VBLANK control with the actual vblank. */
-        if (device->vblank_ctrl) {
-                device->vblank_ctrl->minimum       = vblank.min;
-                device->vblank_ctrl->maximum       = vblank.max;
-                device->vblank_ctrl->default_value = vblank.def;
-                device->vblank_ctrl->val           = vblank.def;
-                device->vblank_ctrl->cur.val       = vblank.def;
+        vc_ctrl_update_range(device->vblank_ctrl, &vblank);
+
+        vc_update_exposure_range(device, vmax_sensor);
+}
+
+// Must be called with the control handler lock held, see vc_update_clk_rates()
+static void vc_ctrl_update_range(struct v4l2_ctrl *ctrl, struct vc_control *control)
+{
+        struct vc_device *device;
+        s32 old_val, old_cur;
+        u32 def;
+        int ret;
+
+        if (!ctrl)
+                return;
+
+        device = container_of(ctrl->handler, struct vc_device, ctrl_handler);
+        def = clamp_t(u32, control->def, control->min, max_t(u32, control->min, control->max));
+
+        // The value is set before the range, so that the update does not
+        // call s_ctrl. It is taken back if the update fails.
+        old_val = ctrl->val;
+        old_cur = ctrl->cur.val;
+        ctrl->val     = def;
+        ctrl->cur.val = def;
+        ret = __v4l2_ctrl_modify_range(ctrl, control->min, control->max, 1, def);
+        if (ret) {
+                ctrl->val     = old_val;
+                ctrl->cur.val = old_cur;
+                vc_err(vc_core_get_sen_device(&device->cam), "%s(): Failed to set range %u..%u of 0x%08x: %d\n",
+                       __func__, (u32)control->min, (u32)control->max, ctrl->id, ret);
         }
+}
 
+// vc_publish_link_config() for callers that do not hold the control handler lock
+static void vc_sync_clk_rates(struct vc_device *device)
+{
+        mutex_lock(device->ctrl_handler.lock);
+        vc_publish_link_config(device);
+        mutex_unlock(device->ctrl_handler.lock);
+}
+
+/* With libcamera the exposure control counts lines. Its limits are the
+ * sensor's exposure limits converted to lines, and the maximum is further
+ * limited to the current frame length (VMAX). libcamera's AGC then raises
+ * VBLANK first for longer exposures instead of requesting values the sensor
+ * would clamp. */
+static void vc_get_exposure_lines(struct vc_device *device, u32 vmax, struct vc_control *lines)
+{
+        // vc_core's limits in us, the control counts lines with libcamera
+        struct vc_control *us = &device->cam.ctrl.exposure;
+        u32 line_ns = vc_core_get_time_per_line_ns(&device->cam);
+
+        if (line_ns == 0) {
+                *lines = *us;
+                return;
+        }
+
+        lines->min = max_t(u32, 1, DIV_ROUND_UP((u64)us->min * 1000, line_ns));
+        lines->max = (u32)div_u64((u64)us->max * 1000, line_ns);
+        if (vmax > 0 && vmax < lines->max)
+                lines->max = vmax;
+        if (lines->max < lines->min)
+                lines->max = lines->min;
+        lines->def = clamp_t(u32, div_u64((u64)us->def * 1000, line_ns), lines->min, lines->max);
+}
+
+// Must be called with the control handler lock held
+static void vc_update_exposure_range(struct vc_device *device, u32 vmax)
+{
+        struct v4l2_ctrl *ctrl = device->exposure_ctrl;
+        struct vc_control lines;
+        int ret;
+
+        if (!device->libcamera_enabled || !ctrl)
+                return;
+
+        vc_get_exposure_lines(device, vmax, &lines);
+        // Keeps the current exposure unless it is out of the new range
+        ret = __v4l2_ctrl_modify_range(ctrl, lines.min, lines.max, 1, lines.def);
+        if (ret)
+                vc_err(vc_core_get_sen_device(&device->cam), "%s(): Failed to set range %u..%u: %d\n",
+                       __func__, (u32)lines.min, (u32)lines.max, ret);
 }
 
 static void vc_update_blacklevel_ctrl(struct vc_device *device, struct vc_cam *cam)
@@ -1179,9 +1973,10 @@ static void vc_update_blacklevel_ctrl(struct vc_device *device, struct vc_cam *c
         }
 }
 
+// Must be called with the control handler lock held
 static void update_frame_rate_ctrl(struct vc_cam *cam, struct vc_device *device)
 {
-        struct v4l2_ctrl *ctrl = v4l2_ctrl_find(&device->ctrl_handler, V4L2_CID_VC_FRAME_RATE);
+        struct v4l2_ctrl *ctrl = device->frame_rate_ctrl;
         if (ctrl)
         {              
                 ctrl->maximum = cam->ctrl.framerate.max;
@@ -1190,6 +1985,7 @@ static void update_frame_rate_ctrl(struct vc_cam *cam, struct vc_device *device)
                 ctrl->val = cam->state.framerate;                
         }
 }
+// Must be called with the control handler lock and device->mutex held
 int vc_sd_update_fmt(struct vc_device *device)
 {
         __u8 h_scale, v_scale;
@@ -1199,15 +1995,17 @@ int vc_sd_update_fmt(struct vc_device *device)
         fmt.format.width = device->cam.ctrl.frame.width / h_scale;
         fmt.format.height = device->cam.ctrl.frame.height / v_scale;
 
-        // return 0;
-               
+        __vc_sd_set_fmt(device, &fmt.format);
 
-        return v4l2_subdev_call(&device->sd, pad, set_fmt, NULL, &fmt);
+        return 0;
 }
 static int vc_sd_init(struct vc_device *device)
 {
         struct i2c_client *client = device->cam.ctrl.client_sen;
         struct device *dev = &client->dev;
+        vc_mode *mode = vc_get_mode(&device->cam);
+        struct v4l2_ctrl_config blank;
+        struct vc_control exposure;
         int ret;
 
         // Initializes the subdevice
@@ -1223,22 +2021,24 @@ static int vc_sd_init(struct vc_device *device)
         // Hook the control handler into the driver
         device->sd.ctrl_handler = &device->ctrl_handler;
 
+        // The link frequency of the current mode is the fallback menu entry
         vc_update_clk_rates(device, &device->cam);
+        vc_init_link_freqs(device);
         vc_update_blacklevel_ctrl(device, &device->cam);
         struct v4l2_ctrl *ctrl;
 
-
+        // vc_core checks the us values against cam.ctrl.exposure, the line
+        // range for libcamera only goes into the control
+        exposure = device->cam.ctrl.exposure;
         if(device->libcamera_enabled)
         {
-                device->cam.ctrl.exposure.min = 1;
-                device->cam.ctrl.exposure.max = 1000000;
-                device->cam.ctrl.exposure.def = 10;
+                vc_get_exposure_lines(device, vc_core_get_frame(&device->cam)->height + device->vblank.def,
+                                      &exposure);
         }
-     
-
 
         // Add controls
-        ret |= vc_ctrl_init_ctrl(device, &device->ctrl_handler, V4L2_CID_EXPOSURE, &device->cam.ctrl.exposure, 0);
+        ret |= vc_ctrl_init_ctrl(device, &device->ctrl_handler, V4L2_CID_EXPOSURE, &exposure, 0);
+        device->exposure_ctrl = v4l2_ctrl_find(&device->ctrl_handler, V4L2_CID_EXPOSURE);
         ret |= vc_ctrl_init_ctrl_special(device, &device->ctrl_handler, V4L2_CID_ANALOGUE_GAIN, 
                 0, device->cam.ctrl.again.max_mdB + device->cam.ctrl.dgain.max_mdB, 0);
                 
@@ -1248,16 +2048,30 @@ static int vc_sd_init(struct vc_device *device)
         ret |= vc_ctrl_init_custom_ctrl(device, &device->ctrl_handler, &ctrl_trigger_mode, &ctrl);
         ret |= vc_ctrl_init_custom_ctrl(device, &device->ctrl_handler, &ctrl_rotation, &ctrl);
         ret |= vc_ctrl_init_custom_ctrl(device, &device->ctrl_handler, &ctrl_flash_mode, &ctrl);
-        ret |= vc_ctrl_init_custom_ctrl(device, &device->ctrl_handler, &ctrl_frame_rate, &ctrl);
+        ret |= vc_ctrl_init_custom_ctrl(device, &device->ctrl_handler, &ctrl_frame_rate, &device->frame_rate_ctrl);
         ret |= vc_ctrl_init_custom_ctrl(device, &device->ctrl_handler, &ctrl_single_trigger, &ctrl);
         ret |= vc_ctrl_init_custom_ctrl(device, &device->ctrl_handler, &ctrl_binning_mode, &ctrl);
         ret |= vc_ctrl_init_custom_ctrl(device, &device->ctrl_handler, &ctrl_live_roi, &ctrl);
         ret |= vc_ctrl_init_custom_ctrl(device, &device->ctrl_handler, &ctrl_name, &ctrl);
-
-        ret |= vc_ctrl_init_ctrl(device, &device->ctrl_handler, V4L2_CID_PIXEL_RATE, &pixel_rate, 0);
-        ret |= vc_ctrl_init_ctrl_lfreq(device, &device->ctrl_handler, V4L2_CID_LINK_FREQ, &linkfreq);
-        ret |= vc_ctrl_init_custom_ctrl(device, &device->ctrl_handler, &ctrl_hblank, &device->hblank_ctrl);
-        ret |= vc_ctrl_init_custom_ctrl(device, &device->ctrl_handler, &ctrl_vblank, &device->vblank_ctrl);
+        ret |= vc_ctrl_init_custom_ctrl(device, &device->ctrl_handler, &ctrl_restart_stream, &ctrl);
+        ret |= vc_ctrl_init_custom_ctrl(device, &device->ctrl_handler, &ctrl_restart_count, &ctrl);
+
+        ret |= vc_ctrl_init_ctrl(device, &device->ctrl_handler, V4L2_CID_PIXEL_RATE, &device->pixel_rate, 0);
+        device->pixel_rate_ctrl = v4l2_ctrl_find(&device->ctrl_handler, V4L2_CID_PIXEL_RATE);
+        ret |= vc_ctrl_init_ctrl_lfreq(device, &device->ctrl_handler, V4L2_CID_LINK_FREQ);
+        blank = ctrl_hblank;
+        blank.min = device->hblank.min;
+        blank.max = device->hblank.max;
+        blank.def = device->hblank.def;
+        // Only writable if the sensor allows to change HMAX
+        if (mode && mode->hmax.min != mode->hmax.max)
+                blank.flags &= ~V4L2_CTRL_FLAG_READ_ONLY;
+        ret |= vc_ctrl_init_custom_ctrl(device, &device->ctrl_handler, &blank, &device->hblank_ctrl);
+        blank = ctrl_vblank;
+        blank.min = device->vblank.min;
+        blank.max = device->vblank.max;
+        blank.def = device->vblank.def;
+        ret |= vc_ctrl_init_custom_ctrl(device, &device->ctrl_handler, &blank, &device->vblank_ctrl);
         ret |= vc_ctrl_init_ctrl_lc(device, &device->ctrl_handler);
         if (ret)
         {
@@ -1265,7 +2079,11 @@ static int vc_sd_init(struct vc_device *device)
                 return ret;
         }
 
+        mutex_lock(device->ctrl_handler.lock);
+        mutex_lock(&device->mutex);
         vc_sd_update_fmt(device);
+        mutex_unlock(&device->mutex);
+        mutex_unlock(device->ctrl_handler.lock);
 
         return 0;
 }
@@ -1286,6 +2104,7 @@ static int vc_probe(struct i2c_client *client)
     struct device *dev = &client->dev;
     struct vc_device *device;
     struct vc_cam *cam;
+    ktime_t start = vc_timing_start();
     int ret;
 
     vc_notice(dev, "%s(): Probing UNIVERSAL VC MIPI Driver (v%s)\n", __func__, VERSION);
@@ -1324,6 +2143,8 @@ static int vc_probe(struct i2c_client *client)
     if (ret)
         goto error_handler_free;
 
+    vc_apply_preset(device);
+
     device->sd.flags |= V4L2_SUBDEV_FL_HAS_DEVNODE | V4L2_SUBDEV_FL_HAS_EVENTS;
     device->pad.flags = MEDIA_PAD_FL_SOURCE;
     device->sd.entity.ops = &vc_sd_media_ops;
@@ -1341,6 +2162,7 @@ static int vc_probe(struct i2c_client *client)
     vc_notice(dev, "%s(): Runtime PM enabled\n", __func__);
     pm_runtime_get_sync(dev);
     vc_notice(dev, "%s(): Probe successful\n", __func__);
+    vc_timing_end(dev, "probe", start);
     return 0;
 
 error_media_entity:
@@ -1412,4 +2234,6 @@ MODULE_AUTHOR("Michael Steinel, Vision Components GmbH <mipi-tech@vision-compone
 MODULE_LICENSE("GPL v2");
 
 module_param(debug, int, 0644);
-MODULE_PARM_DESC(debug, "Debug level (0-6)");
\ No newline at end of file
+MODULE_PARM_DESC(debug, "Debug level (0-6)");
+module_param(timing, bool, 0644);
+MODULE_PARM_DESC(timing, "Log the wall clock time of probe, set_fmt and stream on");
\ No newline at end of file
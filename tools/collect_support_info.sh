@@ -12,8 +12,35 @@
 # Nothing is transmitted automatically. You decide whether to share
 # the resulting archive when submitting a support ticket.
 # By running this script you consent to collecting this diagnostic data.
-
-OUTDIR="$HOME/vc_mipi_support_$(date +%Y%m%d_%H%M%S)"
+#
+# Usage:
+#   collect_support_info.sh              full support package
+#   collect_support_info.sh --perf [N]   performance snapshot only: streams
+#                                        every camera for N seconds (default 10)
+#                                        and writes perf.json
+
+PERF_SECONDS=""
+case "$1" in
+    --perf)
+        PERF_SECONDS="${2:-10}"
+        if ! [[ "$PERF_SECONDS" =~ ^[0-9]+$ ]] || [ "$PERF_SECONDS" -eq 0 ]; then
+            echo "Usage: $0 [--perf [seconds]]" >&2
+            exit 1
+        fi
+        ;;
+    "")
+        ;;
+    *)
+        echo "Usage: $0 [--perf [seconds]]" >&2
+        exit 1
+        ;;
+esac
+
+if [ -n "$PERF_SECONDS" ]; then
+    OUTDIR="$HOME/vc_mipi_perf_$(date +%Y%m%d_%H%M%S)"
+else
+    OUTDIR="$HOME/vc_mipi_support_$(date +%Y%m%d_%H%M%S)"
+fi
 mkdir -p "$OUTDIR"
 
 INFO="$OUTDIR/system_info.txt"
@@ -26,6 +53,254 @@ section() {
     echo "################################################################################" >> "$INFO"
 }
 
+# Helper: print "subdev videodev" for every VC MIPI camera
+find_cameras() {
+    local mediadev subdev videodev
+    for mediadev in /dev/media*; do
+        if [ -e "$mediadev" ] && media-ctl -d "$mediadev" -p 2>/dev/null | grep -q "vc_mipi_camera"; then
+            subdev=$(media-ctl -d "$mediadev" -p 2>/dev/null | grep "vc_mipi_camera" -A 2 | grep "device node name" | awk '{print $4}')
+            videodev=$(media-ctl -d "$mediadev" -p 2>/dev/null | grep "rp1-cfe-csi2_ch0\|unicam-image" -A 2 | grep "device node name" | awk '{print $4}' | head -n 1)
+            echo "$subdev $videodev"
+        fi
+    done
+}
+
+# Helper: create the tar.gz archive of $OUTDIR
+create_archive() {
+    ARCHIVE="$HOME/$(basename $OUTDIR).tar.gz"
+    echo "Creating archive..."
+    if (cd "$HOME" && tar -czf "$(basename $OUTDIR).tar.gz" "$(basename $OUTDIR)"); then
+        echo "✓ Archive created successfully: $ARCHIVE"
+        echo ""
+        echo "Please attach this file to your support ticket."
+    else
+        echo "✗ Failed to create archive automatically."
+        echo "Please create it manually with:"
+        echo "  cd \$HOME && tar -czf $(basename $OUTDIR).tar.gz $(basename $OUTDIR)"
+    fi
+}
+
+# ---------------------------------------------------------------------------
+# Performance snapshot (--perf)
+#
+# Streams every camera for a few seconds and writes one JSON document with
+# everything needed to tell sensor, CSI receiver, CMA and consumer problems
+# apart. Keys are stable and values are plain numbers, so snapshots of
+# different sites can be compared with diff or jq.
+
+# Helper: JSON string
+json_str() {
+    local s="$1"
+    s=${s//\\/\\\\}
+    s=${s//\"/\\\"}
+    s=$(printf '%s' "$s" | tr -d '\000-\037')
+    printf '"%s"' "$s"
+}
+
+# Helper: JSON number, null if empty or not numeric
+json_num() {
+    if [[ "$1" =~ ^-?[0-9]+(\.[0-9]+)?$ ]]; then printf '%s' "$1"; else printf 'null'; fi
+}
+
+# Helper: integer value of an integer control of a device
+get_ctrl() {
+    v4l2-ctl -d "$1" --get-ctrl="$2" 2>/dev/null | awk -F': ' 'NR == 1 { print $2 }'
+}
+
+# Helper: value of the selected entry of an integer menu control (link_frequency)
+get_int_menu_ctrl() {
+    local index
+    index=$(get_ctrl "$1" "$2")
+    [ -n "$index" ] || return
+    v4l2-ctl -d "$1" --list-ctrls-menus 2>/dev/null | awk -v ctrl="$2" -v idx="$index" '
+        $1 == ctrl { found = 1; next }
+        found && $1 == idx ":" { print $2; exit }
+        found && $1 !~ /^[0-9]+:$/ { exit }'
+}
+
+# Helper: "busy total" jiffies of all CPUs ("cpu") or one ("cpu0") from /proc/stat
+cpu_jiffies() {
+    awk -v cpu="$1" '$1 == cpu { busy = $2 + $3 + $4 + $7 + $8; print busy, busy + $5 + $6 }' /proc/stat
+}
+
+# Helper: CPU load in percent between two cpu_jiffies samples
+cpu_percent() {
+    awk -v a="$1" -v b="$2" 'BEGIN {
+        split(a, x, " "); split(b, y, " ")
+        if (y[2] > x[2]) printf "%.1f", 100 * (y[1] - x[1]) / (y[2] - x[2]); else print "null" }'
+}
+
+meminfo_kb() {
+    awk -v key="$1:" '$1 == key { print $2 }' /proc/meminfo
+}
+
+# Helper: size of the CMA reservation from the device tree (linux,cma node)
+cma_reserved_bytes() {
+    local node hex
+    for node in /proc/device-tree/reserved-memory/linux,cma /proc/device-tree/reserved-memory/*cma*; do
+        if [ -f "$node/size" ]; then
+            hex=$(od -An -tx1 "$node/size" | tr -d ' \n')
+            echo $((16#${hex: -16}))
+            return
+        fi
+    done
+}
+
+# Helper: frame statistics of "v4l2-ctl --stream-mmap --verbose" output as JSON
+stream_stats() {
+    awk '
+        /dqbuf/ && /seq:/ && /ts:/ {
+            for (i = 1; i < NF; i++) {
+                if ($i == "seq:") seq = $(i + 1) + 0
+                if ($i == "ts:") ts = $(i + 1) + 0
+            }
+            if (/error/) errors++
+            if (frames) {
+                dt = (ts - last_ts) * 1e6
+                n++; sum += dt; sumsq += dt * dt
+                if (n == 1 || dt < min) min = dt
+                if (dt > max) max = dt
+                if (seq > last_seq + 1) dropped += seq - last_seq - 1
+            } else {
+                first_ts = ts
+            }
+            frames++; last_ts = ts; last_seq = seq
+        }
+        END {
+            mean = n ? sum / n : 0
+            var = n ? sumsq / n - mean * mean : 0
+            printf "{ \"frames\": %d, \"dropped\": %d, \"error_buffers\": %d, ", frames, dropped, errors
+            printf "\"fps\": %.3f, ", (last_ts > first_ts ? (frames - 1) / (last_ts - first_ts) : 0)
+            printf "\"interval_us\": { \"mean\": %.1f, \"stddev\": %.1f, \"min\": %.1f, \"max\": %.1f } }",
+                   mean, (var > 0 ? sqrt(var) : 0), min, max
+        }'
+}
+
+perf_camera() {
+    local subdev="$1" videodev="$2" seconds="$3" outdir="$4"
+    local log="$outdir/perf_stream_$(basename "$videodev").log"
+    local name width height pixel_rate link_freq hblank vblank expected_fps cma_streaming pid
+
+    name=$(v4l2-ctl -d "$subdev" --get-ctrl=name 2>/dev/null | awk -F': ' 'NR == 1 { print $2 }')
+    read -r width height < <(v4l2-ctl -d "$subdev" --get-subdev-fmt pad=0 2>/dev/null \
+        | awk -F'[ :/]+' '/Width\/Height/ { print $(NF - 1), $NF }')
+    pixel_rate=$(get_ctrl "$subdev" pixel_rate)
+    link_freq=$(get_int_menu_ctrl "$subdev" link_frequency)
+    hblank=$(get_ctrl "$subdev" horizontal_blanking)
+    vblank=$(get_ctrl "$subdev" vertical_blanking)
+    expected_fps=$(awk -v p="$pixel_rate" -v w="$width" -v h="$height" -v hb="$hblank" -v vb="$vblank" \
+        'BEGIN { if (p > 0 && w + hb > 0 && h + vb > 0) printf "%.3f", p / ((w + hb) * (h + vb)) }')
+
+    # Stream in the background to sample CMA while the buffers are allocated.
+    # SIGINT lets v4l2-ctl stop streaming cleanly, stdbuf keeps its output.
+    timeout -s INT "$seconds" stdbuf -oL v4l2-ctl --device="$videodev" --stream-mmap=8 \
+        --stream-count=1000000 --verbose > "$log" 2>&1 &
+    pid=$!
+    sleep 1
+    cma_streaming=$(meminfo_kb CmaFree)
+    wait "$pid"
+
+    printf '    {\n'
+    printf '      "subdev": %s,\n' "$(json_str "$subdev")"
+    printf '      "video": %s,\n' "$(json_str "$videodev")"
+    printf '      "sensor": %s,\n' "$(json_str "$name")"
+    printf '      "format": %s,\n' "$(json_str "$(v4l2-ctl -d "$videodev" --get-fmt-video 2>/dev/null \
+        | awk -F"'" '/Pixel Format/ { print $2 }')")"
+    printf '      "timing": { "width": %s, "height": %s, "pixel_rate": %s, "link_frequency": %s, ' \
+        "$(json_num "$width")" "$(json_num "$height")" "$(json_num "$pixel_rate")" "$(json_num "$link_freq")"
+    printf '"hblank": %s, "vblank": %s, "expected_fps": %s },\n' \
+        "$(json_num "$hblank")" "$(json_num "$vblank")" "$(json_num "$expected_fps")"
+    printf '      "controls": { "exposure": %s, "analogue_gain": %s, "frame_rate": %s, "trigger_mode": %s, ' \
+        "$(json_num "$(get_ctrl "$subdev" exposure)")" "$(json_num "$(get_ctrl "$subdev" analogue_gain)")" \
+        "$(json_num "$(get_ctrl "$subdev" frame_rate)")" "$(json_num "$(get_ctrl "$subdev" trigger_mode)")"
+    printf '"binning_mode": %s, "black_level": %s },\n' \
+        "$(json_num "$(get_ctrl "$subdev" binning_mode)")" "$(json_num "$(get_ctrl "$subdev" black_level)")"
+    printf '      "cma_free_kb_streaming": %s,\n' "$(json_num "$cma_streaming")"
+    printf '      "stream": %s\n' "$(stream_stats < "$log")"
+    printf '    }'
+}
+
+perf_snapshot() {
+    local seconds="$1" outdir="$2"
+    local json="$outdir/perf.json" kernel_log="$outdir/perf_kernel.log"
+    local start_epoch cpu_before cpu_after cma_before cma_after cores core first=true
+    local -a cores_before
+
+    echo "Performance snapshot, streaming every camera for $seconds s..."
+    start_epoch=$(date +%s)
+    cma_before=$(meminfo_kb CmaFree)
+    cpu_before=$(cpu_jiffies cpu)
+    cores=$(grep -c '^cpu[0-9]' /proc/stat)
+    for ((core = 0; core < cores; core++)); do
+        cores_before[$core]=$(cpu_jiffies "cpu$core")
+    done
+
+    {
+        printf '{\n'
+        printf '  "schema": 1,\n'
+        printf '  "created": %s,\n' "$(json_str "$(date -u +%Y-%m-%dT%H:%M:%SZ)")"
+        printf '  "model": %s,\n' "$(json_str "$(tr -d '\0' 2>/dev/null < /proc/device-tree/model)")"
+        printf '  "kernel": %s,\n' "$(json_str "$(uname -r)")"
+        printf '  "driver_version": %s,\n' "$(json_str "$(cat /sys/module/vc_mipi_camera/version 2>/dev/null)")"
+        printf '  "seconds": %s,\n' "$seconds"
+        printf '  "cameras": ['
+        while read -r subdev videodev; do
+            [ -e "$subdev" ] && [ -e "$videodev" ] || continue
+            $first || printf ','
+            printf '\n'
+            first=false
+            perf_camera "$subdev" "$videodev" "$seconds" "$outdir"
+        done < <(find_cameras)
+        printf '\n  ],\n'
+
+        cpu_after=$(cpu_jiffies cpu)
+        cma_after=$(meminfo_kb CmaFree)
+        printf '  "cpu": {\n'
+        printf '    "cores": %s,\n' "$cores"
+        printf '    "load_percent": %s,\n' "$(cpu_percent "$cpu_before" "$cpu_after")"
+        printf '    "core_load_percent": ['
+        for ((core = 0; core < cores; core++)); do
+            ((core)) && printf ', '
+            printf '%s' "$(cpu_percent "${cores_before[$core]}" "$(cpu_jiffies "cpu$core")")"
+        done
+        printf '],\n'
+        printf '    "loadavg": %s,\n' "$(json_str "$(cut -d' ' -f1-3 /proc/loadavg)")"
+        printf '    "temperature_mc": %s,\n' "$(json_num "$(cat /sys/class/thermal/thermal_zone0/temp 2>/dev/null)")"
+        printf '    "throttled": %s\n' "$(json_str "$(vcgencmd get_throttled 2>/dev/null | cut -d= -f2)")"
+        printf '  },\n'
+        printf '  "cma": {\n'
+        printf '    "reserved_bytes": %s,\n' "$(json_num "$(cma_reserved_bytes)")"
+        printf '    "expected_bytes": 402653184,\n'
+        printf '    "total_kb": %s,\n' "$(json_num "$(meminfo_kb CmaTotal)")"
+        printf '    "free_kb_before": %s,\n' "$(json_num "$cma_before")"
+        printf '    "free_kb_after": %s\n' "$(json_num "$cma_after")"
+        printf '  },\n'
+
+        # CSI-2 receiver and driver messages during the snapshot
+        sudo journalctl -k -o short-monotonic --since "@$start_epoch" 2>/dev/null \
+            | grep -iE "csi|cfe|unicam|vc_mipi|vc-mipi|cma" > "$kernel_log"
+        printf '  "kernel": {\n'
+        printf '    "messages": %s,\n' "$(wc -l < "$kernel_log")"
+        printf '    "errors": %s\n' "$(grep -ciE "error|overflow|timeout|fail" "$kernel_log")"
+        printf '  }\n'
+        printf '}\n'
+    } > "$json"
+
+    cat "$json"
+}
+
+if [ -n "$PERF_SECONDS" ]; then
+    perf_snapshot "$PERF_SECONDS" "$OUTDIR"
+    echo ""
+    echo "Performance snapshot created in: $OUTDIR"
+    echo "  perf.json        - machine readable snapshot (diff it against other sites)"
+    echo "  perf_stream_*.log - v4l2-ctl stream output per camera"
+    echo "  perf_kernel.log  - kernel messages during the snapshot"
+    echo ""
+    create_archive
+    exit 0
+fi
+
 echo "Collecting system information..."
 
 # ---------------------------------------------------------------------------
@@ -217,17 +492,7 @@ echo "  v4l2_capture_*.log - v4l2-ctl stream output from camera diagnostic captu
 echo ""
 
 # Create tar.gz archive
-ARCHIVE="$HOME/$(basename $OUTDIR).tar.gz"
-echo "Creating archive..."
-if (cd "$HOME" && tar -czf "$(basename $OUTDIR).tar.gz" "$(basename $OUTDIR)"); then
-    echo "✓ Archive created successfully: $ARCHIVE"
-    echo ""
-    echo "Please attach this file to your support ticket."
-else
-    echo "✗ Failed to create archive automatically."
-    echo "Please create it manually with:"
-    echo "  cd \$HOME && tar -czf $(basename $OUTDIR).tar.gz $(basename $OUTDIR)"
-fi
+create_archive
 
 echo ""
 echo "PRIVACY NOTICE (GDPR/DSGVO):"
@@ -0,0 +1,998 @@
+// vcmipisrc - GStreamer source element for VC MIPI cameras
+//
+// Unlike v4l2src the element configures the camera itself: the binning
+// mode, crop window and sensor format are set on the subdevice, the media
+// pipeline is routed to the receiver like vc_pipeline does and the video
+// node format follows. Trigger mode, I/O mode, frame rate, exposure, gain
+// and black level are element properties, the ones that do not change the
+// format can be changed while streaming.
+//
+// The capture buffers are exported as DMABUF and pushed downstream without
+// a copy. A buffer is queued back to the driver when the last GstMemory of
+// it is freed. Every buffer carries the sensor controls sampled for its
+// frame as GstVcMipiFrameMeta (see gstvcmipisrc.h).
+//
+// Example:
+//   gst-launch-1.0 vcmipisrc format=RGGB10 binning=1 trigger-mode=self frame-rate=30 ! \
+//       bayer2rgb ! videoconvert ! autovideosink
+
+#include "gstvcmipisrc.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <gst/allocators/gstdmabuf.h>
+#include <gst/video/video.h>
+
+#include "vc_capture.h"
+#include "vc_media.h"
+#include "vc_pixfmt.h"
+#include "vc_stats.h"
+#include "vc_v4l2.h"
+
+#define PACKAGE                         "vcmipi"
+#define VERSION                         "1.0"
+
+#define VC_MIPI_SRC_MAX_BUFFERS         16
+#define VC_MIPI_SRC_MAX_MEDIA           16
+// Longest wait for a frame before released buffers are queued again and
+// flushing is checked
+#define VC_MIPI_SRC_WAIT_SLICE_MS       10
+
+GST_DEBUG_CATEGORY_STATIC(gst_vc_mipi_src_debug);
+#define GST_CAT_DEFAULT gst_vc_mipi_src_debug
+
+enum {
+        PROP_0,
+        PROP_DEVICE,
+        PROP_SUBDEV,
+        PROP_CONFIGURE,
+        PROP_FORMAT,
+        PROP_PACKED,
+        PROP_ROI,
+        PROP_BINNING,
+        PROP_TRIGGER_MODE,
+        PROP_IO_MODE,
+        PROP_FRAME_RATE,
+        PROP_EXPOSURE,
+        PROP_GAIN,
+        PROP_BLACK_LEVEL,
+        PROP_BUFFERS,
+        PROP_DMABUF,
+};
+
+enum {
+        SIGNAL_SINGLE_TRIGGER,
+        LAST_SIGNAL,
+};
+
+// Capture and exported buffers of one start() / stop() cycle. Buffers still
+// held downstream after stop() keep it alive.
+struct vc_mipi_src_stream {
+        gint refcount;
+        GMutex lock;                    // protects 'released' and 'closing'
+        struct vc_capture *cap;
+        int fds[VC_MIPI_SRC_MAX_BUFFERS];
+        size_t lengths[VC_MIPI_SRC_MAX_BUFFERS];
+        unsigned int num_fds;
+        GArray *released;               // struct vc_frame, queued again by create()
+        gboolean closing;
+        gboolean streaming;
+};
+
+// Attached to the GstMemory of a DMABUF frame
+struct vc_mipi_src_frame {
+        struct vc_mipi_src_stream *stream;
+        struct vc_frame frame;
+};
+
+struct _GstVcMipiSrc {
+        GstPushSrc parent;
+
+        // Properties, protected by the object lock
+        gchar *device;
+        gchar *subdev;
+        gboolean configure;
+        gchar *format;
+        gboolean packed;
+        gchar *roi;
+        gint binning;
+        gint trigger_mode;
+        gint io_mode;
+        gdouble frame_rate;
+        gint exposure;
+        gint gain;
+        gint black_level;
+        guint buffers;
+        gboolean dmabuf;
+
+        // Set and cleared under the object lock, other threads take a reference
+        struct vc_mipi_src_stream *stream;
+        struct vc_format fmt;
+        const struct vc_pixfmt *pixfmt;
+        bool fmt_packed;
+        GstCaps *caps;
+        GstAllocator *allocator;        // NULL: frames are copied
+        gint flushing;
+};
+
+static guint gst_vc_mipi_src_signals[LAST_SIGNAL];
+static GQuark gst_vc_mipi_src_frame_quark;
+
+static GstStaticPadTemplate gst_vc_mipi_src_template = GST_STATIC_PAD_TEMPLATE(
+        "src", GST_PAD_SRC, GST_PAD_ALWAYS,
+        GST_STATIC_CAPS("video/x-raw, format = (string) { GRAY8, GRAY16_LE }, "
+                        "width = " GST_VIDEO_SIZE_RANGE ", height = " GST_VIDEO_SIZE_RANGE ", "
+                        "framerate = " GST_VIDEO_FPS_RANGE "; "
+                        "video/x-bayer, "
+                        "width = " GST_VIDEO_SIZE_RANGE ", height = " GST_VIDEO_SIZE_RANGE ", "
+                        "framerate = " GST_VIDEO_FPS_RANGE "; "
+                        "video/x-vc-mipi-raw, "
+                        "width = " GST_VIDEO_SIZE_RANGE ", height = " GST_VIDEO_SIZE_RANGE ", "
+                        "framerate = " GST_VIDEO_FPS_RANGE));
+
+#define gst_vc_mipi_src_parent_class parent_class
+G_DEFINE_TYPE(GstVcMipiSrc, gst_vc_mipi_src, GST_TYPE_PUSH_SRC);
+
+// --- Enums -------------------------------------------------------------------
+
+#define GST_TYPE_VC_MIPI_TRIGGER_MODE   (gst_vc_mipi_trigger_mode_get_type())
+#define GST_TYPE_VC_MIPI_IO_MODE        (gst_vc_mipi_io_mode_get_type())
+
+// Values of V4L2_CID_VC_TRIGGER_MODE, see docs/trigger_mode.md
+static GType gst_vc_mipi_trigger_mode_get_type(void)
+{
+        static const GEnumValue values[] = {
+                { -1, "Keep the sensor setting", "keep" },
+                { 0, "Free running", "off" },
+                { 1, "External trigger", "external" },
+                { 2, "Pulse width trigger", "pulse-width" },
+                { 3, "Self trigger", "self" },
+                { 4, "Single trigger, see the single-trigger signal", "single" },
+                { 5, "Sync trigger", "sync" },
+                { 6, "Stream edge trigger", "stream-edge" },
+                { 7, "Stream level trigger", "stream-level" },
+                { 0, NULL, NULL },
+        };
+        static gsize type;
+
+        if (g_once_init_enter(&type))
+                g_once_init_leave(&type, g_enum_register_static("GstVcMipiTriggerMode", values));
+        return type;
+}
+
+// Values of V4L2_CID_VC_IO_MODE, see docs/io_mode.md
+static GType gst_vc_mipi_io_mode_get_type(void)
+{
+        static const GEnumValue values[] = {
+                { -1, "Keep the sensor setting", "keep" },
+                { 0, "Flash off, trigger active high", "disabled" },
+                { 1, "Flash active high, trigger active high", "flash-high" },
+                { 2, "Flash active low, trigger active high", "flash-low" },
+                { 3, "Flash off, trigger active low", "trigger-low" },
+                { 4, "Flash active high, trigger active low", "trigger-low-flash-high" },
+                { 5, "Flash active low, trigger active low", "trigger-low-flash-low" },
+                { 0, NULL, NULL },
+        };
+        static gsize type;
+
+        if (g_once_init_enter(&type))
+                g_once_init_leave(&type, g_enum_register_static("GstVcMipiIoMode", values));
+        return type;
+}
+
+// --- Stream ------------------------------------------------------------------
+
+static struct vc_mipi_src_stream *vc_mipi_src_stream_ref(struct vc_mipi_src_stream *stream)
+{
+        g_atomic_int_inc(&stream->refcount);
+        return stream;
+}
+
+static void vc_mipi_src_stream_unref(struct vc_mipi_src_stream *stream)
+{
+        unsigned int i;
+
+        if (!g_atomic_int_dec_and_test(&stream->refcount))
+                return;
+
+        for (i = 0; i < stream->num_fds; i++)
+                close(stream->fds[i]);
+        vc_capture_close(stream->cap);
+        g_array_free(stream->released, TRUE);
+        g_mutex_clear(&stream->lock);
+        g_free(stream);
+}
+
+// Called when the last reference to the GstMemory of a frame is gone, from
+// any thread. The frame is queued again by the streaming thread.
+static void gst_vc_mipi_src_frame_done(gpointer data)
+{
+        struct vc_mipi_src_frame *frame = data;
+        struct vc_mipi_src_stream *stream = frame->stream;
+
+        g_mutex_lock(&stream->lock);
+        if (!stream->closing)
+                g_array_append_val(stream->released, frame->frame);
+        g_mutex_unlock(&stream->lock);
+
+        vc_mipi_src_stream_unref(stream);
+        g_free(frame);
+}
+
+static void gst_vc_mipi_src_requeue(struct vc_mipi_src_stream *stream)
+{
+        unsigned int i;
+
+        g_mutex_lock(&stream->lock);
+        for (i = 0; i < stream->released->len; i++)
+                vc_capture_release(stream->cap, &g_array_index(stream->released, struct vc_frame, i));
+        g_array_set_size(stream->released, 0);
+        g_mutex_unlock(&stream->lock);
+}
+
+// --- Configuration -----------------------------------------------------------
+
+// Crop window "WxH+L+T" or "WxH" (centered is up to the driver)
+static gboolean gst_vc_mipi_src_parse_roi(const gchar *str, struct v4l2_rect *rect)
+{
+        unsigned int width, height, left = 0, top = 0;
+        int n = sscanf(str, "%ux%u+%u+%u", &width, &height, &left, &top);
+
+        if (n != 2 && n != 4)
+                return FALSE;
+        rect->width = width;
+        rect->height = height;
+        rect->left = left;
+        rect->top = top;
+        return TRUE;
+}
+
+static struct vc_media *gst_vc_mipi_src_find_media(const char *subdev, const struct media_v2_entity **sensor)
+{
+        struct dirent *entry;
+        struct vc_media *media = NULL;
+        DIR *dir;
+
+        dir = opendir("/dev");
+        if (!dir)
+                return NULL;
+
+        while (!media && (entry = readdir(dir)) != NULL) {
+                char path[288];
+
+                if (strncmp(entry->d_name, "media", 5) != 0)
+                        continue;
+                snprintf(path, sizeof(path), "/dev/%s", entry->d_name);
+                media = vc_media_open(path);
+                if (!media)
+                        continue;
+                *sensor = vc_media_find_entity_by_devnode(media, subdev);
+                if (!*sensor) {
+                        vc_media_close(media);
+                        media = NULL;
+                }
+        }
+
+        closedir(dir);
+        return media;
+}
+
+// Sets binning, crop and format of the sensor, routes it to the receiver and
+// sets the video node format. 'video' is the node to capture from; if it is
+// empty, the receiver's node is returned in it.
+static gboolean gst_vc_mipi_src_configure(GstVcMipiSrc *src, const char *subdev, char *video, size_t len)
+{
+        const struct media_v2_entity *sensor, *frontend;
+        const struct vc_pixfmt *pixfmt = NULL, *out;
+        struct v4l2_mbus_framefmt mbus;
+        struct vc_media *media;
+        struct vc_format fmt;
+        struct v4l2_rect rect;
+        int fd, ret = 0;
+
+        fd = open(subdev, O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+                GST_ELEMENT_ERROR(src, RESOURCE, OPEN_READ_WRITE, ("Failed to open %s", subdev),
+                                  ("%s", g_strerror(errno)));
+                return FALSE;
+        }
+
+        // Binning changes the sensor format, so it goes first
+        if (src->binning >= 0)
+                ret = vc_ctrl_set(fd, V4L2_CID_VC_BINNING_MODE, src->binning);
+        if (ret == 0 && src->roi) {
+                if (!gst_vc_mipi_src_parse_roi(src->roi, &rect)) {
+                        close(fd);
+                        GST_ELEMENT_ERROR(src, RESOURCE, SETTINGS, ("Invalid roi '%s', expected WxH+L+T", src->roi),
+                                          (NULL));
+                        return FALSE;
+                }
+                ret = vc_subdev_set_crop(fd, 0, &rect);
+        }
+        if (ret == 0)
+                ret = vc_subdev_get_fmt(fd, 0, &mbus);
+        if (ret == 0 && src->format) {
+                pixfmt = vc_pixfmt_from_name(src->format);
+                if (!pixfmt) {
+                        close(fd);
+                        GST_ELEMENT_ERROR(src, RESOURCE, SETTINGS, ("Unknown format '%s'", src->format), (NULL));
+                        return FALSE;
+                }
+                mbus.code = pixfmt->mbus_code;
+                ret = vc_subdev_set_fmt(fd, 0, &mbus);
+        }
+        close(fd);
+        if (ret < 0) {
+                GST_ELEMENT_ERROR(src, RESOURCE, SETTINGS, ("Failed to configure the sensor %s", subdev),
+                                  ("%s", g_strerror(-ret)));
+                return FALSE;
+        }
+
+        pixfmt = vc_pixfmt_from_mbus(mbus.code);
+        if (!pixfmt) {
+                GST_ELEMENT_ERROR(src, RESOURCE, SETTINGS, ("Unknown mediabus code 0x%04x", mbus.code), (NULL));
+                return FALSE;
+        }
+
+        media = gst_vc_mipi_src_find_media(subdev, &sensor);
+        if (!media) {
+                GST_ELEMENT_ERROR(src, RESOURCE, NOT_FOUND, ("No media device contains %s", subdev), (NULL));
+                return FALSE;
+        }
+
+        fmt.width = mbus.width;
+        fmt.height = mbus.height;
+        fmt.fourcc = src->packed || !pixfmt->fourcc_unpacked ? pixfmt->fourcc : pixfmt->fourcc_unpacked;
+        out = vc_pixfmt_from_fourcc(fmt.fourcc, NULL);
+
+        frontend = vc_media_find_frontend(media);
+        if (!video[0] && (!frontend || vc_media_entity_devnode(media, frontend->id, video, len) < 0))
+                ret = -ENODEV;
+        if (ret == 0 && !frontend)
+                frontend = vc_media_find_entity_by_devnode(media, video);
+        if (ret == 0 && !frontend)
+                ret = -ENODEV;
+        if (ret == 0)
+                ret = vc_media_reset_links(media);
+        if (ret == 0)
+                ret = vc_media_route_sensor(media, sensor->id, frontend->id, &mbus, out ? out->mbus_code : 0);
+        vc_media_close(media);
+        if (ret == 0)
+                ret = vc_capture_set_format(video, &fmt);
+        if (ret < 0) {
+                GST_ELEMENT_ERROR(src, RESOURCE, SETTINGS, ("Failed to route %s to the receiver", subdev),
+                                  ("%s", g_strerror(-ret)));
+                return FALSE;
+        }
+
+        GST_INFO_OBJECT(src, "%s -> %s %ux%u %s", subdev, video, fmt.width, fmt.height, pixfmt->name);
+        return TRUE;
+}
+
+// Writes the control properties that are set. Called with the object lock.
+static int gst_vc_mipi_src_apply_controls(GstVcMipiSrc *src, int fd)
+{
+        uint32_t ids[VC_CTRL_MULTI_MAX];
+        int32_t values[VC_CTRL_MULTI_MAX];
+        unsigned int count = 0;
+
+        if (src->trigger_mode >= 0) {
+                ids[count] = V4L2_CID_VC_TRIGGER_MODE;
+                values[count++] = src->trigger_mode;
+        }
+        if (src->io_mode >= 0) {
+                ids[count] = V4L2_CID_VC_IO_MODE;
+                values[count++] = src->io_mode;
+        }
+        if (src->frame_rate >= 0) {
+                ids[count] = V4L2_CID_VC_FRAME_RATE;
+                values[count++] = (int32_t)(src->frame_rate * 1000.0 + 0.5);
+        }
+        if (src->exposure >= 0) {
+                ids[count] = V4L2_CID_EXPOSURE;
+                values[count++] = src->exposure;
+        }
+        if (src->gain >= 0) {
+                ids[count] = V4L2_CID_ANALOGUE_GAIN;
+                values[count++] = src->gain;
+        }
+        if (src->black_level >= 0) {
+                ids[count] = V4L2_CID_BLACK_LEVEL;
+                values[count++] = src->black_level;
+        }
+
+        return count ? vc_ctrl_set_multi(fd, ids, values, count) : 0;
+}
+
+static GstCaps *gst_vc_mipi_src_make_caps(const struct vc_format *fmt, const struct vc_pixfmt *pixfmt, bool packed,
+                                          gdouble frame_rate)
+{
+        static const char *const orders[] = { NULL, "bggr", "gbrg", "grbg", "rggb" };
+        gint fps_n = 0, fps_d = 1;
+        GstCaps *caps;
+
+        if (packed) {
+                // CSI-2 packed lines have no GStreamer format
+                caps = gst_caps_new_simple("video/x-vc-mipi-raw", "format", G_TYPE_STRING, pixfmt->name,
+                                           "bpp", G_TYPE_INT, pixfmt->bits, "stride", G_TYPE_INT,
+                                           fmt->bytesperline, NULL);
+        } else if (pixfmt->bayer != VC_BAYER_NONE) {
+                gchar *format = pixfmt->bits > 8 ? g_strdup_printf("%s%ule", orders[pixfmt->bayer], pixfmt->bits)
+                                                 : g_strdup(orders[pixfmt->bayer]);
+
+                caps = gst_caps_new_simple("video/x-bayer", "format", G_TYPE_STRING, format, NULL);
+                g_free(format);
+        } else {
+                // Samples of 16 bit containers are right aligned
+                caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING,
+                                           pixfmt->bits > 8 ? "GRAY16_LE" : "GRAY8", NULL);
+        }
+
+        if (frame_rate > 0)
+                gst_util_double_to_fraction(frame_rate, &fps_n, &fps_d);
+        gst_caps_set_simple(caps, "width", G_TYPE_INT, fmt->width, "height", G_TYPE_INT, fmt->height,
+                            "framerate", GST_TYPE_FRACTION, fps_n, fps_d, NULL);
+        return caps;
+}
+
+// --- GstBaseSrc --------------------------------------------------------------
+
+static gboolean gst_vc_mipi_src_start(GstBaseSrc *bsrc)
+{
+        GstVcMipiSrc *src = GST_VC_MIPI_SRC(bsrc);
+        struct vc_mipi_src_stream *stream;
+        struct vc_capture *cap;
+        char subdev[64] = "", video[64] = "";
+        gboolean replay;
+        char fcc[5];
+        int ret, fd;
+
+        GST_OBJECT_LOCK(src);
+        if (src->device)
+                g_strlcpy(video, src->device, sizeof(video));
+        if (src->subdev)
+                g_strlcpy(subdev, src->subdev, sizeof(subdev));
+        GST_OBJECT_UNLOCK(src);
+
+        replay = g_str_has_prefix(video, VC_CAPTURE_REPLAY_PREFIX);
+        if (!replay && !subdev[0] && vc_find_sensor_subdev(subdev, sizeof(subdev)) < 0) {
+                GST_ELEMENT_ERROR(src, RESOURCE, NOT_FOUND, ("No vc_mipi_camera subdevice found"), (NULL));
+                return FALSE;
+        }
+        if (!replay && src->configure && !gst_vc_mipi_src_configure(src, subdev, video, sizeof(video)))
+                return FALSE;
+        if (!video[0])
+                g_strlcpy(video, "/dev/video0", sizeof(video));
+
+        cap = vc_capture_open(video, subdev[0] && !replay ? subdev : NULL, src->buffers);
+        if (!cap) {
+                GST_ELEMENT_ERROR(src, RESOURCE, OPEN_READ, ("Failed to open %s", video), ("%s", g_strerror(errno)));
+                return FALSE;
+        }
+
+        fd = vc_capture_subdev_fd(cap);
+        if (fd >= 0) {
+                GST_OBJECT_LOCK(src);
+                ret = gst_vc_mipi_src_apply_controls(src, fd);
+                GST_OBJECT_UNLOCK(src);
+                if (ret < 0)
+                        GST_ELEMENT_WARNING(src, RESOURCE, SETTINGS, ("Failed to set the sensor controls"),
+                                            ("%s", g_strerror(-ret)));
+        }
+
+        vc_capture_get_format(cap, &src->fmt);
+        src->pixfmt = vc_pixfmt_from_fourcc(src->fmt.fourcc, &src->fmt_packed);
+        if (!src->pixfmt) {
+                GST_ELEMENT_ERROR(src, RESOURCE, SETTINGS, ("Unsupported format %s",
+                                  vc_fourcc_str(src->fmt.fourcc, fcc)), (NULL));
+                vc_capture_close(cap);
+                return FALSE;
+        }
+
+        stream = g_new0(struct vc_mipi_src_stream, 1);
+        stream->refcount = 1;
+        g_mutex_init(&stream->lock);
+        stream->cap = cap;
+        stream->released = g_array_new(FALSE, FALSE, sizeof(struct vc_frame));
+
+        // Replay has nothing to export, its frames are copied
+        if (src->dmabuf) {
+                ret = vc_capture_export(cap, stream->fds, stream->lengths, VC_MIPI_SRC_MAX_BUFFERS);
+                if (ret > 0) {
+                        stream->num_fds = ret;
+                        src->allocator = gst_dmabuf_allocator_new();
+                } else {
+                        GST_INFO_OBJECT(src, "No DMABUF export (%s), copying frames", g_strerror(-ret));
+                }
+        }
+        GST_OBJECT_LOCK(src);
+        src->stream = stream;
+        src->caps = gst_vc_mipi_src_make_caps(&src->fmt, src->pixfmt, src->fmt_packed, src->frame_rate);
+        GST_OBJECT_UNLOCK(src);
+
+        GST_INFO_OBJECT(src, "Capturing %s %ux%u from %s (%s)", vc_fourcc_str(src->fmt.fourcc, fcc),
+                        src->fmt.width, src->fmt.height, video, src->allocator ? "DMABUF" : "copy");
+        return TRUE;
+}
+
+static gboolean gst_vc_mipi_src_stop(GstBaseSrc *bsrc)
+{
+        GstVcMipiSrc *src = GST_VC_MIPI_SRC(bsrc);
+        struct vc_mipi_src_stream *stream;
+
+        // Property setters hold their own reference while they use the stream
+        GST_OBJECT_LOCK(src);
+        stream = src->stream;
+        src->stream = NULL;
+        GST_OBJECT_UNLOCK(src);
+
+        if (stream) {
+                // Buffers still held downstream keep the stream until they are freed
+                g_mutex_lock(&stream->lock);
+                stream->closing = TRUE;
+                g_array_set_size(stream->released, 0);
+                g_mutex_unlock(&stream->lock);
+                vc_capture_stop(stream->cap);
+                vc_mipi_src_stream_unref(stream);
+        }
+
+        gst_clear_object(&src->allocator);
+        GST_OBJECT_LOCK(src);
+        gst_clear_caps(&src->caps);
+        GST_OBJECT_UNLOCK(src);
+        return TRUE;
+}
+
+static GstCaps *gst_vc_mipi_src_get_caps(GstBaseSrc *bsrc, GstCaps *filter)
+{
+        GstVcMipiSrc *src = GST_VC_MIPI_SRC(bsrc);
+        GstCaps *caps;
+
+        GST_OBJECT_LOCK(src);
+        caps = src->caps ? gst_caps_ref(src->caps) : gst_pad_get_pad_template_caps(GST_BASE_SRC_PAD(bsrc));
+        GST_OBJECT_UNLOCK(src);
+
+        if (filter) {
+                GstCaps *tmp = gst_caps_intersect_full(filter, caps, GST_CAPS_INTERSECT_FIRST);
+
+                gst_caps_unref(caps);
+                caps = tmp;
+        }
+        return caps;
+}
+
+static gboolean gst_vc_mipi_src_unlock(GstBaseSrc *bsrc)
+{
+        g_atomic_int_set(&GST_VC_MIPI_SRC(bsrc)->flushing, 1);
+        return TRUE;
+}
+
+static gboolean gst_vc_mipi_src_unlock_stop(GstBaseSrc *bsrc)
+{
+        g_atomic_int_set(&GST_VC_MIPI_SRC(bsrc)->flushing, 0);
+        return TRUE;
+}
+
+static void gst_vc_mipi_src_add_meta(GstBuffer *buf, const struct vc_frame *frame)
+{
+        static const struct {
+                const char *name;
+                size_t offset;
+        } ctrls[] = {
+                { "exposure", offsetof(struct vc_ctrl_state, exposure) },
+                { "gain", offsetof(struct vc_ctrl_state, gain) },
+                { "black-level", offsetof(struct vc_ctrl_state, blacklevel) },
+                { "frame-rate", offsetof(struct vc_ctrl_state, frame_rate) },
+                { "binning-mode", offsetof(struct vc_ctrl_state, binning_mode) },
+                { "live-roi", offsetof(struct vc_ctrl_state, live_roi) },
+                { "bracket", offsetof(struct vc_ctrl_state, bracket) },
+        };
+        GstCustomMeta *meta = gst_buffer_add_custom_meta(buf, GST_VC_MIPI_FRAME_META);
+        GstStructure *s;
+        unsigned int i;
+
+        if (!meta)
+                return;
+
+        s = gst_custom_meta_get_structure(meta);
+        gst_structure_set(s, "sequence", G_TYPE_UINT, frame->sequence, NULL);
+        for (i = 0; i < G_N_ELEMENTS(ctrls); i++) {
+                int32_t value = *(const int32_t *)((const char *)&frame->ctrls + ctrls[i].offset);
+
+                if (value != VC_CTRL_UNAVAILABLE)
+                        gst_structure_set(s, ctrls[i].name, G_TYPE_INT, value, NULL);
+        }
+}
+
+// Running time of the start of frame, from the CLOCK_MONOTONIC timestamp of
+// the receiver and the delay until now
+static GstClockTime gst_vc_mipi_src_timestamp(GstVcMipiSrc *src, uint64_t timestamp_ns)
+{
+        GstClock *clock = gst_element_get_clock(GST_ELEMENT(src));
+        GstClockTime base, now, delay;
+        uint64_t now_ns;
+
+        if (!clock)
+                return GST_CLOCK_TIME_NONE;
+
+        base = gst_element_get_base_time(GST_ELEMENT(src));
+        now = gst_clock_get_time(clock);
+        gst_object_unref(clock);
+
+        now_ns = vc_clock_ns(CLOCK_MONOTONIC);
+        delay = now_ns > timestamp_ns ? now_ns - timestamp_ns : 0;
+        return now > base + delay ? now - base - delay : 0;
+}
+
+static GstFlowReturn gst_vc_mipi_src_create(GstPushSrc *psrc, GstBuffer **outbuf)
+{
+        GstVcMipiSrc *src = GST_VC_MIPI_SRC(psrc);
+        struct vc_mipi_src_stream *stream = src->stream;
+        struct vc_frame frame;
+        GstBuffer *buf;
+        int ret;
+
+        if (!stream->streaming) {
+                ret = vc_capture_start(stream->cap);
+                if (ret < 0) {
+                        GST_ELEMENT_ERROR(src, RESOURCE, FAILED, ("Failed to start streaming"),
+                                          ("%s", g_strerror(-ret)));
+                        return GST_FLOW_ERROR;
+                }
+                stream->streaming = TRUE;
+        }
+
+        do {
+                if (g_atomic_int_get(&src->flushing))
+                        return GST_FLOW_FLUSHING;
+                gst_vc_mipi_src_requeue(stream);
+                ret = vc_capture_dequeue(stream->cap, &frame, VC_MIPI_SRC_WAIT_SLICE_MS);
+        } while (ret == -ETIMEDOUT);
+
+        if (ret == -ENODATA)
+                return GST_FLOW_EOS;
+        if (ret < 0) {
+                GST_ELEMENT_ERROR(src, RESOURCE, READ, ("Failed to dequeue a frame"), ("%s", g_strerror(-ret)));
+                return GST_FLOW_ERROR;
+        }
+
+        if (src->allocator && frame.index < stream->num_fds) {
+                struct vc_mipi_src_frame *held = g_new(struct vc_mipi_src_frame, 1);
+                GstMemory *mem;
+
+                mem = gst_dmabuf_allocator_alloc_with_flags(src->allocator, stream->fds[frame.index],
+                                                            stream->lengths[frame.index],
+                                                            GST_FD_MEMORY_FLAG_DONT_CLOSE);
+                gst_memory_resize(mem, 0, frame.bytesused);
+                // Exported read-only, the driver owns the buffer
+                GST_MINI_OBJECT_FLAG_SET(mem, GST_MEMORY_FLAG_READONLY);
+
+                held->stream = vc_mipi_src_stream_ref(stream);
+                held->frame = frame;
+                gst_mini_object_set_qdata(GST_MINI_OBJECT(mem), gst_vc_mipi_src_frame_quark, held,
+                                          gst_vc_mipi_src_frame_done);
+
+                buf = gst_buffer_new();
+                gst_buffer_append_memory(buf, mem);
+        } else {
+                buf = gst_buffer_new_allocate(NULL, frame.bytesused, NULL);
+                if (buf)
+                        gst_buffer_fill(buf, 0, frame.data, frame.bytesused);
+                vc_capture_release(stream->cap, &frame);
+                if (!buf)
+                        return GST_FLOW_ERROR;
+        }
+
+        GST_BUFFER_PTS(buf) = gst_vc_mipi_src_timestamp(src, frame.timestamp_ns);
+        GST_BUFFER_OFFSET(buf) = frame.sequence;
+        GST_BUFFER_OFFSET_END(buf) = frame.sequence + 1;
+        if (src->pixfmt->bayer == VC_BAYER_NONE && !src->fmt_packed) {
+                gsize offset[GST_VIDEO_MAX_PLANES] = { 0 };
+                gint stride[GST_VIDEO_MAX_PLANES] = { (gint)src->fmt.bytesperline };
+
+                // The line stride of the receiver may differ from GStreamer's default
+                gst_buffer_add_video_meta_full(buf, GST_VIDEO_FRAME_FLAG_NONE,
+                                               src->pixfmt->bits > 8 ? GST_VIDEO_FORMAT_GRAY16_LE
+                                                                     : GST_VIDEO_FORMAT_GRAY8,
+                                               src->fmt.width, src->fmt.height, 1, offset, stride);
+        }
+        gst_vc_mipi_src_add_meta(buf, &frame);
+
+        *outbuf = buf;
+        return GST_FLOW_OK;
+}
+
+// --- Properties and signals --------------------------------------------------
+
+// Properties and signals come from application threads while stop() may drop
+// the stream. The reference keeps the subdevice open for the ioctl.
+static struct vc_mipi_src_stream *gst_vc_mipi_src_get_stream(GstVcMipiSrc *src)
+{
+        struct vc_mipi_src_stream *stream;
+
+        GST_OBJECT_LOCK(src);
+        stream = src->stream ? vc_mipi_src_stream_ref(src->stream) : NULL;
+        GST_OBJECT_UNLOCK(src);
+        return stream;
+}
+
+static gboolean gst_vc_mipi_src_single_trigger(GstVcMipiSrc *src)
+{
+        struct vc_mipi_src_stream *stream = gst_vc_mipi_src_get_stream(src);
+        gboolean ret;
+        int fd;
+
+        if (!stream)
+                return FALSE;
+
+        fd = vc_capture_subdev_fd(stream->cap);
+        ret = fd >= 0 && vc_ctrl_set(fd, V4L2_CID_VC_SINGLE_TRIGGER, 1) == 0;
+        vc_mipi_src_stream_unref(stream);
+        return ret;
+}
+
+// Applies a control property while streaming. Called without the object lock.
+static void gst_vc_mipi_src_update_control(GstVcMipiSrc *src, uint32_t id, int32_t value)
+{
+        struct vc_mipi_src_stream *stream;
+        int fd, ret;
+
+        if (value < 0)
+                return;
+
+        stream = gst_vc_mipi_src_get_stream(src);
+        if (!stream)
+                return;
+
+        fd = vc_capture_subdev_fd(stream->cap);
+        if (fd >= 0) {
+                ret = vc_ctrl_set(fd, id, value);
+                if (ret < 0)
+                        GST_WARNING_OBJECT(src, "Failed to set control 0x%08x to %d: %s", id, value,
+                                           g_strerror(-ret));
+        }
+        vc_mipi_src_stream_unref(stream);
+}
+
+static void gst_vc_mipi_src_set_property(GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec)
+{
+        GstVcMipiSrc *src = GST_VC_MIPI_SRC(object);
+        // Control to apply to a running stream, after the object lock is released
+        uint32_t ctrl_id = 0;
+        int32_t ctrl_value = -1;
+
+        GST_OBJECT_LOCK(src);
+        switch (prop_id) {
+        case PROP_DEVICE:
+                g_free(src->device);
+                src->device = g_value_dup_string(value);
+                break;
+        case PROP_SUBDEV:
+                g_free(src->subdev);
+                src->subdev = g_value_dup_string(value);
+                break;
+        case PROP_CONFIGURE:
+                src->configure = g_value_get_boolean(value);
+                break;
+        case PROP_FORMAT:
+                g_free(src->format);
+                src->format = g_value_dup_string(value);
+                break;
+        case PROP_PACKED:
+                src->packed = g_value_get_boolean(value);
+                break;
+        case PROP_ROI:
+                g_free(src->roi);
+                src->roi = g_value_dup_string(value);
+                break;
+        case PROP_BINNING:
+                src->binning = g_value_get_int(value);
+                break;
+        case PROP_TRIGGER_MODE:
+                src->trigger_mode = g_value_get_enum(value);
+                ctrl_id = V4L2_CID_VC_TRIGGER_MODE;
+                ctrl_value = src->trigger_mode;
+                break;
+        case PROP_IO_MODE:
+                src->io_mode = g_value_get_enum(value);
+                ctrl_id = V4L2_CID_VC_IO_MODE;
+                ctrl_value = src->io_mode;
+                break;
+        case PROP_FRAME_RATE:
+                src->frame_rate = g_value_get_double(value);
+                if (src->frame_rate >= 0) {
+                        ctrl_id = V4L2_CID_VC_FRAME_RATE;
+                        ctrl_value = (int32_t)(src->frame_rate * 1000.0 + 0.5);
+                }
+                break;
+        case PROP_EXPOSURE:
+                src->exposure = g_value_get_int(value);
+                ctrl_id = V4L2_CID_EXPOSURE;
+                ctrl_value = src->exposure;
+                break;
+        case PROP_GAIN:
+                src->gain = g_value_get_int(value);
+                ctrl_id = V4L2_CID_ANALOGUE_GAIN;
+                ctrl_value = src->gain;
+                break;
+        case PROP_BLACK_LEVEL:
+                src->black_level = g_value_get_int(value);
+                ctrl_id = V4L2_CID_BLACK_LEVEL;
+                ctrl_value = src->black_level;
+                break;
+        case PROP_BUFFERS:
+                src->buffers = g_value_get_uint(value);
+                break;
+        case PROP_DMABUF:
+                src->dmabuf = g_value_get_boolean(value);
+                break;
+        default:
+                G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+                break;
+        }
+        GST_OBJECT_UNLOCK(src);
+
+        if (ctrl_id)
+                gst_vc_mipi_src_update_control(src, ctrl_id, ctrl_value);
+}
+
+static void gst_vc_mipi_src_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec *pspec)
+{
+        GstVcMipiSrc *src = GST_VC_MIPI_SRC(object);
+
+        GST_OBJECT_LOCK(src);
+        switch (prop_id) {
+        case PROP_DEVICE: g_value_set_string(value, src->device); break;
+        case PROP_SUBDEV: g_value_set_string(value, src->subdev); break;
+        case PROP_CONFIGURE: g_value_set_boolean(value, src->configure); break;
+        case PROP_FORMAT: g_value_set_string(value, src->format); break;
+        case PROP_PACKED: g_value_set_boolean(value, src->packed); break;
+        case PROP_ROI: g_value_set_string(value, src->roi); break;
+        case PROP_BINNING: g_value_set_int(value, src->binning); break;
+        case PROP_TRIGGER_MODE: g_value_set_enum(value, src->trigger_mode); break;
+        case PROP_IO_MODE: g_value_set_enum(value, src->io_mode); break;
+        case PROP_FRAME_RATE: g_value_set_double(value, src->frame_rate); break;
+        case PROP_EXPOSURE: g_value_set_int(value, src->exposure); break;
+        case PROP_GAIN: g_value_set_int(value, src->gain); break;
+        case PROP_BLACK_LEVEL: g_value_set_int(value, src->black_level); break;
+        case PROP_BUFFERS: g_value_set_uint(value, src->buffers); break;
+        case PROP_DMABUF: g_value_set_boolean(value, src->dmabuf); break;
+        default:
+                G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+                break;
+        }
+        GST_OBJECT_UNLOCK(src);
+}
+
+static void gst_vc_mipi_src_finalize(GObject *object)
+{
+        GstVcMipiSrc *src = GST_VC_MIPI_SRC(object);
+
+        g_free(src->device);
+        g_free(src->subdev);
+        g_free(src->format);
+        g_free(src->roi);
+        G_OBJECT_CLASS(parent_class)->finalize(object);
+}
+
+static void gst_vc_mipi_src_init(GstVcMipiSrc *src)
+{
+        src->configure = TRUE;
+        src->binning = -1;
+        src->trigger_mode = -1;
+        src->io_mode = -1;
+        src->frame_rate = -1;
+        src->exposure = -1;
+        src->gain = -1;
+        src->black_level = -1;
+        src->buffers = 4;
+        src->dmabuf = TRUE;
+
+        gst_base_src_set_live(GST_BASE_SRC(src), TRUE);
+        gst_base_src_set_format(GST_BASE_SRC(src), GST_FORMAT_TIME);
+}
+
+#define GST_VC_MIPI_SRC_PARAM           (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)
+#define GST_VC_MIPI_SRC_PARAM_LIVE      (GST_VC_MIPI_SRC_PARAM | GST_PARAM_MUTABLE_PLAYING)
+
+static void gst_vc_mipi_src_class_init(GstVcMipiSrcClass *klass)
+{
+        GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+        GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+        GstBaseSrcClass *basesrc_class = GST_BASE_SRC_CLASS(klass);
+        GstPushSrcClass *pushsrc_class = GST_PUSH_SRC_CLASS(klass);
+
+        gobject_class->set_property = gst_vc_mipi_src_set_property;
+        gobject_class->get_property = gst_vc_mipi_src_get_property;
+        gobject_class->finalize = gst_vc_mipi_src_finalize;
+
+        g_object_class_install_property(gobject_class, PROP_DEVICE,
+                g_param_spec_string("device", "Device", "Video node or replay:<file.vcraw> "
+                                    "(default: the receiver of the sensor, or /dev/video0)",
+                                    NULL, GST_VC_MIPI_SRC_PARAM));
+        g_object_class_install_property(gobject_class, PROP_SUBDEV,
+                g_param_spec_string("subdev", "Subdevice", "Sensor subdevice (default: auto-detected)",
+                                    NULL, GST_VC_MIPI_SRC_PARAM));
+        g_object_class_install_property(gobject_class, PROP_CONFIGURE,
+                g_param_spec_boolean("configure", "Configure", "Set up the sensor format and media pipeline on start",
+                                     TRUE, GST_VC_MIPI_SRC_PARAM));
+        g_object_class_install_property(gobject_class, PROP_FORMAT,
+                g_param_spec_string("format", "Format", "Sensor format as in vc-config, e.g. RGGB10 or GREY "
+                                    "(default: keep)", NULL, GST_VC_MIPI_SRC_PARAM));
+        g_object_class_install_property(gobject_class, PROP_PACKED,
+                g_param_spec_boolean("packed", "Packed", "Capture CSI-2 packed lines instead of 16 bit containers",
+                                     FALSE, GST_VC_MIPI_SRC_PARAM));
+        g_object_class_install_property(gobject_class, PROP_ROI,
+                g_param_spec_string("roi", "ROI", "Sensor crop window WxH+L+T (default: keep)",
+                                    NULL, GST_VC_MIPI_SRC_PARAM));
+        g_object_class_install_property(gobject_class, PROP_BINNING,
+                g_param_spec_int("binning", "Binning", "Binning mode, see docs/binning_mode.md (-1: keep)",
+                                 -1, G_MAXINT, -1, GST_VC_MIPI_SRC_PARAM));
+        g_object_class_install_property(gobject_class, PROP_TRIGGER_MODE,
+                g_param_spec_enum("trigger-mode", "Trigger mode", "Trigger mode, see docs/trigger_mode.md",
+                                  GST_TYPE_VC_MIPI_TRIGGER_MODE, -1, GST_VC_MIPI_SRC_PARAM_LIVE));
+        g_object_class_install_property(gobject_class, PROP_IO_MODE,
+                g_param_spec_enum("io-mode", "I/O mode", "Flash and trigger I/O mode, see docs/io_mode.md",
+                                  GST_TYPE_VC_MIPI_IO_MODE, -1, GST_VC_MIPI_SRC_PARAM_LIVE));
+        g_object_class_install_property(gobject_class, PROP_FRAME_RATE,
+                g_param_spec_double("frame-rate", "Frame rate", "Frame rate in Hz, 0 is the sensor maximum "
+                                    "(-1: keep)", -1, 10000, -1, GST_VC_MIPI_SRC_PARAM_LIVE));
+        g_object_class_install_property(gobject_class, PROP_EXPOSURE,
+                g_param_spec_int("exposure", "Exposure", "Exposure time in us (-1: keep)",
+                                 -1, G_MAXINT, -1, GST_VC_MIPI_SRC_PARAM_LIVE));
+        g_object_class_install_property(gobject_class, PROP_GAIN,
+                g_param_spec_int("gain", "Gain", "Analogue gain in mdB (-1: keep)",
+                                 -1, G_MAXINT, -1, GST_VC_MIPI_SRC_PARAM_LIVE));
+        g_object_class_install_property(gobject_class, PROP_BLACK_LEVEL,
+                g_param_spec_int("black-level", "Black level", "Black level (-1: keep)",
+                                 -1, G_MAXINT, -1, GST_VC_MIPI_SRC_PARAM_LIVE));
+        g_object_class_install_property(gobject_class, PROP_BUFFERS,
+                g_param_spec_uint("buffers", "Buffers", "Number of capture buffers",
+                                  2, VC_MIPI_SRC_MAX_BUFFERS, 4, GST_VC_MIPI_SRC_PARAM));
+        g_object_class_install_property(gobject_class, PROP_DMABUF,
+                g_param_spec_boolean("dmabuf", "DMABUF", "Push the capture buffers as DMABUF, otherwise copy",
+                                     TRUE, GST_VC_MIPI_SRC_PARAM));
+
+        gst_vc_mipi_src_signals[SIGNAL_SINGLE_TRIGGER] =
+                g_signal_new_class_handler("single-trigger", G_TYPE_FROM_CLASS(klass),
+                                           G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+                                           G_CALLBACK(gst_vc_mipi_src_single_trigger), NULL, NULL, NULL,
+                                           G_TYPE_BOOLEAN, 0);
+
+        gst_element_class_set_static_metadata(element_class, "VC MIPI camera source", "Source/Video/Hardware",
+                                              "Captures from VC MIPI cameras with sensor controls and DMABUF output",
+                                              "Vision Components");
+        gst_element_class_add_static_pad_template(element_class, &gst_vc_mipi_src_template);
+
+        basesrc_class->start = GST_DEBUG_FUNCPTR(gst_vc_mipi_src_start);
+        basesrc_class->stop = GST_DEBUG_FUNCPTR(gst_vc_mipi_src_stop);
+        basesrc_class->get_caps = GST_DEBUG_FUNCPTR(gst_vc_mipi_src_get_caps);
+        basesrc_class->unlock = GST_DEBUG_FUNCPTR(gst_vc_mipi_src_unlock);
+        basesrc_class->unlock_stop = GST_DEBUG_FUNCPTR(gst_vc_mipi_src_unlock_stop);
+        pushsrc_class->create = GST_DEBUG_FUNCPTR(gst_vc_mipi_src_create);
+
+        gst_vc_mipi_src_frame_quark = g_quark_from_static_string("GstVcMipiSrcFrame");
+        gst_type_mark_as_plugin_api(GST_TYPE_VC_MIPI_TRIGGER_MODE, 0);
+        gst_type_mark_as_plugin_api(GST_TYPE_VC_MIPI_IO_MODE, 0);
+}
+
+// --- Plugin ------------------------------------------------------------------
+
+static gboolean plugin_init(GstPlugin *plugin)
+{
+        static const gchar *tags[] = { NULL };
+
+        GST_DEBUG_CATEGORY_INIT(gst_vc_mipi_src_debug, "vcmipisrc", 0, "VC MIPI camera source");
+        gst_meta_register_custom(GST_VC_MIPI_FRAME_META, tags, NULL, NULL, NULL);
+
+        return gst_element_register(plugin, "vcmipisrc", GST_RANK_NONE, GST_TYPE_VC_MIPI_SRC);
+}
+
+GST_PLUGIN_DEFINE(GST_VERSION_MAJOR, GST_VERSION_MINOR, vcmipi, "VC MIPI camera source", plugin_init, VERSION,
+                  "GPL", PACKAGE, "https://github.com/VC-MIPI-modules/vc_mipi_raspi")
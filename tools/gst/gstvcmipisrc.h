@@ -0,0 +1,20 @@
+#ifndef _GST_VC_MIPI_SRC_H
+#define _GST_VC_MIPI_SRC_H
+
+#include <gst/gst.h>
+#include <gst/base/gstpushsrc.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_VC_MIPI_SRC            (gst_vc_mipi_src_get_type())
+G_DECLARE_FINAL_TYPE(GstVcMipiSrc, gst_vc_mipi_src, GST, VC_MIPI_SRC, GstPushSrc)
+
+// Name of the GstCustomMeta attached to every buffer. Its structure holds
+// the sensor controls sampled for the frame as G_TYPE_INT fields
+// (exposure, gain, black-level, frame-rate, binning-mode, live-roi; missing
+// if the sensor does not expose them) and the receiver sequence number.
+#define GST_VC_MIPI_FRAME_META          "GstVcMipiFrameMeta"
+
+G_END_DECLS
+
+#endif // _GST_VC_MIPI_SRC_H
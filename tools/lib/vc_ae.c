@@ -0,0 +1,303 @@
+#include "vc_ae.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vc_pixfmt.h"
+#include "vc_stats.h"
+#include "vc_v4l2.h"
+
+// Samples at or above this 8 bit level count as saturated
+#define VC_AE_SATURATION_LEVEL          250
+// Step down if the ROI is clipped, the mean is useless then
+#define VC_AE_CLIP_RATIO                0.25
+// Gain steps below this only compensate the exposure rounding (~1 %)
+#define VC_AE_GAIN_DEADBAND             100
+
+struct vc_ae {
+        int fd;
+        struct vc_ae_params params;
+        int64_t exposure_min, exposure_max;
+        int64_t gain_min, gain_max;
+        unsigned int settle;
+        struct vc_ae_status status;
+};
+
+enum vc_ae_layout {
+        VC_AE_LAYOUT_8,
+        VC_AE_LAYOUT_10P,
+        VC_AE_LAYOUT_12P,
+        VC_AE_LAYOUT_14P,
+        VC_AE_LAYOUT_16,
+};
+
+// Offset of the byte holding the 8 MSBs of pixel x in a CSI-2 packed line.
+// The packed formats store the MSBs of every pixel first and the LSBs of
+// the group in the trailing byte(s).
+static inline size_t vc_ae_msb_offset(enum vc_ae_layout layout, uint32_t x)
+{
+        switch (layout) {
+        case VC_AE_LAYOUT_10P: return (x >> 2) * 5 + (x & 3);
+        case VC_AE_LAYOUT_12P: return (x >> 1) * 3 + (x & 1);
+        case VC_AE_LAYOUT_14P: return (x >> 2) * 7 + (x & 3);
+        default:               return x;
+        }
+}
+
+int vc_ae_histogram(const struct vc_format *fmt, const void *data, const struct vc_ae_params *params,
+                    uint32_t hist[VC_AE_HIST_BINS])
+{
+        // One histogram per pixel of the 2x2 block, so consecutive increments
+        // never hit the same counter and the loop does not stall on them.
+        uint32_t sub[4][VC_AE_HIST_BINS];
+        const struct vc_pixfmt *pixfmt;
+        enum vc_ae_layout layout;
+        uint32_t x0, x1, y0, y1, x, y, stride;
+        unsigned int shift = 0, i, samples = 0;
+        bool packed;
+
+        pixfmt = vc_pixfmt_from_fourcc(fmt->fourcc, &packed);
+        if (!pixfmt)
+                return -EINVAL;
+
+        if (pixfmt->bits == 8) {
+                layout = VC_AE_LAYOUT_8;
+        } else if (!packed) {
+                layout = VC_AE_LAYOUT_16;
+                shift = pixfmt->bits - 8;
+        } else if (pixfmt->bits == 10) {
+                layout = VC_AE_LAYOUT_10P;
+        } else if (pixfmt->bits == 12) {
+                layout = VC_AE_LAYOUT_12P;
+        } else if (pixfmt->bits == 14) {
+                layout = VC_AE_LAYOUT_14P;
+        } else {
+                return -EINVAL;
+        }
+
+        // Even start and step keep every 2x2 block on one Bayer quad
+        stride = 2 * (params->step ? params->step : 1);
+        x0 = (uint32_t)(params->roi.left * fmt->width) & ~1u;
+        y0 = (uint32_t)(params->roi.top * fmt->height) & ~1u;
+        x1 = x0 + (uint32_t)(params->roi.width * fmt->width);
+        y1 = y0 + (uint32_t)(params->roi.height * fmt->height);
+        if (x1 > fmt->width)
+                x1 = fmt->width;
+        if (y1 > fmt->height)
+                y1 = fmt->height;
+        if (x1 < x0 + 2 || y1 < y0 + 2)
+                return -EINVAL;
+
+        memset(sub, 0, sizeof(sub));
+
+        for (y = y0; y + 1 < y1; y += stride) {
+                const uint8_t *line0 = (const uint8_t *)data + (size_t)y * fmt->bytesperline;
+                const uint8_t *line1 = line0 + fmt->bytesperline;
+
+                if (layout == VC_AE_LAYOUT_16) {
+                        const uint16_t *src0 = (const uint16_t *)line0;
+                        const uint16_t *src1 = (const uint16_t *)line1;
+
+                        for (x = x0; x + 1 < x1; x += stride) {
+                                unsigned int v0 = src0[x] >> shift, v1 = src0[x + 1] >> shift;
+                                unsigned int v2 = src1[x] >> shift, v3 = src1[x + 1] >> shift;
+
+                                sub[0][v0 > 255 ? 255 : v0]++;
+                                sub[1][v1 > 255 ? 255 : v1]++;
+                                sub[2][v2 > 255 ? 255 : v2]++;
+                                sub[3][v3 > 255 ? 255 : v3]++;
+                        }
+                } else {
+                        for (x = x0; x + 1 < x1; x += stride) {
+                                size_t offset0 = vc_ae_msb_offset(layout, x);
+                                size_t offset1 = vc_ae_msb_offset(layout, x + 1);
+
+                                sub[0][line0[offset0]]++;
+                                sub[1][line0[offset1]]++;
+                                sub[2][line1[offset0]]++;
+                                sub[3][line1[offset1]]++;
+                        }
+                }
+                samples += 4 * ((x1 - x0 - 2) / stride + 1);
+        }
+
+        for (i = 0; i < VC_AE_HIST_BINS; i++)
+                hist[i] = sub[0][i] + sub[1][i] + sub[2][i] + sub[3][i];
+
+        return samples;
+}
+
+// --- Control -----------------------------------------------------------------
+
+static double vc_ae_gain_linear(int64_t mdb)
+{
+        return pow(10.0, mdb / 20000.0);
+}
+
+static int64_t vc_ae_clamp(int64_t value, int64_t min, int64_t max)
+{
+        return value < min ? min : value > max ? max : value;
+}
+
+int vc_ae_refresh_limits(struct vc_ae *ae)
+{
+        int ret;
+
+        if (ae->fd < 0) {
+                ae->exposure_min = 1;
+                ae->exposure_max = ae->params.exposure_max;
+                ae->gain_min = 0;
+                ae->gain_max = ae->params.gain_max;
+                return 0;
+        }
+
+        ret = vc_ctrl_query(ae->fd, V4L2_CID_EXPOSURE, &ae->exposure_min, &ae->exposure_max, NULL);
+        if (ret < 0)
+                return ret;
+        ret = vc_ctrl_query(ae->fd, V4L2_CID_ANALOGUE_GAIN, &ae->gain_min, &ae->gain_max, NULL);
+        if (ret < 0)
+                return ret;
+
+        if (ae->params.exposure_max > 0 && ae->params.exposure_max < ae->exposure_max)
+                ae->exposure_max = ae->params.exposure_max;
+        if (ae->params.gain_max > 0 && ae->params.gain_max < ae->gain_max)
+                ae->gain_max = ae->params.gain_max;
+        if (ae->exposure_min < 1)
+                ae->exposure_min = 1;
+
+        return 0;
+}
+
+struct vc_ae *vc_ae_create(int subdev_fd, const struct vc_ae_params *params)
+{
+        struct vc_ae *ae;
+        int ret;
+
+        if (params->target <= 0.0 || params->target >= 1.0 ||
+            params->damping < 0.0 || params->damping >= 1.0 ||
+            (subdev_fd < 0 && params->exposure_max <= 0)) {
+                errno = EINVAL;
+                return NULL;
+        }
+
+        ae = calloc(1, sizeof(*ae));
+        if (!ae)
+                return NULL;
+        ae->fd = subdev_fd;
+        ae->params = *params;
+
+        ret = vc_ae_refresh_limits(ae);
+        if (ret < 0)
+                goto err_free;
+
+        if (ae->fd >= 0) {
+                ret = vc_ctrl_get(ae->fd, V4L2_CID_EXPOSURE, &ae->status.exposure);
+                if (ret == 0)
+                        ret = vc_ctrl_get(ae->fd, V4L2_CID_ANALOGUE_GAIN, &ae->status.gain);
+                if (ret < 0)
+                        goto err_free;
+        } else {
+                ae->status.exposure = ae->exposure_max / 10 > 0 ? ae->exposure_max / 10 : 1;
+                ae->status.gain = ae->gain_min;
+        }
+
+        return ae;
+
+err_free:
+        free(ae);
+        errno = -ret;
+        return NULL;
+}
+
+void vc_ae_destroy(struct vc_ae *ae)
+{
+        free(ae);
+}
+
+const struct vc_ae_status *vc_ae_get_status(const struct vc_ae *ae)
+{
+        return &ae->status;
+}
+
+static int vc_ae_apply(struct vc_ae *ae, int32_t exposure, int32_t gain)
+{
+        static const uint32_t ids[] = { V4L2_CID_EXPOSURE, V4L2_CID_ANALOGUE_GAIN };
+        int32_t values[] = { exposure, gain };
+        int ret;
+
+        if (ae->fd >= 0) {
+                ret = vc_ctrl_set_multi(ae->fd, ids, values, 2);
+                if (ret < 0) {
+                        // The range may have moved (frame rate change), retry next time
+                        vc_ae_refresh_limits(ae);
+                        return ret;
+                }
+        }
+
+        ae->status.exposure = exposure;
+        ae->status.gain = gain;
+        ae->status.updates++;
+        ae->settle = ae->params.settle_frames;
+        return 1;
+}
+
+int vc_ae_process(struct vc_ae *ae, const struct vc_format *fmt, const void *data)
+{
+        struct vc_ae_status *status = &ae->status;
+        uint32_t hist[VC_AE_HIST_BINS];
+        uint64_t start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+        uint64_t sum = 0, saturated = 0;
+        double ratio, total, gain_lin;
+        int64_t exposure, gain;
+        int samples, i, ret = 0;
+
+        samples = vc_ae_histogram(fmt, data, &ae->params, hist);
+        if (samples <= 0) {
+                ret = samples < 0 ? samples : -EINVAL;
+                goto out;
+        }
+
+        for (i = 0; i < VC_AE_HIST_BINS; i++) {
+                sum += (uint64_t)hist[i] * i;
+                if (i >= VC_AE_SATURATION_LEVEL)
+                        saturated += hist[i];
+        }
+        status->mean = (sum + 0.5 * samples) / samples / VC_AE_HIST_BINS;
+        status->saturated = (double)saturated / samples;
+
+        ratio = ae->params.target / (status->mean > 1.0 / 512 ? status->mean : 1.0 / 512);
+        if (status->saturated > ae->params.clip_fraction && ratio > VC_AE_CLIP_RATIO)
+                ratio = VC_AE_CLIP_RATIO;
+        status->converged = fabs(ratio - 1.0) <= ae->params.tolerance &&
+                            status->saturated <= ae->params.clip_fraction;
+
+        // Wait until the last setting shows up in the frames
+        if (ae->settle) {
+                ae->settle--;
+                goto out;
+        }
+        if (status->converged)
+                goto out;
+
+        ratio = pow(ratio, 1.0 - ae->params.damping);
+        total = status->exposure * vc_ae_gain_linear(status->gain) * ratio;
+
+        // Exposure first at minimum gain, the rest with gain
+        exposure = vc_ae_clamp(llround(total / vc_ae_gain_linear(ae->gain_min)),
+                               ae->exposure_min, ae->exposure_max);
+        gain_lin = total / exposure;
+        gain = vc_ae_clamp(llround(20000.0 * log10(gain_lin > 1e-6 ? gain_lin : 1e-6)),
+                           ae->gain_min, ae->gain_max);
+        if (gain < ae->gain_min + VC_AE_GAIN_DEADBAND)
+                gain = ae->gain_min;
+
+        if (exposure != status->exposure || gain != status->gain)
+                ret = vc_ae_apply(ae, exposure, gain);
+
+out:
+        status->process_ns = vc_clock_ns(CLOCK_MONOTONIC) - start_ns;
+        return ret;
+}
@@ -0,0 +1,75 @@
+#ifndef _VC_AE_H
+#define _VC_AE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "vc_capture.h"
+
+// Auto exposure / auto gain for raw pipelines without an ISP
+//
+// Every frame a histogram of the 8 most significant bits is taken from a
+// subsampled region of interest. The exposure and analogue gain of the
+// sensor subdevice are then moved towards the target mean level, exposure
+// first (no noise penalty) and gain only when the exposure range is used
+// up. Gain uses the driver's mdB model, 20000 mdB = 10x (6000 mdB ~ 2x).
+
+#define VC_AE_HIST_BINS                 256
+
+struct vc_ae;
+
+struct vc_ae_params {
+        double target;                  // mean level, fraction of full scale (default 0.25)
+        double tolerance;               // relative dead band around target (default 0.05)
+        double damping;                 // 0 = jump to the estimate, 0.9 = very slow (default 0.3)
+        double clip_fraction;           // max. fraction of saturated samples (default 0.01)
+        unsigned int step;              // sample every step-th 2x2 block (default 8)
+        unsigned int settle_frames;     // frames until a new setting is visible (default 2)
+        struct {                        // region of interest, fractions of the frame
+                double left, top, width, height;
+        } roi;                          // default: centre 100 %
+        int64_t exposure_max;           // user limit in control units, 0 = driver maximum
+        int64_t gain_max;               // user limit in mdB, 0 = driver maximum
+};
+
+#define VC_AE_PARAMS_DEFAULT                                    \
+        {                                                       \
+                .target = 0.25, .tolerance = 0.05,              \
+                .damping = 0.3, .clip_fraction = 0.01,          \
+                .step = 8, .settle_frames = 2,                  \
+                .roi = { 0.0, 0.0, 1.0, 1.0 },                  \
+        }
+
+struct vc_ae_status {
+        double mean;                    // measured mean level, fraction of full scale
+        double saturated;               // fraction of saturated samples
+        int32_t exposure;               // current exposure (control units)
+        int32_t gain;                   // current analogue gain (mdB)
+        bool converged;
+        unsigned int updates;           // number of control writes
+        uint64_t process_ns;            // time spent in the last vc_ae_process()
+};
+
+// Reads the exposure and gain ranges and the current values from the sensor
+// subdevice. With subdev_fd < 0 no controls are written (dry run), the
+// ranges must then be given in 'params' (exposure_max, gain_max).
+struct vc_ae *vc_ae_create(int subdev_fd, const struct vc_ae_params *params);
+void vc_ae_destroy(struct vc_ae *ae);
+
+// Re-reads the control ranges, e.g. after a frame rate change which limits
+// the exposure.
+int vc_ae_refresh_limits(struct vc_ae *ae);
+
+// Meters one frame and updates exposure and gain with a single
+// VIDIOC_S_EXT_CTRLS if needed. Returns 1 if the controls were written, 0 if
+// not, or a negative errno.
+int vc_ae_process(struct vc_ae *ae, const struct vc_format *fmt, const void *data);
+
+const struct vc_ae_status *vc_ae_get_status(const struct vc_ae *ae);
+
+// Histogram of the 8 MSBs of every step-th 2x2 block inside the ROI. Returns
+// the number of samples or a negative errno for unsupported formats.
+int vc_ae_histogram(const struct vc_format *fmt, const void *data, const struct vc_ae_params *params,
+                    uint32_t hist[VC_AE_HIST_BINS]);
+
+#endif // _VC_AE_H
@@ -0,0 +1,189 @@
+#include "vc_bracket.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vc_stats.h"
+#include "vc_v4l2.h"
+
+// Pending writes, more than latency + 1 are never in flight
+#define VC_BRACKET_HISTORY              16
+
+struct vc_bracket_write {
+        uint32_t sequence;              // first frame that shows this entry
+        int entry;
+};
+
+struct vc_bracket {
+        int fd;
+        struct vc_bracket_entry entries[VC_BRACKET_MAX_ENTRIES];
+        unsigned int count;
+        unsigned int latency;
+        struct vc_bracket_write history[VC_BRACKET_HISTORY];
+        unsigned int num_history;
+        int last_entry;
+        uint64_t last_timestamp_ns;
+        uint32_t last_sequence;
+        uint64_t interval_ns;           // 0 until two frames were seen
+        struct vc_bracket_stats stats;
+};
+
+struct vc_bracket *vc_bracket_create(int subdev_fd, const struct vc_bracket_entry *entries,
+                                     unsigned int count, unsigned int latency)
+{
+        struct vc_bracket *bracket;
+
+        if (count < 1 || count > VC_BRACKET_MAX_ENTRIES || latency >= VC_BRACKET_HISTORY) {
+                errno = EINVAL;
+                return NULL;
+        }
+
+        bracket = calloc(1, sizeof(*bracket));
+        if (!bracket)
+                return NULL;
+        bracket->fd = subdev_fd;
+        memcpy(bracket->entries, entries, count * sizeof(*entries));
+        bracket->count = count;
+        bracket->latency = latency;
+        bracket->last_entry = -1;
+
+        return bracket;
+}
+
+void vc_bracket_destroy(struct vc_bracket *bracket)
+{
+        free(bracket);
+}
+
+const struct vc_bracket_stats *vc_bracket_get_stats(const struct vc_bracket *bracket)
+{
+        return &bracket->stats;
+}
+
+// Entry of the latest write that is visible in frame 'sequence'
+static int vc_bracket_lookup(const struct vc_bracket *bracket, uint32_t sequence)
+{
+        const struct vc_bracket_write *best = NULL;
+        unsigned int i;
+
+        for (i = 0; i < bracket->num_history; i++) {
+                const struct vc_bracket_write *write = &bracket->history[i];
+
+                if ((int32_t)(sequence - write->sequence) >= 0 &&
+                    (!best || (int32_t)(write->sequence - best->sequence) > 0))
+                        best = write;
+        }
+        return best ? best->entry : -1;
+}
+
+static void vc_bracket_record(struct vc_bracket *bracket, uint32_t sequence, int entry)
+{
+        unsigned int i, oldest = 0;
+
+        if (bracket->num_history < VC_BRACKET_HISTORY) {
+                bracket->history[bracket->num_history++] = (struct vc_bracket_write){ sequence, entry };
+                return;
+        }
+
+        for (i = 1; i < VC_BRACKET_HISTORY; i++) {
+                if ((int32_t)(bracket->history[i].sequence - bracket->history[oldest].sequence) < 0)
+                        oldest = i;
+        }
+        bracket->history[oldest] = (struct vc_bracket_write){ sequence, entry };
+}
+
+// True if frame N is dequeued so late that frame N + 2 has already started.
+// A setting written now would land a frame after frame N + latency.
+static int vc_bracket_stale(struct vc_bracket *bracket, const struct vc_frame *frame)
+{
+        int32_t frames = (int32_t)(frame->sequence - bracket->last_sequence);
+        uint64_t now_ns = vc_clock_ns(CLOCK_MONOTONIC);
+
+        // Frame interval from the receiver timestamps, across dropped frames
+        if (bracket->last_timestamp_ns && frames > 0 && frame->timestamp_ns > bracket->last_timestamp_ns)
+                bracket->interval_ns = (frame->timestamp_ns - bracket->last_timestamp_ns) / frames;
+        bracket->last_timestamp_ns = frame->timestamp_ns;
+        bracket->last_sequence = frame->sequence;
+
+        return bracket->interval_ns && now_ns > frame->timestamp_ns &&
+               now_ns - frame->timestamp_ns > 2 * bracket->interval_ns;
+}
+
+int vc_bracket_process(struct vc_bracket *bracket, struct vc_frame *frame)
+{
+        static const uint32_t ids[] = { V4L2_CID_EXPOSURE, V4L2_CID_ANALOGUE_GAIN };
+        uint32_t target = frame->sequence + bracket->latency;
+        int entry, next = target % bracket->count;
+        int ret = 0;
+
+        entry = vc_bracket_lookup(bracket, frame->sequence);
+
+        // Replay (no subdev) has old timestamps, there is nothing to be late for
+        if (bracket->fd >= 0 && vc_bracket_stale(bracket, frame)) {
+                // Writes in flight may land a frame late too, untag until resynced
+                bracket->stats.stale++;
+                bracket->num_history = 0;
+        } else {
+                if (bracket->fd >= 0) {
+                        int32_t values[] = { bracket->entries[next].exposure, bracket->entries[next].gain };
+
+                        ret = vc_ctrl_set_multi(bracket->fd, ids, values, 2);
+                }
+                bracket->stats.writes++;
+                if (ret < 0)
+                        bracket->stats.write_errors++;
+                else
+                        vc_bracket_record(bracket, target, next);
+        }
+
+        bracket->stats.frames++;
+        if (entry < 0) {
+                // The values read at dequeue belong to some other frame
+                bracket->stats.untagged++;
+                frame->ctrls.exposure = VC_CTRL_UNAVAILABLE;
+                frame->ctrls.gain = VC_CTRL_UNAVAILABLE;
+                frame->ctrls.bracket = VC_CTRL_UNAVAILABLE;
+        } else {
+                if (entry == bracket->last_entry)
+                        bracket->stats.repeated++;
+                frame->ctrls.exposure = bracket->entries[entry].exposure;
+                frame->ctrls.gain = bracket->entries[entry].gain;
+                frame->ctrls.bracket = entry;
+        }
+        bracket->last_entry = entry;
+
+        return entry;
+}
+
+int vc_bracket_parse(const char *str, struct vc_bracket_entry *entries, unsigned int max)
+{
+        unsigned int count = 0;
+        char *end;
+
+        while (*str) {
+                if (count == max)
+                        return -EINVAL;
+
+                entries[count].exposure = strtol(str, &end, 0);
+                if (end == str || entries[count].exposure <= 0)
+                        return -EINVAL;
+                entries[count].gain = 0;
+                str = end;
+                if (*str == ':') {
+                        entries[count].gain = strtol(++str, &end, 0);
+                        if (end == str)
+                                return -EINVAL;
+                        str = end;
+                }
+                count++;
+
+                if (*str == ',')
+                        str++;
+                else if (*str)
+                        return -EINVAL;
+        }
+
+        return count ? (int)count : -EINVAL;
+}
@@ -0,0 +1,62 @@
+#ifndef _VC_BRACKET_H
+#define _VC_BRACKET_H
+
+#include <stdint.h>
+
+#include "vc_capture.h"
+
+// Exposure bracketing at the sensor's frame rate
+//
+// The sensors latch exposure and gain at the frame boundary and apply them a
+// fixed number of frames later. Writing the setting for frame N + latency
+// while frame N is dequeued therefore gives every frame its own setting
+// without losing frames. The entries are cycled in order and every frame is
+// tagged with the entry it was exposed with.
+//
+// That only holds if the write lands before the next frame boundary. A frame
+// dequeued more than one frame interval after its end (timestamp + interval)
+// is stale: the write would take effect a frame late. Its write is skipped,
+// the pending writes are dropped and the following frames stay untagged until
+// a write made in time is visible. Tags are only valid when stats.stale is 0.
+//
+// Untagged frames get VC_CTRL_UNAVAILABLE for exposure, gain and bracket: the
+// values read at dequeue time don't belong to them.
+
+#define VC_BRACKET_MAX_ENTRIES          4
+#define VC_BRACKET_LATENCY_DEFAULT      2
+
+struct vc_bracket;
+
+struct vc_bracket_entry {
+        int32_t exposure;               // control units (us, lines with libcamera)
+        int32_t gain;                   // mdB
+};
+
+struct vc_bracket_stats {
+        unsigned int frames;            // frames tagged
+        unsigned int untagged;          // frames before the first setting took effect
+        unsigned int repeated;          // frames with the same entry as their predecessor
+        unsigned int writes;            // VIDIOC_S_EXT_CTRLS calls
+        unsigned int write_errors;
+        unsigned int stale;             // frames dequeued too late, writes skipped
+};
+
+// With subdev_fd < 0 no controls are written (dry run, e.g. for replay).
+// 'latency' is the number of frames until a written setting is visible.
+struct vc_bracket *vc_bracket_create(int subdev_fd, const struct vc_bracket_entry *entries,
+                                     unsigned int count, unsigned int latency);
+void vc_bracket_destroy(struct vc_bracket *bracket);
+
+// Call once per dequeued frame, in sequence order. Writes the setting for
+// frame sequence + latency and stores the entry this frame was exposed with
+// and its index in frame->ctrls. Returns the entry index or -1 if it is not
+// known yet.
+int vc_bracket_process(struct vc_bracket *bracket, struct vc_frame *frame);
+
+const struct vc_bracket_stats *vc_bracket_get_stats(const struct vc_bracket *bracket);
+
+// Parses "exposure:gain,exposure:gain,..." (gain optional, default 0).
+// Returns the number of entries or -EINVAL.
+int vc_bracket_parse(const char *str, struct vc_bracket_entry *entries, unsigned int max);
+
+#endif // _VC_BRACKET_H
@@ -0,0 +1,288 @@
+#include "vc_burst.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "vc_v4l2.h"
+
+// Values of the trigger_mode menu in vc_mipi_camera
+#define VC_TRIGGER_OFF                  0
+#define VC_TRIGGER_EXTERNAL             1
+#define VC_TRIGGER_SINGLE               4
+#define VC_TRIGGER_STREAM_EDGE          6
+#define VC_TRIGGER_STREAM_LEVEL         7
+
+static const struct {
+        const char *name;
+        int32_t mode;
+} vc_burst_triggers[] = {
+        [VC_BURST_SOFTWARE]     = { "software", VC_TRIGGER_OFF },
+        [VC_BURST_SINGLE]       = { "single",   VC_TRIGGER_SINGLE },
+        [VC_BURST_EXTERNAL]     = { "external", VC_TRIGGER_EXTERNAL },
+        [VC_BURST_STREAM_EDGE]  = { "edge",     VC_TRIGGER_STREAM_EDGE },
+        [VC_BURST_STREAM_LEVEL] = { "level",    VC_TRIGGER_STREAM_LEVEL },
+};
+
+#define VC_BURST_NUM_TRIGGERS   (sizeof(vc_burst_triggers) / sizeof(vc_burst_triggers[0]))
+
+struct vc_burst {
+        struct vc_capture *cap;
+        int fd;
+        struct vc_burst_params params;
+
+        uint8_t *memory;
+        size_t memory_size;
+        size_t slot_size;
+        struct vc_frame *frames;
+
+        // Sensor settings before the burst, restored by vc_burst_destroy()
+        int32_t trigger_mode;
+        int32_t frame_rate;
+        bool have_trigger_mode;
+        bool have_frame_rate;
+
+        bool armed;
+        struct vc_burst_result result;
+};
+
+// --- Setup -------------------------------------------------------------------
+
+struct vc_burst *vc_burst_create(struct vc_capture *cap, int subdev_fd, const struct vc_burst_params *params)
+{
+        struct vc_burst *burst;
+        struct vc_format fmt;
+        int ret;
+
+        vc_capture_get_format(cap, &fmt);
+        if (params->frames == 0 || fmt.sizeimage == 0 ||
+            (subdev_fd < 0 && params->trigger != VC_BURST_SOFTWARE) ||
+            (unsigned int)params->trigger >= VC_BURST_NUM_TRIGGERS) {
+                errno = EINVAL;
+                return NULL;
+        }
+
+        burst = calloc(1, sizeof(*burst));
+        if (!burst)
+                return NULL;
+        burst->cap = cap;
+        burst->fd = subdev_fd;
+        burst->params = *params;
+
+        burst->frames = calloc(params->frames, sizeof(*burst->frames));
+        if (!burst->frames) {
+                ret = -ENOMEM;
+                goto err_free;
+        }
+
+        // Faulted in now, locked if the limits allow it, so the copies
+        // during the burst never wait for the page allocator
+        burst->slot_size = fmt.sizeimage;
+        burst->memory_size = (size_t)params->frames * burst->slot_size;
+        burst->memory = mmap(NULL, burst->memory_size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (burst->memory == MAP_FAILED) {
+                burst->memory = NULL;
+                ret = -errno;
+                goto err_free;
+        }
+        mlock(burst->memory, burst->memory_size);
+
+        if (subdev_fd >= 0) {
+                burst->have_trigger_mode = vc_ctrl_get(subdev_fd, V4L2_CID_VC_TRIGGER_MODE,
+                                                       &burst->trigger_mode) == 0;
+                burst->have_frame_rate = vc_ctrl_get(subdev_fd, V4L2_CID_VC_FRAME_RATE,
+                                                     &burst->frame_rate) == 0;
+                if (params->trigger != VC_BURST_SOFTWARE && !burst->have_trigger_mode) {
+                        ret = -ENOTSUP;
+                        goto err_unmap;
+                }
+        }
+
+        return burst;
+
+err_unmap:
+        munmap(burst->memory, burst->memory_size);
+err_free:
+        free(burst->frames);
+        free(burst);
+        errno = -ret;
+        return NULL;
+}
+
+void vc_burst_destroy(struct vc_burst *burst)
+{
+        if (!burst)
+                return;
+
+        vc_capture_stop(burst->cap);
+        if (burst->fd >= 0) {
+                if (burst->have_trigger_mode)
+                        vc_ctrl_set(burst->fd, V4L2_CID_VC_TRIGGER_MODE, burst->trigger_mode);
+                if (burst->have_frame_rate && burst->params.max_rate)
+                        vc_ctrl_set(burst->fd, V4L2_CID_VC_FRAME_RATE, burst->frame_rate);
+        }
+        munmap(burst->memory, burst->memory_size);
+        free(burst->frames);
+        free(burst);
+}
+
+int vc_burst_parse_trigger(const char *str)
+{
+        unsigned int i;
+
+        for (i = 0; i < VC_BURST_NUM_TRIGGERS; i++)
+                if (strcmp(str, vc_burst_triggers[i].name) == 0)
+                        return i;
+        return -EINVAL;
+}
+
+const char *vc_burst_trigger_name(enum vc_burst_trigger trigger)
+{
+        return (unsigned int)trigger < VC_BURST_NUM_TRIGGERS ? vc_burst_triggers[trigger].name : "unknown";
+}
+
+// --- Burst -------------------------------------------------------------------
+
+int vc_burst_arm(struct vc_burst *burst)
+{
+        const struct vc_burst_params *params = &burst->params;
+        int ret;
+
+        if (burst->armed)
+                return 0;
+
+        if (burst->fd >= 0) {
+                if (burst->have_trigger_mode &&
+                    burst->trigger_mode != vc_burst_triggers[params->trigger].mode) {
+                        ret = vc_ctrl_set(burst->fd, V4L2_CID_VC_TRIGGER_MODE,
+                                          vc_burst_triggers[params->trigger].mode);
+                        if (ret < 0)
+                                return ret;
+                }
+                // 0 selects the maximum frame rate when the stream starts
+                if (params->max_rate && burst->have_frame_rate) {
+                        ret = vc_ctrl_set(burst->fd, V4L2_CID_VC_FRAME_RATE, 0);
+                        if (ret < 0)
+                                return ret;
+                }
+        }
+
+        memset(&burst->result, 0, sizeof(burst->result));
+        vc_hist_reset(&burst->result.interval);
+
+        if (params->trigger != VC_BURST_SOFTWARE) {
+                ret = vc_capture_start(burst->cap);
+                if (ret < 0)
+                        return ret;
+        }
+
+        burst->armed = true;
+        return 0;
+}
+
+static int vc_burst_fire(struct vc_burst *burst)
+{
+        switch (burst->params.trigger) {
+        case VC_BURST_SOFTWARE:
+                return vc_capture_start(burst->cap);
+        case VC_BURST_SINGLE:
+                return vc_ctrl_set(burst->fd, V4L2_CID_VC_SINGLE_TRIGGER, 1);
+        default:
+                return 0;
+        }
+}
+
+// Copies a frame into its slot, the capture buffer is released by the caller
+static void vc_burst_store(struct vc_burst *burst, const struct vc_frame *frame)
+{
+        struct vc_burst_result *result = &burst->result;
+        struct vc_frame *slot = &burst->frames[result->frames];
+        uint8_t *data = burst->memory + result->frames * burst->slot_size;
+        size_t size = frame->bytesused < burst->slot_size ? frame->bytesused : burst->slot_size;
+        uint64_t start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+
+        memcpy(data, frame->data, size);
+        start_ns = vc_clock_ns(CLOCK_MONOTONIC) - start_ns;
+        if (start_ns > result->copy_max_ns)
+                result->copy_max_ns = start_ns;
+
+        *slot = *frame;
+        slot->data = data;
+        slot->bytesused = size;
+
+        if (frame->flags & V4L2_BUF_FLAG_ERROR)
+                result->errors++;
+        if (result->frames > 0) {
+                const struct vc_frame *prev = slot - 1;
+
+                if (frame->sequence > prev->sequence + 1)
+                        result->dropped += frame->sequence - prev->sequence - 1;
+                if (frame->timestamp_ns > prev->timestamp_ns)
+                        vc_hist_add(&result->interval, frame->timestamp_ns - prev->timestamp_ns);
+        }
+        result->frames++;
+}
+
+int vc_burst_capture(struct vc_burst *burst, int first_timeout_ms)
+{
+        const struct vc_burst_params *params = &burst->params;
+        struct vc_burst_result *result = &burst->result;
+        struct vc_ctrl_state ctrls;
+        struct vc_frame frame;
+        uint64_t fire_ns;
+        unsigned int i;
+        int ret;
+
+        ret = vc_burst_arm(burst);
+        if (ret < 0)
+                return ret;
+
+        fire_ns = vc_clock_ns(CLOCK_MONOTONIC);
+        ret = vc_burst_fire(burst);
+
+        while (ret == 0 && result->frames < params->frames) {
+                ret = vc_capture_dequeue(burst->cap, &frame,
+                                         result->frames ? params->frame_timeout_ms : first_timeout_ms);
+                if (ret < 0)
+                        break;
+
+                vc_burst_store(burst, &frame);
+                ret = vc_capture_release(burst->cap, &frame);
+                if (ret == 0 && params->trigger == VC_BURST_SINGLE && result->frames < params->frames)
+                        ret = vc_burst_fire(burst);
+        }
+
+        // The settings did not change during the burst, one read for all frames
+        if (burst->fd >= 0 && vc_ctrl_read_state(burst->fd, &ctrls) == 0)
+                for (i = 0; i < result->frames; i++)
+                        burst->frames[i].ctrls = ctrls;
+
+        vc_capture_stop(burst->cap);
+        burst->armed = false;
+
+        if (result->frames > 0) {
+                const struct vc_frame *first = &burst->frames[0];
+                const struct vc_frame *last = &burst->frames[result->frames - 1];
+
+                if (last->timestamp_ns > first->timestamp_ns)
+                        result->fps = (result->frames - 1) * 1e9 / (double)(last->timestamp_ns - first->timestamp_ns);
+                if ((params->trigger == VC_BURST_SOFTWARE || params->trigger == VC_BURST_SINGLE) &&
+                    first->timestamp_ns > fire_ns)
+                        result->start_latency_ns = first->timestamp_ns - fire_ns;
+        }
+
+        return ret < 0 ? ret : (int)result->frames;
+}
+
+const struct vc_frame *vc_burst_get_frame(const struct vc_burst *burst, unsigned int index)
+{
+        return index < burst->result.frames ? &burst->frames[index] : NULL;
+}
+
+const struct vc_burst_result *vc_burst_get_result(const struct vc_burst *burst)
+{
+        return &burst->result;
+}
@@ -0,0 +1,95 @@
+#ifndef _VC_BURST_H
+#define _VC_BURST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "vc_capture.h"
+#include "vc_stats.h"
+
+// Burst capture into preallocated memory
+//
+// A burst is a fixed number of consecutive frames, usually at a frame rate
+// the consumer can not process live. The memory for all frames is allocated
+// and faulted in before the burst. During the burst every frame is only
+// copied into its slot and the capture buffer is queued again at once, so
+// the capture buffers only have to cover the scheduling jitter. After the
+// last frame the stream is stopped and the frames are handed over.
+//
+// The burst starts on a software or hardware trigger (trigger_mode):
+//
+//   - VC_BURST_SOFTWARE: free-running (Off), vc_burst_capture() starts the
+//     stream
+//   - VC_BURST_SINGLE: Single, vc_burst_capture() fires single_trigger for
+//     the first frame and again as soon as each frame arrived
+//   - VC_BURST_EXTERNAL: External, one frame per trigger pulse
+//   - VC_BURST_STREAM_EDGE, VC_BURST_STREAM_LEVEL: Stream Edge / Level, the
+//     sensor streams after the edge / while the trigger input is active
+//
+// For all but VC_BURST_SOFTWARE, vc_burst_arm() starts the stream and the
+// sensor waits for its trigger.
+
+enum vc_burst_trigger {
+        VC_BURST_SOFTWARE,
+        VC_BURST_SINGLE,
+        VC_BURST_EXTERNAL,
+        VC_BURST_STREAM_EDGE,
+        VC_BURST_STREAM_LEVEL,
+};
+
+struct vc_burst;
+
+struct vc_burst_params {
+        unsigned int frames;            // frames in the burst (default 100)
+        enum vc_burst_trigger trigger;  // (default VC_BURST_SOFTWARE)
+        bool max_rate;                  // frame_rate 0, the maximum of the ROI (default true)
+        int frame_timeout_ms;           // between two frames of the burst (default 1000)
+};
+
+#define VC_BURST_PARAMS_DEFAULT                                         \
+        {                                                               \
+                .frames = 100, .trigger = VC_BURST_SOFTWARE,            \
+                .max_rate = true, .frame_timeout_ms = 1000,             \
+        }
+
+struct vc_burst_result {
+        unsigned int frames;            // captured, less than requested after a timeout
+        unsigned int dropped;           // sequence gaps within the burst
+        unsigned int errors;            // frames flagged V4L2_BUF_FLAG_ERROR
+        double fps;                     // from the first and last frame timestamp
+        struct vc_histogram interval;   // between consecutive frame timestamps
+        uint64_t start_latency_ns;      // software trigger to first frame, 0 for hardware triggers
+        uint64_t copy_max_ns;           // longest copy into the burst memory
+};
+
+// 'cap' is opened with the capture buffers for the burst and not started.
+// Open it without a subdevice, the sensor controls are read once per burst
+// from 'subdev_fd' instead of per frame. Without a subdevice (-1) only
+// VC_BURST_SOFTWARE is possible and the trigger mode and frame rate are left
+// as they are. Allocates frames x sizeimage bytes.
+struct vc_burst *vc_burst_create(struct vc_capture *cap, int subdev_fd, const struct vc_burst_params *params);
+
+// Stops the stream and restores the trigger mode and frame rate.
+void vc_burst_destroy(struct vc_burst *burst);
+
+// Sets trigger mode and frame rate and, for the triggered modes, starts the
+// stream. vc_burst_capture() arms the burst itself if needed.
+int vc_burst_arm(struct vc_burst *burst);
+
+// Fires the software trigger and captures the burst. first_timeout_ms (-1
+// forever) is the wait for the first frame, e.g. for the hardware trigger.
+// The stream is stopped afterwards. Returns the number of frames or a
+// negative errno, the frames captured up to an error are kept.
+int vc_burst_capture(struct vc_burst *burst, int first_timeout_ms);
+
+// Frames of the last burst, data points into the burst memory. The sensor
+// controls are read at the end of the burst. NULL beyond the last frame.
+const struct vc_frame *vc_burst_get_frame(const struct vc_burst *burst, unsigned int index);
+const struct vc_burst_result *vc_burst_get_result(const struct vc_burst *burst);
+
+// Parses "software", "single", "external", "edge" or "level". Returns the
+// trigger or -EINVAL.
+int vc_burst_parse_trigger(const char *str);
+const char *vc_burst_trigger_name(enum vc_burst_trigger trigger);
+
+#endif // _VC_BURST_H
@@ -0,0 +1,560 @@
+#include "vc_capture_priv.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// --- V4L2 buffers ------------------------------------------------------------
+
+static int vc_capture_map_buffers(struct vc_capture *cap, unsigned int count)
+{
+        struct v4l2_requestbuffers req = {
+                .count = count,
+                .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+                .memory = V4L2_MEMORY_MMAP,
+        };
+        unsigned int i;
+        int ret;
+
+        ret = vc_xioctl(cap->fd, VIDIOC_REQBUFS, &req);
+        if (ret < 0)
+                return ret;
+        if (req.count == 0)
+                return -ENOMEM;
+        if (req.count > VC_CAPTURE_MAX_BUFFERS)
+                req.count = VC_CAPTURE_MAX_BUFFERS;
+
+        for (i = 0; i < req.count; i++) {
+                struct v4l2_buffer buf = {
+                        .index = i,
+                        .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+                        .memory = V4L2_MEMORY_MMAP,
+                };
+
+                ret = vc_xioctl(cap->fd, VIDIOC_QUERYBUF, &buf);
+                if (ret < 0)
+                        return ret;
+
+                cap->buffers[i].length = buf.length;
+                cap->buffers[i].start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED, cap->fd, buf.m.offset);
+                if (cap->buffers[i].start == MAP_FAILED) {
+                        cap->buffers[i].start = NULL;
+                        return -errno;
+                }
+                cap->num_buffers++;
+        }
+
+        return 0;
+}
+
+static void vc_capture_unmap_buffers(struct vc_capture *cap)
+{
+        struct v4l2_requestbuffers req = {
+                .count = 0,
+                .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+                .memory = V4L2_MEMORY_MMAP,
+        };
+        unsigned int i;
+
+        for (i = 0; i < cap->num_buffers; i++)
+                munmap(cap->buffers[i].start, cap->buffers[i].length);
+        cap->num_buffers = 0;
+
+        vc_xioctl(cap->fd, VIDIOC_REQBUFS, &req);
+}
+
+static int vc_capture_queue(struct vc_capture *cap, unsigned int index)
+{
+        struct v4l2_buffer buf = {
+                .index = index,
+                .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+                .memory = V4L2_MEMORY_MMAP,
+        };
+
+        return vc_xioctl(cap->fd, VIDIOC_QBUF, &buf);
+}
+
+// --- V4L2 backend ------------------------------------------------------------
+
+static int vc_v4l2_start(struct vc_capture *cap)
+{
+        int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        unsigned int i;
+        int ret;
+
+        for (i = 0; i < cap->num_buffers; i++) {
+                ret = vc_capture_queue(cap, i);
+                if (ret < 0)
+                        return ret;
+        }
+
+        return vc_xioctl(cap->fd, VIDIOC_STREAMON, &type);
+}
+
+static int vc_v4l2_stop(struct vc_capture *cap)
+{
+        int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+        return vc_xioctl(cap->fd, VIDIOC_STREAMOFF, &type);
+}
+
+static int vc_v4l2_dequeue(struct vc_capture *cap, struct vc_frame *frame, int timeout_ms)
+{
+        struct v4l2_buffer buf = {
+                .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+                .memory = V4L2_MEMORY_MMAP,
+        };
+        struct pollfd pfd = { .fd = cap->fd, .events = POLLIN };
+        int ret;
+
+        for (;;) {
+                ret = vc_xioctl(cap->fd, VIDIOC_DQBUF, &buf);
+                if (ret != -EAGAIN)
+                        break;
+
+                ret = poll(&pfd, 1, timeout_ms);
+                if (ret < 0 && errno != EINTR)
+                        return -errno;
+                if (ret == 0)
+                        return -ETIMEDOUT;
+        }
+        if (ret < 0)
+                return ret;
+
+        frame->data = cap->buffers[buf.index].start;
+        frame->bytesused = buf.bytesused;
+        frame->index = buf.index;
+        frame->sequence = buf.sequence;
+        frame->timestamp_ns = (uint64_t)buf.timestamp.tv_sec * 1000000000ULL +
+                              (uint64_t)buf.timestamp.tv_usec * 1000ULL;
+        frame->flags = buf.flags;
+
+        if (cap->subdev_fd >= 0)
+                vc_ctrl_read_state(cap->subdev_fd, &frame->ctrls);
+        else {
+                memset(&frame->ctrls, 0, sizeof(frame->ctrls));
+                frame->ctrls.bracket = VC_CTRL_UNAVAILABLE;
+        }
+
+        return 0;
+}
+
+static int vc_v4l2_release(struct vc_capture *cap, const struct vc_frame *frame)
+{
+        return vc_capture_queue(cap, frame->index);
+}
+
+static int vc_v4l2_export(struct vc_capture *cap, int *fds, size_t *lengths, unsigned int max)
+{
+        unsigned int i;
+        int ret;
+
+        if (cap->num_buffers > max)
+                return -ENOSPC;
+
+        for (i = 0; i < cap->num_buffers; i++) {
+                struct v4l2_exportbuffer exp = {
+                        .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+                        .index = i,
+                        .flags = O_RDONLY | O_CLOEXEC,
+                };
+
+                ret = vc_xioctl(cap->fd, VIDIOC_EXPBUF, &exp);
+                if (ret < 0) {
+                        while (i--)
+                                close(fds[i]);
+                        return ret;
+                }
+                fds[i] = exp.fd;
+                lengths[i] = cap->buffers[i].length;
+        }
+
+        return cap->num_buffers;
+}
+
+static void vc_v4l2_close(struct vc_capture *cap)
+{
+        vc_capture_unmap_buffers(cap);
+        if (cap->subdev_fd >= 0)
+                close(cap->subdev_fd);
+        close(cap->fd);
+}
+
+static const struct vc_capture_ops vc_v4l2_ops = {
+        .start = vc_v4l2_start,
+        .stop = vc_v4l2_stop,
+        .dequeue = vc_v4l2_dequeue,
+        .release = vc_v4l2_release,
+        .close = vc_v4l2_close,
+        .export = vc_v4l2_export,
+};
+
+// --- Stream recovery ---------------------------------------------------------
+
+static uint64_t vc_recovery_timeout_ns(struct vc_capture *cap)
+{
+        const struct vc_recovery_params *params = &cap->recovery;
+        uint64_t timeout_ns;
+
+        if (params->timeout_periods == 0)
+                return UINT64_MAX;
+        if (cap->frame_period_ns == 0)
+                return params->first_frame_ms * 1000000ull;
+
+        timeout_ns = params->timeout_periods * cap->frame_period_ns;
+        if (timeout_ns < params->timeout_min_ms * 1000000ull)
+                timeout_ns = params->timeout_min_ms * 1000000ull;
+        return timeout_ns;
+}
+
+static int vc_recovery_restart(struct vc_capture *cap, uint64_t now_ns)
+{
+        int ret;
+
+        if (cap->restart_run >= cap->recovery.max_restarts)
+                return -EPIPE;
+
+        ret = vc_ctrl_set(cap->recovery_fd, V4L2_CID_VC_RESTART_STREAM, 0);
+        if (ret < 0)
+                return ret;
+
+        cap->stats.restarts++;
+        cap->restart_run++;
+        if (!cap->restart_ns)
+                cap->restart_ns = now_ns;
+        cap->last_frame_ns = now_ns;
+        cap->good_timestamp_ns = 0;
+        cap->error_run = 0;
+        return 0;
+}
+
+// Waits like the backend, but restarts the sensor each time the recovery
+// timeout expires before the caller's timeout.
+static int vc_recovery_dequeue(struct vc_capture *cap, struct vc_frame *frame, int timeout_ms)
+{
+        uint64_t now_ns = vc_clock_ns(CLOCK_MONOTONIC);
+        uint64_t deadline_ns = timeout_ms < 0 ? UINT64_MAX : now_ns + timeout_ms * 1000000ull;
+        int ret;
+
+        if (cap->recovery_error) {
+                ret = cap->recovery_error;
+                cap->recovery_error = 0;
+                return ret;
+        }
+
+        for (;;) {
+                uint64_t timeout_ns = vc_recovery_timeout_ns(cap);
+                uint64_t expire_ns = timeout_ns == UINT64_MAX ? UINT64_MAX : cap->last_frame_ns + timeout_ns;
+                uint64_t until_ns = expire_ns < deadline_ns ? expire_ns : deadline_ns;
+                uint64_t wait_ms = until_ns > now_ns ? (until_ns - now_ns + 999999) / 1000000 : 0;
+
+                ret = cap->ops->dequeue(cap, frame, until_ns == UINT64_MAX ? -1 :
+                                        wait_ms > INT_MAX ? INT_MAX : (int)wait_ms);
+                if (ret != -ETIMEDOUT)
+                        return ret;
+
+                now_ns = vc_clock_ns(CLOCK_MONOTONIC);
+                if (now_ns >= expire_ns) {
+                        cap->stats.timeouts++;
+                        ret = vc_recovery_restart(cap, now_ns);
+                        if (ret < 0)
+                                return ret;
+                }
+                if (now_ns >= deadline_ns)
+                        return -ETIMEDOUT;
+        }
+}
+
+static void vc_recovery_frame(struct vc_capture *cap, const struct vc_frame *frame, uint64_t now_ns)
+{
+        uint64_t period_ns;
+
+        cap->last_frame_ns = now_ns;
+
+        if (frame->flags & V4L2_BUF_FLAG_ERROR) {
+                if (cap->recovery.error_frames && ++cap->error_run >= cap->recovery.error_frames)
+                        cap->recovery_error = vc_recovery_restart(cap, now_ns);
+                return;
+        }
+
+        // Frame period from the receiver timestamps, not across a restart
+        if (cap->good_timestamp_ns && frame->timestamp_ns > cap->good_timestamp_ns &&
+            frame->sequence > cap->good_sequence) {
+                period_ns = (frame->timestamp_ns - cap->good_timestamp_ns) /
+                            (frame->sequence - cap->good_sequence);
+                cap->frame_period_ns = cap->frame_period_ns ? (7 * cap->frame_period_ns + period_ns) / 8
+                                                            : period_ns;
+        }
+        cap->good_timestamp_ns = frame->timestamp_ns;
+        cap->good_sequence = frame->sequence;
+
+        if (cap->restart_ns) {
+                vc_hist_add(&cap->stats.recovery, now_ns - cap->restart_ns);
+                cap->restart_ns = 0;
+        }
+        cap->restart_run = 0;
+        cap->error_run = 0;
+}
+
+static void vc_recovery_reset(struct vc_capture *cap)
+{
+        cap->recovery_error = 0;
+        cap->last_frame_ns = vc_clock_ns(CLOCK_MONOTONIC);
+        cap->frame_period_ns = 0;
+        cap->good_timestamp_ns = 0;
+        cap->restart_ns = 0;
+        cap->error_run = 0;
+        cap->restart_run = 0;
+}
+
+// --- Public API --------------------------------------------------------------
+
+struct vc_capture *vc_capture_alloc(const struct vc_capture_ops *ops)
+{
+        struct vc_capture *cap;
+
+        cap = calloc(1, sizeof(*cap));
+        if (!cap)
+                return NULL;
+
+        cap->ops = ops;
+        cap->fd = -1;
+        cap->subdev_fd = -1;
+        cap->recovery_fd = -1;
+        vc_capture_reset_stats(cap);
+        return cap;
+}
+
+struct vc_capture *vc_capture_open(const char *device, const char *subdev, unsigned int buffers)
+{
+        struct v4l2_format format = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+        struct vc_capture *cap;
+        int ret;
+
+        if (strncmp(device, VC_CAPTURE_REPLAY_PREFIX, strlen(VC_CAPTURE_REPLAY_PREFIX)) == 0) {
+                const struct vc_replay_params params = VC_REPLAY_PARAMS_DEFAULT;
+
+                return vc_capture_open_replay(device + strlen(VC_CAPTURE_REPLAY_PREFIX), &params, buffers);
+        }
+
+        cap = vc_capture_alloc(&vc_v4l2_ops);
+        if (!cap)
+                return NULL;
+
+        cap->fd = open(device, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (cap->fd < 0) {
+                ret = -errno;
+                goto err_free;
+        }
+
+        if (subdev) {
+                cap->subdev_fd = open(subdev, O_RDWR | O_CLOEXEC);
+                if (cap->subdev_fd < 0) {
+                        ret = -errno;
+                        goto err_close;
+                }
+        }
+
+        ret = vc_xioctl(cap->fd, VIDIOC_G_FMT, &format);
+        if (ret < 0)
+                goto err_close;
+
+        cap->fmt.width = format.fmt.pix.width;
+        cap->fmt.height = format.fmt.pix.height;
+        cap->fmt.fourcc = format.fmt.pix.pixelformat;
+        cap->fmt.bytesperline = format.fmt.pix.bytesperline;
+        cap->fmt.sizeimage = format.fmt.pix.sizeimage;
+
+        ret = vc_capture_map_buffers(cap, buffers ? buffers : 4);
+        if (ret < 0)
+                goto err_unmap;
+
+        return cap;
+
+err_unmap:
+        vc_capture_unmap_buffers(cap);
+err_close:
+        if (cap->subdev_fd >= 0)
+                close(cap->subdev_fd);
+        if (cap->fd >= 0)
+                close(cap->fd);
+err_free:
+        free(cap);
+        errno = -ret;
+        return NULL;
+}
+
+int vc_capture_set_format(const char *device, struct vc_format *fmt)
+{
+        struct v4l2_format format = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+        int fd, ret;
+
+        fd = open(device, O_RDWR | O_CLOEXEC);
+        if (fd < 0)
+                return -errno;
+
+        format.fmt.pix.width = fmt->width;
+        format.fmt.pix.height = fmt->height;
+        format.fmt.pix.pixelformat = fmt->fourcc;
+        format.fmt.pix.field = V4L2_FIELD_NONE;
+        format.fmt.pix.colorspace = V4L2_COLORSPACE_SRGB;
+
+        ret = vc_xioctl(fd, VIDIOC_S_FMT, &format);
+        if (ret == 0) {
+                fmt->width = format.fmt.pix.width;
+                fmt->height = format.fmt.pix.height;
+                fmt->fourcc = format.fmt.pix.pixelformat;
+                fmt->bytesperline = format.fmt.pix.bytesperline;
+                fmt->sizeimage = format.fmt.pix.sizeimage;
+        }
+
+        close(fd);
+        return ret;
+}
+
+void vc_capture_close(struct vc_capture *cap)
+{
+        if (!cap)
+                return;
+
+        vc_capture_stop(cap);
+        cap->ops->close(cap);
+        free(cap);
+}
+
+int vc_capture_get_format(struct vc_capture *cap, struct vc_format *fmt)
+{
+        *fmt = cap->fmt;
+        return 0;
+}
+
+int vc_capture_fd(struct vc_capture *cap)
+{
+        return cap->fd;
+}
+
+int vc_capture_subdev_fd(struct vc_capture *cap)
+{
+        return cap->subdev_fd;
+}
+
+int vc_capture_export(struct vc_capture *cap, int *fds, size_t *lengths, unsigned int max)
+{
+        if (!cap->ops->export)
+                return -ENOTSUP;
+        return cap->ops->export(cap, fds, lengths, max);
+}
+
+int vc_capture_set_recovery(struct vc_capture *cap, int subdev_fd, const struct vc_recovery_params *params)
+{
+        int64_t min, max, def;
+
+        if (!params) {
+                cap->recovery_fd = -1;
+                return 0;
+        }
+
+        if (subdev_fd < 0)
+                subdev_fd = cap->subdev_fd;
+        if (subdev_fd < 0)
+                return -ENODEV;
+        if (vc_ctrl_query(subdev_fd, V4L2_CID_VC_RESTART_STREAM, &min, &max, &def) < 0)
+                return -ENOTSUP;
+
+        cap->recovery = *params;
+        cap->recovery_fd = subdev_fd;
+        vc_recovery_reset(cap);
+        return 0;
+}
+
+int vc_capture_start(struct vc_capture *cap)
+{
+        int ret;
+
+        if (cap->streaming)
+                return 0;
+
+        ret = cap->ops->start(cap);
+        if (ret < 0)
+                return ret;
+
+        cap->have_sequence = false;
+        cap->streaming = true;
+        vc_recovery_reset(cap);
+        return 0;
+}
+
+int vc_capture_stop(struct vc_capture *cap)
+{
+        if (!cap->streaming)
+                return 0;
+
+        cap->streaming = false;
+        return cap->ops->stop(cap);
+}
+
+int vc_capture_dequeue(struct vc_capture *cap, struct vc_frame *frame, int timeout_ms)
+{
+        struct vc_capture_stats *stats = &cap->stats;
+        uint64_t now_ns;
+        int ret;
+
+        if (cap->recovery_fd >= 0)
+                ret = vc_recovery_dequeue(cap, frame, timeout_ms);
+        else
+                ret = cap->ops->dequeue(cap, frame, timeout_ms);
+        if (ret < 0)
+                return ret;
+
+        now_ns = vc_clock_ns(CLOCK_MONOTONIC);
+
+        stats->frames++;
+        if (frame->flags & V4L2_BUF_FLAG_ERROR)
+                stats->errors++;
+        if (cap->recovery_fd >= 0)
+                vc_recovery_frame(cap, frame, now_ns);
+        if (cap->have_sequence && frame->sequence > cap->last_sequence + 1)
+                stats->dropped += frame->sequence - cap->last_sequence - 1;
+        cap->last_sequence = frame->sequence;
+        cap->have_sequence = true;
+
+        if (frame->timestamp_ns && now_ns >= frame->timestamp_ns)
+                vc_hist_add(&stats->latency, now_ns - frame->timestamp_ns);
+
+        if (cap->ops->pending) {
+                int pending = cap->ops->pending(cap);
+
+                if (pending > 0) {
+                        stats->backlog_sum += pending;
+                        if ((unsigned int)pending > stats->backlog_max)
+                                stats->backlog_max = pending;
+                }
+        }
+
+        return 0;
+}
+
+int vc_capture_release(struct vc_capture *cap, const struct vc_frame *frame)
+{
+        return cap->ops->release(cap, frame);
+}
+
+const struct vc_capture_stats *vc_capture_get_stats(struct vc_capture *cap)
+{
+        return &cap->stats;
+}
+
+void vc_capture_reset_stats(struct vc_capture *cap)
+{
+        memset(&cap->stats, 0, sizeof(cap->stats));
+        vc_hist_reset(&cap->stats.latency);
+        vc_hist_reset(&cap->stats.decode);
+        vc_hist_reset(&cap->stats.recovery);
+}
@@ -0,0 +1,130 @@
+#ifndef _VC_CAPTURE_H
+#define _VC_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vc_stats.h"
+#include "vc_v4l2.h"
+
+#define VC_CAPTURE_MAX_BUFFERS          32
+
+// Device prefix accepted by vc_capture_open() to replay a .vcraw recording
+// with default vc_replay_params, e.g. "replay:capture.vcraw".
+#define VC_CAPTURE_REPLAY_PREFIX        "replay:"
+
+struct vc_capture;
+
+struct vc_format {
+        uint32_t width;
+        uint32_t height;
+        uint32_t fourcc;
+        uint32_t bytesperline;
+        uint32_t sizeimage;
+};
+
+struct vc_frame {
+        const void *data;
+        size_t bytesused;
+        unsigned int index;             // buffer index, hand back with vc_capture_release()
+        uint32_t sequence;
+        uint64_t timestamp_ns;          // CLOCK_MONOTONIC, start of frame as set by the receiver
+        uint32_t flags;                 // V4L2_BUF_FLAG_*
+        struct vc_ctrl_state ctrls;     // only valid if a subdevice was attached
+};
+
+// Consumer side statistics, updated by vc_capture_dequeue()
+struct vc_capture_stats {
+        uint64_t frames;
+        uint64_t dropped;               // sequence gaps seen by the consumer
+        struct vc_histogram latency;    // dequeue time - frame timestamp
+        unsigned int backlog_max;       // frames still waiting after a dequeue
+        uint64_t backlog_sum;
+        uint64_t overruns;              // replay only: frames lost for lack of a free buffer
+        uint64_t injected;              // replay only: frames dropped on purpose (drop_rate)
+        struct vc_histogram decode;     // replay only: decode time of compressed frames
+        uint64_t late_decodes;          // replay only: decoded on delivery, the time is in latency
+        uint64_t errors;                // frames flagged V4L2_BUF_FLAG_ERROR by the receiver
+        uint64_t timeouts;              // recovery only: no frame within the timeout
+        uint64_t restarts;              // recovery only: sensor restarts
+        struct vc_histogram recovery;   // recovery only: first restart - next good frame
+};
+
+// Fast stream recovery. After receiver errors or when no frame arrives, only
+// the sensor readout is restarted with V4L2_CID_VC_RESTART_STREAM, the video
+// node keeps streaming with its format and buffers.
+struct vc_recovery_params {
+        unsigned int timeout_periods;   // frame periods without a frame, 0 = no timeout (default 5)
+        unsigned int timeout_min_ms;    // lower bound of the timeout (default 100)
+        unsigned int first_frame_ms;    // timeout until the frame period is known (default 1000)
+        unsigned int error_frames;      // V4L2_BUF_FLAG_ERROR frames in a row, 0 = ignore (default 1)
+        unsigned int max_restarts;      // restarts without a good frame in between (default 3)
+};
+
+#define VC_RECOVERY_PARAMS_DEFAULT                                      \
+        {                                                               \
+                .timeout_periods = 5, .timeout_min_ms = 100,            \
+                .first_frame_ms = 1000, .error_frames = 1,              \
+                .max_restarts = 3,                                      \
+        }
+
+struct vc_replay_params {
+        double speed;                   // 1.0 original timing, 0 as fast as the consumer reads
+        double fps;                     // > 0 replaces the recorded timing by a fixed rate
+        unsigned int loops;             // number of passes over the file, 0 is endless
+        double drop_rate;               // probability of dropping a frame before delivery
+        unsigned int seed;              // for drop_rate
+        bool preload;                   // read the whole file into the page cache first
+};
+
+#define VC_REPLAY_PARAMS_DEFAULT        { .speed = 1.0, .loops = 1, .seed = 1 }
+
+// Opens the video node and maps 'buffers' capture buffers. The subdevice is
+// optional; if given, its control state is sampled for every frame.
+struct vc_capture *vc_capture_open(const char *device, const char *subdev, unsigned int buffers);
+
+// Replays a .vcraw recording through the same interface. The recording is
+// delivered with its original sequence numbers and sensor controls, the
+// timestamps are moved to the time of replay. Like the V4L2 driver, frames
+// that are due while all 'buffers' are held by the consumer are dropped.
+// vc_capture_dequeue() returns -ENODATA after the last pass.
+struct vc_capture *vc_capture_open_replay(const char *path, const struct vc_replay_params *params,
+                                          unsigned int buffers);
+void vc_capture_close(struct vc_capture *cap);
+
+// Sets the format of a video node that is not opened for capture, like
+// v4l2-ctl --set-fmt-video. 'fmt' is updated with what the driver applied.
+int vc_capture_set_format(const char *device, struct vc_format *fmt);
+
+int vc_capture_get_format(struct vc_capture *cap, struct vc_format *fmt);
+int vc_capture_fd(struct vc_capture *cap);               // -1 for replay
+int vc_capture_subdev_fd(struct vc_capture *cap);
+
+// Exports the capture buffers as read-only DMABUF file descriptors, indexed
+// like vc_frame.index. Returns the number of buffers or a negative errno,
+// -ENOTSUP for replay. The caller closes the descriptors.
+int vc_capture_export(struct vc_capture *cap, int *fds, size_t *lengths, unsigned int max);
+
+// Enables stream recovery in vc_capture_dequeue() (params NULL disables it).
+// The restart control is written on 'subdev_fd', or on the subdevice given to
+// vc_capture_open() if -1. Returns -ENODEV without a subdevice and -ENOTSUP
+// if the driver has no restart control. Not for external trigger mode, where
+// a pause between frames is no error.
+int vc_capture_set_recovery(struct vc_capture *cap, int subdev_fd, const struct vc_recovery_params *params);
+
+int vc_capture_start(struct vc_capture *cap);
+int vc_capture_stop(struct vc_capture *cap);
+
+// Waits up to timeout_ms (-1 forever) for the next frame. Returns 0 on
+// success, -ETIMEDOUT if no frame arrived or another negative errno. With
+// recovery, frames with V4L2_BUF_FLAG_ERROR are still returned and the sensor
+// is restarted behind them. -EPIPE means that max_restarts did not help, the
+// caller has to restart the whole pipeline.
+int vc_capture_dequeue(struct vc_capture *cap, struct vc_frame *frame, int timeout_ms);
+int vc_capture_release(struct vc_capture *cap, const struct vc_frame *frame);
+
+const struct vc_capture_stats *vc_capture_get_stats(struct vc_capture *cap);
+void vc_capture_reset_stats(struct vc_capture *cap);
+
+#endif // _VC_CAPTURE_H
@@ -0,0 +1,61 @@
+#ifndef _VC_CAPTURE_PRIV_H
+#define _VC_CAPTURE_PRIV_H
+
+#include <stdbool.h>
+
+#include "vc_capture.h"
+
+// Backend interface behind struct vc_capture. The generic layer in
+// vc_capture.c keeps the statistics and the streaming state, the backends
+// only move buffers.
+struct vc_capture_ops {
+        int (*start)(struct vc_capture *cap);
+        int (*stop)(struct vc_capture *cap);
+        int (*dequeue)(struct vc_capture *cap, struct vc_frame *frame, int timeout_ms);
+        int (*release)(struct vc_capture *cap, const struct vc_frame *frame);
+        void (*close)(struct vc_capture *cap);
+        // Optional, number of filled buffers still waiting to be dequeued
+        int (*pending)(struct vc_capture *cap);
+        // Optional, DMABUF file descriptors of the capture buffers
+        int (*export)(struct vc_capture *cap, int *fds, size_t *lengths, unsigned int max);
+};
+
+struct vc_capture_buffer {
+        void *start;
+        size_t length;
+};
+
+struct vc_capture {
+        const struct vc_capture_ops *ops;
+        int fd;
+        int subdev_fd;
+        struct vc_format fmt;
+        bool streaming;
+
+        // V4L2 backend
+        struct vc_capture_buffer buffers[VC_CAPTURE_MAX_BUFFERS];
+        unsigned int num_buffers;
+
+        // Replay backend
+        void *priv;
+
+        struct vc_capture_stats stats;
+        uint32_t last_sequence;
+        bool have_sequence;
+
+        // Stream recovery, recovery_fd is -1 if disabled
+        struct vc_recovery_params recovery;
+        int recovery_fd;
+        int recovery_error;             // failed restart, returned by the next dequeue
+        uint64_t last_frame_ns;         // CLOCK_MONOTONIC of the last frame or restart
+        uint64_t frame_period_ns;       // 0 until two good frames in a row arrived
+        uint64_t good_timestamp_ns;     // of the last good frame, 0 after a restart
+        uint32_t good_sequence;
+        uint64_t restart_ns;            // first restart without a good frame since
+        unsigned int error_run;
+        unsigned int restart_run;
+};
+
+struct vc_capture *vc_capture_alloc(const struct vc_capture_ops *ops);
+
+#endif // _VC_CAPTURE_PRIV_H
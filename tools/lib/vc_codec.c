@@ -0,0 +1,359 @@
+#include "vc_codec.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vc_pixfmt.h"
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define VC_CODEC_NEON                   1
+#else
+#define VC_CODEC_NEON                   0
+#endif
+
+_Static_assert(sizeof(struct vc_codec_header) == 32, "vc_codec_header layout changed");
+
+// A block header byte plus 16 samples of up to 16 bits
+#define VC_CODEC_BLOCK_MAX              (1 + 2 * VC_CODEC_BLOCK)
+// Lines kept for the prediction, enough for Bayer (two lines up)
+#define VC_CODEC_ROWS                   3
+
+struct vc_codec {
+        struct vc_format fmt;
+        const struct vc_pixfmt *pixfmt;
+        bool packed;
+        uint32_t step;                  // distance to the next sample of the same colour
+        uint32_t blocks;                // per line
+        size_t line_bytes;
+        uint16_t *rows[VC_CODEC_ROWS];
+        uint16_t *residuals;
+};
+
+// --- Prediction --------------------------------------------------------------
+
+static inline uint16_t vc_codec_zigzag(int16_t r)
+{
+        return (uint16_t)((uint16_t)r << 1) ^ (uint16_t)(r >> 15);
+}
+
+static inline int16_t vc_codec_unzigzag(uint16_t u)
+{
+        return (int16_t)((u >> 1) ^ -(u & 1));
+}
+
+// Median of left, up and the gradient left + up - up-left
+static inline int vc_codec_med(int a, int b, int c)
+{
+        int lo = a < b ? a : b;
+        int hi = a < b ? b : a;
+        int g = a + b - c;
+
+        return g < lo ? lo : g > hi ? hi : g;
+}
+
+static inline int vc_codec_predict(const uint16_t *cur, const uint16_t *up, uint32_t x, uint32_t step)
+{
+        if (!up)
+                return x >= step ? cur[x - step] : 0;
+        if (x < step)
+                return up[x];
+        return vc_codec_med(cur[x - step], up[x], up[x - step]);
+}
+
+#if VC_CODEC_NEON
+// Only for samples of up to 14 bits, the gradient must not overflow 16 bits
+static uint32_t vc_codec_residuals_neon(const uint16_t *cur, const uint16_t *up, uint16_t *res,
+                                        uint32_t x, uint32_t step, uint32_t width)
+{
+        for (; x + 8 <= width; x += 8) {
+                int16x8_t a = vreinterpretq_s16_u16(vld1q_u16(cur + x - step));
+                int16x8_t b = vreinterpretq_s16_u16(vld1q_u16(up + x));
+                int16x8_t c = vreinterpretq_s16_u16(vld1q_u16(up + x - step));
+                int16x8_t p = vreinterpretq_s16_u16(vld1q_u16(cur + x));
+                int16x8_t g = vsubq_s16(vaddq_s16(a, b), c);
+                int16x8_t pred = vmaxq_s16(vminq_s16(a, b), vminq_s16(vmaxq_s16(a, b), g));
+                int16x8_t r = vsubq_s16(p, pred);
+                uint16x8_t z = veorq_u16(vreinterpretq_u16_s16(vshlq_n_s16(r, 1)),
+                                         vreinterpretq_u16_s16(vshrq_n_s16(r, 15)));
+
+                vst1q_u16(res + x, z);
+        }
+        return x;
+}
+#endif
+
+static void vc_codec_residuals(const struct vc_codec *codec, const uint16_t *cur, const uint16_t *up,
+                               uint16_t *res, bool simd)
+{
+        uint32_t width = codec->fmt.width, step = codec->step, x = 0;
+
+        if (up) {
+                for (; x < step && x < width; x++)
+                        res[x] = vc_codec_zigzag(cur[x] - up[x]);
+#if VC_CODEC_NEON
+                if (simd)
+                        x = vc_codec_residuals_neon(cur, up, res, x, step, width);
+#endif
+        }
+        for (; x < width; x++)
+                res[x] = vc_codec_zigzag(cur[x] - vc_codec_predict(cur, up, x, step));
+
+        // The last block is padded with zero residuals
+        for (; x < codec->blocks * VC_CODEC_BLOCK; x++)
+                res[x] = 0;
+}
+
+// --- Blocks ------------------------------------------------------------------
+
+static inline unsigned int vc_codec_block_bits(const uint16_t *v)
+{
+        uint32_t max;
+
+#if VC_CODEC_NEON
+        max = vmaxvq_u16(vmaxq_u16(vld1q_u16(v), vld1q_u16(v + 8)));
+#else
+        unsigned int i;
+
+        // The bit width of the OR is the one of the maximum
+        for (i = 0, max = 0; i < VC_CODEC_BLOCK; i++)
+                max |= v[i];
+#endif
+        return max ? 32 - __builtin_clz(max) : 0;
+}
+
+static uint8_t *vc_codec_pack_block(const uint16_t *v, uint8_t *out)
+{
+        unsigned int bits = vc_codec_block_bits(v), fill = 0, i;
+        uint64_t acc = 0;
+
+        *out++ = bits;
+        if (!bits)
+                return out;
+
+        for (i = 0; i < VC_CODEC_BLOCK; i++) {
+                acc |= (uint64_t)v[i] << fill;
+                fill += bits;
+                if (fill >= 32) {
+                        out[0] = acc;
+                        out[1] = acc >> 8;
+                        out[2] = acc >> 16;
+                        out[3] = acc >> 24;
+                        out += 4;
+                        acc >>= 32;
+                        fill -= 32;
+                }
+        }
+        // 16 * bits is a multiple of 16, so at most two bytes are left
+        for (; fill; fill -= 8, acc >>= 8)
+                *out++ = acc;
+        return out;
+}
+
+static const uint8_t *vc_codec_unpack_block(const uint8_t *in, const uint8_t *end, uint16_t *v)
+{
+        unsigned int bits, fill = 0, i;
+        uint64_t acc = 0;
+        uint32_t mask;
+
+        if (in >= end)
+                return NULL;
+        bits = *in++;
+        if (bits > 16 || in + 2 * bits > end)
+                return NULL;
+        if (!bits) {
+                memset(v, 0, VC_CODEC_BLOCK * sizeof(*v));
+                return in;
+        }
+
+        mask = (1u << bits) - 1;
+        for (i = 0; i < VC_CODEC_BLOCK; i++) {
+                while (fill < bits) {
+                        acc |= (uint64_t)*in++ << fill;
+                        fill += 8;
+                }
+                v[i] = acc & mask;
+                acc >>= bits;
+                fill -= bits;
+        }
+        return in;
+}
+
+// --- Public API --------------------------------------------------------------
+
+struct vc_codec *vc_codec_create(const struct vc_format *fmt)
+{
+        struct vc_codec *codec;
+        size_t row_size;
+        unsigned int i;
+
+        codec = calloc(1, sizeof(*codec));
+        if (!codec)
+                return NULL;
+
+        codec->fmt = *fmt;
+        codec->pixfmt = vc_pixfmt_from_fourcc(fmt->fourcc, &codec->packed);
+        if (!codec->pixfmt || !fmt->width || !fmt->height) {
+                free(codec);
+                errno = EINVAL;
+                return NULL;
+        }
+        codec->step = codec->pixfmt->bayer != VC_BAYER_NONE ? 2 : 1;
+        codec->blocks = (fmt->width + VC_CODEC_BLOCK - 1) / VC_CODEC_BLOCK;
+        codec->line_bytes = vc_pixfmt_line_bytes(codec->pixfmt, codec->packed, fmt->width);
+        if (!codec->fmt.bytesperline)
+                codec->fmt.bytesperline = codec->line_bytes;
+        // The decoder clears the padding after line_bytes
+        if (codec->fmt.bytesperline < codec->line_bytes) {
+                free(codec);
+                errno = EINVAL;
+                return NULL;
+        }
+
+        row_size = (size_t)codec->blocks * VC_CODEC_BLOCK * sizeof(uint16_t);
+        for (i = 0; i < VC_CODEC_ROWS; i++)
+                codec->rows[i] = malloc(row_size);
+        codec->residuals = malloc(row_size);
+        for (i = 0; i < VC_CODEC_ROWS; i++) {
+                if (!codec->rows[i])
+                        break;
+        }
+        if (i < VC_CODEC_ROWS || !codec->residuals) {
+                vc_codec_destroy(codec);
+                errno = ENOMEM;
+                return NULL;
+        }
+
+        return codec;
+}
+
+void vc_codec_destroy(struct vc_codec *codec)
+{
+        unsigned int i;
+
+        if (!codec)
+                return;
+
+        for (i = 0; i < VC_CODEC_ROWS; i++)
+                free(codec->rows[i]);
+        free(codec->residuals);
+        free(codec);
+}
+
+size_t vc_codec_bound(const struct vc_codec *codec)
+{
+        return sizeof(struct vc_codec_header) +
+               (size_t)codec->fmt.height * codec->blocks * VC_CODEC_BLOCK_MAX;
+}
+
+// OR of all samples of a frame in 16 bit containers
+static uint16_t vc_codec_container_bits(const struct vc_codec *codec, const uint8_t *src, uint32_t lines)
+{
+        uint16_t all = 0;
+        uint32_t x, y;
+
+        for (y = 0; y < lines; y++) {
+                const uint16_t *line = (const uint16_t *)(src + (size_t)y * codec->fmt.bytesperline);
+
+                for (x = 0; x < codec->fmt.width; x++)
+                        all |= line[x];
+        }
+        return all;
+}
+
+ssize_t vc_codec_encode(struct vc_codec *codec, const void *src, size_t bytesused, void *dst, size_t size)
+{
+        struct vc_codec_header *header = dst;
+        uint32_t bpl = codec->fmt.bytesperline, lines, x, y;
+        uint8_t *out = (uint8_t *)dst + sizeof(*header);
+        unsigned int bits = codec->pixfmt->bits;
+        bool simd;
+
+        if (size < vc_codec_bound(codec))
+                return -ENOSPC;
+
+        lines = bytesused / bpl;
+        if (lines > codec->fmt.height)
+                lines = codec->fmt.height;
+
+        memset(header, 0, sizeof(*header));
+        memcpy(header->magic, VC_CODEC_MAGIC, sizeof(header->magic));
+        header->fourcc = codec->fmt.fourcc;
+        header->width = codec->fmt.width;
+        header->height = lines;
+        header->bytesperline = bpl;
+        header->bytesused = bytesused;
+
+        // Receivers may store the samples MSB aligned in the container
+        if (!codec->packed && bits > 8) {
+                uint16_t all = vc_codec_container_bits(codec, src, lines);
+
+                header->shift = all ? __builtin_ctz(all) : 0;
+                all >>= header->shift;
+                bits = all ? 32 - __builtin_clz(all) : 0;
+        }
+        simd = bits <= 14;
+
+        for (y = 0; y < lines; y++) {
+                uint16_t *cur = codec->rows[y % VC_CODEC_ROWS];
+                uint16_t *up = y >= codec->step ? codec->rows[(y - codec->step) % VC_CODEC_ROWS] : NULL;
+
+                vc_pixfmt_unpack_line(codec->pixfmt, codec->packed, (const uint8_t *)src + (size_t)y * bpl,
+                                      cur, codec->fmt.width);
+                if (header->shift) {
+                        for (x = 0; x < codec->fmt.width; x++)
+                                cur[x] >>= header->shift;
+                }
+
+                vc_codec_residuals(codec, cur, up, codec->residuals, simd);
+                for (x = 0; x < codec->blocks; x++)
+                        out = vc_codec_pack_block(codec->residuals + x * VC_CODEC_BLOCK, out);
+        }
+
+        return out - (uint8_t *)dst;
+}
+
+ssize_t vc_codec_decode(struct vc_codec *codec, const void *src, size_t len, void *dst, size_t size)
+{
+        const struct vc_codec_header *header = src;
+        const uint8_t *in = (const uint8_t *)src + sizeof(*header);
+        const uint8_t *end = (const uint8_t *)src + len;
+        uint32_t bpl = codec->fmt.bytesperline, step = codec->step, x, y;
+        uint8_t *out = dst;
+
+        if (len < sizeof(*header) || memcmp(header->magic, VC_CODEC_MAGIC, sizeof(header->magic)))
+                return -EBADMSG;
+        if (header->fourcc != codec->fmt.fourcc || header->width != codec->fmt.width ||
+            header->bytesperline != bpl || header->height > codec->fmt.height ||
+            header->shift > 15)
+                return -EINVAL;
+        if (size < header->bytesused || (size_t)header->height * bpl > header->bytesused)
+                return -ENOSPC;
+
+        for (y = 0; y < header->height; y++) {
+                uint16_t *cur = codec->rows[y % VC_CODEC_ROWS];
+                uint16_t *up = y >= step ? codec->rows[(y - step) % VC_CODEC_ROWS] : NULL;
+                uint16_t *res = codec->residuals;
+
+                for (x = 0; x < codec->blocks; x++) {
+                        in = vc_codec_unpack_block(in, end, res + x * VC_CODEC_BLOCK);
+                        if (!in)
+                                return -EBADMSG;
+                }
+
+                for (x = 0; x < codec->fmt.width; x++)
+                        cur[x] = vc_codec_predict(cur, up, x, step) + vc_codec_unzigzag(res[x]);
+
+                // The residuals are not needed any more, they take the output line
+                for (x = 0; x < codec->fmt.width; x++)
+                        res[x] = cur[x] << header->shift;
+                vc_pixfmt_pack_line(codec->pixfmt, codec->packed, res, out, codec->fmt.width);
+                memset(out + codec->line_bytes, 0, bpl - codec->line_bytes);
+                out += bpl;
+        }
+        memset(out, 0, header->bytesused - (size_t)header->height * bpl);
+
+        return header->bytesused;
+}
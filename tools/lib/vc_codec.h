@@ -0,0 +1,52 @@
+#ifndef _VC_CODEC_H
+#define _VC_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "vc_capture.h"
+
+// Lossless raw frame codec
+//
+// Every sample is predicted from its neighbours of the same colour (the MED
+// predictor of LOCO-I: left, up and up-left, two pixels apart for Bayer
+// formats). The residuals are zigzag mapped and stored in blocks of 16 with
+// the bit width of the largest one, so every block takes 1 + 2 * bits bytes
+// and stays byte aligned. Prediction and block widths use NEON on arm.
+//
+// The pixel values are restored bit-exact. The padding at the end of the
+// lines (bytesperline) is not kept, it is zero after decoding.
+
+#define VC_CODEC_MAGIC                  "VCZ1"
+#define VC_CODEC_BLOCK                  16
+
+struct vc_codec;
+
+struct vc_codec_header {
+        char magic[4];
+        uint32_t fourcc;
+        uint32_t width;
+        uint32_t height;                // lines in this frame
+        uint32_t bytesperline;
+        uint32_t bytesused;             // size of the original frame
+        uint8_t shift;                  // trailing zero bits removed from every sample
+        uint8_t reserved[7];
+} __attribute__((packed));
+
+// Supports the mono and Bayer formats of vc_pixfmt, packed or in 16 bit
+// containers. Returns NULL with errno EINVAL for other formats.
+struct vc_codec *vc_codec_create(const struct vc_format *fmt);
+void vc_codec_destroy(struct vc_codec *codec);
+
+// Worst case size of an encoded frame
+size_t vc_codec_bound(const struct vc_codec *codec);
+
+// Returns the encoded size or a negative errno (-ENOSPC if 'size' is too small).
+ssize_t vc_codec_encode(struct vc_codec *codec, const void *src, size_t bytesused, void *dst, size_t size);
+
+// Returns the size of the original frame or a negative errno (-EBADMSG for
+// corrupt data).
+ssize_t vc_codec_decode(struct vc_codec *codec, const void *src, size_t len, void *dst, size_t size);
+
+#endif // _VC_CODEC_H
@@ -0,0 +1,661 @@
+#include "vc_demosaic.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vc_pixfmt.h"
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define VC_DM_NEON                      1
+#elif defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#include <immintrin.h>
+#define VC_DM_X86                       1
+#endif
+
+// Internal sample range after black level and white balance
+#define VC_DM_BITS                      12
+#define VC_DM_MAX                       ((1 << VC_DM_BITS) - 1)
+// Samples in front of and behind every line, the kernels read x - 1 and x + 1
+#define VC_DM_PAD                       16
+
+enum vc_dm_color {
+        VC_DM_RED,
+        VC_DM_GREEN,
+        VC_DM_BLUE,
+};
+
+// Layout of one Bayer line: the colour next to green and whether the line
+// starts with green
+struct vc_dm_phase {
+        enum vc_dm_color color;
+        bool first_green;
+};
+
+struct vc_dm_kernels {
+        const char *name;
+        // dst = min(((src - black) << shift) * gain >> 16, VC_DM_MAX), gains of even / odd pixels
+        void (*normalize)(const uint16_t *src, uint16_t *dst, uint32_t width, uint16_t black,
+                          unsigned int shift, uint16_t gain_even, uint16_t gain_odd);
+        // 'own' is the colour of the line next to green, 'other' the one of the lines above / below
+        void (*interpolate)(const uint16_t *up, const uint16_t *cur, const uint16_t *down,
+                            uint16_t *own, uint16_t *green, uint16_t *other,
+                            uint32_t width, bool first_green, bool edge);
+};
+
+struct vc_demosaic {
+        struct vc_format fmt;
+        struct vc_demosaic_params params;
+        const struct vc_pixfmt *pixfmt;
+        bool packed;
+        const struct vc_dm_kernels *kernels;
+        struct vc_dm_phase phase[2];    // even / odd lines
+        unsigned int shift;
+        uint16_t black;
+        uint16_t gains[3];              // 0.16 fixed point, see normalize
+        uint8_t lut[VC_DM_MAX + 1];
+
+        uint16_t *rows[3];              // normalized lines, VC_DM_PAD samples of margin
+        uint16_t *unpacked;
+        uint16_t *planes[3];            // own, green, other of the current line
+
+        uint32_t preview_width;
+        uint32_t preview_height;
+        uint32_t *acc;                  // preview sums, 3 per preview pixel
+};
+
+static inline uint16_t vc_dm_avg(uint16_t a, uint16_t b)
+{
+        return (a + b + 1) >> 1;
+}
+
+// --- Scalar kernels ----------------------------------------------------------
+
+static inline uint16_t vc_dm_normalize_one(uint16_t v, uint16_t black, unsigned int shift, uint16_t gain)
+{
+        uint32_t x = v > black ? v - black : 0;
+
+        x = (((x << shift) & 0xffff) * gain) >> 16;
+        return x > VC_DM_MAX ? VC_DM_MAX : x;
+}
+
+static void vc_dm_normalize_scalar(const uint16_t *src, uint16_t *dst, uint32_t width, uint16_t black,
+                                   unsigned int shift, uint16_t gain_even, uint16_t gain_odd)
+{
+        uint32_t x;
+
+        for (x = 0; x + 2 <= width; x += 2) {
+                dst[x] = vc_dm_normalize_one(src[x], black, shift, gain_even);
+                dst[x + 1] = vc_dm_normalize_one(src[x + 1], black, shift, gain_odd);
+        }
+        if (x < width)
+                dst[x] = vc_dm_normalize_one(src[x], black, shift, gain_even);
+}
+
+static inline void vc_dm_interpolate_one(const uint16_t *up, const uint16_t *cur, const uint16_t *down,
+                                         uint16_t *own, uint16_t *green, uint16_t *other,
+                                         uint32_t x, bool is_green, bool edge)
+{
+        const uint16_t *n = up + x, *c = cur + x, *s = down + x;
+        uint16_t horiz = vc_dm_avg(c[-1], c[1]);
+        uint16_t vert = vc_dm_avg(n[0], s[0]);
+
+        if (is_green) {
+                own[x] = horiz;
+                green[x] = c[0];
+                other[x] = vert;
+                return;
+        }
+
+        own[x] = c[0];
+        other[x] = vc_dm_avg(vc_dm_avg(n[-1], n[1]), vc_dm_avg(s[-1], s[1]));
+        green[x] = vc_dm_avg(horiz, vert);
+        if (edge) {
+                int dh = abs(c[-1] - c[1]);
+                int dv = abs(n[0] - s[0]);
+
+                if (dh < dv)
+                        green[x] = horiz;
+                else if (dv < dh)
+                        green[x] = vert;
+        }
+}
+
+static void vc_dm_interpolate_scalar(const uint16_t *up, const uint16_t *cur, const uint16_t *down,
+                                     uint16_t *own, uint16_t *green, uint16_t *other,
+                                     uint32_t width, bool first_green, bool edge)
+{
+        uint32_t x;
+
+        for (x = 0; x < width; x++)
+                vc_dm_interpolate_one(up, cur, down, own, green, other, x, ((x & 1) == 0) == first_green, edge);
+}
+
+static const struct vc_dm_kernels vc_dm_scalar = {
+        .name = "scalar",
+        .normalize = vc_dm_normalize_scalar,
+        .interpolate = vc_dm_interpolate_scalar,
+};
+
+// --- NEON kernels ------------------------------------------------------------
+
+#if VC_DM_NEON
+static void vc_dm_normalize_neon(const uint16_t *src, uint16_t *dst, uint32_t width, uint16_t black,
+                                 unsigned int shift, uint16_t gain_even, uint16_t gain_odd)
+{
+        const uint16_t gains[8] = { gain_even, gain_odd, gain_even, gain_odd,
+                                    gain_even, gain_odd, gain_even, gain_odd };
+        uint16x8_t vgain = vld1q_u16(gains);
+        uint16x8_t vblack = vdupq_n_u16(black);
+        uint16x8_t vmax = vdupq_n_u16(VC_DM_MAX);
+        int16x8_t vshift = vdupq_n_s16(shift);
+        uint32_t x = 0;
+
+        for (; x + 8 <= width; x += 8) {
+                uint16x8_t v = vshlq_u16(vqsubq_u16(vld1q_u16(src + x), vblack), vshift);
+                uint32x4_t lo = vmull_u16(vget_low_u16(v), vget_low_u16(vgain));
+                uint32x4_t hi = vmull_high_u16(v, vgain);
+
+                v = vcombine_u16(vshrn_n_u32(lo, 16), vshrn_n_u32(hi, 16));
+                vst1q_u16(dst + x, vminq_u16(v, vmax));
+        }
+        vc_dm_normalize_scalar(src + x, dst + x, width - x, black, shift, gain_even, gain_odd);
+}
+
+static void vc_dm_interpolate_neon(const uint16_t *up, const uint16_t *cur, const uint16_t *down,
+                                   uint16_t *own, uint16_t *green, uint16_t *other,
+                                   uint32_t width, bool first_green, bool edge)
+{
+        static const uint16_t odd[8] = { 0, 0xffff, 0, 0xffff, 0, 0xffff, 0, 0xffff };
+        uint16x8_t is_green = vld1q_u16(odd);
+        uint32_t x = 0;
+
+        if (first_green)
+                is_green = vmvnq_u16(is_green);
+
+        for (; x + 8 <= width; x += 8) {
+                uint16x8_t c = vld1q_u16(cur + x);
+                uint16x8_t w = vld1q_u16(cur + x - 1);
+                uint16x8_t e = vld1q_u16(cur + x + 1);
+                uint16x8_t n = vld1q_u16(up + x);
+                uint16x8_t s = vld1q_u16(down + x);
+                uint16x8_t horiz = vrhaddq_u16(w, e);
+                uint16x8_t vert = vrhaddq_u16(n, s);
+                uint16x8_t g = vrhaddq_u16(horiz, vert);
+                uint16x8_t diag = vrhaddq_u16(vrhaddq_u16(vld1q_u16(up + x - 1), vld1q_u16(up + x + 1)),
+                                              vrhaddq_u16(vld1q_u16(down + x - 1), vld1q_u16(down + x + 1)));
+
+                if (edge) {
+                        uint16x8_t dh = vabdq_u16(w, e);
+                        uint16x8_t dv = vabdq_u16(n, s);
+
+                        g = vbslq_u16(vcltq_u16(dh, dv), horiz, g);
+                        g = vbslq_u16(vcltq_u16(dv, dh), vert, g);
+                }
+
+                vst1q_u16(own + x, vbslq_u16(is_green, horiz, c));
+                vst1q_u16(green + x, vbslq_u16(is_green, c, g));
+                vst1q_u16(other + x, vbslq_u16(is_green, vert, diag));
+        }
+        for (; x < width; x++)
+                vc_dm_interpolate_one(up, cur, down, own, green, other, x, ((x & 1) == 0) == first_green, edge);
+}
+
+static const struct vc_dm_kernels vc_dm_neon = {
+        .name = "neon",
+        .normalize = vc_dm_normalize_neon,
+        .interpolate = vc_dm_interpolate_neon,
+};
+#endif
+
+// --- x86 kernels -------------------------------------------------------------
+
+#if VC_DM_X86
+// Samples are at most 12 bits, so signed compares work for them
+static inline __m128i vc_dm_absdiff_sse2(__m128i a, __m128i b)
+{
+        return _mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a));
+}
+
+static inline __m128i vc_dm_select_sse2(__m128i mask, __m128i a, __m128i b)
+{
+        return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static void vc_dm_normalize_sse2(const uint16_t *src, uint16_t *dst, uint32_t width, uint16_t black,
+                                 unsigned int shift, uint16_t gain_even, uint16_t gain_odd)
+{
+        __m128i vgain = _mm_setr_epi16(gain_even, gain_odd, gain_even, gain_odd,
+                                       gain_even, gain_odd, gain_even, gain_odd);
+        __m128i vblack = _mm_set1_epi16(black);
+        __m128i vmax = _mm_set1_epi16(VC_DM_MAX);
+        __m128i vshift = _mm_cvtsi32_si128(shift);
+        uint32_t x = 0;
+
+        for (; x + 8 <= width; x += 8) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+
+                v = _mm_sll_epi16(_mm_subs_epu16(v, vblack), vshift);
+                v = _mm_mulhi_epu16(v, vgain);
+                _mm_storeu_si128((__m128i *)(dst + x), _mm_min_epi16(v, vmax));
+        }
+        vc_dm_normalize_scalar(src + x, dst + x, width - x, black, shift, gain_even, gain_odd);
+}
+
+static void vc_dm_interpolate_sse2(const uint16_t *up, const uint16_t *cur, const uint16_t *down,
+                                   uint16_t *own, uint16_t *green, uint16_t *other,
+                                   uint32_t width, bool first_green, bool edge)
+{
+        __m128i is_green = _mm_setr_epi16(0, -1, 0, -1, 0, -1, 0, -1);
+        uint32_t x = 0;
+
+        if (first_green)
+                is_green = _mm_xor_si128(is_green, _mm_set1_epi16(-1));
+
+        for (; x + 8 <= width; x += 8) {
+                __m128i c = _mm_loadu_si128((const __m128i *)(cur + x));
+                __m128i w = _mm_loadu_si128((const __m128i *)(cur + x - 1));
+                __m128i e = _mm_loadu_si128((const __m128i *)(cur + x + 1));
+                __m128i n = _mm_loadu_si128((const __m128i *)(up + x));
+                __m128i s = _mm_loadu_si128((const __m128i *)(down + x));
+                __m128i horiz = _mm_avg_epu16(w, e);
+                __m128i vert = _mm_avg_epu16(n, s);
+                __m128i g = _mm_avg_epu16(horiz, vert);
+                __m128i diag = _mm_avg_epu16(
+                        _mm_avg_epu16(_mm_loadu_si128((const __m128i *)(up + x - 1)),
+                                      _mm_loadu_si128((const __m128i *)(up + x + 1))),
+                        _mm_avg_epu16(_mm_loadu_si128((const __m128i *)(down + x - 1)),
+                                      _mm_loadu_si128((const __m128i *)(down + x + 1))));
+
+                if (edge) {
+                        __m128i dh = vc_dm_absdiff_sse2(w, e);
+                        __m128i dv = vc_dm_absdiff_sse2(n, s);
+
+                        g = vc_dm_select_sse2(_mm_cmplt_epi16(dh, dv), horiz, g);
+                        g = vc_dm_select_sse2(_mm_cmplt_epi16(dv, dh), vert, g);
+                }
+
+                _mm_storeu_si128((__m128i *)(own + x), vc_dm_select_sse2(is_green, horiz, c));
+                _mm_storeu_si128((__m128i *)(green + x), vc_dm_select_sse2(is_green, c, g));
+                _mm_storeu_si128((__m128i *)(other + x), vc_dm_select_sse2(is_green, vert, diag));
+        }
+        for (; x < width; x++)
+                vc_dm_interpolate_one(up, cur, down, own, green, other, x, ((x & 1) == 0) == first_green, edge);
+}
+
+static const struct vc_dm_kernels vc_dm_sse2 = {
+        .name = "sse2",
+        .normalize = vc_dm_normalize_sse2,
+        .interpolate = vc_dm_interpolate_sse2,
+};
+
+#define VC_DM_AVX2 __attribute__((target("avx2")))
+
+VC_DM_AVX2 static void vc_dm_normalize_avx2(const uint16_t *src, uint16_t *dst, uint32_t width, uint16_t black,
+                                            unsigned int shift, uint16_t gain_even, uint16_t gain_odd)
+{
+        __m256i vgain = _mm256_setr_epi16(gain_even, gain_odd, gain_even, gain_odd,
+                                          gain_even, gain_odd, gain_even, gain_odd,
+                                          gain_even, gain_odd, gain_even, gain_odd,
+                                          gain_even, gain_odd, gain_even, gain_odd);
+        __m256i vblack = _mm256_set1_epi16(black);
+        __m256i vmax = _mm256_set1_epi16(VC_DM_MAX);
+        __m128i vshift = _mm_cvtsi32_si128(shift);
+        uint32_t x = 0;
+
+        for (; x + 16 <= width; x += 16) {
+                __m256i v = _mm256_loadu_si256((const __m256i *)(src + x));
+
+                v = _mm256_sll_epi16(_mm256_subs_epu16(v, vblack), vshift);
+                v = _mm256_mulhi_epu16(v, vgain);
+                _mm256_storeu_si256((__m256i *)(dst + x), _mm256_min_epu16(v, vmax));
+        }
+        vc_dm_normalize_scalar(src + x, dst + x, width - x, black, shift, gain_even, gain_odd);
+}
+
+VC_DM_AVX2 static void vc_dm_interpolate_avx2(const uint16_t *up, const uint16_t *cur, const uint16_t *down,
+                                              uint16_t *own, uint16_t *green, uint16_t *other,
+                                              uint32_t width, bool first_green, bool edge)
+{
+        __m256i is_green = _mm256_setr_epi16(0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1);
+        uint32_t x = 0;
+
+        if (first_green)
+                is_green = _mm256_xor_si256(is_green, _mm256_set1_epi16(-1));
+
+        for (; x + 16 <= width; x += 16) {
+                __m256i c = _mm256_loadu_si256((const __m256i *)(cur + x));
+                __m256i w = _mm256_loadu_si256((const __m256i *)(cur + x - 1));
+                __m256i e = _mm256_loadu_si256((const __m256i *)(cur + x + 1));
+                __m256i n = _mm256_loadu_si256((const __m256i *)(up + x));
+                __m256i s = _mm256_loadu_si256((const __m256i *)(down + x));
+                __m256i horiz = _mm256_avg_epu16(w, e);
+                __m256i vert = _mm256_avg_epu16(n, s);
+                __m256i g = _mm256_avg_epu16(horiz, vert);
+                __m256i diag = _mm256_avg_epu16(
+                        _mm256_avg_epu16(_mm256_loadu_si256((const __m256i *)(up + x - 1)),
+                                         _mm256_loadu_si256((const __m256i *)(up + x + 1))),
+                        _mm256_avg_epu16(_mm256_loadu_si256((const __m256i *)(down + x - 1)),
+                                         _mm256_loadu_si256((const __m256i *)(down + x + 1))));
+
+                if (edge) {
+                        __m256i dh = _mm256_or_si256(_mm256_subs_epu16(w, e), _mm256_subs_epu16(e, w));
+                        __m256i dv = _mm256_or_si256(_mm256_subs_epu16(n, s), _mm256_subs_epu16(s, n));
+
+                        g = _mm256_blendv_epi8(g, horiz, _mm256_cmpgt_epi16(dv, dh));
+                        g = _mm256_blendv_epi8(g, vert, _mm256_cmpgt_epi16(dh, dv));
+                }
+
+                _mm256_storeu_si256((__m256i *)(own + x), _mm256_blendv_epi8(c, horiz, is_green));
+                _mm256_storeu_si256((__m256i *)(green + x), _mm256_blendv_epi8(g, c, is_green));
+                _mm256_storeu_si256((__m256i *)(other + x), _mm256_blendv_epi8(diag, vert, is_green));
+        }
+        for (; x < width; x++)
+                vc_dm_interpolate_one(up, cur, down, own, green, other, x, ((x & 1) == 0) == first_green, edge);
+}
+
+static const struct vc_dm_kernels vc_dm_avx2 = {
+        .name = "avx2",
+        .normalize = vc_dm_normalize_avx2,
+        .interpolate = vc_dm_interpolate_avx2,
+};
+#endif
+
+static const struct vc_dm_kernels *vc_dm_select_kernels(const char *name)
+{
+        static const struct vc_dm_kernels *const kernels[] = {
+#if VC_DM_NEON
+                &vc_dm_neon,
+#endif
+#if VC_DM_X86
+                &vc_dm_avx2,
+                &vc_dm_sse2,
+#endif
+                &vc_dm_scalar,
+        };
+        unsigned int i;
+
+        for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+#if VC_DM_X86
+                if (kernels[i] == &vc_dm_avx2 && !__builtin_cpu_supports("avx2"))
+                        continue;
+#endif
+                if (!name || !strcmp(name, kernels[i]->name))
+                        return kernels[i];
+        }
+        return NULL;
+}
+
+// --- Output ------------------------------------------------------------------
+
+static void vc_dm_output_line(const struct vc_demosaic *dm, const uint16_t *r, const uint16_t *g,
+                              const uint16_t *b, uint8_t *dst, uint32_t width)
+{
+        const uint8_t *lut = dm->lut;
+        uint32_t x;
+
+        switch (dm->params.output) {
+        case VC_DEMOSAIC_RGB24:
+                for (x = 0; x < width; x++, dst += 3) {
+                        dst[0] = lut[r[x]];
+                        dst[1] = lut[g[x]];
+                        dst[2] = lut[b[x]];
+                }
+                break;
+        case VC_DEMOSAIC_BGR24:
+                for (x = 0; x < width; x++, dst += 3) {
+                        dst[0] = lut[b[x]];
+                        dst[1] = lut[g[x]];
+                        dst[2] = lut[r[x]];
+                }
+                break;
+        case VC_DEMOSAIC_YUYV:
+                for (x = 0; x + 2 <= width; x += 2, dst += 4) {
+                        int r0 = lut[r[x]], g0 = lut[g[x]], b0 = lut[b[x]];
+                        int r1 = lut[r[x + 1]], g1 = lut[g[x + 1]], b1 = lut[b[x + 1]];
+                        int rs = r0 + r1, gs = g0 + g1, bs = b0 + b1;
+
+                        dst[0] = (77 * r0 + 150 * g0 + 29 * b0 + 128) >> 8;
+                        dst[1] = ((-43 * rs - 85 * gs + 128 * bs + 256) >> 9) + 128;
+                        dst[2] = (77 * r1 + 150 * g1 + 29 * b1 + 128) >> 8;
+                        dst[3] = ((128 * rs - 107 * gs - 21 * bs + 256) >> 9) + 128;
+                }
+                break;
+        }
+}
+
+// Adds one normalized line to the preview sums
+static void vc_dm_preview_add(struct vc_demosaic *dm, const uint16_t *line, const struct vc_dm_phase *phase)
+{
+        unsigned int scale = dm->params.preview_scale;
+        unsigned int ch_even = phase->first_green ? VC_DM_GREEN : phase->color;
+        unsigned int ch_odd = phase->first_green ? phase->color : VC_DM_GREEN;
+        uint32_t *acc = dm->acc, px, i;
+
+        for (px = 0; px < dm->preview_width; px++, acc += 3) {
+                const uint16_t *p = line + px * scale;
+
+                for (i = 0; i < scale; i += 2) {
+                        acc[ch_even] += p[i];
+                        acc[ch_odd] += p[i + 1];
+                }
+        }
+}
+
+static void vc_dm_preview_emit(struct vc_demosaic *dm, uint8_t *dst)
+{
+        unsigned int scale = dm->params.preview_scale;
+        // Per block: red and blue s*s/4 samples, green s*s/2
+        uint32_t rb = scale * scale / 4, gg = scale * scale / 2;
+        uint16_t *r = dm->planes[0], *g = dm->planes[1], *b = dm->planes[2];
+        uint32_t *acc = dm->acc, px;
+
+        for (px = 0; px < dm->preview_width; px++, acc += 3) {
+                r[px] = (acc[VC_DM_RED] + rb / 2) / rb;
+                g[px] = (acc[VC_DM_GREEN] + gg / 2) / gg;
+                b[px] = (acc[VC_DM_BLUE] + rb / 2) / rb;
+        }
+        vc_dm_output_line(dm, r, g, b, dst, dm->preview_width);
+        memset(dm->acc, 0, (size_t)dm->preview_width * 3 * sizeof(*dm->acc));
+}
+
+// --- Public API --------------------------------------------------------------
+
+void vc_demosaic_set_levels(struct vc_demosaic *dm, uint32_t black_level, const double wb[3])
+{
+        uint32_t max = (1u << dm->pixfmt->bits) - 1;
+        unsigned int i;
+
+        if (black_level >= max)
+                black_level = max - 1;
+        dm->params.black_level = black_level;
+        dm->black = black_level;
+
+        // mulhi((x << shift), gain) = x * gain / 2^bits, full scale after the
+        // black level maps to VC_DM_MAX * wb
+        for (i = 0; i < 3; i++) {
+                double gain = wb[i] * VC_DM_MAX * (double)(1u << dm->pixfmt->bits) / (max - black_level);
+
+                dm->params.wb[i] = wb[i];
+                dm->gains[i] = gain < 0.0 ? 0 : gain > 65535.0 ? 65535 : lround(gain);
+        }
+}
+
+struct vc_demosaic *vc_demosaic_create(const struct vc_format *fmt, const struct vc_demosaic_params *params)
+{
+        struct vc_demosaic *dm;
+        size_t row_size;
+        unsigned int i;
+
+        dm = calloc(1, sizeof(*dm));
+        if (!dm)
+                return NULL;
+
+        dm->fmt = *fmt;
+        dm->params = *params;
+        dm->pixfmt = vc_pixfmt_from_fourcc(fmt->fourcc, &dm->packed);
+        dm->kernels = vc_dm_select_kernels(params->kernel);
+        if (!dm->pixfmt || dm->pixfmt->bayer == VC_BAYER_NONE || !dm->kernels ||
+            fmt->width < 2 || fmt->height < 2 || params->gamma <= 0.0 ||
+            (params->output == VC_DEMOSAIC_YUYV && (fmt->width & 1)) ||
+            (params->preview_scale && params->preview_scale != 2 && params->preview_scale != 4 &&
+             params->preview_scale != 8)) {
+                free(dm);
+                errno = EINVAL;
+                return NULL;
+        }
+        if (!dm->fmt.bytesperline)
+                dm->fmt.bytesperline = vc_pixfmt_line_bytes(dm->pixfmt, dm->packed, fmt->width);
+
+        switch (dm->pixfmt->bayer) {
+        case VC_BAYER_RGGB:
+                dm->phase[0] = (struct vc_dm_phase){ VC_DM_RED, false };
+                dm->phase[1] = (struct vc_dm_phase){ VC_DM_BLUE, true };
+                break;
+        case VC_BAYER_BGGR:
+                dm->phase[0] = (struct vc_dm_phase){ VC_DM_BLUE, false };
+                dm->phase[1] = (struct vc_dm_phase){ VC_DM_RED, true };
+                break;
+        case VC_BAYER_GRBG:
+                dm->phase[0] = (struct vc_dm_phase){ VC_DM_RED, true };
+                dm->phase[1] = (struct vc_dm_phase){ VC_DM_BLUE, false };
+                break;
+        case VC_BAYER_GBRG:
+                dm->phase[0] = (struct vc_dm_phase){ VC_DM_BLUE, true };
+                dm->phase[1] = (struct vc_dm_phase){ VC_DM_RED, false };
+                break;
+        }
+
+        dm->shift = 16 - dm->pixfmt->bits;
+        vc_demosaic_set_levels(dm, params->black_level, params->wb);
+        for (i = 0; i <= VC_DM_MAX; i++)
+                dm->lut[i] = lround(255.0 * pow(i / (double)VC_DM_MAX, 1.0 / params->gamma));
+
+        if (params->preview_scale) {
+                dm->preview_width = fmt->width / params->preview_scale;
+                dm->preview_height = fmt->height / params->preview_scale;
+                dm->acc = calloc((size_t)dm->preview_width * 3 + 1, sizeof(*dm->acc));
+        }
+
+        row_size = (fmt->width + 2 * VC_DM_PAD) * sizeof(uint16_t);
+        for (i = 0; i < 3; i++) {
+                dm->rows[i] = malloc(row_size);
+                dm->planes[i] = malloc(row_size);
+        }
+        dm->unpacked = malloc(row_size);
+        for (i = 0; i < 3; i++) {
+                if (!dm->rows[i] || !dm->planes[i])
+                        break;
+        }
+        if (i < 3 || !dm->unpacked || (params->preview_scale && !dm->acc)) {
+                vc_demosaic_destroy(dm);
+                errno = ENOMEM;
+                return NULL;
+        }
+        for (i = 0; i < 3; i++)
+                memset(dm->rows[i], 0, row_size);
+
+        return dm;
+}
+
+void vc_demosaic_destroy(struct vc_demosaic *dm)
+{
+        unsigned int i;
+
+        if (!dm)
+                return;
+
+        for (i = 0; i < 3; i++) {
+                free(dm->rows[i]);
+                free(dm->planes[i]);
+        }
+        free(dm->unpacked);
+        free(dm->acc);
+        free(dm);
+}
+
+unsigned int vc_demosaic_pixel_bytes(const struct vc_demosaic *dm)
+{
+        return dm->params.output == VC_DEMOSAIC_YUYV ? 2 : 3;
+}
+
+void vc_demosaic_preview_size(const struct vc_demosaic *dm, uint32_t *width, uint32_t *height)
+{
+        *width = dm->preview_width;
+        *height = dm->preview_height;
+}
+
+const char *vc_demosaic_kernel(const struct vc_demosaic *dm)
+{
+        return dm->kernels->name;
+}
+
+// Unpacks, normalizes and pads input line y
+static uint16_t *vc_dm_load_line(struct vc_demosaic *dm, const uint8_t *src, uint32_t y)
+{
+        const struct vc_dm_phase *phase = &dm->phase[y & 1];
+        uint16_t *row = dm->rows[y % 3] + VC_DM_PAD;
+        const uint16_t *line = (const uint16_t *)(src + (size_t)y * dm->fmt.bytesperline);
+        uint16_t gain = dm->gains[phase->color], green = dm->gains[VC_DM_GREEN];
+        uint32_t width = dm->fmt.width;
+
+        // 16 bit containers are read in place
+        if (dm->packed || dm->pixfmt->bits == 8) {
+                vc_pixfmt_unpack_line(dm->pixfmt, dm->packed, (const uint8_t *)line, dm->unpacked, width);
+                line = dm->unpacked;
+        }
+
+        dm->kernels->normalize(line, row, width, dm->black, dm->shift,
+                               phase->first_green ? green : gain, phase->first_green ? gain : green);
+
+        // Mirror at the borders keeps the colour of the neighbours
+        row[-1] = row[1];
+        row[width] = row[width - 2];
+        return row;
+}
+
+int vc_demosaic_process(struct vc_demosaic *dm, const void *src, size_t bytesused,
+                        void *dst, size_t stride, void *preview, size_t preview_stride)
+{
+        uint32_t width = dm->fmt.width, height = dm->fmt.height, y;
+        unsigned int scale = dm->params.preview_scale;
+        uint16_t *lines[3];
+
+        if (bytesused < (size_t)(height - 1) * dm->fmt.bytesperline +
+                        vc_pixfmt_line_bytes(dm->pixfmt, dm->packed, width))
+                return -EINVAL;
+
+        if (preview && dm->acc)
+                memset(dm->acc, 0, (size_t)dm->preview_width * 3 * sizeof(*dm->acc));
+
+        lines[0] = vc_dm_load_line(dm, src, 0);
+        lines[1] = vc_dm_load_line(dm, src, 1);
+
+        for (y = 0; y < height; y++) {
+                const struct vc_dm_phase *phase = &dm->phase[y & 1];
+                uint16_t *up, *cur, *down, *r, *b;
+
+                if (y >= 1 && y + 1 < height)
+                        lines[(y + 1) % 3] = vc_dm_load_line(dm, src, y + 1);
+
+                cur = lines[y % 3];
+                up = y > 0 ? lines[(y - 1) % 3] : lines[1];
+                down = y + 1 < height ? lines[(y + 1) % 3] : lines[(y - 1) % 3];
+
+                dm->kernels->interpolate(up, cur, down, dm->planes[0], dm->planes[1], dm->planes[2],
+                                         width, phase->first_green, dm->params.method == VC_DEMOSAIC_EDGE);
+                r = phase->color == VC_DM_RED ? dm->planes[0] : dm->planes[2];
+                b = phase->color == VC_DM_RED ? dm->planes[2] : dm->planes[0];
+                vc_dm_output_line(dm, r, dm->planes[1], b, (uint8_t *)dst + (size_t)y * stride, width);
+
+                if (preview && dm->acc && y < dm->preview_height * scale) {
+                        vc_dm_preview_add(dm, cur, phase);
+                        if ((y + 1) % scale == 0)
+                                vc_dm_preview_emit(dm, (uint8_t *)preview + (size_t)(y / scale) * preview_stride);
+                }
+        }
+
+        return 0;
+}
@@ -0,0 +1,75 @@
+#ifndef _VC_DEMOSAIC_H
+#define _VC_DEMOSAIC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vc_capture.h"
+
+// Demosaicing of the Bayer formats for platforms without an ISP
+//
+// Every input line is unpacked once, the black level is subtracted and the
+// white balance gain of its colour applied, scaled to 12 bits. Three such
+// lines feed the interpolation: bilinear, or edge-aware where green is
+// interpolated along the smaller gradient (horizontal or vertical) and red
+// and blue bilinear. The result goes through an 8 bit output table (gamma)
+// into RGB24, BGR24 (OpenCV) or YUYV. The 12 bit stages use AVX2 (selected
+// at run time) or SSE2 on x86 and NEON on arm.
+//
+// Optionally a preview scaled down by 2, 4 or 8 is made in the same pass by
+// averaging the colour samples of every block.
+
+enum vc_demosaic_method {
+        VC_DEMOSAIC_BILINEAR,
+        VC_DEMOSAIC_EDGE,               // edge-aware green
+};
+
+enum vc_demosaic_output {
+        VC_DEMOSAIC_RGB24,
+        VC_DEMOSAIC_BGR24,
+        VC_DEMOSAIC_YUYV,               // BT.601 full range, even width
+};
+
+struct vc_demosaic;
+
+struct vc_demosaic_params {
+        enum vc_demosaic_method method;
+        enum vc_demosaic_output output;
+        uint32_t black_level;           // in sample units of the format
+        double wb[3];                   // red, green, blue gain (default 1.0)
+        double gamma;                   // output gamma, 1.0 is linear (default 2.2)
+        unsigned int preview_scale;     // 0: no preview, 2, 4 or 8
+        const char *kernel;             // NULL: fastest, or "scalar", "sse2", "avx2", "neon"
+};
+
+#define VC_DEMOSAIC_PARAMS_DEFAULT                              \
+        {                                                       \
+                .method = VC_DEMOSAIC_BILINEAR,                 \
+                .output = VC_DEMOSAIC_RGB24,                    \
+                .wb = { 1.0, 1.0, 1.0 }, .gamma = 2.2,          \
+        }
+
+// Supports the Bayer formats of vc_pixfmt, packed or in right aligned 16
+// bit containers, of at least 2x2 pixels. Returns NULL with errno EINVAL
+// otherwise, also if the requested kernel is not available on this CPU.
+struct vc_demosaic *vc_demosaic_create(const struct vc_format *fmt, const struct vc_demosaic_params *params);
+void vc_demosaic_destroy(struct vc_demosaic *dm);
+
+// Changes black level and white balance, e.g. from an AWB loop
+void vc_demosaic_set_levels(struct vc_demosaic *dm, uint32_t black_level, const double wb[3]);
+
+// Bytes per output pixel and the preview size (0x0 without preview)
+unsigned int vc_demosaic_pixel_bytes(const struct vc_demosaic *dm);
+void vc_demosaic_preview_size(const struct vc_demosaic *dm, uint32_t *width, uint32_t *height);
+
+// Name of the kernels in use, e.g. "avx2"
+const char *vc_demosaic_kernel(const struct vc_demosaic *dm);
+
+// Demosaics one frame into 'dst' ('stride' bytes per line) and, if set up
+// and 'preview' is not NULL, the preview. Returns 0 or a negative errno
+// (-EINVAL if the frame is shorter than the format).
+int vc_demosaic_process(struct vc_demosaic *dm, const void *src, size_t bytesused,
+                        void *dst, size_t stride, void *preview, size_t preview_stride);
+
+#endif // _VC_DEMOSAIC_H
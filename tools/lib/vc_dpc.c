@@ -0,0 +1,597 @@
+#include "vc_dpc.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vc_pixfmt.h"
+#include "vc_v4l2.h"
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define VC_DPC_NEON                     1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define VC_DPC_SSE2                     1
+#endif
+
+_Static_assert(sizeof(struct vc_dpc_header) == 128, "vc_dpc_header layout changed");
+
+// MAD to standard deviation for normally distributed noise
+#define VC_DPC_MAD_SIGMA                1.4826
+// Residuals sampled for the robust statistics
+#define VC_DPC_MAX_SAMPLES              (1u << 20)
+
+struct vc_dpc {
+        struct vc_dpc_header header;
+        int16_t *offsets;
+        uint32_t *defects;
+
+        // Correction
+        const struct vc_pixfmt *pixfmt;
+        bool packed;
+        uint32_t step;                  // distance to the next pixel of the same colour
+        uint16_t max;
+        bool has_offsets;
+        uint16_t *sub;                  // positive column offsets
+        uint16_t *add;                  // negative column offsets, negated
+        uint16_t *line;
+};
+
+struct vc_dpc_calib {
+        struct vc_dpc_mode mode;
+        struct vc_format fmt;
+        const struct vc_pixfmt *pixfmt;
+        bool packed;
+        uint32_t *sum;
+        uint32_t frames;
+        uint16_t *line;
+        struct vc_ctrl_state ctrls;
+};
+
+// --- Mode --------------------------------------------------------------------
+
+int vc_dpc_mode_read(int subdev_fd, const struct vc_format *fmt, struct vc_dpc_mode *mode)
+{
+        struct v4l2_rect crop;
+        int32_t binning;
+
+        memset(mode, 0, sizeof(*mode));
+        mode->fourcc = fmt->fourcc;
+        mode->width = fmt->width;
+        mode->height = fmt->height;
+        mode->binning_mode = VC_CTRL_UNAVAILABLE;
+
+        if (subdev_fd < 0) {
+                snprintf(mode->sensor_name, sizeof(mode->sensor_name), "unknown");
+                return 0;
+        }
+
+        if (vc_ctrl_get_string(subdev_fd, V4L2_CID_VC_NAME, mode->sensor_name, sizeof(mode->sensor_name)) < 0)
+                snprintf(mode->sensor_name, sizeof(mode->sensor_name), "unknown");
+        if (vc_subdev_get_crop(subdev_fd, 0, &crop) == 0) {
+                mode->crop.left = crop.left;
+                mode->crop.top = crop.top;
+                mode->crop.width = crop.width;
+                mode->crop.height = crop.height;
+        }
+        if (vc_ctrl_get(subdev_fd, V4L2_CID_VC_BINNING_MODE, &binning) == 0)
+                mode->binning_mode = binning;
+
+        return 0;
+}
+
+// Sensor names and fourccs may contain spaces
+static void vc_dpc_sanitize(char *str)
+{
+        for (; *str; str++) {
+                if (!isalnum((unsigned char)*str) && *str != '-')
+                        *str = '_';
+        }
+}
+
+int vc_dpc_path(const char *dir, const struct vc_dpc_mode *mode, char *path, size_t len)
+{
+        char name[VC_SENSOR_NAME_LEN + 1], fcc[5], binning[16] = "";
+        int ret;
+
+        snprintf(name, sizeof(name), "%.*s", (int)sizeof(mode->sensor_name), mode->sensor_name);
+        vc_dpc_sanitize(name);
+        vc_fourcc_str(mode->fourcc, fcc);
+        vc_dpc_sanitize(fcc);
+        if (mode->binning_mode != VC_CTRL_UNAVAILABLE)
+                snprintf(binning, sizeof(binning), "_bin%d", mode->binning_mode);
+
+        ret = snprintf(path, len, "%s/%s_%s_%ux%u_%ux%u+%d+%d%s.vcdpc", dir ? dir : VC_DPC_DIR_DEFAULT,
+                       name, fcc, mode->width, mode->height, mode->crop.width, mode->crop.height,
+                       mode->crop.left, mode->crop.top, binning);
+        return ret < 0 || (size_t)ret >= len ? -ENAMETOOLONG : 0;
+}
+
+// --- Tables ------------------------------------------------------------------
+
+static struct vc_dpc *vc_dpc_alloc(const struct vc_dpc_header *header)
+{
+        struct vc_dpc *dpc;
+        uint32_t width = header->mode.width;
+
+        dpc = calloc(1, sizeof(*dpc));
+        if (!dpc)
+                return NULL;
+
+        dpc->header = *header;
+        dpc->pixfmt = vc_pixfmt_from_fourcc(header->mode.fourcc, &dpc->packed);
+        if (!dpc->pixfmt || !width || !header->mode.height ||
+            header->num_defects > (uint64_t)width * header->mode.height) {
+                free(dpc);
+                errno = EINVAL;
+                return NULL;
+        }
+        dpc->step = dpc->pixfmt->bayer != VC_BAYER_NONE ? 2 : 1;
+        dpc->max = dpc->packed || dpc->pixfmt->bits == 8 ? (1u << dpc->pixfmt->bits) - 1 : 0xffff;
+
+        dpc->offsets = calloc(width, sizeof(*dpc->offsets));
+        dpc->defects = malloc((header->num_defects ? header->num_defects : 1) * sizeof(*dpc->defects));
+        dpc->sub = calloc(width, sizeof(*dpc->sub));
+        dpc->add = calloc(width, sizeof(*dpc->add));
+        dpc->line = malloc(width * sizeof(*dpc->line));
+        if (!dpc->offsets || !dpc->defects || !dpc->sub || !dpc->add || !dpc->line) {
+                vc_dpc_destroy(dpc);
+                errno = ENOMEM;
+                return NULL;
+        }
+
+        return dpc;
+}
+
+// Splits the offsets for the saturating kernel
+static void vc_dpc_prepare(struct vc_dpc *dpc)
+{
+        uint32_t x;
+
+        dpc->has_offsets = false;
+        for (x = 0; x < dpc->header.mode.width; x++) {
+                int16_t offset = dpc->offsets[x];
+
+                dpc->sub[x] = offset > 0 ? offset : 0;
+                dpc->add[x] = offset < 0 ? -offset : 0;
+                if (offset)
+                        dpc->has_offsets = true;
+        }
+}
+
+struct vc_dpc *vc_dpc_load(const char *path)
+{
+        struct vc_dpc_header header;
+        struct vc_dpc *dpc = NULL;
+        uint32_t i;
+        FILE *file;
+        int ret = -EINVAL;
+
+        file = fopen(path, "rb");
+        if (!file)
+                return NULL;
+
+        if (fread(&header, sizeof(header), 1, file) != 1 ||
+            memcmp(header.magic, VC_DPC_MAGIC, sizeof(header.magic)))
+                goto err;
+
+        dpc = vc_dpc_alloc(&header);
+        if (!dpc) {
+                ret = -errno;
+                goto err;
+        }
+
+        if (fread(dpc->offsets, sizeof(*dpc->offsets), header.mode.width, file) != header.mode.width ||
+            fread(dpc->defects, sizeof(*dpc->defects), header.num_defects, file) != header.num_defects)
+                goto err;
+
+        // vc_dpc_apply() walks the defects line by line
+        for (i = 0; i < header.num_defects; i++) {
+                if (dpc->defects[i] >= header.mode.width * header.mode.height ||
+                    (i && dpc->defects[i] <= dpc->defects[i - 1]))
+                        goto err;
+        }
+
+        fclose(file);
+        vc_dpc_prepare(dpc);
+        return dpc;
+
+err:
+        fclose(file);
+        vc_dpc_destroy(dpc);
+        errno = -ret;
+        return NULL;
+}
+
+int vc_dpc_save(const struct vc_dpc *dpc, const char *path)
+{
+        const struct vc_dpc_header *header = &dpc->header;
+        FILE *file;
+        int ret = 0;
+
+        file = fopen(path, "wb");
+        if (!file)
+                return -errno;
+
+        if (fwrite(header, sizeof(*header), 1, file) != 1 ||
+            fwrite(dpc->offsets, sizeof(*dpc->offsets), header->mode.width, file) != header->mode.width ||
+            fwrite(dpc->defects, sizeof(*dpc->defects), header->num_defects, file) != header->num_defects)
+                ret = -EIO;
+        if (fclose(file) != 0 && ret == 0)
+                ret = -errno;
+
+        return ret;
+}
+
+void vc_dpc_destroy(struct vc_dpc *dpc)
+{
+        if (!dpc)
+                return;
+
+        free(dpc->offsets);
+        free(dpc->defects);
+        free(dpc->sub);
+        free(dpc->add);
+        free(dpc->line);
+        free(dpc);
+}
+
+struct vc_dpc *vc_dpc_load_mode(const char *dir, const struct vc_dpc_mode *mode)
+{
+        struct vc_dpc *dpc;
+        char path[512];
+        int ret;
+
+        ret = vc_dpc_path(dir, mode, path, sizeof(path));
+        if (ret < 0) {
+                errno = -ret;
+                return NULL;
+        }
+
+        dpc = vc_dpc_load(path);
+        if (dpc && memcmp(&dpc->header.mode, mode, sizeof(*mode))) {
+                vc_dpc_destroy(dpc);
+                errno = ESTALE;
+                return NULL;
+        }
+        return dpc;
+}
+
+const struct vc_dpc_header *vc_dpc_info(const struct vc_dpc *dpc)
+{
+        return &dpc->header;
+}
+
+const int16_t *vc_dpc_offsets(const struct vc_dpc *dpc)
+{
+        return dpc->offsets;
+}
+
+const uint32_t *vc_dpc_defects(const struct vc_dpc *dpc)
+{
+        return dpc->defects;
+}
+
+// --- Calibration -------------------------------------------------------------
+
+struct vc_dpc_calib *vc_dpc_calib_create(const struct vc_dpc_mode *mode, const struct vc_format *fmt)
+{
+        struct vc_dpc_calib *calib;
+
+        calib = calloc(1, sizeof(*calib));
+        if (!calib)
+                return NULL;
+
+        calib->mode = *mode;
+        calib->fmt = *fmt;
+        calib->pixfmt = vc_pixfmt_from_fourcc(fmt->fourcc, &calib->packed);
+        if (!calib->pixfmt || !fmt->width || !fmt->height ||
+            fmt->fourcc != mode->fourcc || fmt->width != mode->width || fmt->height != mode->height) {
+                free(calib);
+                errno = EINVAL;
+                return NULL;
+        }
+        if (!calib->fmt.bytesperline)
+                calib->fmt.bytesperline = vc_pixfmt_line_bytes(calib->pixfmt, calib->packed, fmt->width);
+
+        calib->sum = calloc((size_t)fmt->width * fmt->height, sizeof(*calib->sum));
+        calib->line = malloc(fmt->width * sizeof(*calib->line));
+        if (!calib->sum || !calib->line) {
+                vc_dpc_calib_destroy(calib);
+                errno = ENOMEM;
+                return NULL;
+        }
+
+        return calib;
+}
+
+void vc_dpc_calib_destroy(struct vc_dpc_calib *calib)
+{
+        if (!calib)
+                return;
+
+        free(calib->sum);
+        free(calib->line);
+        free(calib);
+}
+
+int vc_dpc_calib_add(struct vc_dpc_calib *calib, const struct vc_frame *frame)
+{
+        const struct vc_format *fmt = &calib->fmt;
+        uint32_t x, y;
+
+        if (frame->bytesused < (size_t)fmt->height * fmt->bytesperline)
+                return -EINVAL;
+        // 16 bit samples must not overflow the sums
+        if (calib->frames >= UINT32_MAX >> 16)
+                return -EOVERFLOW;
+
+        for (y = 0; y < fmt->height; y++) {
+                uint32_t *sum = calib->sum + (size_t)y * fmt->width;
+
+                vc_pixfmt_unpack_line(calib->pixfmt, calib->packed,
+                                      (const uint8_t *)frame->data + (size_t)y * fmt->bytesperline,
+                                      calib->line, fmt->width);
+                for (x = 0; x < fmt->width; x++)
+                        sum[x] += calib->line[x];
+        }
+
+        calib->ctrls = frame->ctrls;
+        calib->frames++;
+        return 0;
+}
+
+static int vc_dpc_compare_float(const void *a, const void *b)
+{
+        float fa = *(const float *)a, fb = *(const float *)b;
+
+        return (fa > fb) - (fa < fb);
+}
+
+static float vc_dpc_median(float *values, size_t count)
+{
+        qsort(values, count, sizeof(*values), vc_dpc_compare_float);
+        return values[count / 2];
+}
+
+// Column means of the pixels that are no defects
+static void vc_dpc_columns(const struct vc_dpc_calib *calib, const float *mean, const uint8_t *bad,
+                           double *columns)
+{
+        uint32_t width = calib->fmt.width, height = calib->fmt.height, x, y;
+
+        for (x = 0; x < width; x++) {
+                double sum = 0.0;
+                uint32_t count = 0;
+
+                for (y = 0; y < height; y++) {
+                        size_t i = (size_t)y * width + x;
+
+                        if (!bad[i]) {
+                                sum += mean[i];
+                                count++;
+                        }
+                }
+                columns[x] = count ? sum / count : 0.0;
+        }
+}
+
+// Marks the pixels too far from their column, returns the count
+static uint32_t vc_dpc_mark(const struct vc_dpc_calib *calib, const float *mean, const double *columns,
+                            double center, double threshold, uint8_t *bad)
+{
+        uint32_t width = calib->fmt.width, height = calib->fmt.height, x, y, count = 0;
+
+        for (y = 0; y < height; y++) {
+                for (x = 0; x < width; x++) {
+                        size_t i = (size_t)y * width + x;
+
+                        bad[i] = fabs(mean[i] - columns[x] - center) > threshold;
+                        count += bad[i];
+                }
+        }
+        return count;
+}
+
+struct vc_dpc *vc_dpc_calib_finish(struct vc_dpc_calib *calib, const struct vc_dpc_params *params)
+{
+        uint32_t width = calib->fmt.width, height = calib->fmt.height, x, count;
+        size_t pixels = (size_t)width * height, stride, samples, i;
+        struct vc_dpc_header header;
+        struct vc_dpc *dpc = NULL;
+        double *columns = NULL, level = 0.0, center, threshold;
+        float *mean = NULL, *residuals = NULL;
+        uint8_t *bad = NULL;
+        int ret = -ENOMEM;
+
+        if (!calib->frames) {
+                errno = ENODATA;
+                return NULL;
+        }
+
+        mean = calloc(pixels, sizeof(*mean));
+        bad = calloc(pixels, sizeof(*bad));
+        columns = malloc(width * sizeof(*columns));
+        stride = (pixels + VC_DPC_MAX_SAMPLES - 1) / VC_DPC_MAX_SAMPLES;
+        residuals = malloc((pixels / stride + 1) * sizeof(*residuals));
+        if (!mean || !bad || !columns || !residuals)
+                goto out;
+
+        for (i = 0; i < pixels; i++)
+                mean[i] = (float)calib->sum[i] / calib->frames;
+
+        // First pass over all pixels, the robust statistics keep the defects
+        // from widening the threshold
+        vc_dpc_columns(calib, mean, bad, columns);
+        for (i = 0, samples = 0; i < pixels; i += stride)
+                residuals[samples++] = mean[i] - columns[i % width];
+        center = vc_dpc_median(residuals, samples);
+        for (i = 0; i < samples; i++)
+                residuals[i] = fabsf(residuals[i] - (float)center);
+        threshold = params->sigma * VC_DPC_MAD_SIGMA * vc_dpc_median(residuals, samples);
+        if (threshold < params->min_level * ((1u << calib->pixfmt->bits) - 1))
+                threshold = params->min_level * ((1u << calib->pixfmt->bits) - 1);
+        vc_dpc_mark(calib, mean, columns, center, threshold, bad);
+
+        // Second pass with column means free of defects
+        vc_dpc_columns(calib, mean, bad, columns);
+        count = vc_dpc_mark(calib, mean, columns, center, threshold, bad);
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, VC_DPC_MAGIC, sizeof(header.magic));
+        header.mode = calib->mode;
+        header.exposure = calib->ctrls.exposure;
+        header.gain = calib->ctrls.gain;
+        header.blacklevel = calib->ctrls.blacklevel;
+        header.frames = calib->frames;
+        header.num_defects = count;
+
+        dpc = vc_dpc_alloc(&header);
+        if (!dpc) {
+                ret = -errno;
+                goto out;
+        }
+
+        for (x = 0; x < width; x++)
+                level += columns[x];
+        level /= width;
+        for (x = 0; params->columns && x < width; x++) {
+                long offset = lround(columns[x] - level);
+
+                dpc->offsets[x] = offset < INT16_MIN ? INT16_MIN : offset > INT16_MAX ? INT16_MAX : offset;
+        }
+        for (i = 0, count = 0; i < pixels; i++) {
+                if (bad[i])
+                        dpc->defects[count++] = i;
+        }
+        vc_dpc_prepare(dpc);
+        ret = 0;
+
+out:
+        free(mean);
+        free(bad);
+        free(columns);
+        free(residuals);
+        if (ret < 0) {
+                errno = -ret;
+                return NULL;
+        }
+        return dpc;
+}
+
+// --- Correction --------------------------------------------------------------
+
+// line = min(max(line - sub, 0) + add, max)
+static void vc_dpc_correct_columns(uint16_t *line, const uint16_t *sub, const uint16_t *add,
+                                   uint16_t max, uint32_t width)
+{
+        uint32_t x = 0;
+
+#if VC_DPC_NEON
+        uint16x8_t vmax = vdupq_n_u16(max);
+
+        for (; x + 8 <= width; x += 8) {
+                uint16x8_t v = vqsubq_u16(vld1q_u16(line + x), vld1q_u16(sub + x));
+
+                v = vminq_u16(vqaddq_u16(v, vld1q_u16(add + x)), vmax);
+                vst1q_u16(line + x, v);
+        }
+#elif VC_DPC_SSE2
+        __m128i vmax = _mm_set1_epi16(max);
+
+        for (; x + 8 <= width; x += 8) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(line + x));
+
+                v = _mm_subs_epu16(v, _mm_loadu_si128((const __m128i *)(sub + x)));
+                v = _mm_adds_epu16(v, _mm_loadu_si128((const __m128i *)(add + x)));
+                // SSE2 has no unsigned 16 bit minimum: v - max(v - vmax, 0)
+                v = _mm_sub_epi16(v, _mm_subs_epu16(v, vmax));
+                _mm_storeu_si128((__m128i *)(line + x), v);
+        }
+#endif
+        for (; x < width; x++) {
+                uint32_t v = line[x] > sub[x] ? line[x] - sub[x] : 0;
+
+                v += add[x];
+                line[x] = v > max ? max : v;
+        }
+}
+
+static bool vc_dpc_is_defect(const uint32_t *defects, uint32_t count, uint32_t index)
+{
+        uint32_t i;
+
+        for (i = 0; i < count; i++) {
+                if (defects[i] == index)
+                        return true;
+        }
+        return false;
+}
+
+// Replaces the defects of one line, 'defects' are those of this line
+static void vc_dpc_correct_defects(const struct vc_dpc *dpc, uint16_t *line, const uint32_t *defects,
+                                   uint32_t count, uint32_t line_start)
+{
+        uint32_t width = dpc->header.mode.width, step = dpc->step, i;
+
+        for (i = 0; i < count; i++) {
+                uint32_t x = defects[i] - line_start, sum = 0, n = 0;
+
+                if (x >= step && !vc_dpc_is_defect(defects, count, defects[i] - step)) {
+                        sum += line[x - step];
+                        n++;
+                }
+                if (x + step < width && !vc_dpc_is_defect(defects, count, defects[i] + step)) {
+                        sum += line[x + step];
+                        n++;
+                }
+                if (n)
+                        line[x] = (sum + n / 2) / n;
+        }
+}
+
+int vc_dpc_apply(struct vc_dpc *dpc, const struct vc_format *fmt, void *data, size_t bytesused)
+{
+        const struct vc_dpc_mode *mode = &dpc->header.mode;
+        uint32_t width = mode->width, bpl = fmt->bytesperline, lines, y, d = 0, e;
+        bool direct = !dpc->packed && dpc->pixfmt->bits > 8;
+
+        if (fmt->fourcc != mode->fourcc || fmt->width != width || fmt->height != mode->height)
+                return -EINVAL;
+        if (!bpl)
+                bpl = vc_pixfmt_line_bytes(dpc->pixfmt, dpc->packed, width);
+
+        lines = bytesused / bpl;
+        if (lines > mode->height)
+                lines = mode->height;
+
+        for (y = 0; y < lines; y++) {
+                uint8_t *src = (uint8_t *)data + (size_t)y * bpl;
+                uint32_t line_start = y * width;
+                uint16_t *line;
+
+                for (e = d; e < dpc->header.num_defects && dpc->defects[e] < line_start + width; e++)
+                        ;
+                if (!dpc->has_offsets && e == d)
+                        continue;
+
+                // 16 bit containers are corrected in the buffer itself
+                line = direct ? (uint16_t *)src : dpc->line;
+                if (!direct)
+                        vc_pixfmt_unpack_line(dpc->pixfmt, dpc->packed, src, line, width);
+
+                if (dpc->has_offsets)
+                        vc_dpc_correct_columns(line, dpc->sub, dpc->add, dpc->max, width);
+                vc_dpc_correct_defects(dpc, line, dpc->defects + d, e - d, line_start);
+
+                if (!direct)
+                        vc_pixfmt_pack_line(dpc->pixfmt, dpc->packed, line, src, width);
+                d = e;
+        }
+
+        return 0;
+}
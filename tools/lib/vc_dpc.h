@@ -0,0 +1,111 @@
+#ifndef _VC_DPC_H
+#define _VC_DPC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vc_capture.h"
+
+// Defect pixel and column fixed pattern correction for raw pipelines
+//
+// The calibration averages dark frames (lens covered, at the exposure, gain
+// and black level the camera is used with). The mean of every column minus
+// the mean of the frame is the column offset. Pixels whose mean differs from
+// their column by more than 'sigma' times the robust spread (MAD) of all
+// pixels, and by at least 'min_level', are defects. Dead pixels only show up
+// in a flat field and are not detected.
+//
+// The correction runs in place: it subtracts the column offsets with
+// saturation (NEON or SSE2) and replaces every defect by the mean of its
+// same-colour neighbours on the line. 16 bit containers are corrected
+// directly, 8 bit and CSI-2 packed lines through vc_pixfmt.
+//
+// A table only fits the sensor mode it was taken in. The tables live in one
+// directory, named after the sensor (V4L2_CID_VC_NAME), format, sensor crop
+// and binning mode, see vc_dpc_path().
+
+#define VC_DPC_MAGIC                    "VCDPC001"
+#define VC_DPC_DIR_DEFAULT              "/var/lib/vc_mipi/dpc"
+
+struct vc_dpc;
+struct vc_dpc_calib;
+
+struct vc_dpc_mode {
+        char sensor_name[VC_SENSOR_NAME_LEN];
+        uint32_t fourcc;
+        uint32_t width;
+        uint32_t height;
+        struct {
+                int32_t left;
+                int32_t top;
+                uint32_t width;
+                uint32_t height;
+        } crop;
+        int32_t binning_mode;           // VC_CTRL_UNAVAILABLE if the sensor has none
+} __attribute__((packed));
+
+// File layout: header, int16_t offsets[width], uint32_t defects[num_defects]
+// (y * width + x, ascending). All fields are little endian.
+struct vc_dpc_header {
+        char magic[8];
+        struct vc_dpc_mode mode;
+        int32_t exposure;               // calibration conditions
+        int32_t gain;
+        int32_t blacklevel;
+        uint32_t frames;
+        uint32_t num_defects;
+        uint8_t reserved[36];
+} __attribute__((packed));
+
+struct vc_dpc_params {
+        double sigma;                   // defect threshold in robust sigmas (default 6)
+        double min_level;               // minimum deviation, fraction of full scale (default 0.01)
+        bool columns;                   // estimate column offsets (default true)
+};
+
+#define VC_DPC_PARAMS_DEFAULT           { .sigma = 6.0, .min_level = 0.01, .columns = true }
+
+// --- Mode --------------------------------------------------------------------
+
+// Fills the mode from the sensor subdevice and the capture format.
+int vc_dpc_mode_read(int subdev_fd, const struct vc_format *fmt, struct vc_dpc_mode *mode);
+
+// Table file name of a mode, e.g.
+// <dir>/IMX296_pRAA_1440x1080_1440x1080+0+0_bin0.vcdpc (size, crop, binning)
+int vc_dpc_path(const char *dir, const struct vc_dpc_mode *mode, char *path, size_t len);
+
+// --- Calibration -------------------------------------------------------------
+
+// Supports the mono and Bayer formats of vc_pixfmt. Returns NULL with errno
+// EINVAL for other formats.
+struct vc_dpc_calib *vc_dpc_calib_create(const struct vc_dpc_mode *mode, const struct vc_format *fmt);
+void vc_dpc_calib_destroy(struct vc_dpc_calib *calib);
+
+// Adds one dark frame, its control state is stored as the calibration
+// conditions.
+int vc_dpc_calib_add(struct vc_dpc_calib *calib, const struct vc_frame *frame);
+
+// Builds the table from the frames added so far.
+struct vc_dpc *vc_dpc_calib_finish(struct vc_dpc_calib *calib, const struct vc_dpc_params *params);
+
+// --- Tables ------------------------------------------------------------------
+
+struct vc_dpc *vc_dpc_load(const char *path);
+int vc_dpc_save(const struct vc_dpc *dpc, const char *path);
+void vc_dpc_destroy(struct vc_dpc *dpc);
+
+// Loads the table of 'mode' from 'dir'. Fails with errno ENOENT if there is
+// none and ESTALE if the file belongs to another mode.
+struct vc_dpc *vc_dpc_load_mode(const char *dir, const struct vc_dpc_mode *mode);
+
+const struct vc_dpc_header *vc_dpc_info(const struct vc_dpc *dpc);
+const int16_t *vc_dpc_offsets(const struct vc_dpc *dpc);
+const uint32_t *vc_dpc_defects(const struct vc_dpc *dpc);
+
+// --- Correction --------------------------------------------------------------
+
+// Corrects one frame in place. 'fmt' must match the mode of the table.
+int vc_dpc_apply(struct vc_dpc *dpc, const struct vc_format *fmt, void *data, size_t bytesused);
+
+#endif // _VC_DPC_H
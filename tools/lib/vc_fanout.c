@@ -0,0 +1,291 @@
+#include "vc_fanout.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/dma-buf.h>
+
+struct vc_fanout_client {
+        int sock;
+        struct vc_format fmt;
+        unsigned int depth;
+        bool dmabuf;
+        int fds[VC_CAPTURE_MAX_BUFFERS];
+        void *maps[VC_CAPTURE_MAX_BUFFERS];
+        size_t lengths[VC_CAPTURE_MAX_BUFFERS];
+        unsigned int num_buffers;
+        uint32_t last_sequence;
+        bool have_sequence;
+        struct vc_fanout_client_stats stats;
+};
+
+// --- Protocol ----------------------------------------------------------------
+
+int vc_fanout_send(int sock, const struct vc_fanout_msg *msg, const int *fds, unsigned int num_fds)
+{
+        char control[CMSG_SPACE(sizeof(int) * VC_CAPTURE_MAX_BUFFERS)] = { 0 };
+        struct iovec iov = { .iov_base = (void *)msg, .iov_len = sizeof(*msg) };
+        struct msghdr hdr = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+        if (num_fds > VC_CAPTURE_MAX_BUFFERS)
+                return -EINVAL;
+
+        if (num_fds) {
+                struct cmsghdr *cmsg;
+
+                hdr.msg_control = control;
+                hdr.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+                cmsg = CMSG_FIRSTHDR(&hdr);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_RIGHTS;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+                memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * num_fds);
+        }
+
+        if (sendmsg(sock, &hdr, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+                return -errno;
+        return 0;
+}
+
+int vc_fanout_recv(int sock, struct vc_fanout_msg *msg, int *fds, unsigned int *num_fds)
+{
+        char control[CMSG_SPACE(sizeof(int) * VC_CAPTURE_MAX_BUFFERS)];
+        struct iovec iov = { .iov_base = msg, .iov_len = sizeof(*msg) };
+        struct msghdr hdr = {
+                .msg_iov = &iov,
+                .msg_iovlen = 1,
+                .msg_control = control,
+                .msg_controllen = sizeof(control),
+        };
+        struct cmsghdr *cmsg;
+        ssize_t len;
+
+        if (num_fds)
+                *num_fds = 0;
+
+        len = recvmsg(sock, &hdr, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if (len < 0)
+                return -errno;
+        if (len == 0)
+                return -ECONNRESET;
+
+        for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+                unsigned int count, i;
+
+                if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+                        continue;
+                count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (i = 0; i < count; i++) {
+                        int fd;
+
+                        memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                        if (fds && num_fds && *num_fds < VC_CAPTURE_MAX_BUFFERS)
+                                fds[(*num_fds)++] = fd;
+                        else
+                                close(fd);
+                }
+        }
+
+        if ((size_t)len < sizeof(*msg))
+                return -EPROTO;
+        return 0;
+}
+
+// Waits for and receives one message
+static int vc_fanout_wait(int sock, struct vc_fanout_msg *msg, int *fds, unsigned int *num_fds,
+                          int timeout_ms)
+{
+        struct pollfd pfd = { .fd = sock, .events = POLLIN };
+        int ret;
+
+        for (;;) {
+                ret = vc_fanout_recv(sock, msg, fds, num_fds);
+                if (ret != -EAGAIN)
+                        return ret;
+
+                ret = poll(&pfd, 1, timeout_ms);
+                if (ret < 0 && errno != EINTR)
+                        return -errno;
+                if (ret == 0)
+                        return -ETIMEDOUT;
+        }
+}
+
+// --- Client ------------------------------------------------------------------
+
+static void vc_fanout_dmabuf_sync(struct vc_fanout_client *client, unsigned int index, uint64_t flags)
+{
+        struct dma_buf_sync sync = { .flags = flags | DMA_BUF_SYNC_READ };
+
+        if (client->dmabuf)
+                ioctl(client->fds[index], DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+static void vc_fanout_unmap(struct vc_fanout_client *client)
+{
+        unsigned int i;
+
+        for (i = 0; i < client->num_buffers; i++) {
+                if (client->maps[i])
+                        munmap(client->maps[i], client->lengths[i]);
+                close(client->fds[i]);
+        }
+        client->num_buffers = 0;
+}
+
+struct vc_fanout_client *vc_fanout_connect(const char *path, const char *name,
+                                           enum vc_fanout_policy policy, unsigned int depth)
+{
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        struct vc_fanout_msg msg = { .type = VC_FANOUT_MSG_SUBSCRIBE };
+        struct vc_fanout_client *client;
+        unsigned int num_fds, i;
+        int ret;
+
+        client = calloc(1, sizeof(*client));
+        if (!client)
+                return NULL;
+        vc_hist_reset(&client->stats.latency);
+
+        client->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (client->sock < 0) {
+                ret = -errno;
+                goto err_free;
+        }
+
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path ? path : VC_FANOUT_SOCKET_DEFAULT);
+        if (connect(client->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+                ret = -errno;
+                goto err_close;
+        }
+
+        msg.subscribe.policy = policy;
+        msg.subscribe.depth = depth;
+        snprintf(msg.subscribe.name, sizeof(msg.subscribe.name), "%s", name ? name : "client");
+        ret = vc_fanout_send(client->sock, &msg, NULL, 0);
+        if (ret < 0)
+                goto err_close;
+
+        ret = vc_fanout_wait(client->sock, &msg, client->fds, &num_fds, 5000);
+        if (ret < 0)
+                goto err_close;
+        client->num_buffers = num_fds;
+        if (msg.type != VC_FANOUT_MSG_SETUP || num_fds != msg.setup.num_buffers || !msg.setup.depth) {
+                ret = msg.type == VC_FANOUT_MSG_SETUP && !msg.setup.depth ? -EBUSY : -EPROTO;
+                goto err_unmap;
+        }
+
+        client->fmt = msg.setup.format;
+        client->depth = msg.setup.depth;
+        client->dmabuf = msg.setup.dmabuf;
+        for (i = 0; i < num_fds; i++) {
+                client->lengths[i] = msg.setup.lengths[i];
+                client->maps[i] = mmap(NULL, client->lengths[i], PROT_READ, MAP_SHARED, client->fds[i], 0);
+                if (client->maps[i] == MAP_FAILED) {
+                        client->maps[i] = NULL;
+                        ret = -errno;
+                        goto err_unmap;
+                }
+        }
+
+        return client;
+
+err_unmap:
+        vc_fanout_unmap(client);
+err_close:
+        close(client->sock);
+err_free:
+        free(client);
+        errno = -ret;
+        return NULL;
+}
+
+void vc_fanout_disconnect(struct vc_fanout_client *client)
+{
+        if (!client)
+                return;
+
+        // The server drops the references of the client with the socket
+        close(client->sock);
+        vc_fanout_unmap(client);
+        free(client);
+}
+
+int vc_fanout_get_format(struct vc_fanout_client *client, struct vc_format *fmt)
+{
+        *fmt = client->fmt;
+        return 0;
+}
+
+unsigned int vc_fanout_get_depth(struct vc_fanout_client *client)
+{
+        return client->depth;
+}
+
+int vc_fanout_fd(struct vc_fanout_client *client)
+{
+        return client->sock;
+}
+
+int vc_fanout_dequeue(struct vc_fanout_client *client, struct vc_frame *frame, int timeout_ms)
+{
+        struct vc_fanout_client_stats *stats = &client->stats;
+        struct vc_fanout_msg msg;
+        uint64_t now_ns;
+        int ret;
+
+        do {
+                ret = vc_fanout_wait(client->sock, &msg, NULL, NULL, timeout_ms);
+                if (ret < 0)
+                        return ret;
+        } while (msg.type != VC_FANOUT_MSG_FRAME);
+
+        if (msg.frame.index >= client->num_buffers)
+                return -EPROTO;
+
+        vc_fanout_dmabuf_sync(client, msg.frame.index, DMA_BUF_SYNC_START);
+
+        frame->data = client->maps[msg.frame.index];
+        frame->bytesused = msg.frame.bytesused;
+        frame->index = msg.frame.index;
+        frame->sequence = msg.frame.sequence;
+        frame->timestamp_ns = msg.frame.timestamp_ns;
+        frame->flags = msg.frame.flags;
+        frame->ctrls = msg.frame.ctrls;
+
+        now_ns = vc_clock_ns(CLOCK_MONOTONIC);
+        stats->frames++;
+        if (client->have_sequence && frame->sequence > client->last_sequence + 1)
+                stats->gaps += frame->sequence - client->last_sequence - 1;
+        client->last_sequence = frame->sequence;
+        client->have_sequence = true;
+        if (frame->timestamp_ns && now_ns >= frame->timestamp_ns)
+                vc_hist_add(&stats->latency, now_ns - frame->timestamp_ns);
+
+        return 0;
+}
+
+int vc_fanout_release(struct vc_fanout_client *client, const struct vc_frame *frame)
+{
+        struct vc_fanout_msg msg = { .type = VC_FANOUT_MSG_RELEASE };
+
+        if (frame->index >= client->num_buffers)
+                return -EINVAL;
+
+        vc_fanout_dmabuf_sync(client, frame->index, DMA_BUF_SYNC_END);
+        msg.release.index = frame->index;
+        return vc_fanout_send(client->sock, &msg, NULL, 0);
+}
+
+const struct vc_fanout_client_stats *vc_fanout_get_stats(struct vc_fanout_client *client)
+{
+        return &client->stats;
+}
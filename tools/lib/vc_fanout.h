@@ -0,0 +1,101 @@
+#ifndef _VC_FANOUT_H
+#define _VC_FANOUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vc_capture.h"
+#include "vc_stats.h"
+
+// Frame fan-out to several local processes
+//
+// The vc_fanout server owns the video node. At subscription it passes the
+// capture buffers to the client as DMABUF file descriptors (memfd for replay)
+// over a Unix SOCK_SEQPACKET socket, the client maps them once. For every
+// frame only a small message with the buffer index is sent, there is no copy
+// per client. A buffer goes back to the driver when the last client released
+// it. A client that holds 'depth' frames gets no new ones until it releases
+// one (VC_FANOUT_POLICY_DROP) or is disconnected (VC_FANOUT_POLICY_DISCONNECT),
+// so a slow client never stalls the capture or the other clients.
+
+#define VC_FANOUT_SOCKET_DEFAULT        "/tmp/vc_fanout.sock"
+#define VC_FANOUT_NAME_LEN              32
+
+enum vc_fanout_policy {
+        VC_FANOUT_POLICY_DROP,          // skip frames while the client is full
+        VC_FANOUT_POLICY_DISCONNECT,    // disconnect a client that falls behind
+};
+
+// --- Protocol ----------------------------------------------------------------
+
+enum vc_fanout_msg_type {
+        VC_FANOUT_MSG_SUBSCRIBE = 1,    // client -> server
+        VC_FANOUT_MSG_SETUP,            // server -> client, buffer fds attached
+        VC_FANOUT_MSG_FRAME,            // server -> client
+        VC_FANOUT_MSG_RELEASE,          // client -> server
+};
+
+struct vc_fanout_msg {
+        uint32_t type;
+        union {
+                struct {
+                        uint32_t policy;
+                        uint32_t depth;
+                        char name[VC_FANOUT_NAME_LEN];
+                } subscribe;
+                struct {
+                        struct vc_format format;
+                        uint32_t num_buffers;
+                        uint32_t depth;         // granted, may be lower than requested
+                        uint32_t dmabuf;        // 1: DMABUF, 0: memfd
+                        uint32_t lengths[VC_CAPTURE_MAX_BUFFERS];
+                } setup;
+                struct {
+                        uint32_t index;
+                        uint32_t sequence;
+                        uint64_t timestamp_ns;
+                        uint32_t bytesused;
+                        uint32_t flags;
+                        struct vc_ctrl_state ctrls;
+                } frame;
+                struct {
+                        uint32_t index;
+                } release;
+        };
+};
+
+// Send / receive one message with up to VC_CAPTURE_MAX_BUFFERS descriptors.
+// vc_fanout_recv() returns -ECONNRESET when the peer closed the socket.
+int vc_fanout_send(int sock, const struct vc_fanout_msg *msg, const int *fds, unsigned int num_fds);
+int vc_fanout_recv(int sock, struct vc_fanout_msg *msg, int *fds, unsigned int *num_fds);
+
+// --- Client ------------------------------------------------------------------
+
+struct vc_fanout_client;
+
+struct vc_fanout_client_stats {
+        uint64_t frames;
+        uint64_t gaps;                  // frames missing in the sequence (server or sensor drops)
+        struct vc_histogram latency;    // dequeue time - frame timestamp
+};
+
+// Connects and subscribes. 'depth' is the number of frames the client may
+// hold at the same time, the server may grant fewer.
+struct vc_fanout_client *vc_fanout_connect(const char *path, const char *name,
+                                           enum vc_fanout_policy policy, unsigned int depth);
+void vc_fanout_disconnect(struct vc_fanout_client *client);
+
+int vc_fanout_get_format(struct vc_fanout_client *client, struct vc_format *fmt);
+unsigned int vc_fanout_get_depth(struct vc_fanout_client *client);
+int vc_fanout_fd(struct vc_fanout_client *client);
+
+// Same contract as vc_capture_dequeue() / vc_capture_release(). The frame
+// data stays valid until it is released. Returns -ECONNRESET when the server
+// went away.
+int vc_fanout_dequeue(struct vc_fanout_client *client, struct vc_frame *frame, int timeout_ms);
+int vc_fanout_release(struct vc_fanout_client *client, const struct vc_frame *frame);
+
+const struct vc_fanout_client_stats *vc_fanout_get_stats(struct vc_fanout_client *client);
+
+#endif // _VC_FANOUT_H
@@ -0,0 +1,376 @@
+#include "vc_media.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include "vc_v4l2.h"
+
+#define VC_MEDIA_TOPOLOGY_RETRIES       4
+
+static const char *const vc_media_frontends[] = {
+        "rp1-cfe-csi2_ch0",             // bcm2712
+        "unicam-image",                 // bcm2711, bcm2837, rp3a0
+};
+
+static void vc_media_free_topology(struct vc_media *media)
+{
+        free(media->entities);
+        free(media->interfaces);
+        free(media->pads);
+        free(media->links);
+        media->entities = NULL;
+        media->interfaces = NULL;
+        media->pads = NULL;
+        media->links = NULL;
+}
+
+static int vc_media_read_topology(struct vc_media *media)
+{
+        struct media_v2_topology topo;
+        unsigned int retry;
+        int ret;
+
+        // The graph may change between the two calls (hotplug), then retry
+        for (retry = 0; retry < VC_MEDIA_TOPOLOGY_RETRIES; retry++) {
+                uint64_t version;
+
+                memset(&topo, 0, sizeof(topo));
+                ret = vc_xioctl(media->fd, MEDIA_IOC_G_TOPOLOGY, &topo);
+                if (ret < 0)
+                        return ret;
+                version = topo.topology_version;
+
+                vc_media_free_topology(media);
+                media->entities = calloc(topo.num_entities + 1, sizeof(*media->entities));
+                media->interfaces = calloc(topo.num_interfaces + 1, sizeof(*media->interfaces));
+                media->pads = calloc(topo.num_pads + 1, sizeof(*media->pads));
+                media->links = calloc(topo.num_links + 1, sizeof(*media->links));
+                if (!media->entities || !media->interfaces || !media->pads || !media->links)
+                        return -ENOMEM;
+
+                topo.ptr_entities = (uintptr_t)media->entities;
+                topo.ptr_interfaces = (uintptr_t)media->interfaces;
+                topo.ptr_pads = (uintptr_t)media->pads;
+                topo.ptr_links = (uintptr_t)media->links;
+                ret = vc_xioctl(media->fd, MEDIA_IOC_G_TOPOLOGY, &topo);
+                if (ret < 0 && ret != -ENOSPC)
+                        return ret;
+                if (ret == 0 && topo.topology_version == version) {
+                        media->num_entities = topo.num_entities;
+                        media->num_interfaces = topo.num_interfaces;
+                        media->num_pads = topo.num_pads;
+                        media->num_links = topo.num_links;
+                        return 0;
+                }
+        }
+
+        return -EAGAIN;
+}
+
+struct vc_media *vc_media_open(const char *path)
+{
+        struct vc_media *media;
+        int ret;
+
+        media = calloc(1, sizeof(*media));
+        if (!media)
+                return NULL;
+        snprintf(media->path, sizeof(media->path), "%s", path);
+
+        media->fd = open(path, O_RDWR | O_CLOEXEC);
+        if (media->fd < 0) {
+                ret = -errno;
+                goto err_free;
+        }
+
+        ret = vc_xioctl(media->fd, MEDIA_IOC_DEVICE_INFO, &media->info);
+        if (ret < 0)
+                goto err_close;
+
+        ret = vc_media_read_topology(media);
+        if (ret < 0)
+                goto err_close;
+
+        return media;
+
+err_close:
+        vc_media_free_topology(media);
+        close(media->fd);
+err_free:
+        free(media);
+        errno = -ret;
+        return NULL;
+}
+
+void vc_media_close(struct vc_media *media)
+{
+        if (!media)
+                return;
+
+        vc_media_free_topology(media);
+        close(media->fd);
+        free(media);
+}
+
+// --- Lookup ------------------------------------------------------------------
+
+const struct media_v2_entity *vc_media_find_entity(const struct vc_media *media, const char *name)
+{
+        uint32_t i;
+
+        for (i = 0; i < media->num_entities; i++) {
+                if (strstr(media->entities[i].name, name))
+                        return &media->entities[i];
+        }
+        return NULL;
+}
+
+const struct media_v2_entity *vc_media_get_entity(const struct vc_media *media, uint32_t id)
+{
+        uint32_t i;
+
+        for (i = 0; i < media->num_entities; i++) {
+                if (media->entities[i].id == id)
+                        return &media->entities[i];
+        }
+        return NULL;
+}
+
+const struct media_v2_pad *vc_media_get_pad(const struct vc_media *media, uint32_t id)
+{
+        uint32_t i;
+
+        for (i = 0; i < media->num_pads; i++) {
+                if (media->pads[i].id == id)
+                        return &media->pads[i];
+        }
+        return NULL;
+}
+
+static uint32_t vc_media_pad_index(const struct vc_media *media, const struct media_v2_pad *pad)
+{
+        uint32_t i, index = 0;
+
+        if (MEDIA_V2_PAD_HAS_INDEX(media->info.media_version))
+                return pad->index;
+
+        // Older kernels list the pads of an entity in index order
+        for (i = 0; i < media->num_pads && &media->pads[i] != pad; i++) {
+                if (media->pads[i].entity_id == pad->entity_id)
+                        index++;
+        }
+        return index;
+}
+
+static const struct media_v2_interface *vc_media_entity_interface(const struct vc_media *media,
+                                                                  uint32_t entity_id)
+{
+        uint32_t i, j;
+
+        for (i = 0; i < media->num_links; i++) {
+                const struct media_v2_link *link = &media->links[i];
+
+                if ((link->flags & MEDIA_LNK_FL_LINK_TYPE) != MEDIA_LNK_FL_INTERFACE_LINK ||
+                    link->sink_id != entity_id)
+                        continue;
+
+                for (j = 0; j < media->num_interfaces; j++) {
+                        if (media->interfaces[j].id == link->source_id)
+                                return &media->interfaces[j];
+                }
+        }
+        return NULL;
+}
+
+int vc_media_entity_devnode(const struct vc_media *media, uint32_t entity_id, char *path, size_t len)
+{
+        const struct media_v2_interface *intf;
+        char uevent[64], line[128];
+        FILE *file;
+        int ret = -ENOENT;
+
+        intf = vc_media_entity_interface(media, entity_id);
+        if (!intf)
+                return -ENOENT;
+
+        snprintf(uevent, sizeof(uevent), "/sys/dev/char/%u:%u/uevent", intf->devnode.major, intf->devnode.minor);
+        file = fopen(uevent, "r");
+        if (!file)
+                return -errno;
+
+        while (fgets(line, sizeof(line), file)) {
+                if (strncmp(line, "DEVNAME=", 8) == 0) {
+                        line[strcspn(line, "\n")] = '\0';
+                        snprintf(path, len, "/dev/%s", line + 8);
+                        ret = 0;
+                        break;
+                }
+        }
+
+        fclose(file);
+        return ret;
+}
+
+const struct media_v2_entity *vc_media_find_entity_by_devnode(const struct vc_media *media,
+                                                              const char *devnode)
+{
+        struct stat st;
+        uint32_t i;
+
+        if (stat(devnode, &st) < 0 || !S_ISCHR(st.st_mode))
+                return NULL;
+
+        for (i = 0; i < media->num_entities; i++) {
+                const struct media_v2_interface *intf;
+
+                intf = vc_media_entity_interface(media, media->entities[i].id);
+                if (!intf)
+                        continue;
+                if (intf->devnode.major == major(st.st_rdev) && intf->devnode.minor == minor(st.st_rdev))
+                        return &media->entities[i];
+        }
+        return NULL;
+}
+
+const struct media_v2_link *vc_media_find_link(const struct vc_media *media, uint32_t source, uint32_t sink,
+                                               uint32_t *source_pad, uint32_t *sink_pad)
+{
+        uint32_t i;
+
+        for (i = 0; i < media->num_links; i++) {
+                const struct media_v2_link *link = &media->links[i];
+                const struct media_v2_pad *src, *dst;
+
+                if ((link->flags & MEDIA_LNK_FL_LINK_TYPE) != MEDIA_LNK_FL_DATA_LINK)
+                        continue;
+
+                src = vc_media_get_pad(media, link->source_id);
+                dst = vc_media_get_pad(media, link->sink_id);
+                if (!src || !dst || src->entity_id != source || dst->entity_id != sink)
+                        continue;
+
+                if (source_pad)
+                        *source_pad = vc_media_pad_index(media, src);
+                if (sink_pad)
+                        *sink_pad = vc_media_pad_index(media, dst);
+                return link;
+        }
+        return NULL;
+}
+
+// --- Links -------------------------------------------------------------------
+
+int vc_media_setup_link(struct vc_media *media, const struct media_v2_link *link, bool enable)
+{
+        const struct media_v2_pad *src, *dst;
+        struct media_link_desc desc;
+        int ret;
+
+        if (link->flags & MEDIA_LNK_FL_IMMUTABLE)
+                return enable ? 0 : -EPERM;
+
+        src = vc_media_get_pad(media, link->source_id);
+        dst = vc_media_get_pad(media, link->sink_id);
+        if (!src || !dst)
+                return -EINVAL;
+
+        memset(&desc, 0, sizeof(desc));
+        desc.source.entity = src->entity_id;
+        desc.source.index = vc_media_pad_index(media, src);
+        desc.sink.entity = dst->entity_id;
+        desc.sink.index = vc_media_pad_index(media, dst);
+        desc.flags = enable ? MEDIA_LNK_FL_ENABLED : 0;
+
+        ret = vc_xioctl(media->fd, MEDIA_IOC_SETUP_LINK, &desc);
+        if (ret < 0)
+                return ret;
+
+        // Keep the cached graph in sync
+        media->links[link - media->links].flags =
+                (link->flags & ~MEDIA_LNK_FL_ENABLED) | (enable ? MEDIA_LNK_FL_ENABLED : 0);
+        return 0;
+}
+
+int vc_media_reset_links(struct vc_media *media)
+{
+        uint32_t i;
+        int ret;
+
+        for (i = 0; i < media->num_links; i++) {
+                const struct media_v2_link *link = &media->links[i];
+
+                if ((link->flags & MEDIA_LNK_FL_LINK_TYPE) != MEDIA_LNK_FL_DATA_LINK ||
+                    (link->flags & MEDIA_LNK_FL_IMMUTABLE) || !(link->flags & MEDIA_LNK_FL_ENABLED))
+                        continue;
+
+                ret = vc_media_setup_link(media, link, false);
+                if (ret < 0)
+                        return ret;
+        }
+        return 0;
+}
+
+// --- Routing -----------------------------------------------------------------
+
+const struct media_v2_entity *vc_media_find_frontend(const struct vc_media *media)
+{
+        const struct media_v2_entity *frontend = NULL;
+        size_t i;
+
+        for (i = 0; i < sizeof(vc_media_frontends) / sizeof(vc_media_frontends[0]) && !frontend; i++)
+                frontend = vc_media_find_entity(media, vc_media_frontends[i]);
+        return frontend;
+}
+
+int vc_media_route_sensor(struct vc_media *media, uint32_t sensor_id, uint32_t frontend_id,
+                          const struct v4l2_mbus_framefmt *sensor_fmt, uint32_t source_code)
+{
+        const struct media_v2_entity *csi2;
+        const struct media_v2_link *link;
+        struct v4l2_mbus_framefmt fmt;
+        uint32_t src_pad, sink_pad;
+        char subdev[64];
+        int fd, ret;
+
+        csi2 = vc_media_find_entity(media, "csi2");
+        if (!csi2 || csi2->id == frontend_id || !vc_media_find_link(media, sensor_id, csi2->id, NULL, &sink_pad)) {
+                link = vc_media_find_link(media, sensor_id, frontend_id, NULL, NULL);
+                return link ? vc_media_setup_link(media, link, true) : -ENODEV;
+        }
+
+        // Raspberry Pi 5: sensor -> csi2 -> rp1-cfe
+        link = vc_media_find_link(media, csi2->id, frontend_id, &src_pad, NULL);
+        if (!link)
+                return -ENODEV;
+
+        ret = vc_media_entity_devnode(media, csi2->id, subdev, sizeof(subdev));
+        if (ret < 0)
+                return ret;
+        fd = open(subdev, O_RDWR | O_CLOEXEC);
+        if (fd < 0)
+                return -errno;
+
+        fmt = *sensor_fmt;
+        ret = vc_subdev_set_fmt(fd, sink_pad, &fmt);
+        if (ret == 0) {
+                // The CSI-2 output may carry the unpacked format chosen for the video node
+                fmt = *sensor_fmt;
+                if (source_code)
+                        fmt.code = source_code;
+                ret = vc_subdev_set_fmt(fd, src_pad, &fmt);
+        }
+        close(fd);
+        if (ret < 0)
+                return ret;
+
+        ret = vc_media_setup_link(media, vc_media_find_link(media, sensor_id, csi2->id, NULL, NULL), true);
+        if (ret == 0)
+                ret = vc_media_setup_link(media, link, true);
+        return ret;
+}
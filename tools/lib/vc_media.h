@@ -0,0 +1,62 @@
+#ifndef _VC_MEDIA_H
+#define _VC_MEDIA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/media.h>
+#include <linux/v4l2-mediabus.h>
+
+// Media controller graph, read once with MEDIA_IOC_G_TOPOLOGY
+struct vc_media {
+        int fd;
+        char path[32];
+        struct media_device_info info;
+        struct media_v2_entity *entities;
+        struct media_v2_interface *interfaces;
+        struct media_v2_pad *pads;
+        struct media_v2_link *links;
+        uint32_t num_entities;
+        uint32_t num_interfaces;
+        uint32_t num_pads;
+        uint32_t num_links;
+};
+
+struct vc_media *vc_media_open(const char *path);
+void vc_media_close(struct vc_media *media);
+
+// First entity whose name contains 'name'
+const struct media_v2_entity *vc_media_find_entity(const struct vc_media *media, const char *name);
+const struct media_v2_entity *vc_media_get_entity(const struct vc_media *media, uint32_t id);
+const struct media_v2_pad *vc_media_get_pad(const struct vc_media *media, uint32_t id);
+
+// Entity that is accessed through the device node 'devnode' (/dev/...)
+const struct media_v2_entity *vc_media_find_entity_by_devnode(const struct vc_media *media,
+                                                              const char *devnode);
+// Device node (/dev/...) of an entity, returns 0 or -ENOENT
+int vc_media_entity_devnode(const struct vc_media *media, uint32_t entity_id, char *path, size_t len);
+
+// Data link from any pad of 'source' to any pad of 'sink', NULL if none.
+// 'source_pad' / 'sink_pad' return the pad indices.
+const struct media_v2_link *vc_media_find_link(const struct vc_media *media, uint32_t source, uint32_t sink,
+                                               uint32_t *source_pad, uint32_t *sink_pad);
+
+int vc_media_setup_link(struct vc_media *media, const struct media_v2_link *link, bool enable);
+
+// Disables all links that are not immutable, like media-ctl -r
+int vc_media_reset_links(struct vc_media *media);
+
+// Receiver entity of the Raspberry Pi platforms: rp1-cfe-csi2_ch0 (bcm2712)
+// or unicam-image (bcm2711, bcm2837, rp3a0), NULL if there is none
+const struct media_v2_entity *vc_media_find_frontend(const struct vc_media *media);
+
+// Routes the sensor to the receiver. On the Raspberry Pi 5 the csi2 sink pad
+// is set to 'sensor_fmt', its source pad to 'source_code' (the mediabus code
+// of the video node format, 0 keeps the sensor code) and both links are
+// enabled. Otherwise sensor -> receiver is linked directly. Call
+// vc_media_reset_links() first. Returns 0, -ENODEV if there is no route or
+// another negative errno.
+int vc_media_route_sensor(struct vc_media *media, uint32_t sensor_id, uint32_t frontend_id,
+                          const struct v4l2_mbus_framefmt *sensor_fmt, uint32_t source_code);
+
+#endif // _VC_MEDIA_H
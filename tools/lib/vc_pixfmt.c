@@ -0,0 +1,288 @@
+#include "vc_pixfmt.h"
+
+#include <string.h>
+#include <strings.h>
+#include <linux/media-bus-format.h>
+#include <linux/videodev2.h>
+
+#define FCC(a, b, c, d) v4l2_fourcc(a, b, c, d)
+
+// Not available in older uapi headers
+#ifndef MEDIA_BUS_FMT_Y16_1X16
+#define MEDIA_BUS_FMT_Y16_1X16          0x202e
+#endif
+
+// --- Format table ------------------------------------------------------------
+
+static const struct vc_pixfmt vc_pixfmts[] = {
+        { MEDIA_BUS_FMT_Y8_1X8,       FCC('G','R','E','Y'), 0,                    "Y8",      8,  VC_BAYER_NONE },
+        { MEDIA_BUS_FMT_SBGGR8_1X8,   FCC('B','A','8','1'), 0,                    "BGGR8",   8,  VC_BAYER_BGGR },
+        { MEDIA_BUS_FMT_SGBRG8_1X8,   FCC('G','B','R','G'), 0,                    "GBRG8",   8,  VC_BAYER_GBRG },
+        { MEDIA_BUS_FMT_SGRBG8_1X8,   FCC('G','R','B','G'), 0,                    "GRBG8",   8,  VC_BAYER_GRBG },
+        { MEDIA_BUS_FMT_SRGGB8_1X8,   FCC('R','G','G','B'), 0,                    "RGGB8",   8,  VC_BAYER_RGGB },
+        { MEDIA_BUS_FMT_Y10_1X10,     FCC('Y','1','0','P'), FCC('Y','1','0',' '), "Y10",     10, VC_BAYER_NONE },
+        { MEDIA_BUS_FMT_SBGGR10_1X10, FCC('p','B','A','A'), FCC('B','G','1','0'), "BGGR10",  10, VC_BAYER_BGGR },
+        { MEDIA_BUS_FMT_SGBRG10_1X10, FCC('p','G','A','A'), FCC('G','B','1','0'), "GBRG10",  10, VC_BAYER_GBRG },
+        { MEDIA_BUS_FMT_SGRBG10_1X10, FCC('p','g','A','A'), FCC('B','A','1','0'), "GRBG10",  10, VC_BAYER_GRBG },
+        { MEDIA_BUS_FMT_SRGGB10_1X10, FCC('p','R','A','A'), FCC('R','G','1','0'), "RGGB10",  10, VC_BAYER_RGGB },
+        { MEDIA_BUS_FMT_Y12_1X12,     FCC('Y','1','2','P'), FCC('Y','1','2',' '), "Y12",     12, VC_BAYER_NONE },
+        { MEDIA_BUS_FMT_SBGGR12_1X12, FCC('p','B','C','C'), FCC('B','G','1','2'), "BGGR12",  12, VC_BAYER_BGGR },
+        { MEDIA_BUS_FMT_SGBRG12_1X12, FCC('p','G','C','C'), FCC('G','B','1','2'), "GBRG12",  12, VC_BAYER_GBRG },
+        { MEDIA_BUS_FMT_SGRBG12_1X12, FCC('p','g','C','C'), FCC('B','A','1','2'), "GRBG12",  12, VC_BAYER_GRBG },
+        { MEDIA_BUS_FMT_SRGGB12_1X12, FCC('p','R','C','C'), FCC('R','G','1','2'), "RGGB12",  12, VC_BAYER_RGGB },
+        { MEDIA_BUS_FMT_Y14_1X14,     FCC('Y','1','4','P'), FCC('Y','1','4',' '), "Y14",     14, VC_BAYER_NONE },
+        { MEDIA_BUS_FMT_SBGGR14_1X14, FCC('p','B','E','E'), FCC('B','G','1','4'), "BGGR14",  14, VC_BAYER_BGGR },
+        { MEDIA_BUS_FMT_SGBRG14_1X14, FCC('p','G','E','E'), FCC('G','B','1','4'), "GBRG14",  14, VC_BAYER_GBRG },
+        { MEDIA_BUS_FMT_SGRBG14_1X14, FCC('p','g','E','E'), FCC('G','R','1','4'), "GRBG14",  14, VC_BAYER_GRBG },
+        { MEDIA_BUS_FMT_SRGGB14_1X14, FCC('p','R','E','E'), FCC('R','G','1','4'), "RGGB14",  14, VC_BAYER_RGGB },
+        { MEDIA_BUS_FMT_Y16_1X16,     FCC('Y','1','6',' '), 0,                    "Y16",     16, VC_BAYER_NONE },
+        { MEDIA_BUS_FMT_SBGGR16_1X16, FCC('B','Y','R','2'), 0,                    "BGGR16",  16, VC_BAYER_BGGR },
+        { MEDIA_BUS_FMT_SGBRG16_1X16, FCC('G','B','1','6'), 0,                    "GBRG16",  16, VC_BAYER_GBRG },
+        { MEDIA_BUS_FMT_SGRBG16_1X16, FCC('G','R','1','6'), 0,                    "GRBG16",  16, VC_BAYER_GRBG },
+        { MEDIA_BUS_FMT_SRGGB16_1X16, FCC('R','G','1','6'), 0,                    "RGGB16",  16, VC_BAYER_RGGB },
+};
+
+const struct vc_pixfmt *vc_pixfmt_get(unsigned int index)
+{
+        if (index >= sizeof(vc_pixfmts) / sizeof(vc_pixfmts[0]))
+                return NULL;
+        return &vc_pixfmts[index];
+}
+
+const struct vc_pixfmt *vc_pixfmt_from_mbus(uint32_t mbus_code)
+{
+        const struct vc_pixfmt *fmt;
+        unsigned int i;
+
+        for (i = 0; (fmt = vc_pixfmt_get(i)) != NULL; i++) {
+                if (fmt->mbus_code == mbus_code)
+                        return fmt;
+        }
+        return NULL;
+}
+
+const struct vc_pixfmt *vc_pixfmt_from_fourcc(uint32_t fourcc, bool *packed)
+{
+        const struct vc_pixfmt *fmt;
+        unsigned int i;
+
+        for (i = 0; (fmt = vc_pixfmt_get(i)) != NULL; i++) {
+                if (fmt->fourcc == fourcc) {
+                        if (packed)
+                                *packed = fmt->bits % 8 != 0;
+                        return fmt;
+                }
+                if (fmt->fourcc_unpacked && fmt->fourcc_unpacked == fourcc) {
+                        if (packed)
+                                *packed = false;
+                        return fmt;
+                }
+        }
+        return NULL;
+}
+
+const struct vc_pixfmt *vc_pixfmt_from_name(const char *name)
+{
+        const struct vc_pixfmt *fmt;
+        unsigned int i;
+
+        for (i = 0; (fmt = vc_pixfmt_get(i)) != NULL; i++) {
+                if (strcasecmp(fmt->name, name) == 0)
+                        return fmt;
+        }
+        return NULL;
+}
+
+char *vc_fourcc_str(uint32_t fourcc, char *buf)
+{
+        buf[0] = fourcc & 0xff;
+        buf[1] = (fourcc >> 8) & 0xff;
+        buf[2] = (fourcc >> 16) & 0xff;
+        buf[3] = (fourcc >> 24) & 0xff;
+        buf[4] = '\0';
+        return buf;
+}
+
+// --- Line helpers ------------------------------------------------------------
+
+size_t vc_pixfmt_line_bytes(const struct vc_pixfmt *fmt, bool packed, uint32_t width)
+{
+        uint32_t group;
+
+        if (fmt->bits == 8)
+                return width;
+        if (!packed || fmt->bits == 16)
+                return (size_t)width * 2;
+
+        // CSI-2 packs whole groups of 2 (RAW12) or 4 pixels, the last one too
+        group = fmt->bits == 12 ? 2 : 4;
+        return ((size_t)width + group - 1) / group * group * fmt->bits / 8;
+}
+
+// CSI-2 RAW10: 4 pixels in 5 bytes, the 5th byte holds the 2 LSBs of each pixel.
+static void vc_unpack_raw10(const uint8_t *src, uint16_t *dst, uint32_t width)
+{
+        uint32_t x = 0;
+
+        for (; x + 4 <= width; x += 4, src += 5) {
+                uint8_t lsb = src[4];
+                dst[x + 0] = (src[0] << 2) | (lsb & 0x3);
+                dst[x + 1] = (src[1] << 2) | ((lsb >> 2) & 0x3);
+                dst[x + 2] = (src[2] << 2) | ((lsb >> 4) & 0x3);
+                dst[x + 3] = (src[3] << 2) | ((lsb >> 6) & 0x3);
+        }
+        for (uint32_t i = 0; x < width; x++, i++)
+                dst[x] = (src[i] << 2) | ((src[4] >> (2 * i)) & 0x3);
+}
+
+// CSI-2 RAW12: 2 pixels in 3 bytes, the 3rd byte holds the 4 LSBs of each pixel.
+static void vc_unpack_raw12(const uint8_t *src, uint16_t *dst, uint32_t width)
+{
+        uint32_t x = 0;
+
+        for (; x + 2 <= width; x += 2, src += 3) {
+                dst[x + 0] = (src[0] << 4) | (src[2] & 0xf);
+                dst[x + 1] = (src[1] << 4) | (src[2] >> 4);
+        }
+        if (x < width)
+                dst[x] = (src[0] << 4) | (src[2] & 0xf);
+}
+
+// CSI-2 RAW14: 4 pixels in 7 bytes, the last 3 bytes hold the 6 LSBs of each pixel.
+static void vc_unpack_raw14(const uint8_t *src, uint16_t *dst, uint32_t width)
+{
+        uint32_t x = 0;
+
+        for (; x + 4 <= width; x += 4, src += 7) {
+                uint32_t lsb = src[4] | (src[5] << 8) | (src[6] << 16);
+                dst[x + 0] = (src[0] << 6) | (lsb & 0x3f);
+                dst[x + 1] = (src[1] << 6) | ((lsb >> 6) & 0x3f);
+                dst[x + 2] = (src[2] << 6) | ((lsb >> 12) & 0x3f);
+                dst[x + 3] = (src[3] << 6) | ((lsb >> 18) & 0x3f);
+        }
+        if (x < width) {
+                uint32_t lsb = src[4] | (src[5] << 8) | (src[6] << 16);
+                for (uint32_t i = 0; x < width; x++, i++)
+                        dst[x] = (src[i] << 6) | ((lsb >> (6 * i)) & 0x3f);
+        }
+}
+
+void vc_pixfmt_unpack_line(const struct vc_pixfmt *fmt, bool packed,
+                           const uint8_t *src, uint16_t *dst, uint32_t width)
+{
+        uint32_t x;
+
+        if (fmt->bits == 8) {
+                for (x = 0; x < width; x++)
+                        dst[x] = src[x];
+                return;
+        }
+        if (!packed || fmt->bits == 16) {
+                memcpy(dst, src, (size_t)width * 2);
+                return;
+        }
+
+        switch (fmt->bits) {
+        case 10:
+                vc_unpack_raw10(src, dst, width);
+                break;
+        case 12:
+                vc_unpack_raw12(src, dst, width);
+                break;
+        case 14:
+                vc_unpack_raw14(src, dst, width);
+                break;
+        }
+}
+
+static void vc_pack_raw10(const uint16_t *src, uint8_t *dst, uint32_t width)
+{
+        uint32_t x = 0, i;
+
+        for (; x + 4 <= width; x += 4, dst += 5) {
+                dst[0] = src[x + 0] >> 2;
+                dst[1] = src[x + 1] >> 2;
+                dst[2] = src[x + 2] >> 2;
+                dst[3] = src[x + 3] >> 2;
+                dst[4] = (src[x + 0] & 0x3) | ((src[x + 1] & 0x3) << 2) |
+                         ((src[x + 2] & 0x3) << 4) | ((src[x + 3] & 0x3) << 6);
+        }
+        if (x < width) {
+                memset(dst, 0, 5);
+                for (i = 0; x < width; x++, i++) {
+                        dst[i] = src[x] >> 2;
+                        dst[4] |= (src[x] & 0x3) << (2 * i);
+                }
+        }
+}
+
+static void vc_pack_raw12(const uint16_t *src, uint8_t *dst, uint32_t width)
+{
+        uint32_t x = 0;
+
+        for (; x + 2 <= width; x += 2, dst += 3) {
+                dst[0] = src[x + 0] >> 4;
+                dst[1] = src[x + 1] >> 4;
+                dst[2] = (src[x + 0] & 0xf) | ((src[x + 1] & 0xf) << 4);
+        }
+        if (x < width) {
+                dst[0] = src[x] >> 4;
+                dst[1] = 0;
+                dst[2] = src[x] & 0xf;
+        }
+}
+
+static void vc_pack_raw14(const uint16_t *src, uint8_t *dst, uint32_t width)
+{
+        uint32_t x = 0, i, lsb;
+
+        for (; x + 4 <= width; x += 4, dst += 7) {
+                lsb = (src[x + 0] & 0x3f) | ((src[x + 1] & 0x3f) << 6) |
+                      ((src[x + 2] & 0x3f) << 12) | ((uint32_t)(src[x + 3] & 0x3f) << 18);
+                dst[0] = src[x + 0] >> 6;
+                dst[1] = src[x + 1] >> 6;
+                dst[2] = src[x + 2] >> 6;
+                dst[3] = src[x + 3] >> 6;
+                dst[4] = lsb;
+                dst[5] = lsb >> 8;
+                dst[6] = lsb >> 16;
+        }
+        if (x < width) {
+                memset(dst, 0, 4);
+                for (i = 0, lsb = 0; x < width; x++, i++) {
+                        dst[i] = src[x] >> 6;
+                        lsb |= (uint32_t)(src[x] & 0x3f) << (6 * i);
+                }
+                dst[4] = lsb;
+                dst[5] = lsb >> 8;
+                dst[6] = lsb >> 16;
+        }
+}
+
+void vc_pixfmt_pack_line(const struct vc_pixfmt *fmt, bool packed,
+                         const uint16_t *src, uint8_t *dst, uint32_t width)
+{
+        uint32_t x;
+
+        if (fmt->bits == 8) {
+                for (x = 0; x < width; x++)
+                        dst[x] = src[x];
+                return;
+        }
+        if (!packed || fmt->bits == 16) {
+                memcpy(dst, src, (size_t)width * 2);
+                return;
+        }
+
+        switch (fmt->bits) {
+        case 10:
+                vc_pack_raw10(src, dst, width);
+                break;
+        case 12:
+                vc_pack_raw12(src, dst, width);
+                break;
+        case 14:
+                vc_pack_raw14(src, dst, width);
+                break;
+        }
+}
@@ -0,0 +1,50 @@
+#ifndef _VC_PIXFMT_H
+#define _VC_PIXFMT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Media bus code <-> V4L2 fourcc table shared by all userspace tools.
+// This mirrors map_mediabus_to_fourcc() and the format maps in vc-config and
+// set_rpi*_pipeline.
+
+enum vc_bayer_order {
+        VC_BAYER_NONE = 0,      // monochrome
+        VC_BAYER_BGGR,
+        VC_BAYER_GBRG,
+        VC_BAYER_GRBG,
+        VC_BAYER_RGGB,
+};
+
+struct vc_pixfmt {
+        uint32_t mbus_code;
+        uint32_t fourcc;                // format on the wire (CSI-2 packed for 10/12/14 bit)
+        uint32_t fourcc_unpacked;       // 16 bit container variant, 0 if there is none
+        const char *name;               // short name as used by vc-config, e.g. "RGGB10"
+        uint8_t bits;
+        uint8_t bayer;                  // enum vc_bayer_order
+};
+
+const struct vc_pixfmt *vc_pixfmt_from_mbus(uint32_t mbus_code);
+const struct vc_pixfmt *vc_pixfmt_from_fourcc(uint32_t fourcc, bool *packed);
+const struct vc_pixfmt *vc_pixfmt_from_name(const char *name);
+const struct vc_pixfmt *vc_pixfmt_get(unsigned int index);
+
+// Bytes needed for one line of 'width' pixels in the given storage layout.
+size_t vc_pixfmt_line_bytes(const struct vc_pixfmt *fmt, bool packed, uint32_t width);
+
+// Converts one line into 16 bit samples. 8 bit formats are widened, CSI-2
+// packed lines are unpacked right aligned and 16 bit containers are copied
+// unchanged (the receiver decides about their alignment).
+void vc_pixfmt_unpack_line(const struct vc_pixfmt *fmt, bool packed,
+                           const uint8_t *src, uint16_t *dst, uint32_t width);
+
+// Inverse of vc_pixfmt_unpack_line(), samples must fit into fmt->bits.
+void vc_pixfmt_pack_line(const struct vc_pixfmt *fmt, bool packed,
+                         const uint16_t *src, uint8_t *dst, uint32_t width);
+
+// Prints a fourcc into buf (at least 5 bytes), returns buf.
+char *vc_fourcc_str(uint32_t fourcc, char *buf);
+
+#endif // _VC_PIXFMT_H
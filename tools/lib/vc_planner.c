@@ -0,0 +1,475 @@
+#include "vc_planner.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "vc_pixfmt.h"
+
+// CSI-2 long packet header (4 bytes) and footer (2 bytes) per line
+#define VC_PLANNER_LINE_OVERHEAD_BITS   48
+// The recommended CMA size is a multiple of this
+#define VC_PLANNER_CMA_STEP             (16ull << 20)
+// Relative difference of two pixel rates that counts as equal
+#define VC_PLANNER_SAME_RATE            0.01
+
+// --- Platforms ---------------------------------------------------------------
+
+// Nominal values: D-PHY rate per lane of the receiver, ISP throughput with
+// the default tuning and the CMA used by a desktop image without cameras.
+static const struct vc_planner_platform vc_platforms[] = {
+        {
+                .name = "bcm2712", .frontend = "rp1-cfe",
+                .ports = 2, .max_lanes = 4, .lane_rate = 1500000000ull,
+                .isp_rate = 1000000000ull, .stride_align = 16,
+                .cma_reserve = 64ull << 20,
+        },
+        {
+                .name = "bcm2711", .frontend = "unicam",
+                .ports = 2, .max_lanes = 4, .lane_rate = 1500000000ull,
+                .isp_rate = 200000000ull, .stride_align = 16,
+                .cma_reserve = 64ull << 20,
+        },
+        {
+                .name = "bcm2837", .frontend = "unicam",
+                .ports = 2, .max_lanes = 4, .lane_rate = 1000000000ull,
+                .isp_rate = 120000000ull, .stride_align = 16,
+                .cma_reserve = 32ull << 20,
+        },
+        {
+                .name = "rp3a0", .frontend = "unicam",
+                .ports = 1, .max_lanes = 2, .lane_rate = 1000000000ull,
+                .isp_rate = 120000000ull, .stride_align = 16,
+                .cma_reserve = 32ull << 20,
+        },
+};
+
+#define VC_PLATFORM_COUNT (sizeof(vc_platforms) / sizeof(vc_platforms[0]))
+
+int vc_planner_platform_get(const char *name, struct vc_planner_platform *platform)
+{
+        unsigned int i;
+
+        for (i = 0; i < VC_PLATFORM_COUNT; i++) {
+                if (strcmp(vc_platforms[i].name, name) == 0) {
+                        *platform = vc_platforms[i];
+                        return 0;
+                }
+        }
+        return -ENOENT;
+}
+
+// True if 'str' is one of the NUL separated strings of the compatible list
+static bool vc_compatible(const char *list, size_t len, const char *str)
+{
+        size_t pos;
+
+        for (pos = 0; pos < len; pos += strlen(list + pos) + 1) {
+                if (strstr(list + pos, str))
+                        return true;
+        }
+        return false;
+}
+
+static uint64_t vc_cma_total(void)
+{
+        unsigned long long kb = 0;
+        char line[128];
+        FILE *file;
+
+        file = fopen("/proc/meminfo", "r");
+        if (!file)
+                return 0;
+        while (fgets(line, sizeof(line), file)) {
+                if (sscanf(line, "CmaTotal: %llu kB", &kb) == 1)
+                        break;
+        }
+        fclose(file);
+        return (uint64_t)kb << 10;
+}
+
+void vc_planner_platform_detect(struct vc_planner_platform *platform)
+{
+        const char *name = "bcm2712";
+        char compatible[256];
+        size_t len = 0;
+        FILE *file;
+
+        file = fopen("/proc/device-tree/compatible", "r");
+        if (file) {
+                len = fread(compatible, 1, sizeof(compatible) - 1, file);
+                fclose(file);
+        }
+        compatible[len] = '\0';
+
+        // The Zero 2 W (RP3A0) reports itself as bcm2837
+        if (vc_compatible(compatible, len, "model-zero-2"))
+                name = "rp3a0";
+        else if (vc_compatible(compatible, len, "bcm2711"))
+                name = "bcm2711";
+        else if (vc_compatible(compatible, len, "bcm2837") || vc_compatible(compatible, len, "bcm2710"))
+                name = "bcm2837";
+
+        vc_planner_platform_get(name, platform);
+        platform->cma_total = vc_cma_total();
+}
+
+// --- Sensor modes ------------------------------------------------------------
+
+static int vc_planner_probe_mode(int fd, uint32_t code, int32_t binning, struct vc_planner_mode *mode)
+{
+        const struct vc_pixfmt *pixfmt = vc_pixfmt_from_mbus(code);
+        struct v4l2_mbus_framefmt fmt;
+        struct v4l2_rect crop;
+        int64_t min, pixel_rate, link_freq;
+        uint32_t width, height;
+        int ret;
+
+        if (!pixfmt)
+                return -EINVAL;
+
+        ret = vc_subdev_get_max_size(fd, 0, code, &width, &height);
+        if (ret < 0)
+                return ret;
+
+        ret = vc_subdev_get_fmt(fd, 0, &fmt);
+        if (ret < 0)
+                return ret;
+        fmt.code = code;
+        fmt.width = width;
+        fmt.height = height;
+        ret = vc_subdev_set_fmt(fd, 0, &fmt);
+        if (ret < 0)
+                return ret;
+        crop = (struct v4l2_rect){ .width = fmt.width, .height = fmt.height };
+        vc_subdev_set_crop(fd, 0, &crop);
+
+        ret = vc_ctrl_get64(fd, V4L2_CID_PIXEL_RATE, &pixel_rate);
+        if (ret < 0)
+                return ret;
+        if (pixel_rate <= 0)
+                return -EINVAL;
+        if (vc_ctrl_get_int_menu(fd, V4L2_CID_LINK_FREQ, &link_freq) < 0)
+                link_freq = 0;
+
+        memset(mode, 0, sizeof(*mode));
+        mode->code = fmt.code;
+        mode->binning = binning;
+        mode->width = fmt.width;
+        mode->height = fmt.height;
+        mode->bits = pixfmt->bits;
+        mode->pixel_rate = pixel_rate;
+        mode->link_freq = link_freq > 0 ? link_freq : 0;
+        if (mode->link_freq)
+                mode->lanes = (unsigned int)llround((double)mode->pixel_rate * mode->bits /
+                                                    (2.0 * mode->link_freq));
+        if (vc_ctrl_query(fd, V4L2_CID_HBLANK, &min, NULL, NULL) == 0 && min > 0)
+                mode->hblank_min = min;
+        if (vc_ctrl_query(fd, V4L2_CID_VBLANK, &min, NULL, NULL) == 0 && min > 0)
+                mode->vblank_min = min;
+        mode->max_fps = vc_planner_max_fps(mode, 0, 0);
+        return 0;
+}
+
+int vc_planner_probe(int subdev_fd, struct vc_planner_sensor *sensor)
+{
+        struct v4l2_mbus_framefmt orig_fmt, fmt;
+        struct v4l2_rect orig_crop;
+        int64_t binning_min = -1, binning_max = -1;
+        int32_t orig_binning, binning;
+        bool have_crop, have_binning;
+        uint32_t index, code;
+        int ret;
+
+        memset(sensor, 0, sizeof(*sensor));
+        vc_ctrl_get_string(subdev_fd, V4L2_CID_VC_NAME, sensor->name, sizeof(sensor->name));
+
+        ret = vc_subdev_get_fmt(subdev_fd, 0, &orig_fmt);
+        if (ret < 0)
+                return ret;
+        // A streaming sensor switches binning and crop live. Writing the
+        // current format fails with EBUSY instead, before anything changed.
+        fmt = orig_fmt;
+        ret = vc_subdev_set_fmt(subdev_fd, 0, &fmt);
+        if (ret < 0)
+                return ret;
+        have_crop = vc_subdev_get_crop(subdev_fd, 0, &orig_crop) == 0;
+        have_binning = vc_ctrl_get(subdev_fd, V4L2_CID_VC_BINNING_MODE, &orig_binning) == 0 &&
+                       vc_ctrl_query(subdev_fd, V4L2_CID_VC_BINNING_MODE, &binning_min, &binning_max, NULL) == 0;
+        if (!have_binning)
+                binning_min = binning_max = -1;
+
+        for (index = 0; ret != -EBUSY && vc_subdev_enum_mbus_code(subdev_fd, 0, index, &code) == 0; index++) {
+                for (binning = binning_min; binning <= binning_max; binning++) {
+                        if (sensor->count == VC_PLANNER_MAX_MODES)
+                                break;
+                        // Binning first, it changes the frame size
+                        if (binning >= 0 && vc_ctrl_set(subdev_fd, V4L2_CID_VC_BINNING_MODE, binning) < 0)
+                                continue;
+                        ret = vc_planner_probe_mode(subdev_fd, code, binning, &sensor->modes[sensor->count]);
+                        if (ret == -EBUSY)
+                                break;
+                        if (ret == 0)
+                                sensor->count++;
+                }
+        }
+
+        if (have_binning)
+                vc_ctrl_set(subdev_fd, V4L2_CID_VC_BINNING_MODE, orig_binning);
+        vc_subdev_set_fmt(subdev_fd, 0, &orig_fmt);
+        if (have_crop)
+                vc_subdev_set_crop(subdev_fd, 0, &orig_crop);
+
+        if (ret == -EBUSY)
+                return ret;
+        return sensor->count ? 0 : -ENODATA;
+}
+
+double vc_planner_max_fps(const struct vc_planner_mode *mode, uint32_t width, uint32_t height)
+{
+        double line, lines;
+
+        line = (width ? width : mode->width) + (double)mode->hblank_min;
+        lines = (height ? height : mode->height) + (double)mode->vblank_min;
+        if (line <= 0 || lines <= 0)
+                return 0;
+        return mode->pixel_rate / (line * lines);
+}
+
+// --- Evaluation --------------------------------------------------------------
+
+static uint64_t vc_align(uint64_t value, uint64_t align)
+{
+        return align ? (value + align - 1) / align * align : value;
+}
+
+static void vc_planner_load_camera(const struct vc_planner_platform *platform, const struct vc_planner_params *params,
+                                   const struct vc_planner_config *config, struct vc_planner_load *load)
+{
+        const struct vc_planner_mode *mode = config->mode;
+        const struct vc_pixfmt *pixfmt = vc_pixfmt_from_mbus(mode->code);
+        uint32_t width = config->width ? config->width : mode->width;
+        uint32_t height = config->height ? config->height : mode->height;
+        double max_fps = vc_planner_max_fps(mode, width, height);
+        uint64_t pixels = (uint64_t)width * height;
+        uint64_t line_bytes, isp_bytes = 0;
+
+        memset(load, 0, sizeof(*load));
+        load->fps = config->fps > 0 ? config->fps : max_fps;
+        if (load->fps > max_fps * 1.001)
+                load->limits |= VC_PLANNER_LIMIT_SENSOR;
+
+        load->payload_rate = (uint64_t)(((uint64_t)width * mode->bits + VC_PLANNER_LINE_OVERHEAD_BITS) *
+                                        height * load->fps);
+        load->lane_rate = 2 * mode->link_freq;
+        if (mode->lanes) {
+                load->link_load = (double)load->payload_rate / ((double)load->lane_rate * mode->lanes);
+                if (mode->lanes > platform->max_lanes)
+                        load->limits |= VC_PLANNER_LIMIT_LANES;
+        }
+        if (load->lane_rate > platform->lane_rate)
+                load->limits |= VC_PLANNER_LIMIT_LANE_RATE;
+        load->pixel_rate = (uint64_t)(pixels * load->fps);
+
+        line_bytes = pixfmt ? vc_pixfmt_line_bytes(pixfmt, params->packed, width)
+                            : ((uint64_t)width * mode->bits + 7) / 8;
+        load->frame_bytes = vc_align(line_bytes, platform->stride_align) * height;
+        if (params->isp)
+                isp_bytes = pixels * params->isp_bpp_x2 / 2;
+
+        // The ISP reads the raw frame once and writes its output
+        load->memory_rate = (uint64_t)(load->frame_bytes * load->fps);
+        if (params->isp)
+                load->memory_rate += (uint64_t)((load->frame_bytes + isp_bytes) * load->fps);
+        load->buffer_bytes = params->buffers * load->frame_bytes;
+        if (params->isp)
+                load->buffer_bytes += params->isp_buffers * isp_bytes;
+}
+
+int vc_planner_evaluate(const struct vc_planner_platform *platform, const struct vc_planner_params *params,
+                        const struct vc_planner_config *configs, unsigned int count,
+                        struct vc_planner_result *result)
+{
+        unsigned int i;
+
+        if (count == 0 || count > VC_PLANNER_MAX_CAMERAS)
+                return -EINVAL;
+        for (i = 0; i < count; i++) {
+                if (!configs[i].mode)
+                        return -EINVAL;
+        }
+
+        memset(result, 0, sizeof(*result));
+        result->count = count;
+        for (i = 0; i < count; i++) {
+                struct vc_planner_load *load = &result->cameras[i];
+
+                vc_planner_load_camera(platform, params, &configs[i], load);
+                result->payload_rate += load->payload_rate;
+                result->pixel_rate += load->pixel_rate;
+                result->memory_rate += load->memory_rate;
+                result->buffer_bytes += load->buffer_bytes;
+                result->limits |= load->limits;
+        }
+
+        if (count > platform->ports)
+                result->limits |= VC_PLANNER_LIMIT_PORTS;
+        if (params->isp && platform->isp_rate) {
+                result->isp_load = (double)result->pixel_rate / platform->isp_rate;
+                if (result->isp_load > params->max_load)
+                        result->limits |= VC_PLANNER_LIMIT_ISP;
+        }
+
+        result->cma_needed = result->buffer_bytes + platform->cma_reserve;
+        result->cma_recommended = vc_align((uint64_t)(result->cma_needed / params->max_load), VC_PLANNER_CMA_STEP);
+        if (platform->cma_total && result->cma_needed > platform->cma_total)
+                result->limits |= VC_PLANNER_LIMIT_CMA;
+        return 0;
+}
+
+// --- Recommendation ----------------------------------------------------------
+
+struct vc_planner_search {
+        const struct vc_planner_platform *platform;
+        const struct vc_planner_params *params;
+        const struct vc_planner_sensor *sensors;
+        unsigned int count;
+        struct vc_planner_config presets[VC_PLANNER_MAX_CAMERAS];
+        struct vc_planner_config current[VC_PLANNER_MAX_CAMERAS];
+        struct vc_planner_config best[VC_PLANNER_MAX_CAMERAS];
+        struct vc_planner_result best_result;
+        unsigned int best_bits;
+        uint64_t best_pixels;
+        bool found;
+};
+
+// Most pixels per second, then the higher bit depth and the larger frames.
+// Rates within VC_PLANNER_SAME_RATE count as equal, if the ISP is the limit
+// every combination ends up at about the same rate.
+static bool vc_planner_better(const struct vc_planner_result *result, unsigned int bits, uint64_t pixels,
+                              const struct vc_planner_search *search)
+{
+        double ratio = (double)result->pixel_rate / search->best_result.pixel_rate;
+
+        if (ratio > 1.0 + VC_PLANNER_SAME_RATE)
+                return true;
+        if (ratio < 1.0 - VC_PLANNER_SAME_RATE)
+                return false;
+        if (bits != search->best_bits)
+                return bits > search->best_bits;
+        return pixels > search->best_pixels;
+}
+
+static void vc_planner_try(struct vc_planner_search *search)
+{
+        struct vc_planner_result result;
+        unsigned int i, bits = 0;
+        uint64_t pixels = 0;
+
+        for (i = 0; i < search->count; i++) {
+                struct vc_planner_config *config = &search->current[i];
+                double max_fps = vc_planner_max_fps(config->mode, config->width, config->height);
+
+                config->fps = search->presets[i].fps > 0 && search->presets[i].fps < max_fps
+                              ? search->presets[i].fps : max_fps;
+                bits += config->mode->bits;
+                pixels += (uint64_t)(config->width ? config->width : config->mode->width) *
+                          (config->height ? config->height : config->mode->height);
+        }
+        if (vc_planner_evaluate(search->platform, search->params, search->current, search->count, &result) < 0)
+                return;
+
+        // The ISP is shared, slow down all cameras by the same factor
+        if (result.limits == VC_PLANNER_LIMIT_ISP) {
+                double scale = search->params->max_load / result.isp_load;
+
+                for (i = 0; i < search->count; i++)
+                        search->current[i].fps *= scale;
+                if (vc_planner_evaluate(search->platform, search->params, search->current, search->count,
+                                        &result) < 0)
+                        return;
+        }
+        if (result.limits)
+                return;
+
+        if (search->found && !vc_planner_better(&result, bits, pixels, search))
+                return;
+
+        memcpy(search->best, search->current, sizeof(search->best));
+        search->best_result = result;
+        search->best_bits = bits;
+        search->best_pixels = pixels;
+        search->found = true;
+}
+
+static void vc_planner_search_camera(struct vc_planner_search *search, unsigned int camera)
+{
+        const struct vc_planner_sensor *sensor;
+        const struct vc_planner_config *preset;
+        unsigned int i;
+
+        if (camera == search->count) {
+                vc_planner_try(search);
+                return;
+        }
+        // count is at most VC_PLANNER_MAX_CAMERAS, this bounds the recursion
+        // for the compiler too
+        if (camera >= VC_PLANNER_MAX_CAMERAS)
+                return;
+
+        sensor = &search->sensors[camera];
+        preset = &search->presets[camera];
+
+        for (i = 0; i < sensor->count; i++) {
+                const struct vc_planner_mode *mode = &sensor->modes[i];
+
+                // A preset crop must fit into the frame of the mode
+                if (preset->width > mode->width || preset->height > mode->height)
+                        continue;
+                search->current[camera] = *preset;
+                search->current[camera].mode = mode;
+                vc_planner_search_camera(search, camera + 1);
+        }
+}
+
+int vc_planner_recommend(const struct vc_planner_platform *platform, const struct vc_planner_params *params,
+                         const struct vc_planner_sensor *sensors, unsigned int count,
+                         struct vc_planner_config *configs, struct vc_planner_result *result)
+{
+        struct vc_planner_search search = {
+                .platform = platform,
+                .params = params,
+                .sensors = sensors,
+                .count = count,
+        };
+
+        if (count == 0 || count > VC_PLANNER_MAX_CAMERAS)
+                return -EINVAL;
+
+        memcpy(search.presets, configs, count * sizeof(*configs));
+        vc_planner_search_camera(&search, 0);
+        if (!search.found)
+                return -ERANGE;
+
+        memcpy(configs, search.best, count * sizeof(*configs));
+        *result = search.best_result;
+        return 0;
+}
+
+const char *vc_planner_limits_str(unsigned int limits, char *buf, size_t len)
+{
+        static const char *const names[] = { "sensor", "lanes", "lane rate", "receivers", "ISP", "CMA" };
+        size_t pos = 0;
+        unsigned int i;
+
+        buf[0] = '\0';
+        for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+                if (!(limits & (1u << i)) || pos >= len)
+                        continue;
+                pos += snprintf(buf + pos, len - pos, "%s%s", pos ? ", " : "", names[i]);
+        }
+        if (!limits)
+                snprintf(buf, len, "none");
+        return buf;
+}
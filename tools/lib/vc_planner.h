@@ -0,0 +1,155 @@
+#ifndef _VC_PLANNER_H
+#define _VC_PLANNER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vc_v4l2.h"
+
+// Bandwidth and memory planner for one or two cameras
+//
+// The modes of a sensor (media bus code x binning mode) are read from the
+// driver: frame size, V4L2_CID_PIXEL_RATE, V4L2_CID_LINK_FREQ and the
+// HBLANK / VBLANK minimum. The number of lanes follows from
+// pixel_rate * bits = 2 * link_freq * lanes, the maximum frame rate from
+// pixel_rate / ((width + hblank) * (height + vblank)).
+//
+// A configuration (mode, crop, frame rate and buffers per camera) is checked
+// against the limits of the platform:
+//
+//   - CSI-2: lanes and bit rate per lane of the receiver, one receiver per
+//     camera
+//   - ISP: pixels per second of all cameras together (libcamera only)
+//   - CMA: capture buffers (and ISP output buffers) of all cameras plus the
+//     memory the rest of the system takes from the pool
+//
+// The platform limits are nominal planning values, they can be changed in
+// struct vc_planner_platform.
+
+#define VC_PLANNER_MAX_MODES            32
+#define VC_PLANNER_MAX_CAMERAS          2
+
+// Bits of struct vc_planner_result.limits
+#define VC_PLANNER_LIMIT_SENSOR         (1u << 0)       // frame rate above the mode maximum
+#define VC_PLANNER_LIMIT_LANES          (1u << 1)       // more lanes than the receiver has
+#define VC_PLANNER_LIMIT_LANE_RATE      (1u << 2)       // bit rate per lane too high
+#define VC_PLANNER_LIMIT_PORTS          (1u << 3)       // more cameras than receivers
+#define VC_PLANNER_LIMIT_ISP            (1u << 4)
+#define VC_PLANNER_LIMIT_CMA            (1u << 5)
+
+struct vc_planner_platform {
+        const char *name;               // SoC, e.g. "bcm2712"
+        const char *frontend;           // CSI-2 receiver, e.g. "rp1-cfe"
+        unsigned int ports;             // CSI-2 receivers
+        unsigned int max_lanes;         // per receiver
+        uint64_t lane_rate;             // bit/s per lane
+        uint64_t isp_rate;              // pixel/s of all cameras together
+        uint32_t stride_align;          // bytes per line of a capture buffer
+        uint64_t cma_reserve;           // CMA taken by display, codecs, ...
+        uint64_t cma_total;             // size of the CMA pool, 0 if unknown
+};
+
+// Platform of the running system (device tree compatible and CmaTotal in
+// /proc/meminfo). Returns the bcm2712 entry if the SoC is unknown.
+void vc_planner_platform_detect(struct vc_planner_platform *platform);
+
+// Fills in the nominal limits of a SoC name. Returns -ENOENT if unknown.
+int vc_planner_platform_get(const char *name, struct vc_planner_platform *platform);
+
+struct vc_planner_mode {
+        uint32_t code;                  // media bus code
+        int32_t binning;                // binning mode, -1 if not supported
+        uint32_t width;                 // full frame in this mode
+        uint32_t height;
+        unsigned int bits;
+        unsigned int lanes;
+        uint64_t pixel_rate;            // pixel/s
+        uint64_t link_freq;             // Hz, bit rate per lane is twice this
+        uint32_t hblank_min;            // pixels
+        uint32_t vblank_min;            // lines
+        double max_fps;                 // at full frame
+};
+
+struct vc_planner_sensor {
+        char name[VC_SENSOR_NAME_LEN + 1];
+        struct vc_planner_mode modes[VC_PLANNER_MAX_MODES];
+        unsigned int count;
+};
+
+// Reads all modes of a sensor by setting every media bus code and binning
+// mode in turn. The format, crop and binning mode are restored. Fails with
+// -EBUSY while the sensor is streaming.
+int vc_planner_probe(int subdev_fd, struct vc_planner_sensor *sensor);
+
+// Maximum frame rate of a mode with a crop (0 = full frame). The blanking is
+// taken as constant, so a smaller crop gives a higher frame rate as with
+// sensors that shorten VMAX / HMAX with the crop.
+double vc_planner_max_fps(const struct vc_planner_mode *mode, uint32_t width, uint32_t height);
+
+struct vc_planner_params {
+        unsigned int buffers;           // capture buffers per camera (default 4)
+        bool packed;                    // CSI-2 packed buffers (default true)
+        bool isp;                       // frames go through the ISP (libcamera)
+        unsigned int isp_buffers;       // ISP output buffers per camera (default 4)
+        unsigned int isp_bpp_x2;        // ISP output bytes per pixel x 2 (default 3, YUV420)
+        double max_load;                // usable fraction of each limit (default 0.9)
+};
+
+#define VC_PLANNER_PARAMS_DEFAULT                                       \
+        {                                                               \
+                .buffers = 4, .packed = true,                           \
+                .isp_buffers = 4, .isp_bpp_x2 = 3, .max_load = 0.9,     \
+        }
+
+struct vc_planner_config {
+        const struct vc_planner_mode *mode;
+        uint32_t width;                 // crop, 0 = full frame
+        uint32_t height;
+        double fps;                     // 0 = mode maximum
+};
+
+struct vc_planner_load {
+        double fps;
+        uint64_t payload_rate;          // CSI-2 payload, bit/s
+        uint64_t lane_rate;             // bit/s per lane of the mode
+        double link_load;               // payload of the lanes in use
+        uint64_t pixel_rate;            // active pixel/s
+        uint64_t frame_bytes;
+        uint64_t memory_rate;           // buffer writes, byte/s
+        uint64_t buffer_bytes;          // capture and ISP buffers
+        unsigned int limits;            // VC_PLANNER_LIMIT_*
+};
+
+struct vc_planner_result {
+        struct vc_planner_load cameras[VC_PLANNER_MAX_CAMERAS];
+        unsigned int count;
+        uint64_t payload_rate;          // all cameras
+        uint64_t pixel_rate;
+        double isp_load;                // of platform->isp_rate, 0 without ISP
+        uint64_t memory_rate;
+        uint64_t buffer_bytes;
+        uint64_t cma_needed;            // buffer_bytes + cma_reserve
+        uint64_t cma_recommended;       // cma_needed with headroom, 16 MiB steps
+        unsigned int limits;            // all cameras and the shared limits
+};
+
+// Checks one configuration per camera. Returns 0 and the result, the
+// limits that are exceeded are set in result->limits.
+int vc_planner_evaluate(const struct vc_planner_platform *platform, const struct vc_planner_params *params,
+                        const struct vc_planner_config *configs, unsigned int count,
+                        struct vc_planner_result *result);
+
+// Picks the mode and frame rate of every camera with the most pixels per
+// second of all cameras together that stays within all limits. configs[i]
+// may preset the crop and a frame rate cap for camera i, the mode is
+// replaced. If the ISP is the limit, the frame rates of all cameras are
+// lowered by the same factor. Returns -ERANGE if no mode fits.
+int vc_planner_recommend(const struct vc_planner_platform *platform, const struct vc_planner_params *params,
+                         const struct vc_planner_sensor *sensors, unsigned int count,
+                         struct vc_planner_config *configs, struct vc_planner_result *result);
+
+// Names of the limits in a VC_PLANNER_LIMIT_* mask, e.g. "ISP, CMA"
+const char *vc_planner_limits_str(unsigned int limits, char *buf, size_t len);
+
+#endif // _VC_PLANNER_H
@@ -0,0 +1,487 @@
+#include "vc_pyramid.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vc_pixfmt.h"
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define VC_PYR_NEON                     1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define VC_PYR_SSE2                     1
+#endif
+
+struct vc_pyr_kernels {
+        const char *name;
+        // dst[i] = avg(avg(a[2i], b[2i]), avg(a[2i + 1], b[2i + 1]))
+        void (*bin2)(const uint16_t *a, const uint16_t *b, uint16_t *dst, uint32_t n);
+        // even[i] = src[2i], odd[i] = src[2i + 1]
+        void (*split)(const uint16_t *src, uint16_t *even, uint16_t *odd, uint32_t n);
+        // dst[i] = avg(a[i], b[i])
+        void (*avg)(const uint16_t *a, const uint16_t *b, uint16_t *dst, uint32_t n);
+};
+
+struct vc_pyr_level {
+        struct vc_pyramid_level pub;
+        uint8_t *data;
+        uint16_t *rows[2][3];           // last two binned lines, one plane per colour
+        uint32_t count;                 // lines binned in this frame
+};
+
+struct vc_pyramid {
+        struct vc_format fmt;
+        struct vc_pyramid_params params;
+        const struct vc_pixfmt *pixfmt;
+        bool packed;
+        const struct vc_pyr_kernels *kernels;
+        unsigned int planes;
+        unsigned int shift;             // sample bits - 8
+
+        // RGB: parity of the red and blue samples in their lines
+        unsigned int red_line;
+        unsigned int red_col;
+        unsigned int blue_col;
+
+        uint16_t *lines[2];             // unpacked input lines
+        uint16_t *greens[2];            // green samples of both lines (RGB)
+        struct vc_pyr_level levels[VC_PYRAMID_MAX_LEVELS];
+};
+
+static inline uint16_t vc_pyr_avg(uint16_t a, uint16_t b)
+{
+        return (a + b + 1) >> 1;
+}
+
+// --- Scalar kernels ----------------------------------------------------------
+
+static void vc_pyr_bin2_scalar(const uint16_t *a, const uint16_t *b, uint16_t *dst, uint32_t n)
+{
+        uint32_t i;
+
+        for (i = 0; i < n; i++)
+                dst[i] = vc_pyr_avg(vc_pyr_avg(a[2 * i], b[2 * i]), vc_pyr_avg(a[2 * i + 1], b[2 * i + 1]));
+}
+
+static void vc_pyr_split_scalar(const uint16_t *src, uint16_t *even, uint16_t *odd, uint32_t n)
+{
+        uint32_t i;
+
+        for (i = 0; i < n; i++) {
+                even[i] = src[2 * i];
+                odd[i] = src[2 * i + 1];
+        }
+}
+
+static void vc_pyr_avg_scalar(const uint16_t *a, const uint16_t *b, uint16_t *dst, uint32_t n)
+{
+        uint32_t i;
+
+        for (i = 0; i < n; i++)
+                dst[i] = vc_pyr_avg(a[i], b[i]);
+}
+
+static const struct vc_pyr_kernels vc_pyr_scalar = {
+        .name = "scalar",
+        .bin2 = vc_pyr_bin2_scalar,
+        .split = vc_pyr_split_scalar,
+        .avg = vc_pyr_avg_scalar,
+};
+
+// --- NEON kernels ------------------------------------------------------------
+
+#if VC_PYR_NEON
+static void vc_pyr_bin2_neon(const uint16_t *a, const uint16_t *b, uint16_t *dst, uint32_t n)
+{
+        uint32_t i = 0;
+
+        for (; i + 8 <= n; i += 8) {
+                uint16x8x2_t va = vld2q_u16(a + 2 * i);
+                uint16x8x2_t vb = vld2q_u16(b + 2 * i);
+
+                vst1q_u16(dst + i, vrhaddq_u16(vrhaddq_u16(va.val[0], vb.val[0]),
+                                               vrhaddq_u16(va.val[1], vb.val[1])));
+        }
+        vc_pyr_bin2_scalar(a + 2 * i, b + 2 * i, dst + i, n - i);
+}
+
+static void vc_pyr_split_neon(const uint16_t *src, uint16_t *even, uint16_t *odd, uint32_t n)
+{
+        uint32_t i = 0;
+
+        for (; i + 8 <= n; i += 8) {
+                uint16x8x2_t v = vld2q_u16(src + 2 * i);
+
+                vst1q_u16(even + i, v.val[0]);
+                vst1q_u16(odd + i, v.val[1]);
+        }
+        vc_pyr_split_scalar(src + 2 * i, even + i, odd + i, n - i);
+}
+
+static void vc_pyr_avg_neon(const uint16_t *a, const uint16_t *b, uint16_t *dst, uint32_t n)
+{
+        uint32_t i = 0;
+
+        for (; i + 8 <= n; i += 8)
+                vst1q_u16(dst + i, vrhaddq_u16(vld1q_u16(a + i), vld1q_u16(b + i)));
+        vc_pyr_avg_scalar(a + i, b + i, dst + i, n - i);
+}
+
+static const struct vc_pyr_kernels vc_pyr_neon = {
+        .name = "neon",
+        .bin2 = vc_pyr_bin2_neon,
+        .split = vc_pyr_split_neon,
+        .avg = vc_pyr_avg_neon,
+};
+#endif
+
+// --- SSE2 kernels ------------------------------------------------------------
+
+#if VC_PYR_SSE2
+// Packs the low / high 16 bits of every 32 bit lane of a and b. Sign extending
+// first keeps the bit pattern through the saturating pack.
+static inline __m128i vc_pyr_pack_lo_sse2(__m128i a, __m128i b)
+{
+        return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+                               _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+}
+
+static inline __m128i vc_pyr_pack_hi_sse2(__m128i a, __m128i b)
+{
+        return _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+}
+
+static void vc_pyr_bin2_sse2(const uint16_t *a, const uint16_t *b, uint16_t *dst, uint32_t n)
+{
+        uint32_t i = 0;
+
+        for (; i + 8 <= n; i += 8) {
+                __m128i v0 = _mm_avg_epu16(_mm_loadu_si128((const __m128i *)(a + 2 * i)),
+                                           _mm_loadu_si128((const __m128i *)(b + 2 * i)));
+                __m128i v1 = _mm_avg_epu16(_mm_loadu_si128((const __m128i *)(a + 2 * i + 8)),
+                                           _mm_loadu_si128((const __m128i *)(b + 2 * i + 8)));
+
+                // Low half of every 32 bit lane: avg(even, odd)
+                v0 = _mm_avg_epu16(v0, _mm_srli_epi32(v0, 16));
+                v1 = _mm_avg_epu16(v1, _mm_srli_epi32(v1, 16));
+                _mm_storeu_si128((__m128i *)(dst + i), vc_pyr_pack_lo_sse2(v0, v1));
+        }
+        vc_pyr_bin2_scalar(a + 2 * i, b + 2 * i, dst + i, n - i);
+}
+
+static void vc_pyr_split_sse2(const uint16_t *src, uint16_t *even, uint16_t *odd, uint32_t n)
+{
+        uint32_t i = 0;
+
+        for (; i + 8 <= n; i += 8) {
+                __m128i v0 = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+                __m128i v1 = _mm_loadu_si128((const __m128i *)(src + 2 * i + 8));
+
+                _mm_storeu_si128((__m128i *)(even + i), vc_pyr_pack_lo_sse2(v0, v1));
+                _mm_storeu_si128((__m128i *)(odd + i), vc_pyr_pack_hi_sse2(v0, v1));
+        }
+        vc_pyr_split_scalar(src + 2 * i, even + i, odd + i, n - i);
+}
+
+static void vc_pyr_avg_sse2(const uint16_t *a, const uint16_t *b, uint16_t *dst, uint32_t n)
+{
+        uint32_t i = 0;
+
+        for (; i + 8 <= n; i += 8)
+                _mm_storeu_si128((__m128i *)(dst + i),
+                                 _mm_avg_epu16(_mm_loadu_si128((const __m128i *)(a + i)),
+                                               _mm_loadu_si128((const __m128i *)(b + i))));
+        vc_pyr_avg_scalar(a + i, b + i, dst + i, n - i);
+}
+
+static const struct vc_pyr_kernels vc_pyr_sse2 = {
+        .name = "sse2",
+        .bin2 = vc_pyr_bin2_sse2,
+        .split = vc_pyr_split_sse2,
+        .avg = vc_pyr_avg_sse2,
+};
+#endif
+
+static const struct vc_pyr_kernels *vc_pyr_select_kernels(const char *name)
+{
+        static const struct vc_pyr_kernels *const kernels[] = {
+#if VC_PYR_NEON
+                &vc_pyr_neon,
+#endif
+#if VC_PYR_SSE2
+                &vc_pyr_sse2,
+#endif
+                &vc_pyr_scalar,
+        };
+        unsigned int i;
+
+        for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+                if (!name || !strcmp(name, kernels[i]->name))
+                        return kernels[i];
+        }
+        return NULL;
+}
+
+// --- Levels ------------------------------------------------------------------
+
+// Scales the line just binned into level k to 8 bit
+static void vc_pyr_output_line(const struct vc_pyramid *pyr, const struct vc_pyr_level *level,
+                               uint16_t *const planes[3])
+{
+        uint8_t *dst = level->data + (size_t)level->count * level->pub.stride;
+        unsigned int shift = pyr->shift, half = shift ? 1u << (shift - 1) : 0;
+        uint32_t x, width = level->pub.width;
+        unsigned int p;
+
+        for (p = 0; p < pyr->planes; p++) {
+                const uint16_t *src = planes[p];
+                uint8_t *out = dst + p;
+
+                for (x = 0; x < width; x++, out += pyr->planes) {
+                        uint32_t v = (src[x] + half) >> shift;
+
+                        *out = v > 255 ? 255 : v;
+                }
+        }
+}
+
+// Emits the line just binned into level k and bins it on with its pair
+static void vc_pyr_push(struct vc_pyramid *pyr, unsigned int k)
+{
+        struct vc_pyr_level *level = &pyr->levels[k];
+        unsigned int p;
+
+        if (level->count >= level->pub.height)
+                return;
+        vc_pyr_output_line(pyr, level, level->rows[level->count & 1]);
+
+        if ((level->count & 1) && k + 1 < pyr->params.levels) {
+                struct vc_pyr_level *next = &pyr->levels[k + 1];
+
+                for (p = 0; p < pyr->planes; p++)
+                        pyr->kernels->bin2(level->rows[0][p], level->rows[1][p],
+                                           next->rows[next->count & 1][p], next->pub.width);
+                vc_pyr_push(pyr, k + 1);
+        }
+        level->count++;
+}
+
+// Bins one pair of input lines into the 2x level
+static void vc_pyr_bin_lines(struct vc_pyramid *pyr, const uint16_t *l0, const uint16_t *l1)
+{
+        const struct vc_pyr_kernels *kernels = pyr->kernels;
+        struct vc_pyr_level *level = &pyr->levels[0];
+        uint16_t **rows = level->rows[level->count & 1];
+        uint32_t width = level->pub.width;
+        const uint16_t *red, *blue;
+
+        if (pyr->params.color == VC_PYRAMID_GREY) {
+                kernels->bin2(l0, l1, rows[0], width);
+                vc_pyr_push(pyr, 0);
+                return;
+        }
+
+        red = pyr->red_line ? l1 : l0;
+        blue = pyr->red_line ? l0 : l1;
+        kernels->split(red, pyr->red_col ? pyr->greens[0] : rows[0],
+                       pyr->red_col ? rows[0] : pyr->greens[0], width);
+        kernels->split(blue, pyr->blue_col ? pyr->greens[1] : rows[2],
+                       pyr->blue_col ? rows[2] : pyr->greens[1], width);
+        kernels->avg(pyr->greens[0], pyr->greens[1], rows[1], width);
+        vc_pyr_push(pyr, 0);
+}
+
+// --- Public API --------------------------------------------------------------
+
+struct vc_pyramid *vc_pyramid_create(const struct vc_format *fmt, const struct vc_pyramid_params *params)
+{
+        struct vc_pyramid *pyr;
+        uint32_t width, height;
+        unsigned int k, i, p;
+
+        pyr = calloc(1, sizeof(*pyr));
+        if (!pyr)
+                return NULL;
+
+        pyr->fmt = *fmt;
+        pyr->params = *params;
+        pyr->pixfmt = vc_pixfmt_from_fourcc(fmt->fourcc, &pyr->packed);
+        pyr->kernels = vc_pyr_select_kernels(params->kernel);
+        if (!pyr->pixfmt || !pyr->kernels || params->levels < 1 || params->levels > VC_PYRAMID_MAX_LEVELS ||
+            (params->color == VC_PYRAMID_RGB && pyr->pixfmt->bayer == VC_BAYER_NONE) ||
+            (fmt->width >> params->levels) == 0 || (fmt->height >> params->levels) == 0) {
+                free(pyr);
+                errno = EINVAL;
+                return NULL;
+        }
+        if (!pyr->fmt.bytesperline)
+                pyr->fmt.bytesperline = vc_pixfmt_line_bytes(pyr->pixfmt, pyr->packed, fmt->width);
+
+        pyr->planes = params->color == VC_PYRAMID_RGB ? 3 : 1;
+        pyr->shift = pyr->pixfmt->bits - 8;
+
+        switch (pyr->pixfmt->bayer) {
+        case VC_BAYER_RGGB: pyr->red_line = 0; pyr->red_col = 0; pyr->blue_col = 1; break;
+        case VC_BAYER_GRBG: pyr->red_line = 0; pyr->red_col = 1; pyr->blue_col = 0; break;
+        case VC_BAYER_BGGR: pyr->red_line = 1; pyr->red_col = 1; pyr->blue_col = 0; break;
+        case VC_BAYER_GBRG: pyr->red_line = 1; pyr->red_col = 0; pyr->blue_col = 1; break;
+        }
+
+        for (i = 0; i < 2; i++) {
+                pyr->lines[i] = malloc(fmt->width * sizeof(uint16_t));
+                pyr->greens[i] = malloc(fmt->width / 2 * sizeof(uint16_t));
+                if (!pyr->lines[i] || !pyr->greens[i])
+                        goto nomem;
+        }
+
+        width = fmt->width;
+        height = fmt->height;
+        for (k = 0; k < params->levels; k++) {
+                struct vc_pyr_level *level = &pyr->levels[k];
+
+                width /= 2;
+                height /= 2;
+                level->pub.width = width;
+                level->pub.height = height;
+                level->pub.channels = pyr->planes;
+                level->pub.stride = width * pyr->planes;
+                level->data = malloc((size_t)level->pub.stride * height);
+                level->pub.data = level->data;
+                if (!level->data)
+                        goto nomem;
+                for (i = 0; i < 2; i++) {
+                        for (p = 0; p < pyr->planes; p++) {
+                                level->rows[i][p] = malloc(width * sizeof(uint16_t));
+                                if (!level->rows[i][p])
+                                        goto nomem;
+                        }
+                }
+        }
+
+        return pyr;
+
+nomem:
+        vc_pyramid_destroy(pyr);
+        errno = ENOMEM;
+        return NULL;
+}
+
+void vc_pyramid_destroy(struct vc_pyramid *pyr)
+{
+        unsigned int k, i, p;
+
+        if (!pyr)
+                return;
+
+        for (k = 0; k < VC_PYRAMID_MAX_LEVELS; k++) {
+                free(pyr->levels[k].data);
+                for (i = 0; i < 2; i++) {
+                        for (p = 0; p < 3; p++)
+                                free(pyr->levels[k].rows[i][p]);
+                }
+        }
+        for (i = 0; i < 2; i++) {
+                free(pyr->lines[i]);
+                free(pyr->greens[i]);
+        }
+        free(pyr);
+}
+
+int vc_pyramid_process(struct vc_pyramid *pyr, const void *data, size_t bytesused)
+{
+        const struct vc_pixfmt *pixfmt = pyr->pixfmt;
+        uint32_t width = pyr->fmt.width, lines = pyr->levels[0].pub.height * 2, y;
+        bool in_place = !pyr->packed && pixfmt->bits > 8;
+        unsigned int k;
+
+        if (bytesused < (size_t)(lines - 1) * pyr->fmt.bytesperline +
+                        vc_pixfmt_line_bytes(pixfmt, pyr->packed, width))
+                return -EINVAL;
+
+        for (k = 0; k < pyr->params.levels; k++)
+                pyr->levels[k].count = 0;
+
+        for (y = 0; y < lines; y += 2) {
+                const uint8_t *src = (const uint8_t *)data + (size_t)y * pyr->fmt.bytesperline;
+                const uint16_t *l0, *l1;
+
+                // 16 bit containers are read in place
+                if (in_place) {
+                        l0 = (const uint16_t *)src;
+                        l1 = (const uint16_t *)(src + pyr->fmt.bytesperline);
+                } else {
+                        vc_pixfmt_unpack_line(pixfmt, pyr->packed, src, pyr->lines[0], width);
+                        vc_pixfmt_unpack_line(pixfmt, pyr->packed, src + pyr->fmt.bytesperline,
+                                              pyr->lines[1], width);
+                        l0 = pyr->lines[0];
+                        l1 = pyr->lines[1];
+                }
+                vc_pyr_bin_lines(pyr, l0, l1);
+        }
+
+        return 0;
+}
+
+const struct vc_pyramid_level *vc_pyramid_level(const struct vc_pyramid *pyr, unsigned int level)
+{
+        return level < pyr->params.levels ? &pyr->levels[level].pub : NULL;
+}
+
+unsigned int vc_pyramid_levels(const struct vc_pyramid *pyr)
+{
+        return pyr->params.levels;
+}
+
+const char *vc_pyramid_kernel(const struct vc_pyramid *pyr)
+{
+        return pyr->kernels->name;
+}
+
+int vc_pyramid_write_pnm(const struct vc_pyramid *pyr, unsigned int level, const char *path)
+{
+        const struct vc_pyramid_level *lvl = vc_pyramid_level(pyr, level);
+        char tmp[512];
+        size_t size;
+        FILE *f;
+        int ret = 0;
+
+        if (!lvl)
+                return -EINVAL;
+        if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+                return -ENAMETOOLONG;
+
+        f = fopen(tmp, "wb");
+        if (!f)
+                return -errno;
+
+        size = (size_t)lvl->stride * lvl->height;
+        fprintf(f, "P%c\n%u %u\n255\n", lvl->channels == 3 ? '6' : '5', lvl->width, lvl->height);
+        if (fwrite(lvl->data, 1, size, f) != size)
+                ret = -EIO;
+        if (fclose(f) && ret == 0)
+                ret = -errno;
+        if (ret == 0 && rename(tmp, path) < 0)
+                ret = -errno;
+        if (ret < 0)
+                unlink(tmp);
+        return ret;
+}
+
+int vc_pyramid_snapshot(const struct vc_pyramid *pyr, const char *prefix)
+{
+        unsigned int k;
+        char path[512];
+        int ret;
+
+        for (k = 0; k < pyr->params.levels; k++) {
+                snprintf(path, sizeof(path), "%s_%ux.%s", prefix, 2u << k, pyr->planes == 3 ? "ppm" : "pgm");
+                ret = vc_pyramid_write_pnm(pyr, k, path);
+                if (ret < 0)
+                        return ret;
+        }
+        return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef _VC_PYRAMID_H
+#define _VC_PYRAMID_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vc_capture.h"
+
+// Preview pyramid of raw frames
+//
+// Builds 2x, 4x and 8x box-filtered 8 bit levels of a raw frame in a single
+// pass: every pair of input lines is unpacked once and binned into one line
+// of the 2x level, two of those into one line of the 4x level and so on, so
+// only a few lines are live at any time and the frame is read only once.
+//
+// Bayer frames are binned per CFA cell. In grey mode the 2x level holds the
+// mean of each 2x2 cell, (R + 2G + B) / 4, which has no colour aliasing. In
+// RGB mode the colours of the cell are kept and the levels are RGB24.
+//
+// Samples of 16 bit containers must be right aligned. Levels are scaled to
+// 8 bit by dropping the low bits.
+
+#define VC_PYRAMID_MAX_LEVELS           3
+
+enum vc_pyramid_color {
+        VC_PYRAMID_GREY,
+        VC_PYRAMID_RGB,                 // Bayer formats only
+};
+
+struct vc_pyramid;
+
+struct vc_pyramid_params {
+        unsigned int levels;            // 1 (2x) to VC_PYRAMID_MAX_LEVELS (8x), default 3
+        enum vc_pyramid_color color;
+        const char *kernel;             // NULL: fastest, or "scalar", "sse2", "neon"
+};
+
+#define VC_PYRAMID_PARAMS_DEFAULT       { .levels = VC_PYRAMID_MAX_LEVELS, .color = VC_PYRAMID_GREY }
+
+struct vc_pyramid_level {
+        uint32_t width;
+        uint32_t height;
+        uint32_t stride;                // bytes per line
+        unsigned int channels;          // 1 (grey) or 3 (RGB24)
+        const uint8_t *data;
+};
+
+// Supports the formats of vc_pixfmt. Returns NULL with errno EINVAL for other
+// formats, RGB for mono formats and frames smaller than the last level.
+struct vc_pyramid *vc_pyramid_create(const struct vc_format *fmt, const struct vc_pyramid_params *params);
+void vc_pyramid_destroy(struct vc_pyramid *pyr);
+
+// Builds all levels from one frame. Returns 0 or a negative errno (-EINVAL
+// if the frame is shorter than the format).
+int vc_pyramid_process(struct vc_pyramid *pyr, const void *data, size_t bytesused);
+
+// Level 0 is 2x, 1 is 4x, 2 is 8x. The data is valid until the next
+// vc_pyramid_process().
+const struct vc_pyramid_level *vc_pyramid_level(const struct vc_pyramid *pyr, unsigned int level);
+unsigned int vc_pyramid_levels(const struct vc_pyramid *pyr);
+
+// Name of the kernels in use, e.g. "neon"
+const char *vc_pyramid_kernel(const struct vc_pyramid *pyr);
+
+// Writes a level as PGM (grey) or PPM (RGB). The file is written next to
+// 'path' and renamed, so a viewer polling it never sees a partial image.
+int vc_pyramid_write_pnm(const struct vc_pyramid *pyr, unsigned int level, const char *path);
+
+// Writes all levels as <prefix>_2x.pgm, <prefix>_4x.pgm, ... (.ppm for RGB)
+int vc_pyramid_snapshot(const struct vc_pyramid *pyr, const char *prefix);
+
+#endif // _VC_PYRAMID_H
@@ -0,0 +1,462 @@
+#include "vc_rawseq.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vc_codec.h"
+
+_Static_assert(sizeof(struct vc_rawseq_header) == 256, "vc_rawseq_header layout changed");
+_Static_assert(sizeof(struct vc_rawseq_frame) == 64, "vc_rawseq_frame layout changed");
+
+#define VC_RAWSEQ_INDEX_CHUNK           1024
+
+struct vc_rawseq_writer {
+        int fd;
+        struct vc_rawseq_header header;
+        struct vc_rawseq_frame *index;
+        uint32_t index_size;
+        uint64_t next_offset;
+
+        // Compressed recordings: record followed by the encoded payload
+        struct vc_codec *codec;
+        uint8_t *buf;
+        size_t buf_size;
+};
+
+struct vc_rawseq {
+        const uint8_t *map;
+        size_t map_size;
+        const struct vc_rawseq_header *header;
+        const struct vc_rawseq_frame *index;
+        struct vc_rawseq_frame *recovered;      // rebuilt index if the footer is missing
+        uint32_t count;
+        struct vc_codec *codec;                 // created on the first vc_rawseq_read()
+};
+
+static uint64_t vc_round_up(uint64_t value, uint64_t align)
+{
+        return (value + align - 1) / align * align;
+}
+
+static int vc_pwrite_all(int fd, const void *buf, size_t len, off_t offset)
+{
+        const uint8_t *p = buf;
+
+        while (len > 0) {
+                ssize_t ret = pwrite(fd, p, len, offset);
+                if (ret < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return -errno;
+                }
+                p += ret;
+                len -= ret;
+                offset += ret;
+        }
+        return 0;
+}
+
+static struct vc_codec *vc_rawseq_codec(const struct vc_rawseq_header *header)
+{
+        struct vc_format fmt = {
+                .width = header->width,
+                .height = header->height,
+                .fourcc = header->fourcc,
+                .bytesperline = header->bytesperline,
+                .sizeimage = header->frame_size,
+        };
+
+        return vc_codec_create(&fmt);
+}
+
+// --- Writer ------------------------------------------------------------------
+
+struct vc_rawseq_writer *vc_rawseq_create(const char *path, const struct vc_rawseq_header *info)
+{
+        struct vc_rawseq_writer *writer;
+        struct timespec now;
+        long page_size = sysconf(_SC_PAGESIZE);
+        int ret;
+
+        writer = calloc(1, sizeof(*writer));
+        if (!writer)
+                return NULL;
+
+        writer->header = *info;
+        memcpy(writer->header.magic, VC_RAWSEQ_MAGIC, sizeof(writer->header.magic));
+        writer->header.version = VC_RAWSEQ_VERSION;
+        writer->header.page_size = page_size > 0 ? page_size : 4096;
+        writer->header.slot_size = vc_round_up((uint64_t)info->frame_size + sizeof(struct vc_rawseq_frame),
+                                               writer->header.page_size);
+        writer->next_offset = writer->header.page_size;
+
+        switch (info->compression) {
+        case VC_RAWSEQ_COMPRESSION_NONE:
+                break;
+        case VC_RAWSEQ_COMPRESSION_VCZ:
+                writer->codec = vc_rawseq_codec(info);
+                if (!writer->codec) {
+                        ret = -errno;
+                        goto err_free;
+                }
+                writer->buf_size = sizeof(struct vc_rawseq_frame) + vc_codec_bound(writer->codec);
+                writer->buf = malloc(writer->buf_size);
+                if (!writer->buf) {
+                        ret = -ENOMEM;
+                        goto err_free;
+                }
+                writer->header.version = VC_RAWSEQ_VERSION_COMPRESSED;
+                writer->header.slot_size = vc_round_up(writer->buf_size, writer->header.page_size);
+                break;
+        default:
+                ret = -EINVAL;
+                goto err_free;
+        }
+        writer->header.frame_count = 0;
+        writer->header.index_offset = 0;
+        if (writer->header.created_ns == 0) {
+                clock_gettime(CLOCK_REALTIME, &now);
+                writer->header.created_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+        }
+
+        writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (writer->fd < 0) {
+                ret = -errno;
+                goto err_free;
+        }
+
+        ret = vc_pwrite_all(writer->fd, &writer->header, sizeof(writer->header), 0);
+        if (ret < 0)
+                goto err_close;
+
+        return writer;
+
+err_close:
+        close(writer->fd);
+err_free:
+        vc_codec_destroy(writer->codec);
+        free(writer->buf);
+        free(writer);
+        errno = -ret;
+        return NULL;
+}
+
+int vc_rawseq_append(struct vc_rawseq_writer *writer, const struct vc_frame *frame)
+{
+        struct vc_rawseq_header *header = &writer->header;
+        struct vc_rawseq_frame record;
+        uint64_t offset;
+        size_t bytesused = frame->bytesused;
+        int ret;
+
+        if (bytesused > header->frame_size)
+                bytesused = header->frame_size;
+
+        if (header->frame_count == writer->index_size) {
+                uint32_t size = writer->index_size + VC_RAWSEQ_INDEX_CHUNK;
+                struct vc_rawseq_frame *index = realloc(writer->index, size * sizeof(*index));
+                if (!index)
+                        return -ENOMEM;
+                writer->index = index;
+                writer->index_size = size;
+        }
+
+        offset = writer->next_offset;
+
+        memset(&record, 0, sizeof(record));
+        record.offset = offset;
+        record.timestamp_ns = frame->timestamp_ns;
+        record.sequence = frame->sequence;
+        record.bytesused = bytesused;
+        record.exposure = frame->ctrls.exposure;
+        record.gain = frame->ctrls.gain;
+        record.blacklevel = frame->ctrls.blacklevel;
+        record.live_roi = frame->ctrls.live_roi;
+        record.binning_mode = frame->ctrls.binning_mode;
+        record.frame_rate = frame->ctrls.frame_rate;
+        record.flags = frame->flags;
+        if (frame->ctrls.bracket >= 0)
+                record.bracket = frame->ctrls.bracket + 1;
+        record.magic = VC_RAWSEQ_FRAME_MAGIC;
+
+        if (writer->codec) {
+                ssize_t len = vc_codec_encode(writer->codec, frame->data, bytesused,
+                                              writer->buf + sizeof(record), writer->buf_size - sizeof(record));
+                if (len < 0)
+                        return len;
+
+                record.offset = offset + sizeof(record);
+                record.bytesused = len;
+                record.size = bytesused;
+                memcpy(writer->buf, &record, sizeof(record));
+
+                ret = vc_pwrite_all(writer->fd, writer->buf, sizeof(record) + len, offset);
+                if (ret < 0)
+                        return ret;
+
+                writer->next_offset = vc_round_up(record.offset + len, header->page_size);
+                writer->index[header->frame_count++] = record;
+                return 0;
+        }
+
+        ret = vc_pwrite_all(writer->fd, frame->data, bytesused, offset);
+        if (ret < 0)
+                return ret;
+
+        ret = vc_pwrite_all(writer->fd, &record, sizeof(record),
+                            offset + header->slot_size - sizeof(record));
+        if (ret < 0)
+                return ret;
+
+        writer->next_offset += header->slot_size;
+        writer->index[header->frame_count++] = record;
+        return 0;
+}
+
+int vc_rawseq_finish(struct vc_rawseq_writer *writer)
+{
+        struct vc_rawseq_header *header = &writer->header;
+        int ret;
+
+        header->index_offset = writer->next_offset;
+
+        ret = vc_pwrite_all(writer->fd, writer->index,
+                            (size_t)header->frame_count * sizeof(struct vc_rawseq_frame),
+                            header->index_offset);
+        if (ret == 0)
+                ret = vc_pwrite_all(writer->fd, header, sizeof(*header), 0);
+        if (ret == 0 && fsync(writer->fd) < 0)
+                ret = -errno;
+
+        close(writer->fd);
+        vc_codec_destroy(writer->codec);
+        free(writer->buf);
+        free(writer->index);
+        free(writer);
+
+        return ret;
+}
+
+// --- Reader ------------------------------------------------------------------
+
+static int vc_rawseq_recover_compressed(struct vc_rawseq *seq)
+{
+        const struct vc_rawseq_header *header = seq->header;
+        uint64_t offset = header->page_size;
+        uint32_t count = 0, size = 0;
+
+        while (offset + sizeof(struct vc_rawseq_frame) <= seq->map_size) {
+                const struct vc_rawseq_frame *record = (const void *)(seq->map + offset);
+
+                if (record->magic != VC_RAWSEQ_FRAME_MAGIC || record->offset != offset + sizeof(*record) ||
+                    record->offset + record->bytesused > seq->map_size)
+                        break;
+
+                if (count == size) {
+                        struct vc_rawseq_frame *index;
+
+                        size += VC_RAWSEQ_INDEX_CHUNK;
+                        index = realloc(seq->recovered, size * sizeof(*index));
+                        if (!index)
+                                return -ENOMEM;
+                        seq->recovered = index;
+                }
+                seq->recovered[count++] = *record;
+                offset = vc_round_up(record->offset + record->bytesused, header->page_size);
+        }
+
+        seq->index = seq->recovered;
+        seq->count = count;
+        return 0;
+}
+
+static int vc_rawseq_recover_index(struct vc_rawseq *seq)
+{
+        const struct vc_rawseq_header *header = seq->header;
+        uint64_t slots = (seq->map_size - header->page_size) / header->slot_size;
+        uint32_t i;
+
+        if (header->compression)
+                return vc_rawseq_recover_compressed(seq);
+
+        seq->recovered = calloc(slots ? slots : 1, sizeof(*seq->recovered));
+        if (!seq->recovered)
+                return -ENOMEM;
+
+        for (i = 0; i < slots; i++) {
+                uint64_t offset = header->page_size + (uint64_t)i * header->slot_size;
+                const struct vc_rawseq_frame *record = (const void *)
+                        (seq->map + offset + header->slot_size - sizeof(*record));
+
+                if (record->magic != VC_RAWSEQ_FRAME_MAGIC || record->offset != offset)
+                        break;
+                seq->recovered[i] = *record;
+        }
+
+        seq->index = seq->recovered;
+        seq->count = i;
+        return 0;
+}
+
+struct vc_rawseq *vc_rawseq_open(const char *path)
+{
+        const struct vc_rawseq_header *header;
+        struct vc_rawseq *seq;
+        struct stat st;
+        int fd, ret;
+
+        seq = calloc(1, sizeof(*seq));
+        if (!seq)
+                return NULL;
+
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+                ret = -errno;
+                goto err_free;
+        }
+        if (fstat(fd, &st) < 0) {
+                ret = -errno;
+                goto err_close;
+        }
+        if ((size_t)st.st_size < sizeof(*header)) {
+                ret = -EINVAL;
+                goto err_close;
+        }
+
+        seq->map_size = st.st_size;
+        seq->map = mmap(NULL, seq->map_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (seq->map == MAP_FAILED) {
+                ret = -errno;
+                goto err_close;
+        }
+        close(fd);
+        fd = -1;
+
+        header = seq->header = (const void *)seq->map;
+        if (memcmp(header->magic, VC_RAWSEQ_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version < VC_RAWSEQ_VERSION || header->version > VC_RAWSEQ_VERSION_COMPRESSED ||
+            (header->version == VC_RAWSEQ_VERSION && header->compression) ||
+            header->compression > VC_RAWSEQ_COMPRESSION_VCZ ||
+            header->page_size == 0 || header->slot_size == 0 ||
+            header->page_size > seq->map_size) {
+                ret = -EINVAL;
+                goto err_unmap;
+        }
+
+        if (header->index_offset != 0 &&
+            header->index_offset + (uint64_t)header->frame_count * sizeof(struct vc_rawseq_frame) <= seq->map_size) {
+                seq->index = (const void *)(seq->map + header->index_offset);
+                seq->count = header->frame_count;
+        } else {
+                ret = vc_rawseq_recover_index(seq);
+                if (ret < 0)
+                        goto err_unmap;
+        }
+
+        // Tell the kernel that frames are usually read front to back.
+        madvise((void *)seq->map, seq->map_size, MADV_SEQUENTIAL);
+
+        return seq;
+
+err_unmap:
+        munmap((void *)seq->map, seq->map_size);
+err_close:
+        if (fd >= 0)
+                close(fd);
+err_free:
+        free(seq);
+        errno = -ret;
+        return NULL;
+}
+
+void vc_rawseq_close(struct vc_rawseq *seq)
+{
+        if (!seq)
+                return;
+
+        munmap((void *)seq->map, seq->map_size);
+        vc_codec_destroy(seq->codec);
+        free(seq->recovered);
+        free(seq);
+}
+
+const struct vc_rawseq_header *vc_rawseq_info(const struct vc_rawseq *seq)
+{
+        return seq->header;
+}
+
+uint32_t vc_rawseq_count(const struct vc_rawseq *seq)
+{
+        return seq->count;
+}
+
+const struct vc_rawseq_frame *vc_rawseq_frame(const struct vc_rawseq *seq, uint32_t index,
+                                              const void **data)
+{
+        const struct vc_rawseq_frame *record;
+
+        if (index >= seq->count)
+                return NULL;
+
+        record = &seq->index[index];
+        if (record->offset + record->bytesused > seq->map_size)
+                return NULL;
+
+        if (data)
+                *data = seq->map + record->offset;
+        return record;
+}
+
+bool vc_rawseq_compressed(const struct vc_rawseq *seq)
+{
+        return seq->header->compression != VC_RAWSEQ_COMPRESSION_NONE;
+}
+
+ssize_t vc_rawseq_read(struct vc_rawseq *seq, uint32_t index, void *dst, size_t size)
+{
+        const struct vc_rawseq_frame *record;
+        const void *data;
+
+        record = vc_rawseq_frame(seq, index, &data);
+        if (!record)
+                return -EIO;
+
+        if (!vc_rawseq_compressed(seq)) {
+                if (size < record->bytesused)
+                        return -ENOSPC;
+                memcpy(dst, data, record->bytesused);
+                return record->bytesused;
+        }
+
+        if (!seq->codec) {
+                seq->codec = vc_rawseq_codec(seq->header);
+                if (!seq->codec)
+                        return -errno;
+        }
+        return vc_codec_decode(seq->codec, data, record->bytesused, dst, size);
+}
+
+int vc_rawseq_find_sequence(const struct vc_rawseq *seq, uint32_t sequence)
+{
+        uint32_t lo = 0, hi = seq->count;
+
+        while (lo < hi) {
+                uint32_t mid = lo + (hi - lo) / 2;
+
+                if (seq->index[mid].sequence < sequence)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+
+        if (lo < seq->count && seq->index[lo].sequence == sequence)
+                return lo;
+        return -ENOENT;
+}
@@ -0,0 +1,122 @@
+#ifndef _VC_RAWSEQ_H
+#define _VC_RAWSEQ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "vc_capture.h"
+
+// Raw sequence container (.vcraw)
+//
+//   +--------------------------+ 0
+//   | struct vc_rawseq_header  |   padded to page_size
+//   +--------------------------+ page_size
+//   | frame 0 payload          |   slot_size bytes per frame, every payload
+//   | ...  struct vc_rawseq_   |   starts page aligned, the frame record is
+//   |      frame (slot trailer)|   stored in the last 64 bytes of the slot
+//   +--------------------------+
+//   | frame 1 ...              |
+//   +--------------------------+ index_offset
+//   | struct vc_rawseq_frame[] |   footer index, frame_count entries
+//   +--------------------------+
+//
+// All fields are little endian. The footer index is written when the
+// recording is closed. If it is missing (power loss while recording) the
+// reader rebuilds it from the slot trailers.
+//
+// Compressed recordings (version 2, see vc_codec.h) have slots of variable
+// size: the frame record comes first, the encoded payload follows it and the
+// slot is padded to the next page. The recovery walks the slots from record
+// to record.
+
+#define VC_RAWSEQ_MAGIC                 "VCRAWSEQ"
+#define VC_RAWSEQ_VERSION               1
+#define VC_RAWSEQ_VERSION_COMPRESSED    2
+#define VC_RAWSEQ_FRAME_MAGIC           0x52464356      // "VCFR"
+
+enum vc_rawseq_compression {
+        VC_RAWSEQ_COMPRESSION_NONE = 0,
+        VC_RAWSEQ_COMPRESSION_VCZ,      // vc_codec, lossless
+};
+
+struct vc_rawseq_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t page_size;
+        char sensor_name[VC_SENSOR_NAME_LEN];   // V4L2_CID_VC_NAME
+        uint32_t mbus_code;
+        uint32_t fourcc;
+        uint32_t width;
+        uint32_t height;
+        uint32_t bytesperline;
+        uint32_t frame_size;            // max payload per frame (sizeimage)
+        uint32_t slot_size;             // max slot size if compressed
+        uint32_t frame_count;
+        uint64_t index_offset;          // 0 while recording
+        uint64_t created_ns;            // CLOCK_REALTIME
+        struct {                        // sensor crop at recording start
+                int32_t left;
+                int32_t top;
+                uint32_t width;
+                uint32_t height;
+        } crop;
+        uint32_t compression;           // enum vc_rawseq_compression
+        uint8_t reserved[140];
+} __attribute__((packed));
+
+struct vc_rawseq_frame {
+        uint64_t offset;                // payload offset in file
+        uint64_t timestamp_ns;          // CLOCK_MONOTONIC buffer timestamp
+        uint32_t sequence;
+        uint32_t bytesused;             // stored (compressed) size
+        int32_t exposure;
+        int32_t gain;
+        int32_t blacklevel;
+        int32_t live_roi;
+        int32_t binning_mode;
+        int32_t frame_rate;
+        uint32_t flags;                 // V4L2_BUF_FLAG_*
+        uint32_t magic;                 // VC_RAWSEQ_FRAME_MAGIC
+        uint32_t size;                  // original payload size if compressed
+        uint8_t bracket;                // exposure bracketing entry + 1, 0 if untagged
+        uint8_t reserved[3];
+} __attribute__((packed));
+
+struct vc_rawseq_writer;
+struct vc_rawseq;
+
+// --- Writer ------------------------------------------------------------------
+
+// Creates a new recording. Only magic, version, page_size, slot_size,
+// frame_count and index_offset are filled in by the writer, everything else
+// is taken from 'info'. With info->compression set the frames are encoded
+// by vc_rawseq_append().
+struct vc_rawseq_writer *vc_rawseq_create(const char *path, const struct vc_rawseq_header *info);
+int vc_rawseq_append(struct vc_rawseq_writer *writer, const struct vc_frame *frame);
+int vc_rawseq_finish(struct vc_rawseq_writer *writer);
+
+// --- Reader ------------------------------------------------------------------
+
+struct vc_rawseq *vc_rawseq_open(const char *path);
+void vc_rawseq_close(struct vc_rawseq *seq);
+
+const struct vc_rawseq_header *vc_rawseq_info(const struct vc_rawseq *seq);
+uint32_t vc_rawseq_count(const struct vc_rawseq *seq);
+
+// O(1) access to frame 'index'. Returns the frame record, *data points into
+// the read-only mapping of the file (the encoded payload if compressed).
+const struct vc_rawseq_frame *vc_rawseq_frame(const struct vc_rawseq *seq, uint32_t index,
+                                              const void **data);
+
+bool vc_rawseq_compressed(const struct vc_rawseq *seq);
+
+// Copies or decodes the payload of frame 'index' into 'dst' ('size' bytes,
+// at least frame_size). Returns the payload size or a negative errno.
+ssize_t vc_rawseq_read(struct vc_rawseq *seq, uint32_t index, void *dst, size_t size);
+
+// Binary search for a sensor sequence number, returns the index or -ENOENT.
+int vc_rawseq_find_sequence(const struct vc_rawseq *seq, uint32_t sequence);
+
+#endif // _VC_RAWSEQ_H
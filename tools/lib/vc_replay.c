@@ -0,0 +1,445 @@
+#include "vc_capture_priv.h"
+#include "vc_rawseq.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum vc_replay_slot {
+        VC_REPLAY_SLOT_FREE,            // queued, may be filled by the source
+        VC_REPLAY_SLOT_STAGED,          // holds the next frame decoded ahead, not due yet
+        VC_REPLAY_SLOT_DONE,            // filled, waiting in the done queue
+        VC_REPLAY_SLOT_USER,            // dequeued by the consumer
+};
+
+struct vc_replay {
+        struct vc_rawseq *seq;
+        struct vc_replay_params params;
+        uint32_t count;
+
+        // Timing of one pass over the file
+        uint64_t base_ts;
+        uint64_t pass_duration_ns;
+        uint32_t pass_sequence;
+
+        // Source position
+        uint64_t start_ns;
+        uint64_t produced;
+        uint32_t next;
+        unsigned int pass;
+        bool eof;
+        uint64_t rng;
+
+        unsigned int num_buffers;
+        enum vc_replay_slot slots[VC_CAPTURE_MAX_BUFFERS];
+        struct vc_frame frames[VC_CAPTURE_MAX_BUFFERS];
+        uint8_t *decoded[VC_CAPTURE_MAX_BUFFERS];      // compressed recordings only
+        size_t decoded_size;
+        int staged;                     // slot with frame 'next' decoded, -1 if none
+        unsigned int done[VC_CAPTURE_MAX_BUFFERS];
+        unsigned int done_head;
+        unsigned int done_count;
+};
+
+static double vc_replay_random(struct vc_replay *replay)
+{
+        // xorshift64*, good enough to place drops
+        replay->rng ^= replay->rng >> 12;
+        replay->rng ^= replay->rng << 25;
+        replay->rng ^= replay->rng >> 27;
+        return ((replay->rng * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static bool vc_replay_timed(const struct vc_replay *replay)
+{
+        return replay->params.fps > 0.0 || replay->params.speed > 0.0;
+}
+
+// Monotonic time at which the next frame of the file is due
+static uint64_t vc_replay_due_ns(const struct vc_replay *replay)
+{
+        const struct vc_rawseq_frame *rec;
+        uint64_t offset;
+
+        if (replay->params.fps > 0.0)
+                return replay->start_ns + (uint64_t)(replay->produced * 1e9 / replay->params.fps);
+
+        rec = vc_rawseq_frame(replay->seq, replay->next, NULL);
+        offset = (rec ? rec->timestamp_ns - replay->base_ts : 0) +
+                 (uint64_t)replay->pass * replay->pass_duration_ns;
+        return replay->start_ns + (uint64_t)(offset / replay->params.speed);
+}
+
+static int vc_replay_free_slot(const struct vc_replay *replay)
+{
+        unsigned int i;
+
+        for (i = 0; i < replay->num_buffers; i++) {
+                if (replay->slots[i] == VC_REPLAY_SLOT_FREE)
+                        return i;
+        }
+        return -1;
+}
+
+// Decodes frame 'next' of a compressed recording into the buffer of 'slot'
+static void vc_replay_decode(struct vc_capture *cap, struct vc_replay *replay, int slot)
+{
+        uint64_t start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+        ssize_t len;
+
+        len = vc_rawseq_read(replay->seq, replay->next, replay->decoded[slot], replay->decoded_size);
+        replay->frames[slot].data = replay->decoded[slot];
+        replay->frames[slot].bytesused = len > 0 ? len : 0;
+        vc_hist_add(&cap->stats.decode, vc_clock_ns(CLOCK_MONOTONIC) - start_ns);
+}
+
+// Decodes the next compressed frame while the consumer waits for it to become
+// due, so the decode time is not part of the delivery latency.
+static void vc_replay_stage(struct vc_capture *cap, struct vc_replay *replay)
+{
+        int slot;
+
+        if (!replay->decoded_size || replay->staged >= 0 || replay->eof)
+                return;
+
+        slot = vc_replay_free_slot(replay);
+        if (slot < 0 || !vc_rawseq_frame(replay->seq, replay->next, NULL))
+                return;
+
+        vc_replay_decode(cap, replay, slot);
+        replay->slots[slot] = VC_REPLAY_SLOT_STAGED;
+        replay->staged = slot;
+}
+
+// Delivers the next frame of the file with the given timestamp. Like the
+// receiver, the frame is lost if the consumer did not give back a buffer.
+static void vc_replay_produce(struct vc_capture *cap, struct vc_replay *replay, uint64_t timestamp_ns)
+{
+        const struct vc_rawseq_frame *rec;
+        struct vc_frame *frame;
+        const void *data;
+        int slot = replay->staged;
+
+        rec = vc_rawseq_frame(replay->seq, replay->next, &data);
+        if (!rec) {
+                replay->eof = true;
+                return;
+        }
+
+        // A frame decoded ahead is delivered from its slot or given up with the frame
+        replay->staged = -1;
+        if (replay->params.drop_rate > 0.0 && vc_replay_random(replay) < replay->params.drop_rate) {
+                if (slot >= 0)
+                        replay->slots[slot] = VC_REPLAY_SLOT_FREE;
+                cap->stats.injected++;
+        } else if (slot < 0 && (slot = vc_replay_free_slot(replay)) < 0) {
+                cap->stats.overruns++;
+        } else {
+                frame = &replay->frames[slot];
+                if (!replay->decoded_size) {
+                        frame->data = data;
+                        frame->bytesused = rec->bytesused;
+                } else if (replay->slots[slot] != VC_REPLAY_SLOT_STAGED) {
+                        // Not decoded ahead, the consumer waits for it
+                        vc_replay_decode(cap, replay, slot);
+                        if (vc_replay_timed(replay))
+                                cap->stats.late_decodes++;
+                }
+                frame->index = slot;
+                frame->sequence = rec->sequence + replay->pass * replay->pass_sequence;
+                frame->timestamp_ns = timestamp_ns;
+                frame->flags = rec->flags;
+                frame->ctrls.exposure = rec->exposure;
+                frame->ctrls.gain = rec->gain;
+                frame->ctrls.blacklevel = rec->blacklevel;
+                frame->ctrls.live_roi = rec->live_roi;
+                frame->ctrls.binning_mode = rec->binning_mode;
+                frame->ctrls.frame_rate = rec->frame_rate;
+                frame->ctrls.bracket = rec->bracket ? rec->bracket - 1 : VC_CTRL_UNAVAILABLE;
+
+                replay->slots[slot] = VC_REPLAY_SLOT_DONE;
+                replay->done[(replay->done_head + replay->done_count) % VC_CAPTURE_MAX_BUFFERS] = slot;
+                replay->done_count++;
+        }
+
+        replay->produced++;
+        if (++replay->next == replay->count) {
+                replay->next = 0;
+                replay->pass++;
+                if (replay->params.loops && replay->pass >= replay->params.loops)
+                        replay->eof = true;
+        }
+}
+
+// Catches up with all frames that became due until 'now_ns'
+static void vc_replay_advance(struct vc_capture *cap, struct vc_replay *replay, uint64_t now_ns)
+{
+        uint64_t due;
+
+        if (!cap->streaming || !vc_replay_timed(replay))
+                return;
+
+        while (!replay->eof && (due = vc_replay_due_ns(replay)) <= now_ns)
+                vc_replay_produce(cap, replay, due);
+}
+
+static void vc_replay_sleep_until(uint64_t deadline_ns)
+{
+        struct timespec ts = {
+                .tv_sec = deadline_ns / 1000000000ULL,
+                .tv_nsec = deadline_ns % 1000000000ULL,
+        };
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+                ;
+}
+
+// --- Backend -----------------------------------------------------------------
+
+static int vc_replay_start(struct vc_capture *cap)
+{
+        struct vc_replay *replay = cap->priv;
+        unsigned int i;
+
+        for (i = 0; i < replay->num_buffers; i++)
+                replay->slots[i] = VC_REPLAY_SLOT_FREE;
+        replay->done_head = 0;
+        replay->done_count = 0;
+        replay->staged = -1;
+
+        replay->next = 0;
+        replay->pass = 0;
+        replay->produced = 0;
+        replay->eof = false;
+        replay->rng = replay->params.seed ? replay->params.seed : 1;
+        replay->start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+
+        return 0;
+}
+
+static int vc_replay_stop(struct vc_capture *cap)
+{
+        struct vc_replay *replay = cap->priv;
+        unsigned int i;
+
+        for (i = 0; i < replay->num_buffers; i++)
+                replay->slots[i] = VC_REPLAY_SLOT_FREE;
+        replay->done_count = 0;
+        replay->staged = -1;
+
+        return 0;
+}
+
+static int vc_replay_dequeue(struct vc_capture *cap, struct vc_frame *frame, int timeout_ms)
+{
+        struct vc_replay *replay = cap->priv;
+        uint64_t now_ns, due, deadline = 0;
+        unsigned int slot;
+
+        if (!cap->streaming)
+                return -EINVAL;
+
+        now_ns = vc_clock_ns(CLOCK_MONOTONIC);
+        if (timeout_ms >= 0)
+                deadline = now_ns + (uint64_t)timeout_ms * 1000000ULL;
+
+        for (;;) {
+                vc_replay_advance(cap, replay, now_ns);
+                if (replay->done_count)
+                        break;
+                if (replay->eof)
+                        return -ENODATA;
+
+                if (!vc_replay_timed(replay)) {
+                        // As fast as possible: the source waits for the consumer
+                        if (vc_replay_free_slot(replay) < 0)
+                                return -ENOBUFS;
+                        vc_replay_produce(cap, replay, now_ns);
+                        continue;
+                }
+
+                vc_replay_stage(cap, replay);
+                due = vc_replay_due_ns(replay);
+                if (timeout_ms >= 0 && due > deadline) {
+                        vc_replay_sleep_until(deadline);
+                        return -ETIMEDOUT;
+                }
+                vc_replay_sleep_until(due);
+                now_ns = vc_clock_ns(CLOCK_MONOTONIC);
+        }
+
+        slot = replay->done[replay->done_head];
+        replay->done_head = (replay->done_head + 1) % VC_CAPTURE_MAX_BUFFERS;
+        replay->done_count--;
+        replay->slots[slot] = VC_REPLAY_SLOT_USER;
+        *frame = replay->frames[slot];
+
+        return 0;
+}
+
+static int vc_replay_release(struct vc_capture *cap, const struct vc_frame *frame)
+{
+        struct vc_replay *replay = cap->priv;
+
+        if (frame->index >= replay->num_buffers || replay->slots[frame->index] != VC_REPLAY_SLOT_USER)
+                return -EINVAL;
+
+        // Frames that became due while the consumer held the buffer must not
+        // see it as free.
+        vc_replay_advance(cap, replay, vc_clock_ns(CLOCK_MONOTONIC));
+        replay->slots[frame->index] = VC_REPLAY_SLOT_FREE;
+
+        return 0;
+}
+
+static void vc_replay_free(struct vc_replay *replay)
+{
+        unsigned int i;
+
+        for (i = 0; i < VC_CAPTURE_MAX_BUFFERS; i++)
+                free(replay->decoded[i]);
+        vc_rawseq_close(replay->seq);
+        free(replay);
+}
+
+static void vc_replay_close(struct vc_capture *cap)
+{
+        vc_replay_free(cap->priv);
+}
+
+static int vc_replay_pending(struct vc_capture *cap)
+{
+        struct vc_replay *replay = cap->priv;
+
+        return replay->done_count;
+}
+
+static const struct vc_capture_ops vc_replay_ops = {
+        .start = vc_replay_start,
+        .stop = vc_replay_stop,
+        .dequeue = vc_replay_dequeue,
+        .release = vc_replay_release,
+        .close = vc_replay_close,
+        .pending = vc_replay_pending,
+};
+
+// --- Public API --------------------------------------------------------------
+
+static void vc_replay_preload(struct vc_replay *replay)
+{
+        const struct vc_rawseq_header *info = vc_rawseq_info(replay->seq);
+        const struct vc_rawseq_frame *rec;
+        volatile uint8_t sink = 0;
+        uint32_t i, offset;
+
+        for (i = 0; i < replay->count; i++) {
+                const uint8_t *data;
+
+                rec = vc_rawseq_frame(replay->seq, i, (const void **)&data);
+                if (!rec)
+                        break;
+                for (offset = 0; offset < rec->bytesused; offset += info->page_size)
+                        sink += data[offset];
+        }
+        (void)sink;
+}
+
+struct vc_capture *vc_capture_open_replay(const char *path, const struct vc_replay_params *params,
+                                          unsigned int buffers)
+{
+        const struct vc_rawseq_frame *first, *last;
+        const struct vc_rawseq_header *info;
+        struct vc_replay *replay;
+        struct vc_capture *cap;
+        unsigned int i;
+        int ret;
+
+        if (params->speed < 0.0 || params->fps < 0.0 ||
+            params->drop_rate < 0.0 || params->drop_rate >= 1.0) {
+                errno = EINVAL;
+                return NULL;
+        }
+
+        replay = calloc(1, sizeof(*replay));
+        if (!replay)
+                return NULL;
+        replay->params = *params;
+        replay->staged = -1;
+
+        replay->seq = vc_rawseq_open(path);
+        if (!replay->seq) {
+                ret = -errno;
+                goto err_free;
+        }
+
+        replay->count = vc_rawseq_count(replay->seq);
+        if (replay->count == 0) {
+                ret = -ENODATA;
+                goto err_close;
+        }
+
+        first = vc_rawseq_frame(replay->seq, 0, NULL);
+        last = vc_rawseq_frame(replay->seq, replay->count - 1, NULL);
+        if (!first || !last) {
+                ret = -EIO;
+                goto err_close;
+        }
+
+        // One pass lasts from the first frame to one mean frame interval
+        // after the last, so looping keeps the recorded rate.
+        replay->base_ts = first->timestamp_ns;
+        if (replay->count > 1 && last->timestamp_ns > first->timestamp_ns)
+                replay->pass_duration_ns = (last->timestamp_ns - first->timestamp_ns) *
+                                           replay->count / (replay->count - 1);
+        else
+                replay->pass_duration_ns = 1000000000ULL / 30;
+        replay->pass_sequence = last->sequence - first->sequence + 1;
+
+        replay->num_buffers = buffers ? buffers : 4;
+        if (replay->num_buffers > VC_CAPTURE_MAX_BUFFERS)
+                replay->num_buffers = VC_CAPTURE_MAX_BUFFERS;
+
+        info = vc_rawseq_info(replay->seq);
+
+        // Compressed frames are decoded into a buffer per slot, so they stay
+        // valid while the consumer holds them.
+        if (vc_rawseq_compressed(replay->seq)) {
+                replay->decoded_size = info->frame_size;
+                for (i = 0; i < replay->num_buffers; i++) {
+                        replay->decoded[i] = malloc(replay->decoded_size);
+                        if (!replay->decoded[i]) {
+                                ret = -ENOMEM;
+                                goto err_close;
+                        }
+                }
+        }
+
+        if (params->preload)
+                vc_replay_preload(replay);
+
+        cap = vc_capture_alloc(&vc_replay_ops);
+        if (!cap) {
+                ret = -ENOMEM;
+                goto err_close;
+        }
+        cap->priv = replay;
+
+        cap->fmt.width = info->width;
+        cap->fmt.height = info->height;
+        cap->fmt.fourcc = info->fourcc;
+        cap->fmt.bytesperline = info->bytesperline;
+        cap->fmt.sizeimage = info->frame_size;
+
+        return cap;
+
+err_close:
+        vc_replay_free(replay);
+        errno = -ret;
+        return NULL;
+
+err_free:
+        free(replay);
+        errno = -ret;
+        return NULL;
+}
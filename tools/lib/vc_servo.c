@@ -0,0 +1,277 @@
+#include "vc_servo.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vc_v4l2.h"
+
+// Dynamic POSIX clock of a PHC file descriptor, see clock_gettime(2)
+#define VC_FD_TO_CLOCKID(fd)            ((~(clockid_t)(fd) << 3) | 3)
+
+// Clock readings per offset measurement, the tightest one is used
+#define VC_SERVO_OFFSET_SAMPLES         3
+
+struct vc_servo {
+        int fd;
+        struct vc_servo_params params;
+        int64_t width, height;
+        int64_t vblank_min, vblank_max;
+        int64_t hblank_min, hblank_max;
+        int32_t hblank_nominal;         // HBLANK is kept close to this value
+        double ns_per_pixel;            // measured during calibration
+        double period_free;             // period that holds the phase, in model ns
+        int64_t first_ts;               // calibration start, reference clock
+        uint32_t first_sequence;
+        bool started;
+        unsigned int settle;
+        unsigned int in_lock;
+        struct vc_servo_status status;
+};
+
+// Reference clock - CLOCK_MONOTONIC
+static int64_t vc_servo_clock_offset(clockid_t clock)
+{
+        uint64_t window = UINT64_MAX;
+        int64_t offset = 0;
+        unsigned int i;
+
+        if (clock == CLOCK_MONOTONIC)
+                return 0;
+
+        for (i = 0; i < VC_SERVO_OFFSET_SAMPLES; i++) {
+                uint64_t before = vc_clock_ns(CLOCK_MONOTONIC);
+                uint64_t ref = vc_clock_ns(clock);
+                uint64_t after = vc_clock_ns(CLOCK_MONOTONIC);
+
+                if (after - before < window) {
+                        window = after - before;
+                        offset = (int64_t)(ref - (before + window / 2));
+                }
+        }
+        return offset;
+}
+
+// Distance to the nearest frame start of the target grid, positive if late
+static int64_t vc_servo_phase_error(const struct vc_servo_params *params, int64_t t)
+{
+        int64_t period = params->period_ns;
+        int64_t error = (t - (int64_t)params->phase_ns) % period;
+
+        if (error < 0)
+                error += period;
+        if (error > period / 2)
+                error -= period;
+        return error;
+}
+
+struct vc_servo *vc_servo_create(int subdev_fd, const struct vc_servo_params *params)
+{
+        struct v4l2_mbus_framefmt fmt;
+        struct vc_servo *servo;
+        int32_t vblank, hblank;
+        int64_t def;
+
+        if (subdev_fd < 0 || params->period_ns == 0 || params->kp <= 0 || params->kp >= 1 ||
+            params->ki < 0 || params->ki >= params->kp || params->max_adjust <= 0) {
+                errno = EINVAL;
+                return NULL;
+        }
+
+        servo = calloc(1, sizeof(*servo));
+        if (!servo)
+                return NULL;
+        servo->fd = subdev_fd;
+        servo->params = *params;
+        if (!servo->params.calibration)
+                servo->params.calibration = 1;
+
+        if (vc_subdev_get_fmt(subdev_fd, 0, &fmt) < 0 ||
+            vc_ctrl_query(subdev_fd, V4L2_CID_VBLANK, &servo->vblank_min, &servo->vblank_max, &def) < 0 ||
+            vc_ctrl_get(subdev_fd, V4L2_CID_VBLANK, &vblank) < 0)
+                goto err;
+        servo->width = fmt.width;
+        servo->height = fmt.height;
+
+        // Without a writable HBLANK the period moves in whole lines only
+        if (vc_ctrl_query(subdev_fd, V4L2_CID_HBLANK, &servo->hblank_min, &servo->hblank_max, &def) < 0 ||
+            vc_ctrl_get(subdev_fd, V4L2_CID_HBLANK, &hblank) < 0)
+                hblank = servo->hblank_min = servo->hblank_max = 0;
+
+        servo->hblank_nominal = hblank;
+        servo->status.vblank = vblank;
+        servo->status.hblank = hblank;
+        vc_hist_reset(&servo->status.locked_error);
+
+        return servo;
+
+err:
+        free(servo);
+        return NULL;
+}
+
+void vc_servo_destroy(struct vc_servo *servo)
+{
+        free(servo);
+}
+
+const struct vc_servo_status *vc_servo_get_status(const struct vc_servo *servo)
+{
+        return &servo->status;
+}
+
+static void vc_servo_track_lock(struct vc_servo *servo, int64_t error)
+{
+        struct vc_servo_status *status = &servo->status;
+        uint64_t magnitude = error < 0 ? -error : error;
+
+        if (magnitude > servo->params.lock_ns) {
+                if (status->locked)
+                        status->lock_losses++;
+                status->locked = false;
+                servo->in_lock = 0;
+                return;
+        }
+
+        if (++servo->in_lock >= servo->params.lock_frames)
+                status->locked = true;
+        if (status->locked)
+                vc_hist_add(&status->locked_error, magnitude);
+}
+
+// Frame period of the current setting in model ns
+static double vc_servo_model_period(const struct vc_servo *servo)
+{
+        return servo->ns_per_pixel * (servo->width + servo->status.hblank) *
+               (servo->height + servo->status.vblank);
+}
+
+// Splits a frame period into whole lines (VBLANK) and, if possible, a line
+// length (HBLANK) for the remainder
+static void vc_servo_quantize(const struct vc_servo *servo, double period, int32_t *vblank, int32_t *hblank)
+{
+        double pixels = period / servo->ns_per_pixel;
+        double line = servo->width + servo->hblank_nominal;
+        int64_t vb, hb = servo->hblank_nominal;
+
+        if (servo->hblank_min < servo->hblank_max) {
+                vb = (int64_t)floor(pixels / line) - servo->height;
+                if (vb < servo->vblank_min)
+                        vb = servo->vblank_min;
+                if (vb > servo->vblank_max)
+                        vb = servo->vblank_max;
+                hb = llround(pixels / (servo->height + vb)) - servo->width;
+                if (hb < servo->hblank_min)
+                        hb = servo->hblank_min;
+                if (hb > servo->hblank_max)
+                        hb = servo->hblank_max;
+        } else {
+                vb = llround(pixels / line) - servo->height;
+                if (vb < servo->vblank_min)
+                        vb = servo->vblank_min;
+                if (vb > servo->vblank_max)
+                        vb = servo->vblank_max;
+        }
+
+        *vblank = vb;
+        *hblank = hb;
+}
+
+int vc_servo_process(struct vc_servo *servo, const struct vc_frame *frame)
+{
+        static const uint32_t ids[] = { V4L2_CID_VBLANK, V4L2_CID_HBLANK };
+        const struct vc_servo_params *params = &servo->params;
+        struct vc_servo_status *status = &servo->status;
+        int64_t t = frame->timestamp_ns + vc_servo_clock_offset(params->clock);
+        int64_t error = vc_servo_phase_error(params, t);
+        double correction, period;
+        int32_t values[2];
+        int ret;
+
+        status->frames++;
+        status->phase_error_ns = error;
+
+        // The free-running period is measured on the reference clock
+        if (!status->calibrated) {
+                uint32_t frames = frame->sequence - servo->first_sequence;
+
+                if (!servo->started) {
+                        servo->started = true;
+                        servo->first_ts = t;
+                        servo->first_sequence = frame->sequence;
+                } else if (frames >= params->calibration) {
+                        servo->ns_per_pixel = 1.0;
+                        servo->ns_per_pixel = (double)(t - servo->first_ts) / frames /
+                                              vc_servo_model_period(servo);
+                        servo->period_free = params->period_ns;
+                        status->calibrated = true;
+                }
+                return 0;
+        }
+
+        vc_servo_track_lock(servo, error);
+
+        if (servo->settle) {
+                servo->settle--;
+                return 0;
+        }
+
+        // PI loop. The integral part follows the sensor clock, it is held
+        // while the correction is limited so that it does not wind up
+        // during the pull-in.
+        correction = params->kp * error;
+        if (fabs(correction) <= params->max_adjust * servo->period_free)
+                servo->period_free -= params->ki * error;
+        else
+                correction = copysign(params->max_adjust * servo->period_free, correction);
+        period = servo->period_free - correction;
+        status->drift_ppm = (servo->period_free / params->period_ns - 1.0) * 1e6;
+
+        vc_servo_quantize(servo, period, &values[0], &values[1]);
+        if (values[0] == status->vblank && values[1] == status->hblank)
+                return 0;
+
+        ret = vc_ctrl_set_multi(servo->fd, ids, values, servo->hblank_min < servo->hblank_max ? 2 : 1);
+        status->writes++;
+        if (ret < 0) {
+                status->write_errors++;
+                return ret;
+        }
+        status->vblank = values[0];
+        status->hblank = values[1];
+        servo->settle = params->latency;
+
+        return 1;
+}
+
+int vc_servo_open_clock(const char *name, clockid_t *clock, int *fd)
+{
+        struct timespec ts;
+
+        *fd = -1;
+        if (!strcmp(name, "realtime")) {
+                *clock = CLOCK_REALTIME;
+        } else if (!strcmp(name, "tai")) {
+                *clock = CLOCK_TAI;
+        } else if (!strcmp(name, "monotonic")) {
+                *clock = CLOCK_MONOTONIC;
+        } else {
+                *fd = open(name, O_RDONLY | O_CLOEXEC);
+                if (*fd < 0)
+                        return -errno;
+                *clock = VC_FD_TO_CLOCKID(*fd);
+        }
+
+        if (clock_gettime(*clock, &ts) < 0) {
+                int ret = -errno;
+
+                if (*fd >= 0)
+                        close(*fd);
+                *fd = -1;
+                return ret;
+        }
+        return 0;
+}
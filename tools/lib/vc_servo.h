@@ -0,0 +1,76 @@
+#ifndef _VC_SERVO_H
+#define _VC_SERVO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "vc_capture.h"
+#include "vc_stats.h"
+
+// Frame rate servo, locks the frame starts of a free-running sensor to a
+// reference clock
+//
+// The buffer timestamps (CLOCK_MONOTONIC, start of frame) are moved to the
+// reference clock, e.g. a PTP disciplined CLOCK_REALTIME or a PHC. The phase
+// error is the distance of the frame start to the next multiple of the target
+// period (plus phase). A PI loop turns it into a frame period, which is set
+// with VBLANK (whole lines, VMAX) and, if the sensor allows it, HBLANK (HMAX)
+// for the remainder. Cameras on different hosts with synchronised clocks and
+// the same period and phase then sample at the same instants, without
+// trigger wiring.
+
+struct vc_servo;
+
+struct vc_servo_params {
+        uint64_t period_ns;             // target frame period
+        uint64_t phase_ns;              // frame start offset within the period (default 0)
+        clockid_t clock;                // reference clock (default CLOCK_REALTIME)
+        double kp;                      // phase error fraction corrected per frame (default 0.1)
+        double ki;                      // phase error fraction moved into the period (default 0.01)
+        double max_adjust;              // max. period change per frame, fraction (default 0.01)
+        unsigned int latency;           // frames until a new setting is visible (default 2)
+        unsigned int calibration;       // frames to measure the free-running period (default 30)
+        uint64_t lock_ns;               // |phase error| limit for the locked state (default 50 us)
+        unsigned int lock_frames;       // frames within lock_ns until locked (default 10)
+};
+
+#define VC_SERVO_PARAMS_DEFAULT                                 \
+        {                                                       \
+                .clock = CLOCK_REALTIME,                        \
+                .kp = 0.1, .ki = 0.01, .max_adjust = 0.01,      \
+                .latency = 2, .calibration = 30,                \
+                .lock_ns = 50000, .lock_frames = 10,            \
+        }
+
+struct vc_servo_status {
+        int64_t phase_error_ns;         // last frame, within +-period/2
+        double drift_ppm;               // period correction since calibration (sensor clock drift)
+        int32_t vblank;                 // current setting (lines)
+        int32_t hblank;                 // current setting (pixels)
+        bool calibrated;
+        bool locked;
+        unsigned int frames;
+        unsigned int writes;            // VIDIOC_S_EXT_CTRLS calls
+        unsigned int write_errors;
+        unsigned int lock_losses;
+        struct vc_histogram locked_error; // |phase error| in ns while locked
+};
+
+// Reads the frame size and the VBLANK / HBLANK ranges and values from the
+// sensor subdevice. HBLANK is only used if it is writable.
+struct vc_servo *vc_servo_create(int subdev_fd, const struct vc_servo_params *params);
+void vc_servo_destroy(struct vc_servo *servo);
+
+// Call once per dequeued frame. Returns 1 if the controls were written, 0 if
+// not, or a negative errno.
+int vc_servo_process(struct vc_servo *servo, const struct vc_frame *frame);
+
+const struct vc_servo_status *vc_servo_get_status(const struct vc_servo *servo);
+
+// Resolves "realtime", "tai", "monotonic" or a PHC node like "/dev/ptp0".
+// For a PHC the node stays open, close *fd when the clock is not used any
+// more (*fd is -1 for the system clocks).
+int vc_servo_open_clock(const char *name, clockid_t *clock, int *fd);
+
+#endif // _VC_SERVO_H
@@ -0,0 +1,103 @@
+#include "vc_stats.h"
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+static unsigned int vc_hist_bucket(uint64_t value)
+{
+        unsigned int exp;
+
+        if (value < VC_HIST_SUB)
+                return value;
+
+        exp = 63 - __builtin_clzll(value);
+        return (exp - VC_HIST_SUB_BITS + 1) * VC_HIST_SUB +
+               ((value >> (exp - VC_HIST_SUB_BITS)) & (VC_HIST_SUB - 1));
+}
+
+// Lower bound of a bucket, inverse of vc_hist_bucket()
+static uint64_t vc_hist_value(unsigned int bucket)
+{
+        unsigned int exp;
+
+        if (bucket < VC_HIST_SUB)
+                return bucket;
+
+        exp = bucket / VC_HIST_SUB + VC_HIST_SUB_BITS - 1;
+        return (1ULL << exp) | ((uint64_t)(bucket % VC_HIST_SUB) << (exp - VC_HIST_SUB_BITS));
+}
+
+void vc_hist_reset(struct vc_histogram *hist)
+{
+        memset(hist, 0, sizeof(*hist));
+        hist->min = UINT64_MAX;
+}
+
+void vc_hist_add(struct vc_histogram *hist, uint64_t value)
+{
+        unsigned int bucket = vc_hist_bucket(value);
+
+        if (bucket >= VC_HIST_BUCKETS)
+                bucket = VC_HIST_BUCKETS - 1;
+
+        hist->buckets[bucket]++;
+        hist->count++;
+        hist->sum += value;
+        hist->sum_sq += (double)value * value;
+        if (value < hist->min)
+                hist->min = value;
+        if (value > hist->max)
+                hist->max = value;
+}
+
+uint64_t vc_hist_percentile(const struct vc_histogram *hist, double percentile)
+{
+        uint64_t target, seen = 0;
+        unsigned int i;
+
+        if (hist->count == 0)
+                return 0;
+
+        target = (uint64_t)ceil(hist->count * percentile / 100.0);
+        if (target == 0)
+                target = 1;
+
+        for (i = 0; i < VC_HIST_BUCKETS; i++) {
+                seen += hist->buckets[i];
+                if (seen >= target) {
+                        uint64_t value = vc_hist_value(i);
+
+                        // Never report more than what was actually seen
+                        if (value < hist->min)
+                                value = hist->min;
+                        return value > hist->max ? hist->max : value;
+                }
+        }
+        return hist->max;
+}
+
+double vc_hist_mean(const struct vc_histogram *hist)
+{
+        return hist->count ? hist->sum / hist->count : 0.0;
+}
+
+double vc_hist_stddev(const struct vc_histogram *hist)
+{
+        double mean, var;
+
+        if (hist->count < 2)
+                return 0.0;
+
+        mean = hist->sum / hist->count;
+        var = hist->sum_sq / hist->count - mean * mean;
+        return var > 0.0 ? sqrt(var) : 0.0;
+}
+
+uint64_t vc_clock_ns(int clock_id)
+{
+        struct timespec ts;
+
+        clock_gettime(clock_id, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
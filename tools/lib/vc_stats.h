@@ -0,0 +1,30 @@
+#ifndef _VC_STATS_H
+#define _VC_STATS_H
+
+#include <stdint.h>
+
+// Log-linear histogram for durations in nanoseconds. Every power of two is
+// split into VC_HIST_SUB linear buckets, which keeps the relative error of
+// percentiles below 1/VC_HIST_SUB over the full range.
+#define VC_HIST_SUB_BITS                4
+#define VC_HIST_SUB                     (1 << VC_HIST_SUB_BITS)
+#define VC_HIST_BUCKETS                 (64 * VC_HIST_SUB)
+
+struct vc_histogram {
+        uint64_t count;
+        uint64_t min;
+        uint64_t max;
+        double sum;
+        double sum_sq;
+        uint32_t buckets[VC_HIST_BUCKETS];
+};
+
+void vc_hist_reset(struct vc_histogram *hist);
+void vc_hist_add(struct vc_histogram *hist, uint64_t value);
+uint64_t vc_hist_percentile(const struct vc_histogram *hist, double percentile);
+double vc_hist_mean(const struct vc_histogram *hist);
+double vc_hist_stddev(const struct vc_histogram *hist);
+
+uint64_t vc_clock_ns(int clock_id);
+
+#endif // _VC_STATS_H
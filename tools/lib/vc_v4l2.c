@@ -0,0 +1,347 @@
+#include "vc_v4l2.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+int vc_xioctl(int fd, unsigned long request, void *arg)
+{
+        int ret;
+
+        do {
+                ret = ioctl(fd, request, arg);
+        } while (ret == -1 && errno == EINTR);
+
+        return ret == -1 ? -errno : ret;
+}
+
+// --- Controls ----------------------------------------------------------------
+
+int vc_ctrl_get(int fd, uint32_t id, int32_t *value)
+{
+        struct v4l2_control ctrl = { .id = id };
+        int ret;
+
+        ret = vc_xioctl(fd, VIDIOC_G_CTRL, &ctrl);
+        if (ret < 0)
+                return ret;
+
+        *value = ctrl.value;
+        return 0;
+}
+
+int vc_ctrl_set(int fd, uint32_t id, int32_t value)
+{
+        struct v4l2_control ctrl = { .id = id, .value = value };
+
+        return vc_xioctl(fd, VIDIOC_S_CTRL, &ctrl);
+}
+
+int vc_ctrl_query(int fd, uint32_t id, int64_t *min, int64_t *max, int64_t *def)
+{
+        struct v4l2_query_ext_ctrl query = { .id = id };
+        int ret;
+
+        ret = vc_xioctl(fd, VIDIOC_QUERY_EXT_CTRL, &query);
+        if (ret < 0)
+                return ret;
+        if (query.flags & V4L2_CTRL_FLAG_DISABLED)
+                return -ENOENT;
+
+        if (min)
+                *min = query.minimum;
+        if (max)
+                *max = query.maximum;
+        if (def)
+                *def = query.default_value;
+        return 0;
+}
+
+int vc_ctrl_get64(int fd, uint32_t id, int64_t *value)
+{
+        struct v4l2_ext_control ctrl = { .id = id };
+        struct v4l2_ext_controls ctrls = {
+                .which = V4L2_CTRL_WHICH_CUR_VAL,
+                .count = 1,
+                .controls = &ctrl,
+        };
+        int ret;
+
+        ret = vc_xioctl(fd, VIDIOC_G_EXT_CTRLS, &ctrls);
+        if (ret < 0)
+                return ret;
+
+        *value = ctrl.value64;
+        return 0;
+}
+
+int vc_ctrl_get_int_menu(int fd, uint32_t id, int64_t *value)
+{
+        struct v4l2_querymenu menu = { .id = id };
+        int32_t index;
+        int ret;
+
+        ret = vc_ctrl_get(fd, id, &index);
+        if (ret < 0)
+                return ret;
+
+        menu.index = index;
+        ret = vc_xioctl(fd, VIDIOC_QUERYMENU, &menu);
+        if (ret < 0)
+                return ret;
+
+        *value = menu.value;
+        return 0;
+}
+
+int vc_ctrl_set_multi(int fd, const uint32_t *ids, const int32_t *values, unsigned int count)
+{
+        struct v4l2_ext_control ctrl[VC_CTRL_MULTI_MAX];
+        struct v4l2_ext_controls ctrls = {
+                .which = V4L2_CTRL_WHICH_CUR_VAL,
+                .count = count,
+                .controls = ctrl,
+        };
+        unsigned int i;
+
+        if (count > VC_CTRL_MULTI_MAX)
+                return -E2BIG;
+
+        memset(ctrl, 0, sizeof(ctrl));
+        for (i = 0; i < count; i++) {
+                ctrl[i].id = ids[i];
+                ctrl[i].value = values[i];
+        }
+
+        return vc_xioctl(fd, VIDIOC_S_EXT_CTRLS, &ctrls);
+}
+
+int vc_ctrl_get_string(int fd, uint32_t id, char *buf, size_t len)
+{
+        struct v4l2_ext_control ctrl = {
+                .id = id,
+                .size = len,
+                .string = buf,
+        };
+        struct v4l2_ext_controls ctrls = {
+                .which = V4L2_CTRL_WHICH_CUR_VAL,
+                .count = 1,
+                .controls = &ctrl,
+        };
+
+        memset(buf, 0, len);
+        return vc_xioctl(fd, VIDIOC_G_EXT_CTRLS, &ctrls);
+}
+
+static const uint32_t vc_state_ids[] = {
+        V4L2_CID_EXPOSURE,
+        V4L2_CID_ANALOGUE_GAIN,
+        V4L2_CID_BLACK_LEVEL,
+        V4L2_CID_LIVE_ROI,
+        V4L2_CID_VC_BINNING_MODE,
+        V4L2_CID_VC_FRAME_RATE,
+};
+
+#define VC_STATE_COUNT (sizeof(vc_state_ids) / sizeof(vc_state_ids[0]))
+
+int vc_ctrl_read_state(int fd, struct vc_ctrl_state *state)
+{
+        struct v4l2_ext_control ctrl[VC_STATE_COUNT];
+        struct v4l2_ext_controls ctrls = {
+                .which = V4L2_CTRL_WHICH_CUR_VAL,
+                .count = VC_STATE_COUNT,
+                .controls = ctrl,
+        };
+        int32_t *values[VC_STATE_COUNT] = {
+                &state->exposure, &state->gain, &state->blacklevel,
+                &state->live_roi, &state->binning_mode, &state->frame_rate,
+        };
+        unsigned int i;
+        int ret;
+
+        // Not a control, only set by vc_bracket_process()
+        state->bracket = VC_CTRL_UNAVAILABLE;
+
+        memset(ctrl, 0, sizeof(ctrl));
+        for (i = 0; i < VC_STATE_COUNT; i++)
+                ctrl[i].id = vc_state_ids[i];
+
+        // One ioctl for all controls, fall back to single reads if any of
+        // them is not exposed by the sensor.
+        ret = vc_xioctl(fd, VIDIOC_G_EXT_CTRLS, &ctrls);
+        if (ret == 0) {
+                for (i = 0; i < VC_STATE_COUNT; i++)
+                        *values[i] = ctrl[i].value;
+                return 0;
+        }
+
+        for (i = 0; i < VC_STATE_COUNT; i++) {
+                if (vc_ctrl_get(fd, vc_state_ids[i], values[i]) < 0)
+                        *values[i] = VC_CTRL_UNAVAILABLE;
+        }
+        return 0;
+}
+
+// --- Subdevice ---------------------------------------------------------------
+
+int vc_subdev_get_fmt(int fd, uint32_t pad, struct v4l2_mbus_framefmt *fmt)
+{
+        struct v4l2_subdev_format format = {
+                .which = V4L2_SUBDEV_FORMAT_ACTIVE,
+                .pad = pad,
+        };
+        int ret;
+
+        ret = vc_xioctl(fd, VIDIOC_SUBDEV_G_FMT, &format);
+        if (ret < 0)
+                return ret;
+
+        *fmt = format.format;
+        return 0;
+}
+
+int vc_subdev_get_crop(int fd, uint32_t pad, struct v4l2_rect *rect)
+{
+        struct v4l2_subdev_selection sel = {
+                .which = V4L2_SUBDEV_FORMAT_ACTIVE,
+                .pad = pad,
+                .target = V4L2_SEL_TGT_CROP,
+        };
+        int ret;
+
+        ret = vc_xioctl(fd, VIDIOC_SUBDEV_G_SELECTION, &sel);
+        if (ret < 0)
+                return ret;
+
+        *rect = sel.r;
+        return 0;
+}
+
+int vc_subdev_set_fmt(int fd, uint32_t pad, struct v4l2_mbus_framefmt *fmt)
+{
+        struct v4l2_subdev_format format = {
+                .which = V4L2_SUBDEV_FORMAT_ACTIVE,
+                .pad = pad,
+                .format = *fmt,
+        };
+        int ret;
+
+        ret = vc_xioctl(fd, VIDIOC_SUBDEV_S_FMT, &format);
+        if (ret < 0)
+                return ret;
+
+        *fmt = format.format;
+        return 0;
+}
+
+int vc_subdev_set_crop(int fd, uint32_t pad, struct v4l2_rect *rect)
+{
+        struct v4l2_subdev_selection sel = {
+                .which = V4L2_SUBDEV_FORMAT_ACTIVE,
+                .pad = pad,
+                .target = V4L2_SEL_TGT_CROP,
+                .r = *rect,
+        };
+        int ret;
+
+        ret = vc_xioctl(fd, VIDIOC_SUBDEV_S_SELECTION, &sel);
+        if (ret < 0)
+                return ret;
+
+        *rect = sel.r;
+        return 0;
+}
+
+int vc_subdev_enum_mbus_code(int fd, uint32_t pad, uint32_t index, uint32_t *code)
+{
+        struct v4l2_subdev_mbus_code_enum mbus = {
+                .which = V4L2_SUBDEV_FORMAT_ACTIVE,
+                .pad = pad,
+                .index = index,
+        };
+        int ret;
+
+        ret = vc_xioctl(fd, VIDIOC_SUBDEV_ENUM_MBUS_CODE, &mbus);
+        if (ret < 0)
+                return ret;
+
+        *code = mbus.code;
+        return 0;
+}
+
+int vc_subdev_get_max_size(int fd, uint32_t pad, uint32_t code, uint32_t *width, uint32_t *height)
+{
+        struct v4l2_subdev_frame_size_enum fse = {
+                .which = V4L2_SUBDEV_FORMAT_ACTIVE,
+                .pad = pad,
+                .code = code,
+        };
+        int ret;
+
+        ret = vc_xioctl(fd, VIDIOC_SUBDEV_ENUM_FRAME_SIZE, &fse);
+        if (ret < 0)
+                return ret;
+
+        *width = fse.max_width;
+        *height = fse.max_height;
+        return 0;
+}
+
+int vc_find_subdev(const char *name, char *path, size_t len)
+{
+        return vc_find_subdev_nth(name, 0, path, len);
+}
+
+int vc_find_subdev_nth(const char *name, unsigned int n, char *path, size_t len)
+{
+        struct dirent **entries;
+        int count, i, ret = -ENODEV;
+
+        // Sorted, so the n-th match is stable across calls
+        count = scandir("/sys/class/video4linux", &entries, NULL, alphasort);
+        if (count < 0)
+                return -errno;
+
+        for (i = 0; i < count; i++) {
+                struct dirent *entry = entries[i];
+                char name_path[300];
+                char entry_name[64] = "";
+                FILE *file;
+
+                if (strncmp(entry->d_name, "v4l-subdev", 10) != 0)
+                        continue;
+
+                snprintf(name_path, sizeof(name_path), "/sys/class/video4linux/%s/name", entry->d_name);
+                file = fopen(name_path, "r");
+                if (!file)
+                        continue;
+                if (!fgets(entry_name, sizeof(entry_name), file))
+                        entry_name[0] = '\0';
+                fclose(file);
+
+                if (ret == -ENODEV && strstr(entry_name, name) && n-- == 0) {
+                        snprintf(path, len, "/dev/%s", entry->d_name);
+                        ret = 0;
+                }
+        }
+
+        for (i = 0; i < count; i++)
+                free(entries[i]);
+        free(entries);
+        return ret;
+}
+
+int vc_find_sensor_subdev(char *path, size_t len)
+{
+        return vc_find_sensor_subdev_nth(0, path, len);
+}
+
+int vc_find_sensor_subdev_nth(unsigned int n, char *path, size_t len)
+{
+        if (vc_find_subdev_nth("vc_mipi_camera", n, path, len) == 0)
+                return 0;
+        return vc_find_subdev_nth("vc-mipi-camera", n, path, len);
+}
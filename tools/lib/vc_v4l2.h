@@ -0,0 +1,73 @@
+#ifndef _VC_V4L2_H
+#define _VC_V4L2_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/videodev2.h>
+#include <linux/v4l2-subdev.h>
+
+// Private controls of vc_mipi_camera, must match enum private_cids in
+// src/vc_mipi_camera/vc_mipi_camera.c
+#define V4L2_CID_VC_TRIGGER_MODE        (V4L2_CID_USER_BASE | 0xfff0)
+#define V4L2_CID_VC_IO_MODE             (V4L2_CID_USER_BASE | 0xfff1)
+#define V4L2_CID_VC_FRAME_RATE          (V4L2_CID_USER_BASE | 0xfff2)
+#define V4L2_CID_VC_SINGLE_TRIGGER      (V4L2_CID_USER_BASE | 0xfff3)
+#define V4L2_CID_VC_BINNING_MODE        (V4L2_CID_USER_BASE | 0xfff4)
+#define V4L2_CID_LIVE_ROI               (V4L2_CID_USER_BASE | 0xfff5)
+#define V4L2_CID_VC_NAME                (V4L2_CID_USER_BASE | 0xfff6)
+#define V4L2_CID_VC_RESTART_STREAM      (V4L2_CID_USER_BASE | 0xfff7)
+#define V4L2_CID_VC_RESTART_COUNT       (V4L2_CID_USER_BASE | 0xfff8)
+
+#define VC_SENSOR_NAME_LEN              32
+
+// Value used in struct vc_ctrl_state for controls the sensor does not expose.
+#define VC_CTRL_UNAVAILABLE             INT32_MIN
+
+// Maximum number of controls written by one vc_ctrl_set_multi() call
+#define VC_CTRL_MULTI_MAX               8
+
+// Sensor control state that is recorded with every frame.
+struct vc_ctrl_state {
+        int32_t exposure;
+        int32_t gain;
+        int32_t blacklevel;
+        int32_t live_roi;
+        int32_t binning_mode;
+        int32_t frame_rate;
+        int32_t bracket;                // exposure bracketing entry, see vc_bracket.h
+};
+
+int vc_xioctl(int fd, unsigned long request, void *arg);
+
+int vc_ctrl_get(int fd, uint32_t id, int32_t *value);
+int vc_ctrl_set(int fd, uint32_t id, int32_t value);
+int vc_ctrl_query(int fd, uint32_t id, int64_t *min, int64_t *max, int64_t *def);
+// 64 bit controls, e.g. V4L2_CID_PIXEL_RATE
+int vc_ctrl_get64(int fd, uint32_t id, int64_t *value);
+// Value of the selected entry of an integer menu, e.g. V4L2_CID_LINK_FREQ
+int vc_ctrl_get_int_menu(int fd, uint32_t id, int64_t *value);
+// Writes all controls with a single VIDIOC_S_EXT_CTRLS call
+int vc_ctrl_set_multi(int fd, const uint32_t *ids, const int32_t *values, unsigned int count);
+int vc_ctrl_get_string(int fd, uint32_t id, char *buf, size_t len);
+int vc_ctrl_read_state(int fd, struct vc_ctrl_state *state);
+
+int vc_subdev_get_fmt(int fd, uint32_t pad, struct v4l2_mbus_framefmt *fmt);
+int vc_subdev_get_crop(int fd, uint32_t pad, struct v4l2_rect *rect);
+// The setters write back what the driver applied
+int vc_subdev_set_fmt(int fd, uint32_t pad, struct v4l2_mbus_framefmt *fmt);
+int vc_subdev_set_crop(int fd, uint32_t pad, struct v4l2_rect *rect);
+int vc_subdev_enum_mbus_code(int fd, uint32_t pad, uint32_t index, uint32_t *code);
+int vc_subdev_get_max_size(int fd, uint32_t pad, uint32_t code, uint32_t *width, uint32_t *height);
+
+// Looks for a v4l-subdev node whose name contains 'name'. Returns 0 and the
+// node path of the first match.
+int vc_find_subdev(const char *name, char *path, size_t len);
+// Same for the n-th match, in the order of the node names
+int vc_find_subdev_nth(const char *name, unsigned int n, char *path, size_t len);
+
+// Looks for a v4l-subdev node driven by vc_mipi_camera (the same check as
+// is_vc_mipi_camera() in set_rpi*_pipeline). Returns 0 and the node path.
+int vc_find_sensor_subdev(char *path, size_t len);
+int vc_find_sensor_subdev_nth(unsigned int n, char *path, size_t len);
+
+#endif // _VC_V4L2_H
@@ -0,0 +1,28 @@
+# Builds the vcmipi extension module from vcmipi.c and the sources of ../lib
+#
+#   python3 setup.py build_ext --inplace
+#   pip install .
+
+import glob
+import os
+
+import numpy
+from setuptools import Extension, setup
+
+here = os.path.dirname(os.path.abspath(__file__))
+lib = os.path.join(here, "..", "lib")
+
+setup(
+    name="vcmipi",
+    version="0.1",
+    description="Capture and sensor controls of VC MIPI cameras with zero-copy NumPy frames",
+    ext_modules=[
+        Extension(
+            "vcmipi",
+            sources=["vcmipi.c"] + sorted(os.path.relpath(p, here) for p in glob.glob(os.path.join(lib, "*.c"))),
+            include_dirs=[lib, numpy.get_include()],
+            extra_compile_args=["-std=gnu11", "-Wno-unused-parameter", "-Wno-missing-field-initializers"],
+            libraries=["m"],
+        ),
+    ],
+)
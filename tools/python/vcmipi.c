@@ -0,0 +1,1185 @@
+// vcmipi - Python bindings of the capture path and the sensor controls
+//
+// Frames are returned as NumPy arrays that view the mapped V4L2 buffer, no
+// copy is made. Waiting for a frame and all ioctls run without the GIL, so
+// other Python threads keep running while a capture thread waits. The sensor
+// controls, including the private ones of vc_mipi_camera, are typed
+// attributes of vcmipi.Sensor.
+//
+// See README.md in this directory for the build and an example.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pythread.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+#include <structmember.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vc_capture.h"
+#include "vc_pixfmt.h"
+#include "vc_pyramid.h"
+#include "vc_stats.h"
+#include "vc_v4l2.h"
+
+// Longest time the capture lock is held while waiting, so that frames can be
+// released and signals handled during a long wait
+#define VC_PY_WAIT_SLICE_MS             100
+
+static PyObject *vc_py_set_errno(int err)
+{
+        errno = err < 0 ? -err : err;
+        return PyErr_SetFromErrno(PyExc_OSError);
+}
+
+// --- Capture -----------------------------------------------------------------
+
+typedef struct {
+        PyObject_HEAD
+        struct vc_capture *cap;
+        struct vc_format fmt;
+        const struct vc_pixfmt *pixfmt; // NULL for formats unknown to vc_pixfmt
+        bool packed;
+        bool readonly;                  // replayed frames map a read-only file
+        bool streaming;
+        bool closing;                   // closed, waiting for the frames still held
+        unsigned int outstanding;       // frames not released yet
+        PyThread_type_lock lock;        // serializes the calls into vc_capture / vc_pyramid
+        struct vc_pyramid *pyramid;
+        struct vc_pyramid_params pyramid_params;
+} VcCapture;
+
+typedef struct {
+        PyObject_HEAD
+        VcCapture *capture;
+        struct vc_frame frame;
+        bool released;
+} VcFrame;
+
+static PyTypeObject VcCaptureType;
+static PyTypeObject VcFrameType;
+
+// Takes the capture lock, without holding the GIL while it is contended
+static void vc_py_capture_lock(VcCapture *self)
+{
+        if (!PyThread_acquire_lock(self->lock, NOWAIT_LOCK)) {
+                Py_BEGIN_ALLOW_THREADS
+                PyThread_acquire_lock(self->lock, WAIT_LOCK);
+                Py_END_ALLOW_THREADS
+        }
+}
+
+static void vc_py_capture_unlock(VcCapture *self)
+{
+        PyThread_release_lock(self->lock);
+}
+
+// Unmaps the buffers once the capture is closed and no frame is held
+static void vc_py_capture_finish(VcCapture *self)
+{
+        if (!self->closing || self->outstanding || !self->cap)
+                return;
+
+        vc_pyramid_destroy(self->pyramid);
+        self->pyramid = NULL;
+        vc_capture_close(self->cap);
+        self->cap = NULL;
+}
+
+static int vc_py_capture_init(VcCapture *self, PyObject *args, PyObject *kwds)
+{
+        static char *kwlist[] = { "device", "subdev", "buffers", NULL };
+        const char *device = "/dev/video0", *subdev = NULL;
+        unsigned int buffers = 4;
+        struct vc_capture *cap;
+
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|szI", kwlist, &device, &subdev, &buffers))
+                return -1;
+        if (self->cap) {
+                PyErr_SetString(PyExc_RuntimeError, "Capture is already open");
+                return -1;
+        }
+
+        Py_BEGIN_ALLOW_THREADS
+        cap = vc_capture_open(device, subdev, buffers);
+        Py_END_ALLOW_THREADS
+        if (!cap) {
+                PyErr_SetFromErrnoWithFilename(PyExc_OSError, device);
+                return -1;
+        }
+
+        self->lock = PyThread_allocate_lock();
+        if (!self->lock) {
+                vc_capture_close(cap);
+                PyErr_NoMemory();
+                return -1;
+        }
+
+        self->cap = cap;
+        vc_capture_get_format(cap, &self->fmt);
+        self->pixfmt = vc_pixfmt_from_fourcc(self->fmt.fourcc, &self->packed);
+        self->readonly = vc_capture_fd(cap) < 0;
+        return 0;
+}
+
+static void vc_py_capture_dealloc(VcCapture *self)
+{
+        // Frames hold a reference, none is left here
+        self->closing = true;
+        vc_py_capture_finish(self);
+        if (self->lock)
+                PyThread_free_lock(self->lock);
+        Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int vc_py_capture_check(VcCapture *self)
+{
+        if (!self->cap || self->closing) {
+                PyErr_SetString(PyExc_ValueError, "I/O operation on closed capture");
+                return -1;
+        }
+        return 0;
+}
+
+static PyObject *vc_py_capture_start(VcCapture *self, PyObject *unused)
+{
+        int ret = 0;
+
+        if (vc_py_capture_check(self) < 0)
+                return NULL;
+
+        vc_py_capture_lock(self);
+        if (!self->streaming) {
+                Py_BEGIN_ALLOW_THREADS
+                ret = vc_capture_start(self->cap);
+                Py_END_ALLOW_THREADS
+                self->streaming = ret == 0;
+        }
+        vc_py_capture_unlock(self);
+
+        if (ret < 0)
+                return vc_py_set_errno(ret);
+        Py_RETURN_NONE;
+}
+
+static PyObject *vc_py_capture_stop(VcCapture *self, PyObject *unused)
+{
+        int ret = 0;
+
+        if (vc_py_capture_check(self) < 0)
+                return NULL;
+
+        vc_py_capture_lock(self);
+        if (self->streaming) {
+                Py_BEGIN_ALLOW_THREADS
+                ret = vc_capture_stop(self->cap);
+                Py_END_ALLOW_THREADS
+                self->streaming = false;
+        }
+        vc_py_capture_unlock(self);
+
+        if (ret < 0)
+                return vc_py_set_errno(ret);
+        Py_RETURN_NONE;
+}
+
+static PyObject *vc_py_capture_close(VcCapture *self, PyObject *unused)
+{
+        if (!self->cap || self->closing)
+                Py_RETURN_NONE;
+
+        vc_py_capture_lock(self);
+        if (self->streaming) {
+                Py_BEGIN_ALLOW_THREADS
+                vc_capture_stop(self->cap);
+                Py_END_ALLOW_THREADS
+                self->streaming = false;
+        }
+        self->closing = true;
+        vc_py_capture_unlock(self);
+
+        // Arrays of frames still held keep the buffers mapped
+        vc_py_capture_finish(self);
+        Py_RETURN_NONE;
+}
+
+static VcFrame *vc_py_frame_new(VcCapture *capture, const struct vc_frame *frame)
+{
+        VcFrame *self = PyObject_New(VcFrame, &VcFrameType);
+
+        if (!self)
+                return NULL;
+
+        Py_INCREF(capture);
+        self->capture = capture;
+        self->frame = *frame;
+        self->released = false;
+        capture->outstanding++;
+        return self;
+}
+
+// Returns 1 with a frame, 0 on timeout and -1 with an exception set. Waits
+// in slices so that other threads can release frames in between.
+static int vc_py_capture_wait(VcCapture *self, double timeout, struct vc_frame *frame)
+{
+        uint64_t deadline = 0;
+        int ret;
+
+        if (timeout >= 0)
+                deadline = vc_clock_ns(CLOCK_MONOTONIC) + (uint64_t)(timeout * 1e9);
+
+        for (;;) {
+                int slice = VC_PY_WAIT_SLICE_MS;
+
+                if (timeout >= 0) {
+                        uint64_t now = vc_clock_ns(CLOCK_MONOTONIC);
+                        uint64_t left_ms = now < deadline ? (deadline - now + 999999) / 1000000 : 0;
+
+                        if (left_ms < (uint64_t)slice)
+                                slice = left_ms;
+                }
+
+                Py_BEGIN_ALLOW_THREADS
+                PyThread_acquire_lock(self->lock, WAIT_LOCK);
+                ret = self->cap && !self->closing ? vc_capture_dequeue(self->cap, frame, slice) : -EBADF;
+                PyThread_release_lock(self->lock);
+                Py_END_ALLOW_THREADS
+
+                if (ret == 0)
+                        return 1;
+                if (ret == -EBADF) {
+                        PyErr_SetString(PyExc_ValueError, "Capture closed while waiting");
+                        return -1;
+                }
+                if (ret == -ENODATA) {
+                        PyErr_SetNone(PyExc_EOFError);
+                        return -1;
+                }
+                if (ret != -ETIMEDOUT) {
+                        vc_py_set_errno(ret);
+                        return -1;
+                }
+                if (PyErr_CheckSignals() < 0)
+                        return -1;
+                if (timeout >= 0 && vc_clock_ns(CLOCK_MONOTONIC) >= deadline)
+                        return 0;
+        }
+}
+
+static PyObject *vc_py_capture_dequeue(VcCapture *self, PyObject *args, PyObject *kwds)
+{
+        static char *kwlist[] = { "timeout", NULL };
+        PyObject *timeout_obj = Py_None, *ret;
+        struct vc_frame frame;
+        double timeout = -1.0;
+        int got;
+
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &timeout_obj))
+                return NULL;
+        if (timeout_obj != Py_None) {
+                timeout = PyFloat_AsDouble(timeout_obj);
+                if (timeout == -1.0 && PyErr_Occurred())
+                        return NULL;
+                if (timeout < 0)
+                        timeout = 0;
+        }
+        if (vc_py_capture_check(self) < 0)
+                return NULL;
+
+        if (!self->streaming) {
+                ret = vc_py_capture_start(self, NULL);
+                if (!ret)
+                        return NULL;
+                Py_DECREF(ret);
+        }
+
+        got = vc_py_capture_wait(self, timeout, &frame);
+        if (got < 0)
+                return NULL;
+        if (got == 0)
+                Py_RETURN_NONE;
+        return (PyObject *)vc_py_frame_new(self, &frame);
+}
+
+static PyObject *vc_py_capture_iternext(VcCapture *self)
+{
+        PyObject *frame = vc_py_capture_dequeue(self, PyTuple_New(0), NULL);
+
+        // The end of a replay ends the iteration
+        if (!frame && PyErr_ExceptionMatches(PyExc_EOFError))
+                PyErr_Clear();
+        return frame;
+}
+
+static PyObject *vc_py_capture_iter(VcCapture *self)
+{
+        Py_INCREF(self);
+        return (PyObject *)self;
+}
+
+static PyObject *vc_py_capture_enter(VcCapture *self, PyObject *unused)
+{
+        Py_INCREF(self);
+        return (PyObject *)self;
+}
+
+static PyObject *vc_py_capture_exit(VcCapture *self, PyObject *args)
+{
+        PyObject *ret = vc_py_capture_close(self, NULL);
+
+        if (!ret)
+                return NULL;
+        Py_DECREF(ret);
+        Py_RETURN_FALSE;
+}
+
+static PyObject *vc_py_capture_stats(VcCapture *self, PyObject *unused)
+{
+        struct vc_capture_stats stats;
+
+        if (vc_py_capture_check(self) < 0)
+                return NULL;
+
+        vc_py_capture_lock(self);
+        stats = *vc_capture_get_stats(self->cap);
+        vc_py_capture_unlock(self);
+
+        return Py_BuildValue("{s:K,s:K,s:d,s:d,s:I,s:K}",
+                             "frames", (unsigned long long)stats.frames,
+                             "dropped", (unsigned long long)stats.dropped,
+                             "latency_ms", vc_hist_mean(&stats.latency) / 1e6,
+                             "latency_p99_ms", vc_hist_percentile(&stats.latency, 99.0) / 1e6,
+                             "backlog_max", stats.backlog_max,
+                             "overruns", (unsigned long long)stats.overruns);
+}
+
+static PyObject *vc_py_capture_get_fourcc(VcCapture *self, void *closure)
+{
+        char fcc[5];
+
+        return PyUnicode_FromString(vc_fourcc_str(self->fmt.fourcc, fcc));
+}
+
+static PyObject *vc_py_capture_get_bits(VcCapture *self, void *closure)
+{
+        if (!self->pixfmt)
+                Py_RETURN_NONE;
+        return PyLong_FromLong(self->pixfmt->bits);
+}
+
+static PyObject *vc_py_capture_get_packed(VcCapture *self, void *closure)
+{
+        return PyBool_FromLong(self->packed);
+}
+
+static PyObject *vc_py_capture_get_bayer(VcCapture *self, void *closure)
+{
+        static const char *const names[] = { NULL, "BGGR", "GBRG", "GRBG", "RGGB" };
+
+        if (!self->pixfmt || self->pixfmt->bayer == VC_BAYER_NONE)
+                Py_RETURN_NONE;
+        return PyUnicode_FromString(names[self->pixfmt->bayer]);
+}
+
+static PyObject *vc_py_capture_get_closed(VcCapture *self, void *closure)
+{
+        return PyBool_FromLong(!self->cap || self->closing);
+}
+
+static PyMethodDef vc_py_capture_methods[] = {
+        { "start", (PyCFunction)vc_py_capture_start, METH_NOARGS,
+          "start()\n--\n\nStarts streaming. dequeue() starts it too." },
+        { "stop", (PyCFunction)vc_py_capture_stop, METH_NOARGS,
+          "stop()\n--\n\nStops streaming." },
+        { "close", (PyCFunction)vc_py_capture_close, METH_NOARGS,
+          "close()\n--\n\nStops streaming and closes the device. The buffers stay\n"
+          "mapped until the last frame is gone." },
+        { "dequeue", (PyCFunction)vc_py_capture_dequeue, METH_VARARGS | METH_KEYWORDS,
+          "dequeue(timeout=None)\n--\n\nWaits for the next frame without holding the GIL. Returns a\n"
+          "Frame, or None if no frame arrived within 'timeout' seconds\n"
+          "(None waits forever). Raises EOFError at the end of a replay." },
+        { "stats", (PyCFunction)vc_py_capture_stats, METH_NOARGS,
+          "stats()\n--\n\nConsumer side statistics as a dict." },
+        { "__enter__", (PyCFunction)vc_py_capture_enter, METH_NOARGS, NULL },
+        { "__exit__", (PyCFunction)vc_py_capture_exit, METH_VARARGS, NULL },
+        { NULL },
+};
+
+static PyMemberDef vc_py_capture_members[] = {
+        { "width", T_UINT, offsetof(VcCapture, fmt.width), READONLY, "Width in pixels" },
+        { "height", T_UINT, offsetof(VcCapture, fmt.height), READONLY, "Height in lines" },
+        { "bytesperline", T_UINT, offsetof(VcCapture, fmt.bytesperline), READONLY, "Line stride in bytes" },
+        { "sizeimage", T_UINT, offsetof(VcCapture, fmt.sizeimage), READONLY, "Buffer size in bytes" },
+        { NULL },
+};
+
+static PyGetSetDef vc_py_capture_getset[] = {
+        { "fourcc", (getter)vc_py_capture_get_fourcc, NULL, "Pixel format, e.g. 'pRCC'", NULL },
+        { "bits", (getter)vc_py_capture_get_bits, NULL, "Bits per sample, None for unknown formats", NULL },
+        { "packed", (getter)vc_py_capture_get_packed, NULL, "True for CSI-2 packed lines", NULL },
+        { "bayer", (getter)vc_py_capture_get_bayer, NULL, "Bayer order, e.g. 'RGGB', None for mono", NULL },
+        { "closed", (getter)vc_py_capture_get_closed, NULL, "True after close()", NULL },
+        { NULL },
+};
+
+static PyTypeObject VcCaptureType = {
+        PyVarObject_HEAD_INIT(NULL, 0)
+        .tp_name = "vcmipi.Capture",
+        .tp_doc = "Capture(device='/dev/video0', subdev=None, buffers=4)\n--\n\n"
+                  "Capture from a video node, or replay a recording with\n"
+                  "device='replay:file.vcraw'. With 'subdev' the sensor controls\n"
+                  "are sampled for every frame. Iterating yields frames until the\n"
+                  "end of a replay.",
+        .tp_basicsize = sizeof(VcCapture),
+        .tp_flags = Py_TPFLAGS_DEFAULT,
+        .tp_new = PyType_GenericNew,
+        .tp_init = (initproc)vc_py_capture_init,
+        .tp_dealloc = (destructor)vc_py_capture_dealloc,
+        .tp_iter = (getiterfunc)vc_py_capture_iter,
+        .tp_iternext = (iternextfunc)vc_py_capture_iternext,
+        .tp_methods = vc_py_capture_methods,
+        .tp_members = vc_py_capture_members,
+        .tp_getset = vc_py_capture_getset,
+};
+
+// --- Frame -------------------------------------------------------------------
+
+static void vc_py_frame_do_release(VcFrame *self)
+{
+        VcCapture *capture = self->capture;
+
+        if (self->released)
+                return;
+        self->released = true;
+
+        vc_py_capture_lock(capture);
+        if (capture->cap && !capture->closing)
+                vc_capture_release(capture->cap, &self->frame);
+        capture->outstanding--;
+        vc_py_capture_unlock(capture);
+
+        vc_py_capture_finish(capture);
+}
+
+static void vc_py_frame_dealloc(VcFrame *self)
+{
+        vc_py_frame_do_release(self);
+        Py_DECREF(self->capture);
+        PyObject_Free(self);
+}
+
+static int vc_py_frame_check(VcFrame *self)
+{
+        if (self->released) {
+                PyErr_SetString(PyExc_ValueError, "Frame was released");
+                return -1;
+        }
+        return 0;
+}
+
+static PyObject *vc_py_frame_release(VcFrame *self, PyObject *unused)
+{
+        vc_py_frame_do_release(self);
+        Py_RETURN_NONE;
+}
+
+static PyObject *vc_py_frame_enter(VcFrame *self, PyObject *unused)
+{
+        Py_INCREF(self);
+        return (PyObject *)self;
+}
+
+static PyObject *vc_py_frame_exit(VcFrame *self, PyObject *args)
+{
+        vc_py_frame_do_release(self);
+        Py_RETURN_FALSE;
+}
+
+// View of the buffer: uint8 for 8 bit and CSI-2 packed lines, uint16 for 16
+// bit containers, the line stride is kept
+static PyObject *vc_py_frame_get_array(VcFrame *self, void *closure)
+{
+        const VcCapture *capture = self->capture;
+        const struct vc_format *fmt = &capture->fmt;
+        npy_intp dims[2], strides[2];
+        uint32_t lines = fmt->height;
+        int typenum = NPY_UINT8;
+        PyObject *array;
+
+        if (vc_py_frame_check(self) < 0)
+                return NULL;
+
+        if (capture->pixfmt && !capture->packed && capture->pixfmt->bits > 8) {
+                typenum = NPY_UINT16;
+                dims[1] = fmt->width;
+                strides[1] = 2;
+        } else if (capture->pixfmt) {
+                dims[1] = vc_pixfmt_line_bytes(capture->pixfmt, capture->packed, fmt->width);
+                strides[1] = 1;
+        } else {
+                dims[1] = fmt->bytesperline;
+                strides[1] = 1;
+        }
+        // A short frame only shows its complete lines
+        if (fmt->bytesperline && (size_t)lines * fmt->bytesperline > self->frame.bytesused)
+                lines = self->frame.bytesused / fmt->bytesperline;
+        dims[0] = lines;
+        strides[0] = fmt->bytesperline;
+
+        array = PyArray_New(&PyArray_Type, 2, dims, typenum, strides, (void *)self->frame.data, 0,
+                            capture->readonly ? 0 : NPY_ARRAY_WRITEABLE, NULL);
+        if (!array)
+                return NULL;
+
+        Py_INCREF(self);
+        if (PyArray_SetBaseObject((PyArrayObject *)array, (PyObject *)self) < 0) {
+                Py_DECREF(array);
+                return NULL;
+        }
+        return array;
+}
+
+static PyObject *vc_py_frame_unpack(VcFrame *self, PyObject *args, PyObject *kwds)
+{
+        static char *kwlist[] = { "out", NULL };
+        const VcCapture *capture = self->capture;
+        const struct vc_format *fmt = &capture->fmt;
+        PyArrayObject *out = NULL;
+        npy_intp dims[2] = { fmt->height, fmt->width };
+        uint8_t *dst;
+        uint32_t y;
+
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O!", kwlist, &PyArray_Type, &out))
+                return NULL;
+        if (vc_py_frame_check(self) < 0)
+                return NULL;
+        if (!capture->pixfmt) {
+                PyErr_SetString(PyExc_TypeError, "Format can not be unpacked");
+                return NULL;
+        }
+        if ((size_t)fmt->height * fmt->bytesperline > self->frame.bytesused) {
+                PyErr_SetString(PyExc_ValueError, "Frame is shorter than the format");
+                return NULL;
+        }
+
+        if (out) {
+                if (PyArray_TYPE(out) != NPY_UINT16 || PyArray_NDIM(out) != 2 ||
+                    PyArray_DIM(out, 0) != dims[0] || PyArray_DIM(out, 1) != dims[1] ||
+                    PyArray_STRIDE(out, 1) != 2 || !PyArray_ISWRITEABLE(out)) {
+                        PyErr_SetString(PyExc_ValueError, "out must be a writable uint16 array of (height, width) "
+                                                          "with contiguous lines");
+                        return NULL;
+                }
+                Py_INCREF(out);
+        } else {
+                out = (PyArrayObject *)PyArray_SimpleNew(2, dims, NPY_UINT16);
+                if (!out)
+                        return NULL;
+        }
+
+        dst = (uint8_t *)PyArray_BYTES(out);
+        Py_BEGIN_ALLOW_THREADS
+        for (y = 0; y < fmt->height; y++)
+                vc_pixfmt_unpack_line(capture->pixfmt, capture->packed,
+                                      (const uint8_t *)self->frame.data + (size_t)y * fmt->bytesperline,
+                                      (uint16_t *)(dst + y * PyArray_STRIDE(out, 0)), fmt->width);
+        Py_END_ALLOW_THREADS
+
+        return (PyObject *)out;
+}
+
+static PyObject *vc_py_frame_preview(VcFrame *self, PyObject *args, PyObject *kwds)
+{
+        static char *kwlist[] = { "scale", "rgb", NULL };
+        VcCapture *capture = self->capture;
+        const struct vc_pyramid_level *level;
+        unsigned int scale = 4, index;
+        npy_intp dims[3];
+        PyObject *array;
+        int rgb = 0, ret;
+        uint32_t y;
+
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Ip", kwlist, &scale, &rgb))
+                return NULL;
+        if (vc_py_frame_check(self) < 0)
+                return NULL;
+        if (scale != 2 && scale != 4 && scale != 8) {
+                PyErr_SetString(PyExc_ValueError, "scale must be 2, 4 or 8");
+                return NULL;
+        }
+        index = scale == 2 ? 0 : scale == 4 ? 1 : 2;
+
+        vc_py_capture_lock(capture);
+        if (!capture->pyramid || capture->pyramid_params.levels != index + 1 ||
+            capture->pyramid_params.color != (rgb ? VC_PYRAMID_RGB : VC_PYRAMID_GREY)) {
+                struct vc_pyramid_params params = VC_PYRAMID_PARAMS_DEFAULT;
+
+                params.levels = index + 1;
+                params.color = rgb ? VC_PYRAMID_RGB : VC_PYRAMID_GREY;
+                vc_pyramid_destroy(capture->pyramid);
+                capture->pyramid = vc_pyramid_create(&capture->fmt, &params);
+                capture->pyramid_params = params;
+                if (!capture->pyramid) {
+                        vc_py_capture_unlock(capture);
+                        return vc_py_set_errno(errno);
+                }
+        }
+
+        Py_BEGIN_ALLOW_THREADS
+        ret = vc_pyramid_process(capture->pyramid, self->frame.data, self->frame.bytesused);
+        Py_END_ALLOW_THREADS
+        if (ret < 0) {
+                vc_py_capture_unlock(capture);
+                return vc_py_set_errno(ret);
+        }
+
+        level = vc_pyramid_level(capture->pyramid, index);
+        dims[0] = level->height;
+        dims[1] = level->width;
+        dims[2] = level->channels;
+        array = PyArray_SimpleNew(level->channels == 3 ? 3 : 2, dims, NPY_UINT8);
+        if (array) {
+                for (y = 0; y < level->height; y++)
+                        memcpy((uint8_t *)PyArray_BYTES((PyArrayObject *)array) + (size_t)y * level->stride,
+                               level->data + (size_t)y * level->stride, level->stride);
+        }
+        vc_py_capture_unlock(capture);
+        return array;
+}
+
+static PyObject *vc_py_frame_ctrl(int32_t value)
+{
+        if (value == VC_CTRL_UNAVAILABLE)
+                Py_RETURN_NONE;
+        return PyLong_FromLong(value);
+}
+
+static PyObject *vc_py_frame_get_ctrl(VcFrame *self, void *closure)
+{
+        return vc_py_frame_ctrl(*(const int32_t *)((const char *)&self->frame.ctrls + (size_t)closure));
+}
+
+static PyObject *vc_py_frame_get_released(VcFrame *self, void *closure)
+{
+        return PyBool_FromLong(self->released);
+}
+
+static PyMethodDef vc_py_frame_methods[] = {
+        { "release", (PyCFunction)vc_py_frame_release, METH_NOARGS,
+          "release()\n--\n\nHands the buffer back to the driver. Arrays viewing it must not be\n"
+          "used afterwards, the driver fills it with a new frame. Frames are\n"
+          "released when they are garbage collected or leave a with block." },
+        { "unpack", (PyCFunction)vc_py_frame_unpack, METH_VARARGS | METH_KEYWORDS,
+          "unpack(out=None)\n--\n\nCopies the frame into a (height, width) uint16 array, CSI-2\n"
+          "packed samples are unpacked right aligned. Runs without the GIL." },
+        { "preview", (PyCFunction)vc_py_frame_preview, METH_VARARGS | METH_KEYWORDS,
+          "preview(scale=4, rgb=False)\n--\n\nReturns the frame scaled down by 2, 4 or 8 as a uint8 array, box\n"
+          "filtered per Bayer cell (see vc_pyramid). rgb=True gives\n"
+          "(height, width, 3) for Bayer formats." },
+        { "__enter__", (PyCFunction)vc_py_frame_enter, METH_NOARGS, NULL },
+        { "__exit__", (PyCFunction)vc_py_frame_exit, METH_VARARGS, NULL },
+        { NULL },
+};
+
+static PyMemberDef vc_py_frame_members[] = {
+        { "index", T_UINT, offsetof(VcFrame, frame.index), READONLY, "Buffer index" },
+        { "sequence", T_UINT, offsetof(VcFrame, frame.sequence), READONLY, "Sequence number" },
+        { "timestamp_ns", T_ULONGLONG, offsetof(VcFrame, frame.timestamp_ns), READONLY,
+          "Start of frame, CLOCK_MONOTONIC in ns" },
+        { "bytesused", T_ULONG, offsetof(VcFrame, frame.bytesused), READONLY, "Payload size in bytes" },
+        { "flags", T_UINT, offsetof(VcFrame, frame.flags), READONLY, "V4L2_BUF_FLAG_* of the buffer" },
+        { NULL },
+};
+
+#define VC_PY_FRAME_CTRL(name, field, doc) \
+        { name, (getter)vc_py_frame_get_ctrl, NULL, doc, (void *)offsetof(struct vc_ctrl_state, field) }
+
+static PyGetSetDef vc_py_frame_getset[] = {
+        { "array", (getter)vc_py_frame_get_array, NULL,
+          "NumPy view of the buffer (no copy): (height, width) uint16 for 16 bit\n"
+          "containers, (height, line bytes) uint8 for 8 bit and CSI-2 packed lines.", NULL },
+        { "released", (getter)vc_py_frame_get_released, NULL, "True after release()", NULL },
+        VC_PY_FRAME_CTRL("exposure", exposure, "Exposure when dequeued (needs subdev), None if unknown"),
+        VC_PY_FRAME_CTRL("gain", gain, "Analogue gain in mdB when dequeued"),
+        VC_PY_FRAME_CTRL("black_level", blacklevel, "Black level when dequeued"),
+        VC_PY_FRAME_CTRL("live_roi", live_roi, "Live ROI when dequeued"),
+        VC_PY_FRAME_CTRL("binning_mode", binning_mode, "Binning mode when dequeued"),
+        VC_PY_FRAME_CTRL("frame_rate", frame_rate, "Frame rate in mHz when dequeued"),
+        VC_PY_FRAME_CTRL("bracket", bracket, "Exposure bracketing entry, None if untagged"),
+        { NULL },
+};
+
+static PyTypeObject VcFrameType = {
+        PyVarObject_HEAD_INIT(NULL, 0)
+        .tp_name = "vcmipi.Frame",
+        .tp_doc = "A dequeued frame, see Capture.dequeue(). Holds its buffer until\n"
+                  "release().",
+        .tp_basicsize = sizeof(VcFrame),
+        .tp_flags = Py_TPFLAGS_DEFAULT,
+        .tp_dealloc = (destructor)vc_py_frame_dealloc,
+        .tp_methods = vc_py_frame_methods,
+        .tp_members = vc_py_frame_members,
+        .tp_getset = vc_py_frame_getset,
+};
+
+// --- Sensor ------------------------------------------------------------------
+
+typedef struct {
+        PyObject_HEAD
+        int fd;
+        char path[64];
+} VcSensor;
+
+struct vc_py_ctrl {
+        const char *name;
+        uint32_t id;
+        const char *doc;
+};
+
+static const struct vc_py_ctrl vc_py_ctrls[] = {
+        { "exposure", V4L2_CID_EXPOSURE, "Exposure time in us" },
+        { "gain", V4L2_CID_ANALOGUE_GAIN, "Analogue gain in mdB" },
+        { "black_level", V4L2_CID_BLACK_LEVEL, "Black level" },
+        { "trigger_mode", V4L2_CID_VC_TRIGGER_MODE, "Trigger mode, one of the TRIGGER_* constants" },
+        { "io_mode", V4L2_CID_VC_IO_MODE, "Flash / trigger I/O mode, one of the IO_* constants" },
+        { "frame_rate", V4L2_CID_VC_FRAME_RATE, "Frame rate in mHz, 0 is the sensor maximum" },
+        { "binning_mode", V4L2_CID_VC_BINNING_MODE, "Binning mode, 0 is off (sensor specific, see docs/binning_mode.md)" },
+        { "live_roi", V4L2_CID_LIVE_ROI, "Live ROI offset, see encode_live_roi()" },
+};
+
+#define VC_PY_NUM_CTRLS                 (sizeof(vc_py_ctrls) / sizeof(vc_py_ctrls[0]))
+
+static const struct vc_py_ctrl *vc_py_ctrl_find(const char *name)
+{
+        unsigned int i;
+
+        for (i = 0; i < VC_PY_NUM_CTRLS; i++) {
+                if (!strcmp(vc_py_ctrls[i].name, name))
+                        return &vc_py_ctrls[i];
+        }
+        PyErr_Format(PyExc_KeyError, "Unknown control '%s'", name);
+        return NULL;
+}
+
+static int vc_py_sensor_init(VcSensor *self, PyObject *args, PyObject *kwds)
+{
+        static char *kwlist[] = { "subdev", NULL };
+        const char *subdev = NULL;
+        int fd, ret = 0;
+
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|z", kwlist, &subdev))
+                return -1;
+
+        if (subdev) {
+                snprintf(self->path, sizeof(self->path), "%s", subdev);
+        } else {
+                Py_BEGIN_ALLOW_THREADS
+                ret = vc_find_sensor_subdev(self->path, sizeof(self->path));
+                Py_END_ALLOW_THREADS
+                if (ret < 0) {
+                        PyErr_SetString(PyExc_FileNotFoundError, "No vc_mipi_camera subdevice found");
+                        return -1;
+                }
+        }
+
+        fd = open(self->path, O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+                PyErr_SetFromErrnoWithFilename(PyExc_OSError, self->path);
+                return -1;
+        }
+        if (self->fd > 0)
+                close(self->fd);
+        self->fd = fd;
+        return 0;
+}
+
+static PyObject *vc_py_sensor_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+        VcSensor *self = (VcSensor *)type->tp_alloc(type, 0);
+
+        if (self)
+                self->fd = -1;
+        return (PyObject *)self;
+}
+
+static void vc_py_sensor_dealloc(VcSensor *self)
+{
+        if (self->fd >= 0)
+                close(self->fd);
+        Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int vc_py_sensor_check(VcSensor *self)
+{
+        if (self->fd < 0) {
+                PyErr_SetString(PyExc_ValueError, "I/O operation on closed sensor");
+                return -1;
+        }
+        return 0;
+}
+
+static PyObject *vc_py_sensor_read(VcSensor *self, uint32_t id)
+{
+        int32_t value;
+        int ret;
+
+        if (vc_py_sensor_check(self) < 0)
+                return NULL;
+
+        Py_BEGIN_ALLOW_THREADS
+        ret = vc_ctrl_get(self->fd, id, &value);
+        Py_END_ALLOW_THREADS
+        if (ret < 0)
+                return vc_py_set_errno(ret);
+        return PyLong_FromLong(value);
+}
+
+static int vc_py_sensor_write(VcSensor *self, uint32_t id, PyObject *obj)
+{
+        long value;
+        int ret;
+
+        if (!obj) {
+                PyErr_SetString(PyExc_AttributeError, "Controls can not be deleted");
+                return -1;
+        }
+        if (vc_py_sensor_check(self) < 0)
+                return -1;
+        value = PyLong_AsLong(obj);
+        if (value == -1 && PyErr_Occurred())
+                return -1;
+        if (value < INT32_MIN || value > INT32_MAX) {
+                PyErr_SetString(PyExc_OverflowError, "Control value does not fit into 32 bits");
+                return -1;
+        }
+
+        Py_BEGIN_ALLOW_THREADS
+        ret = vc_ctrl_set(self->fd, id, value);
+        Py_END_ALLOW_THREADS
+        if (ret < 0) {
+                vc_py_set_errno(ret);
+                return -1;
+        }
+        return 0;
+}
+
+static PyObject *vc_py_sensor_get_ctrl(VcSensor *self, void *closure)
+{
+        return vc_py_sensor_read(self, ((const struct vc_py_ctrl *)closure)->id);
+}
+
+static int vc_py_sensor_set_ctrl(VcSensor *self, PyObject *value, void *closure)
+{
+        return vc_py_sensor_write(self, ((const struct vc_py_ctrl *)closure)->id, value);
+}
+
+static PyObject *vc_py_sensor_get_name(VcSensor *self, void *closure)
+{
+        char name[VC_SENSOR_NAME_LEN];
+        int ret;
+
+        if (vc_py_sensor_check(self) < 0)
+                return NULL;
+
+        Py_BEGIN_ALLOW_THREADS
+        ret = vc_ctrl_get_string(self->fd, V4L2_CID_VC_NAME, name, sizeof(name));
+        Py_END_ALLOW_THREADS
+        if (ret < 0)
+                return vc_py_set_errno(ret);
+        name[sizeof(name) - 1] = '\0';
+        return PyUnicode_FromString(name);
+}
+
+static PyObject *vc_py_sensor_get_path(VcSensor *self, void *closure)
+{
+        return PyUnicode_FromString(self->path);
+}
+
+static PyObject *vc_py_sensor_query(VcSensor *self, PyObject *args)
+{
+        const struct vc_py_ctrl *ctrl;
+        int64_t min, max, def;
+        const char *name;
+        int ret;
+
+        if (!PyArg_ParseTuple(args, "s", &name))
+                return NULL;
+        ctrl = vc_py_ctrl_find(name);
+        if (!ctrl || vc_py_sensor_check(self) < 0)
+                return NULL;
+
+        Py_BEGIN_ALLOW_THREADS
+        ret = vc_ctrl_query(self->fd, ctrl->id, &min, &max, &def);
+        Py_END_ALLOW_THREADS
+        if (ret < 0)
+                return vc_py_set_errno(ret);
+        return Py_BuildValue("(LLL)", (long long)min, (long long)max, (long long)def);
+}
+
+static PyObject *vc_py_sensor_set(VcSensor *self, PyObject *args, PyObject *kwds)
+{
+        uint32_t ids[VC_CTRL_MULTI_MAX];
+        int32_t values[VC_CTRL_MULTI_MAX];
+        PyObject *key, *obj;
+        Py_ssize_t pos = 0;
+        unsigned int count = 0;
+        int ret;
+
+        if (PyTuple_GET_SIZE(args)) {
+                PyErr_SetString(PyExc_TypeError, "set() takes keyword arguments only");
+                return NULL;
+        }
+        if (vc_py_sensor_check(self) < 0)
+                return NULL;
+
+        while (kwds && PyDict_Next(kwds, &pos, &key, &obj)) {
+                const struct vc_py_ctrl *ctrl = vc_py_ctrl_find(PyUnicode_AsUTF8(key));
+                long value;
+
+                if (!ctrl)
+                        return NULL;
+                value = PyLong_AsLong(obj);
+                if (value == -1 && PyErr_Occurred())
+                        return NULL;
+                if (value < INT32_MIN || value > INT32_MAX) {
+                        PyErr_Format(PyExc_OverflowError, "%s does not fit into 32 bits", ctrl->name);
+                        return NULL;
+                }
+                ids[count] = ctrl->id;
+                values[count] = value;
+                count++;
+        }
+        if (!count)
+                Py_RETURN_NONE;
+
+        Py_BEGIN_ALLOW_THREADS
+        ret = vc_ctrl_set_multi(self->fd, ids, values, count);
+        Py_END_ALLOW_THREADS
+        if (ret < 0)
+                return vc_py_set_errno(ret);
+        Py_RETURN_NONE;
+}
+
+static PyObject *vc_py_sensor_single_trigger(VcSensor *self, PyObject *unused)
+{
+        int ret;
+
+        if (vc_py_sensor_check(self) < 0)
+                return NULL;
+
+        Py_BEGIN_ALLOW_THREADS
+        ret = vc_ctrl_set(self->fd, V4L2_CID_VC_SINGLE_TRIGGER, 1);
+        Py_END_ALLOW_THREADS
+        if (ret < 0)
+                return vc_py_set_errno(ret);
+        Py_RETURN_NONE;
+}
+
+static PyObject *vc_py_sensor_get(VcSensor *self, PyObject *args)
+{
+        uint32_t id;
+
+        if (!PyArg_ParseTuple(args, "I", &id))
+                return NULL;
+        return vc_py_sensor_read(self, id);
+}
+
+static PyObject *vc_py_sensor_put(VcSensor *self, PyObject *args)
+{
+        PyObject *value;
+        uint32_t id;
+
+        if (!PyArg_ParseTuple(args, "IO", &id, &value))
+                return NULL;
+        if (vc_py_sensor_write(self, id, value) < 0)
+                return NULL;
+        Py_RETURN_NONE;
+}
+
+static PyObject *vc_py_sensor_close(VcSensor *self, PyObject *unused)
+{
+        if (self->fd >= 0) {
+                close(self->fd);
+                self->fd = -1;
+        }
+        Py_RETURN_NONE;
+}
+
+static PyObject *vc_py_sensor_fileno(VcSensor *self, PyObject *unused)
+{
+        if (vc_py_sensor_check(self) < 0)
+                return NULL;
+        return PyLong_FromLong(self->fd);
+}
+
+static PyObject *vc_py_sensor_enter(VcSensor *self, PyObject *unused)
+{
+        Py_INCREF(self);
+        return (PyObject *)self;
+}
+
+static PyObject *vc_py_sensor_exit(VcSensor *self, PyObject *args)
+{
+        vc_py_sensor_close(self, NULL);
+        Py_RETURN_FALSE;
+}
+
+static PyMethodDef vc_py_sensor_methods[] = {
+        { "query", (PyCFunction)vc_py_sensor_query, METH_VARARGS,
+          "query(name)\n--\n\nReturns (min, max, default) of a control, e.g. query('exposure')." },
+        { "set", (PyCFunction)vc_py_sensor_set, METH_VARARGS | METH_KEYWORDS,
+          "set(**controls)\n--\n\nWrites up to 8 controls with one VIDIOC_S_EXT_CTRLS, e.g.\n"
+          "set(exposure=10000, gain=0)." },
+        { "single_trigger", (PyCFunction)vc_py_sensor_single_trigger, METH_NOARGS,
+          "single_trigger()\n--\n\nFires one frame in TRIGGER_SINGLE mode." },
+        { "get_ctrl", (PyCFunction)vc_py_sensor_get, METH_VARARGS,
+          "get_ctrl(id)\n--\n\nReads any integer control by its V4L2 id." },
+        { "set_ctrl", (PyCFunction)vc_py_sensor_put, METH_VARARGS,
+          "set_ctrl(id, value)\n--\n\nWrites any integer control by its V4L2 id." },
+        { "close", (PyCFunction)vc_py_sensor_close, METH_NOARGS, "close()\n--\n\nCloses the subdevice." },
+        { "fileno", (PyCFunction)vc_py_sensor_fileno, METH_NOARGS,
+          "fileno()\n--\n\nFile descriptor of the subdevice." },
+        { "__enter__", (PyCFunction)vc_py_sensor_enter, METH_NOARGS, NULL },
+        { "__exit__", (PyCFunction)vc_py_sensor_exit, METH_VARARGS, NULL },
+        { NULL },
+};
+
+// One attribute per entry of vc_py_ctrls, plus name and path
+static PyGetSetDef vc_py_sensor_getset[VC_PY_NUM_CTRLS + 3] = {
+        { "name", (getter)vc_py_sensor_get_name, NULL, "Sensor name (V4L2_CID_VC_NAME)", NULL },
+        { "path", (getter)vc_py_sensor_get_path, NULL, "Subdevice node", NULL },
+};
+
+static PyTypeObject VcSensorType = {
+        PyVarObject_HEAD_INIT(NULL, 0)
+        .tp_name = "vcmipi.Sensor",
+        .tp_doc = "Sensor(subdev=None)\n--\n\n"
+                  "Controls of a vc_mipi_camera subdevice (auto-detected if None).\n"
+                  "Every control is an int attribute: exposure, gain, black_level,\n"
+                  "trigger_mode, io_mode, frame_rate, binning_mode, live_roi.",
+        .tp_basicsize = sizeof(VcSensor),
+        .tp_flags = Py_TPFLAGS_DEFAULT,
+        .tp_new = vc_py_sensor_new,
+        .tp_init = (initproc)vc_py_sensor_init,
+        .tp_dealloc = (destructor)vc_py_sensor_dealloc,
+        .tp_methods = vc_py_sensor_methods,
+        .tp_getset = vc_py_sensor_getset,
+};
+
+// --- Module ------------------------------------------------------------------
+
+static PyObject *vc_py_encode_live_roi(PyObject *module, PyObject *args, PyObject *kwds)
+{
+        static char *kwlist[] = { "top", "left", "binning", NULL };
+        unsigned int top = 0, left = 0, binning = 0;
+
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|III", kwlist, &top, &left, &binning))
+                return NULL;
+        if (top > 9999 || left > 9999 || binning > 9) {
+                PyErr_SetString(PyExc_ValueError, "top and left must be 0 to 9999, binning 0 to 9");
+                return NULL;
+        }
+        return PyLong_FromLong(binning * 100000000L + left * 10000L + top);
+}
+
+static PyObject *vc_py_decode_live_roi(PyObject *module, PyObject *args)
+{
+        long value;
+
+        if (!PyArg_ParseTuple(args, "l", &value))
+                return NULL;
+        return Py_BuildValue("{s:l,s:l,s:l}", "top", value % 10000, "left", value / 10000 % 10000,
+                             "binning", value / 100000000);
+}
+
+static PyMethodDef vc_py_methods[] = {
+        { "encode_live_roi", (PyCFunction)vc_py_encode_live_roi, METH_VARARGS | METH_KEYWORDS,
+          "encode_live_roi(top=0, left=0, binning=0)\n--\n\nLive ROI control value B_LLLL_TTTT, see docs/live_roi.md." },
+        { "decode_live_roi", (PyCFunction)vc_py_decode_live_roi, METH_VARARGS,
+          "decode_live_roi(value)\n--\n\nSplits a live ROI value into a dict of top, left and binning." },
+        { NULL },
+};
+
+static struct PyModuleDef vc_py_module = {
+        PyModuleDef_HEAD_INIT,
+        .m_name = "vcmipi",
+        .m_doc = "Capture and sensor controls of VC MIPI cameras with zero-copy NumPy frames.",
+        .m_size = -1,
+        .m_methods = vc_py_methods,
+};
+
+PyMODINIT_FUNC PyInit_vcmipi(void)
+{
+        static const struct {
+                const char *name;
+                long value;
+        } constants[] = {
+                { "TRIGGER_OFF", 0 },
+                { "TRIGGER_EXTERNAL", 1 },
+                { "TRIGGER_PULSE_WIDTH", 2 },
+                { "TRIGGER_SELF", 3 },
+                { "TRIGGER_SINGLE", 4 },
+                { "TRIGGER_SYNC", 5 },
+                { "TRIGGER_STREAM_EDGE", 6 },
+                { "TRIGGER_STREAM_LEVEL", 7 },
+                { "IO_DISABLED", 0 },
+                { "IO_FLASH_HIGH", 1 },
+                { "IO_FLASH_LOW", 2 },
+                { "IO_TRIGGER_LOW", 3 },
+                { "IO_TRIGGER_LOW_FLASH_HIGH", 4 },
+                { "IO_TRIGGER_LOW_FLASH_LOW", 5 },
+                { "BINNING_NONE", 0 },
+                { "CID_TRIGGER_MODE", V4L2_CID_VC_TRIGGER_MODE },
+                { "CID_IO_MODE", V4L2_CID_VC_IO_MODE },
+                { "CID_FRAME_RATE", V4L2_CID_VC_FRAME_RATE },
+                { "CID_SINGLE_TRIGGER", V4L2_CID_VC_SINGLE_TRIGGER },
+                { "CID_BINNING_MODE", V4L2_CID_VC_BINNING_MODE },
+                { "CID_LIVE_ROI", V4L2_CID_LIVE_ROI },
+                { "CID_NAME", V4L2_CID_VC_NAME },
+        };
+        PyObject *module;
+        unsigned int i;
+
+        import_array();
+
+        for (i = 0; i < VC_PY_NUM_CTRLS; i++) {
+                vc_py_sensor_getset[i + 2] = (PyGetSetDef){
+                        .name = vc_py_ctrls[i].name,
+                        .get = (getter)vc_py_sensor_get_ctrl,
+                        .set = (setter)vc_py_sensor_set_ctrl,
+                        .doc = vc_py_ctrls[i].doc,
+                        .closure = (void *)&vc_py_ctrls[i],
+                };
+        }
+
+        if (PyType_Ready(&VcCaptureType) < 0 || PyType_Ready(&VcFrameType) < 0 ||
+            PyType_Ready(&VcSensorType) < 0)
+                return NULL;
+
+        module = PyModule_Create(&vc_py_module);
+        if (!module)
+                return NULL;
+
+        Py_INCREF(&VcCaptureType);
+        Py_INCREF(&VcFrameType);
+        Py_INCREF(&VcSensorType);
+        if (PyModule_AddObject(module, "Capture", (PyObject *)&VcCaptureType) < 0 ||
+            PyModule_AddObject(module, "Frame", (PyObject *)&VcFrameType) < 0 ||
+            PyModule_AddObject(module, "Sensor", (PyObject *)&VcSensorType) < 0) {
+                Py_DECREF(module);
+                return NULL;
+        }
+        for (i = 0; i < sizeof(constants) / sizeof(constants[0]); i++) {
+                if (PyModule_AddIntConstant(module, constants[i].name, constants[i].value) < 0) {
+                        Py_DECREF(module);
+                        return NULL;
+                }
+        }
+
+        return module;
+}
@@ -0,0 +1,301 @@
+// vc_burst - Capture a burst of N consecutive frames into preallocated memory
+//
+// The memory for all frames is allocated before the burst. While the burst
+// runs, every frame is only copied into its slot (see vc_burst), so the
+// sensor can run at the maximum frame rate of the ROI even if the frames
+// could not be processed live. The burst starts with a software trigger
+// (stream on, or single_trigger per frame) or waits for the trigger input
+// (trigger_mode External, Stream Edge or Stream Level). After N frames the
+// stream is stopped, the burst is written to a .vcraw container and the
+// achieved frame rate and the frame intervals are reported.
+//
+// Usage:
+//   vc_burst [-d /dev/video0] [-s /dev/v4l-subdevX] [-n 100] [-b 8]
+//            [-t software|single|external|edge|level] [--wait] [--keep-rate]
+//            [-o burst.vcraw] [--timing burst.csv]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vc_burst.h"
+#include "vc_capture.h"
+#include "vc_pixfmt.h"
+#include "vc_rawseq.h"
+#include "vc_stats.h"
+
+static volatile sig_atomic_t stop;
+static volatile sig_atomic_t fire;
+
+static void vc_handle_signal(int sig)
+{
+        if (sig == SIGUSR1)
+                fire = 1;
+        else
+                stop = 1;
+}
+
+static void usage(const char *argv0)
+{
+        fprintf(stderr,
+                "Usage: %s [OPTIONS]\n"
+                "\n"
+                "  -d, --device <dev>    Video device (default: /dev/video0)\n"
+                "  -s, --subdev <dev>    Sensor subdevice (auto-detected if omitted)\n"
+                "  -n, --frames <N>      Frames in the burst (default: 100)\n"
+                "  -b, --buffers <N>     Number of capture buffers (default: 8)\n"
+                "  -t, --trigger <mode>  software, single, external, edge or level (default: software)\n"
+                "  -w, --wait            Fire the software trigger on Enter or SIGUSR1\n"
+                "      --keep-rate       Keep frame_rate, default is the maximum of the ROI\n"
+                "      --timeout <ms>    Wait for the first frame, 0 = forever (default: 10000)\n"
+                "  -o, --output <file>   Write the burst to a .vcraw container\n"
+                "      --timing <file>   Write sequence, timestamp and interval per frame as CSV\n",
+                argv0);
+        exit(1);
+}
+
+// Blocks until Enter, SIGUSR1 or Ctrl+C. Returns 0 to fire.
+static int vc_wait_trigger(void)
+{
+        struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+        char line[64];
+
+        printf("Armed, press Enter or send SIGUSR1 (pid %d) to start the burst\n", (int)getpid());
+        fflush(stdout);
+        while (!fire && !stop) {
+                if (poll(&pfd, 1, 100) > 0) {
+                        if (!fgets(line, sizeof(line), stdin))
+                                pfd.fd = -1;
+                        else
+                                break;
+                }
+        }
+        return stop ? -EINTR : 0;
+}
+
+static int vc_write_burst(const char *path, struct vc_burst *burst, const struct vc_format *fmt,
+                          int subdev_fd)
+{
+        const struct vc_frame *frame;
+        struct vc_rawseq_header info;
+        struct vc_rawseq_writer *writer;
+        struct v4l2_mbus_framefmt mbus;
+        struct v4l2_rect crop;
+        unsigned int i;
+        int ret = 0;
+
+        memset(&info, 0, sizeof(info));
+        info.fourcc = fmt->fourcc;
+        info.width = fmt->width;
+        info.height = fmt->height;
+        info.bytesperline = fmt->bytesperline;
+        info.frame_size = fmt->sizeimage;
+        if (subdev_fd >= 0) {
+                vc_ctrl_get_string(subdev_fd, V4L2_CID_VC_NAME, info.sensor_name, sizeof(info.sensor_name));
+                if (vc_subdev_get_fmt(subdev_fd, 0, &mbus) == 0)
+                        info.mbus_code = mbus.code;
+                if (vc_subdev_get_crop(subdev_fd, 0, &crop) == 0) {
+                        info.crop.left = crop.left;
+                        info.crop.top = crop.top;
+                        info.crop.width = crop.width;
+                        info.crop.height = crop.height;
+                }
+        }
+
+        writer = vc_rawseq_create(path, &info);
+        if (!writer)
+                return -errno;
+        for (i = 0; (frame = vc_burst_get_frame(burst, i)) && ret == 0; i++)
+                ret = vc_rawseq_append(writer, frame);
+        if (vc_rawseq_finish(writer) < 0 && ret == 0)
+                ret = -EIO;
+        return ret;
+}
+
+static int vc_write_timing(const char *path, struct vc_burst *burst)
+{
+        const struct vc_frame *frame, *prev = NULL;
+        unsigned int i;
+        FILE *f;
+
+        f = fopen(path, "w");
+        if (!f)
+                return -errno;
+        fprintf(f, "frame,sequence,timestamp_ns,interval_us,flags\n");
+        for (i = 0; (frame = vc_burst_get_frame(burst, i)); prev = frame, i++)
+                fprintf(f, "%u,%u,%llu,%.3f,0x%x\n", i, frame->sequence,
+                        (unsigned long long)frame->timestamp_ns,
+                        prev ? (frame->timestamp_ns - prev->timestamp_ns) / 1e3 : 0.0, frame->flags);
+        return fclose(f) == 0 ? 0 : -errno;
+}
+
+int main(int argc, char *argv[])
+{
+        static const struct option options[] = {
+                { "device",    required_argument, NULL, 'd' },
+                { "subdev",    required_argument, NULL, 's' },
+                { "frames",    required_argument, NULL, 'n' },
+                { "buffers",   required_argument, NULL, 'b' },
+                { "trigger",   required_argument, NULL, 't' },
+                { "wait",      no_argument,       NULL, 'w' },
+                { "keep-rate", no_argument,       NULL, 'K' },
+                { "timeout",   required_argument, NULL, 'T' },
+                { "output",    required_argument, NULL, 'o' },
+                { "timing",    required_argument, NULL, 'C' },
+                { "help",      no_argument,       NULL, 'h' },
+                { NULL, 0, NULL, 0 },
+        };
+        struct vc_burst_params params = VC_BURST_PARAMS_DEFAULT;
+        const char *device = "/dev/video0";
+        const char *output = NULL, *timing = NULL;
+        char subdev[64] = "";
+        unsigned int buffers = 8;
+        int wait = 0, timeout_ms = 10000;
+        const struct vc_burst_result *result;
+        struct vc_burst *burst = NULL;
+        struct vc_capture *cap;
+        struct vc_format fmt;
+        int subdev_fd = -1;
+        char fcc[5];
+        int opt, ret, status = 0;
+
+        while ((opt = getopt_long(argc, argv, "d:s:n:b:t:wo:h", options, NULL)) != -1) {
+                switch (opt) {
+                case 'd': device = optarg; break;
+                case 's': snprintf(subdev, sizeof(subdev), "%s", optarg); break;
+                case 'n': params.frames = strtoul(optarg, NULL, 0); break;
+                case 'b': buffers = strtoul(optarg, NULL, 0); break;
+                case 't':
+                        ret = vc_burst_parse_trigger(optarg);
+                        if (ret < 0) {
+                                fprintf(stderr, "Unknown trigger '%s'\n", optarg);
+                                return 1;
+                        }
+                        params.trigger = ret;
+                        break;
+                case 'w': wait = 1; break;
+                case 'K': params.max_rate = false; break;
+                case 'T': timeout_ms = strtol(optarg, NULL, 0); break;
+                case 'o': output = optarg; break;
+                case 'C': timing = optarg; break;
+                default: usage(argv[0]);
+                }
+        }
+        if (params.frames == 0)
+                usage(argv[0]);
+        if (wait && params.trigger != VC_BURST_SOFTWARE && params.trigger != VC_BURST_SINGLE) {
+                fprintf(stderr, "--wait needs a software trigger, the %s trigger comes from the trigger input\n",
+                        vc_burst_trigger_name(params.trigger));
+                return 1;
+        }
+
+        if (!subdev[0] && vc_find_sensor_subdev(subdev, sizeof(subdev)) < 0 &&
+            strncmp(device, VC_CAPTURE_REPLAY_PREFIX, strlen(VC_CAPTURE_REPLAY_PREFIX)) != 0)
+                fprintf(stderr, "No vc_mipi_camera subdevice found, frame rate and trigger mode are left as they are\n");
+        if (subdev[0]) {
+                subdev_fd = open(subdev, O_RDWR | O_CLOEXEC);
+                if (subdev_fd < 0) {
+                        fprintf(stderr, "Failed to open %s: %s\n", subdev, strerror(errno));
+                        return 1;
+                }
+        }
+
+        // The controls are read once per burst, not per frame
+        cap = vc_capture_open(device, NULL, buffers);
+        if (!cap) {
+                fprintf(stderr, "Failed to open %s: %s\n", device, strerror(errno));
+                status = -errno;
+                goto out_subdev;
+        }
+        vc_capture_get_format(cap, &fmt);
+
+        burst = vc_burst_create(cap, subdev_fd, &params);
+        if (!burst) {
+                fprintf(stderr, "Failed to set up a %s burst of %u frames (%.1f MiB): %s\n",
+                        vc_burst_trigger_name(params.trigger), params.frames,
+                        params.frames * (double)fmt.sizeimage / (1 << 20), strerror(errno));
+                status = -errno;
+                goto out_close;
+        }
+
+        signal(SIGINT, vc_handle_signal);
+        signal(SIGTERM, vc_handle_signal);
+        signal(SIGUSR1, vc_handle_signal);
+
+        printf("Burst of %u frames %s %ux%u from %s, %u buffers, %.1f MiB, %s trigger%s\n",
+               params.frames, vc_fourcc_str(fmt.fourcc, fcc), fmt.width, fmt.height, device, buffers,
+               params.frames * (double)fmt.sizeimage / (1 << 20), vc_burst_trigger_name(params.trigger),
+               params.max_rate ? ", maximum frame rate" : "");
+
+        ret = vc_burst_arm(burst);
+        if (ret < 0) {
+                fprintf(stderr, "Failed to arm the burst: %s\n", strerror(-ret));
+                status = ret;
+                goto out_close;
+        }
+        if (wait && vc_wait_trigger() < 0)
+                goto out_close;
+        if (params.trigger != VC_BURST_SOFTWARE && params.trigger != VC_BURST_SINGLE) {
+                printf("Armed, waiting for the trigger input\n");
+                fflush(stdout);
+        }
+
+        ret = vc_burst_capture(burst, timeout_ms > 0 ? timeout_ms : -1);
+        if (ret == -ETIMEDOUT)
+                fprintf(stderr, "No frame within %d ms\n",
+                        vc_burst_get_result(burst)->frames ? params.frame_timeout_ms : timeout_ms);
+        else if (ret < 0)
+                fprintf(stderr, "Burst failed: %s\n", strerror(-ret));
+        if (ret < 0)
+                status = ret;
+
+        result = vc_burst_get_result(burst);
+        printf("Captured %u of %u frames, %u dropped, %u receiver errors", result->frames, params.frames,
+               result->dropped, result->errors);
+        if (result->fps > 0)
+                printf(", %.2f fps", result->fps);
+        printf("\n");
+        if (result->interval.count)
+                printf("Interval: min %.3f ms, mean %.3f ms, p99 %.3f ms, max %.3f ms, stddev %.3f ms\n",
+                       result->interval.min / 1e6, vc_hist_mean(&result->interval) / 1e6,
+                       vc_hist_percentile(&result->interval, 99.0) / 1e6, result->interval.max / 1e6,
+                       vc_hist_stddev(&result->interval) / 1e6);
+        if (result->start_latency_ns)
+                printf("Trigger to first frame: %.3f ms\n", result->start_latency_ns / 1e6);
+        if (result->frames)
+                printf("Copy per frame: max %.3f ms\n", result->copy_max_ns / 1e6);
+
+        if (output && result->frames) {
+                ret = vc_write_burst(output, burst, &fmt, subdev_fd);
+                if (ret < 0) {
+                        fprintf(stderr, "Failed to write %s: %s\n", output, strerror(-ret));
+                        status = ret;
+                } else {
+                        printf("Written to %s\n", output);
+                }
+        }
+        if (timing && result->frames) {
+                ret = vc_write_timing(timing, burst);
+                if (ret < 0) {
+                        fprintf(stderr, "Failed to write %s: %s\n", timing, strerror(-ret));
+                        status = ret;
+                }
+        }
+        if (status == 0 && result->dropped)
+                status = 2;
+
+out_close:
+        vc_burst_destroy(burst);
+        vc_capture_close(cap);
+out_subdev:
+        if (subdev_fd >= 0)
+                close(subdev_fd);
+
+        return status < 0 ? 1 : status;
+}
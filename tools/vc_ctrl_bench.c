@@ -0,0 +1,592 @@
+// vc_ctrl_bench - Control round-trip latency benchmark
+//
+// Writes the sensor controls (exposure, gain, black level, VBLANK, HBLANK,
+// frame rate, binning mode, live ROI) in a tight loop, alternating between
+// the current value and a neighbour, first one control at a time with
+// VIDIOC_S_CTRL, then all of them in one VIDIOC_S_EXT_CTRLS batch. This is
+// done idle and while streaming. For every run the latency distribution of
+// the ioctl and the achievable updates per second are printed.
+//
+// The driver only logs most control errors and returns 0 to userspace. Such
+// swallowed failures are found by reading the value back after every write
+// (live_roi is read from the sensor state) and by counting the warnings and
+// errors of the driver in the kernel log (/dev/kmsg, needs root).
+//
+// Any subdevice with these controls works, unsupported or read-only
+// controls are skipped. All controls are restored at the end.
+//
+// Usage:
+//   vc_ctrl_bench [-d /dev/video0] [-s /dev/v4l-subdevX] [-n 1000]
+//                 [--controls exposure,vblank] [--phase idle|stream|both] [-o result.json]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vc_capture.h"
+#include "vc_stats.h"
+#include "vc_v4l2.h"
+
+// Highest kernel log level that counts as a failure (KERN_WARNING)
+#define VC_KMSG_MAX_LEVEL               4
+
+enum vc_phase {
+        VC_PHASE_IDLE   = 1 << 0,
+        VC_PHASE_STREAM = 1 << 1,
+};
+
+struct vc_ctrl_def {
+        const char *name;
+        uint32_t id;
+};
+
+static const struct vc_ctrl_def vc_ctrl_defs[] = {
+        { "exposure",      V4L2_CID_EXPOSURE },
+        { "analogue_gain", V4L2_CID_ANALOGUE_GAIN },
+        { "black_level",   V4L2_CID_BLACK_LEVEL },
+        { "vblank",        V4L2_CID_VBLANK },
+        { "hblank",        V4L2_CID_HBLANK },
+        { "frame_rate",    V4L2_CID_VC_FRAME_RATE },
+        { "binning_mode",  V4L2_CID_VC_BINNING_MODE },
+        { "live_roi",      V4L2_CID_LIVE_ROI },
+};
+
+#define VC_CTRL_COUNT (sizeof(vc_ctrl_defs) / sizeof(vc_ctrl_defs[0]))
+
+struct vc_target {
+        const struct vc_ctrl_def *def;
+        bool selected;
+        const char *skip;               // reason, NULL if usable
+        int32_t orig;
+        int32_t values[2];              // written alternately
+};
+
+struct vc_result {
+        const char *name;
+        const char *phase;
+        unsigned int controls;          // per ioctl
+        struct vc_histogram latency;
+        uint64_t ops;
+        uint64_t errors;                // ioctl failed
+        uint64_t busy;                  // -EBUSY, rejected while streaming
+        uint64_t mismatches;            // read back differs from the value written
+        uint64_t kernel_errors;         // driver warnings / errors in the kernel log
+        int first_error;
+        double seconds;
+};
+
+struct vc_bench {
+        int subdev_fd;
+        int kmsg_fd;
+        unsigned int iterations;
+        struct vc_target targets[VC_CTRL_COUNT];
+        struct vc_capture *cap;         // while streaming
+        FILE *out;
+        unsigned int results;
+};
+
+static volatile sig_atomic_t stop;
+
+static void vc_handle_signal(int sig)
+{
+        stop = 1;
+}
+
+static void usage(const char *argv0)
+{
+        fprintf(stderr,
+                "Usage: %s [OPTIONS]\n"
+                "\n"
+                "  -d, --device <dev>      Video device for the streaming runs (default: /dev/video0)\n"
+                "  -s, --subdev <dev>      Sensor subdevice (auto-detected if omitted)\n"
+                "  -n, --iterations <N>    Writes per control and run (default: 1000)\n"
+                "  -c, --controls <list>   Controls, default: exposure,analogue_gain,black_level,\n"
+                "                          vblank,hblank,frame_rate,binning_mode,live_roi\n"
+                "  -p, --phase <phase>     idle, stream or both (default: both)\n"
+                "  -b, --buffers <N>       Capture buffers while streaming (default: 4)\n"
+                "  -o, --output <file>     JSON output\n",
+                argv0);
+        exit(1);
+}
+
+static void vc_json_string(FILE *out, const char *str)
+{
+        fputc('"', out);
+        for (; *str; str++) {
+                if (*str == '"' || *str == '\\')
+                        fputc('\\', out);
+                if ((unsigned char)*str >= 0x20)
+                        fputc(*str, out);
+        }
+        fputc('"', out);
+}
+
+// --- Kernel log --------------------------------------------------------------
+
+static int vc_kmsg_open(void)
+{
+        int fd = open("/dev/kmsg", O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+        if (fd >= 0)
+                lseek(fd, 0, SEEK_END);
+        return fd;
+}
+
+// Counts the new driver warnings and errors, records look like
+// "<prio>,<seq>,<ts>,<flags>;vc_mipi_camera 10-001a: ..."
+static unsigned int vc_kmsg_count(int fd)
+{
+        unsigned int count = 0;
+        char record[1024];
+        ssize_t len;
+
+        if (fd < 0)
+                return 0;
+
+        for (;;) {
+                unsigned int prio;
+                char *msg;
+
+                len = read(fd, record, sizeof(record) - 1);
+                if (len < 0 && errno == EPIPE)
+                        continue;       // overwritten, resume with the next record
+                if (len <= 0)
+                        break;
+                record[len] = '\0';
+
+                msg = strchr(record, ';');
+                if (!msg || sscanf(record, "%u,", &prio) != 1)
+                        continue;
+                if ((prio & 7) <= VC_KMSG_MAX_LEVEL && (strstr(msg, "vc_mipi") || strstr(msg, "vc-mipi")))
+                        count++;
+        }
+        return count;
+}
+
+// --- Controls ----------------------------------------------------------------
+
+// Picks the two values a control is toggled between, returns NULL or the
+// reason why the control is skipped
+static const char *vc_target_prepare(int fd, struct vc_target *target)
+{
+        struct v4l2_query_ext_ctrl query = { .id = target->def->id };
+        int64_t delta, other;
+
+        if (vc_xioctl(fd, VIDIOC_QUERY_EXT_CTRL, &query) < 0 || (query.flags & V4L2_CTRL_FLAG_DISABLED))
+                return "not supported";
+        if (query.flags & V4L2_CTRL_FLAG_READ_ONLY)
+                return "read-only";
+        if (query.type != V4L2_CTRL_TYPE_INTEGER)
+                return "not an integer";
+        if (vc_ctrl_get(fd, target->def->id, &target->orig) < 0)
+                return "not readable";
+
+        delta = query.step > 0 ? (int64_t)query.step : 1;
+        switch (target->def->id) {
+        case V4L2_CID_VC_FRAME_RATE:
+                // 0 runs at the sensor maximum, there is no neighbour to toggle with
+                if (target->orig <= 0)
+                        return "free running (0), set a frame rate first";
+                if (target->orig / 100 > delta)
+                        delta = target->orig / 100;
+                break;
+        case V4L2_CID_LIVE_ROI:
+                delta = 2;      // two lines down, keeps the Bayer phase
+                break;
+        }
+
+        other = target->orig + delta;
+        if (other > query.maximum)
+                other = target->orig - delta;
+        if (other < query.minimum)
+                return "no second value in range";
+
+        target->values[0] = (int32_t)other;
+        target->values[1] = target->orig;
+        return NULL;
+}
+
+static void vc_target_restore(int fd, const struct vc_target *target)
+{
+        int32_t value;
+
+        if (vc_ctrl_get(fd, target->def->id, &value) == 0 && value != target->orig)
+                vc_ctrl_set(fd, target->def->id, target->orig);
+}
+
+// Binning first as it changes the frame size, then the frame rate as it
+// moves the blanking, then the rest
+static void vc_restore_all(struct vc_bench *bench)
+{
+        static const uint32_t first[] = { V4L2_CID_VC_BINNING_MODE, V4L2_CID_VC_FRAME_RATE, 0 };
+        unsigned int pass, k;
+
+        for (pass = 0; pass < sizeof(first) / sizeof(first[0]); pass++) {
+                for (k = 0; k < VC_CTRL_COUNT; k++) {
+                        const struct vc_target *target = &bench->targets[k];
+                        bool early = target->def->id == first[0] || target->def->id == first[1];
+
+                        if (!target->selected || target->skip)
+                                continue;
+                        if (first[pass] ? target->def->id == first[pass] : !early)
+                                vc_target_restore(bench->subdev_fd, target);
+                }
+        }
+}
+
+// Keeps the stream running between two writes
+static void vc_bench_pump(struct vc_bench *bench)
+{
+        struct vc_frame frame;
+
+        if (!bench->cap)
+                return;
+        while (vc_capture_dequeue(bench->cap, &frame, 0) == 0)
+                vc_capture_release(bench->cap, &frame);
+}
+
+static void vc_result_error(struct vc_result *res, int ret)
+{
+        res->errors++;
+        if (ret == -EBUSY)
+                res->busy++;
+        if (!res->first_error)
+                res->first_error = ret;
+}
+
+static void vc_bench_single(struct vc_bench *bench, struct vc_target *target, struct vc_result *res)
+{
+        uint64_t start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+        unsigned int i;
+
+        for (i = 0; i < bench->iterations && !stop; i++) {
+                int32_t value = target->values[i & 1], readback;
+                uint64_t t0 = vc_clock_ns(CLOCK_MONOTONIC);
+                int ret;
+
+                ret = vc_ctrl_set(bench->subdev_fd, target->def->id, value);
+                vc_hist_add(&res->latency, vc_clock_ns(CLOCK_MONOTONIC) - t0);
+                res->ops++;
+                if (ret < 0)
+                        vc_result_error(res, ret);
+                else if (vc_ctrl_get(bench->subdev_fd, target->def->id, &readback) == 0 && readback != value)
+                        res->mismatches++;
+                vc_bench_pump(bench);
+        }
+        res->seconds = (vc_clock_ns(CLOCK_MONOTONIC) - start_ns) / 1e9;
+}
+
+static void vc_bench_batch(struct vc_bench *bench, struct vc_result *res)
+{
+        uint32_t ids[VC_CTRL_MULTI_MAX];
+        int32_t values[2][VC_CTRL_MULTI_MAX];
+        uint64_t start_ns;
+        unsigned int i, k, count = 0;
+
+        for (k = 0; k < VC_CTRL_COUNT && count < VC_CTRL_MULTI_MAX; k++) {
+                struct vc_target *target = &bench->targets[k];
+
+                if (!target->selected || target->skip)
+                        continue;
+                ids[count] = target->def->id;
+                values[0][count] = target->values[0];
+                values[1][count] = target->values[1];
+                count++;
+        }
+        res->controls = count;
+        if (count == 0)
+                return;
+
+        start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+        for (i = 0; i < bench->iterations && !stop; i++) {
+                uint64_t t0 = vc_clock_ns(CLOCK_MONOTONIC);
+                int ret;
+
+                ret = vc_ctrl_set_multi(bench->subdev_fd, ids, values[i & 1], count);
+                vc_hist_add(&res->latency, vc_clock_ns(CLOCK_MONOTONIC) - t0);
+                res->ops++;
+                if (ret < 0) {
+                        vc_result_error(res, ret);
+                } else {
+                        for (k = 0; k < count; k++) {
+                                int32_t readback;
+
+                                if (vc_ctrl_get(bench->subdev_fd, ids[k], &readback) == 0 &&
+                                    readback != values[i & 1][k])
+                                        res->mismatches++;
+                        }
+                }
+                vc_bench_pump(bench);
+        }
+        res->seconds = (vc_clock_ns(CLOCK_MONOTONIC) - start_ns) / 1e9;
+        vc_restore_all(bench);
+}
+
+// --- Output ------------------------------------------------------------------
+
+static void vc_print_header(void)
+{
+        printf("%-16s %-6s %7s %6s %5s %6s %5s %8s %8s %8s %8s %9s\n", "control", "phase", "writes", "errors",
+               "busy", "mismat", "klog", "mean us", "p50 us", "p99 us", "max us", "updates/s");
+}
+
+static void vc_bench_report(struct vc_bench *bench, const struct vc_result *res)
+{
+        const struct vc_histogram *hist = &res->latency;
+        double rate = res->seconds > 0 ? res->ops * res->controls / res->seconds : 0.0;
+
+        printf("%-16s %-6s %7" PRIu64 " %6" PRIu64 " %5" PRIu64 " %6" PRIu64 " %5" PRIu64
+               " %8.1f %8.1f %8.1f %8.1f %9.0f\n",
+               res->name, res->phase, res->ops, res->errors, res->busy, res->mismatches, res->kernel_errors,
+               vc_hist_mean(hist) / 1e3, vc_hist_percentile(hist, 50) / 1e3, vc_hist_percentile(hist, 99) / 1e3,
+               hist->count ? hist->max / 1e3 : 0.0, rate);
+        if (res->first_error)
+                printf("%-16s %-6s first error: %s\n", "", "", strerror(-res->first_error));
+
+        if (!bench->out)
+                return;
+        fprintf(bench->out, "%s\n    {\n      \"control\": ", bench->results ? "," : "");
+        vc_json_string(bench->out, res->name);
+        fprintf(bench->out, ",\n      \"phase\": \"%s\",\n", res->phase);
+        fprintf(bench->out, "      \"controls_per_write\": %u,\n", res->controls);
+        fprintf(bench->out, "      \"writes\": %" PRIu64 ",\n", res->ops);
+        fprintf(bench->out, "      \"errors\": %" PRIu64 ",\n", res->errors);
+        fprintf(bench->out, "      \"busy\": %" PRIu64 ",\n", res->busy);
+        fprintf(bench->out, "      \"readback_mismatches\": %" PRIu64 ",\n", res->mismatches);
+        fprintf(bench->out, "      \"kernel_log_errors\": %" PRIu64 ",\n", res->kernel_errors);
+        fprintf(bench->out, "      \"latency_us\": { \"mean\": %.2f, \"stddev\": %.2f, \"min\": %.2f, "
+                "\"p50\": %.2f, \"p99\": %.2f, \"max\": %.2f },\n",
+                vc_hist_mean(hist) / 1e3, vc_hist_stddev(hist) / 1e3, hist->count ? hist->min / 1e3 : 0.0,
+                vc_hist_percentile(hist, 50) / 1e3, vc_hist_percentile(hist, 99) / 1e3,
+                hist->count ? hist->max / 1e3 : 0.0);
+        fprintf(bench->out, "      \"updates_per_s\": %.1f\n    }", rate);
+        bench->results++;
+}
+
+// --- Runs --------------------------------------------------------------------
+
+static void vc_bench_phase(struct vc_bench *bench, const char *phase)
+{
+        struct vc_result res;
+        unsigned int k;
+
+        for (k = 0; k < VC_CTRL_COUNT && !stop; k++) {
+                struct vc_target *target = &bench->targets[k];
+
+                if (!target->selected || target->skip)
+                        continue;
+
+                memset(&res, 0, sizeof(res));
+                vc_hist_reset(&res.latency);
+                res.name = target->def->name;
+                res.phase = phase;
+                res.controls = 1;
+
+                vc_kmsg_count(bench->kmsg_fd);
+                vc_bench_single(bench, target, &res);
+                vc_target_restore(bench->subdev_fd, target);
+                res.kernel_errors = vc_kmsg_count(bench->kmsg_fd);
+                vc_bench_report(bench, &res);
+        }
+
+        if (stop)
+                return;
+        memset(&res, 0, sizeof(res));
+        vc_hist_reset(&res.latency);
+        res.name = "S_EXT_CTRLS";
+        res.phase = phase;
+        vc_kmsg_count(bench->kmsg_fd);
+        vc_bench_batch(bench, &res);
+        res.kernel_errors = vc_kmsg_count(bench->kmsg_fd);
+        if (res.controls > 1)
+                vc_bench_report(bench, &res);
+}
+
+static int vc_bench_stream(struct vc_bench *bench, const char *device, unsigned int buffers)
+{
+        const struct vc_capture_stats *stats;
+        int ret;
+
+        bench->cap = vc_capture_open(device, NULL, buffers);
+        if (!bench->cap) {
+                ret = -errno;
+                fprintf(stderr, "Failed to open %s: %s\n", device, strerror(errno));
+                return ret;
+        }
+        ret = vc_capture_start(bench->cap);
+        if (ret < 0) {
+                fprintf(stderr, "Failed to start streaming: %s\n", strerror(-ret));
+                vc_capture_close(bench->cap);
+                bench->cap = NULL;
+                return ret;
+        }
+
+        vc_bench_phase(bench, "stream");
+
+        vc_bench_pump(bench);
+        stats = vc_capture_get_stats(bench->cap);
+        printf("Streaming: %" PRIu64 " frames, %" PRIu64 " dropped\n", stats->frames, stats->dropped);
+        vc_capture_stop(bench->cap);
+        vc_capture_close(bench->cap);
+        bench->cap = NULL;
+        return 0;
+}
+
+static int vc_select(struct vc_bench *bench, const char *list)
+{
+        char *copy, *token, *save = NULL;
+        unsigned int k;
+        int ret = 0;
+
+        copy = strdup(list);
+        if (!copy)
+                return -ENOMEM;
+        for (token = strtok_r(copy, ",", &save); token; token = strtok_r(NULL, ",", &save)) {
+                for (k = 0; k < VC_CTRL_COUNT; k++) {
+                        if (strcmp(vc_ctrl_defs[k].name, token) == 0)
+                                break;
+                }
+                if (k == VC_CTRL_COUNT) {
+                        fprintf(stderr, "Unknown control '%s'\n", token);
+                        ret = -EINVAL;
+                        break;
+                }
+                bench->targets[k].selected = true;
+        }
+        free(copy);
+        return ret;
+}
+
+int main(int argc, char *argv[])
+{
+        static const struct option options[] = {
+                { "device",     required_argument, NULL, 'd' },
+                { "subdev",     required_argument, NULL, 's' },
+                { "iterations", required_argument, NULL, 'n' },
+                { "controls",   required_argument, NULL, 'c' },
+                { "phase",      required_argument, NULL, 'p' },
+                { "buffers",    required_argument, NULL, 'b' },
+                { "output",     required_argument, NULL, 'o' },
+                { "help",       no_argument,       NULL, 'h' },
+                { NULL, 0, NULL, 0 },
+        };
+        struct vc_bench bench = {
+                .iterations = 1000,
+                .kmsg_fd = -1,
+        };
+        const char *device = "/dev/video0", *controls = NULL, *output = NULL;
+        char sensor[VC_SENSOR_NAME_LEN + 1] = "";
+        char subdev[64] = "";
+        struct v4l2_mbus_framefmt orig_fmt;
+        struct v4l2_rect orig_crop;
+        bool have_fmt, have_crop;
+        unsigned int phases = VC_PHASE_IDLE | VC_PHASE_STREAM, buffers = 4, k;
+        int opt, ret = 0;
+
+        while ((opt = getopt_long(argc, argv, "d:s:n:c:p:b:o:h", options, NULL)) != -1) {
+                switch (opt) {
+                case 'd': device = optarg; break;
+                case 's': snprintf(subdev, sizeof(subdev), "%s", optarg); break;
+                case 'n': bench.iterations = strtoul(optarg, NULL, 0); break;
+                case 'c': controls = optarg; break;
+                case 'p':
+                        if (strcmp(optarg, "idle") == 0)
+                                phases = VC_PHASE_IDLE;
+                        else if (strcmp(optarg, "stream") == 0)
+                                phases = VC_PHASE_STREAM;
+                        else if (strcmp(optarg, "both") == 0)
+                                phases = VC_PHASE_IDLE | VC_PHASE_STREAM;
+                        else
+                                usage(argv[0]);
+                        break;
+                case 'b': buffers = strtoul(optarg, NULL, 0); break;
+                case 'o': output = optarg; break;
+                default: usage(argv[0]);
+                }
+        }
+        if (optind != argc || bench.iterations < 2)
+                usage(argv[0]);
+
+        for (k = 0; k < VC_CTRL_COUNT; k++) {
+                bench.targets[k].def = &vc_ctrl_defs[k];
+                bench.targets[k].selected = controls == NULL;
+        }
+        if (controls && vc_select(&bench, controls) < 0)
+                usage(argv[0]);
+
+        if (!subdev[0] && vc_find_sensor_subdev(subdev, sizeof(subdev)) < 0) {
+                fprintf(stderr, "No vc_mipi_camera subdevice found, use --subdev\n");
+                return 1;
+        }
+        bench.subdev_fd = open(subdev, O_RDWR | O_CLOEXEC);
+        if (bench.subdev_fd < 0) {
+                fprintf(stderr, "Failed to open %s: %s\n", subdev, strerror(errno));
+                return 1;
+        }
+        vc_ctrl_get_string(bench.subdev_fd, V4L2_CID_VC_NAME, sensor, VC_SENSOR_NAME_LEN);
+        // binning_mode changes the format, it is restored at the end
+        have_fmt = vc_subdev_get_fmt(bench.subdev_fd, 0, &orig_fmt) == 0;
+        have_crop = vc_subdev_get_crop(bench.subdev_fd, 0, &orig_crop) == 0;
+
+        bench.kmsg_fd = vc_kmsg_open();
+        printf("Sensor %s on %s, %u writes per run", sensor[0] ? sensor : "?", subdev, bench.iterations);
+        printf(bench.kmsg_fd < 0 ? ", kernel log not readable (run as root)\n" : "\n");
+
+        for (k = 0; k < VC_CTRL_COUNT; k++) {
+                struct vc_target *target = &bench.targets[k];
+
+                if (!target->selected)
+                        continue;
+                target->skip = vc_target_prepare(bench.subdev_fd, target);
+                if (target->skip)
+                        printf("Skipping %s: %s\n", target->def->name, target->skip);
+        }
+
+        if (output) {
+                bench.out = fopen(output, "w");
+                if (!bench.out) {
+                        fprintf(stderr, "Failed to create %s: %s\n", output, strerror(errno));
+                        ret = -errno;
+                        goto out;
+                }
+                fprintf(bench.out, "{\n  \"sensor\": ");
+                vc_json_string(bench.out, sensor);
+                fprintf(bench.out, ",\n  \"subdev\": ");
+                vc_json_string(bench.out, subdev);
+                fprintf(bench.out, ",\n  \"iterations\": %u,\n  \"kernel_log\": %s,\n  \"results\": [",
+                        bench.iterations, bench.kmsg_fd >= 0 ? "true" : "false");
+        }
+
+        signal(SIGINT, vc_handle_signal);
+        signal(SIGTERM, vc_handle_signal);
+
+        vc_print_header();
+        if (phases & VC_PHASE_IDLE)
+                vc_bench_phase(&bench, "idle");
+        if ((phases & VC_PHASE_STREAM) && !stop)
+                ret = vc_bench_stream(&bench, device, buffers);
+
+        if (bench.out) {
+                fprintf(bench.out, "\n  ],\n  \"interrupted\": %s\n}\n", stop ? "true" : "false");
+                if (fclose(bench.out) != 0)
+                        ret = -EIO;
+        }
+
+out:
+        vc_restore_all(&bench);
+        if (have_fmt)
+                vc_subdev_set_fmt(bench.subdev_fd, 0, &orig_fmt);
+        if (have_crop)
+                vc_subdev_set_crop(bench.subdev_fd, 0, &orig_crop);
+        if (bench.kmsg_fd >= 0)
+                close(bench.kmsg_fd);
+        close(bench.subdev_fd);
+        return ret < 0 ? 1 : 0;
+}
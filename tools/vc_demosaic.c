@@ -0,0 +1,396 @@
+// vc_demosaic - Bayer to RGB / YUV conversion without the ISP
+//
+// bench    demosaics synthetic frames of every size and prints the frame
+//          rate next to the one of a plain frame copy. Every kernel the
+//          CPU supports is checked against the scalar one.
+// convert  writes one frame of a recording as PPM, optionally with the
+//          downscaled preview.
+//
+// Usage:
+//   vc_demosaic bench [--sizes 640x480,1920x1080] [--format RGGB12] [--unpacked]
+//                     [--method bilinear|edge] [--output rgb|bgr|yuyv] [--preview N]
+//   vc_demosaic convert capture.vcraw -o frame.ppm [-f N] [--black N] [--wb r,g,b]
+//                     [--method bilinear|edge] [--preview N --preview-out small.ppm]
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vc_demosaic.h"
+#include "vc_pixfmt.h"
+#include "vc_rawseq.h"
+#include "vc_stats.h"
+
+#define VC_BENCH_SIZES_DEFAULT          "640x480,1280x720,1920x1080,4056x3040"
+
+static void usage(const char *argv0)
+{
+        fprintf(stderr,
+                "Usage: %s (bench | convert <file.vcraw>) [OPTIONS]\n"
+                "\n"
+                "  -m, --method <m>       bilinear or edge (default: bilinear)\n"
+                "  -p, --preview <N>      Also make a preview scaled down by 2, 4 or 8\n"
+                "  -k, --kernel <name>    Force scalar, sse2, avx2 or neon\n"
+                "\n"
+                "bench:\n"
+                "  -s, --sizes <list>     Frame sizes (default: " VC_BENCH_SIZES_DEFAULT ")\n"
+                "  -F, --format <name>    Bayer format (default: RGGB12)\n"
+                "  -u, --unpacked         16 bit containers instead of CSI-2 packed\n"
+                "  -O, --output <fmt>     rgb, bgr or yuyv (default: bgr)\n"
+                "  -n, --frames <N>       Frames per size (default: 50)\n"
+                "\n"
+                "convert:\n"
+                "  -f, --frame <N>        Frame index (default: 0)\n"
+                "  -o, --out <file>       Output PPM\n"
+                "      --preview-out <f>  Output PPM of the preview\n"
+                "  -b, --black <N>        Black level (default: 0)\n"
+                "  -w, --wb <r,g,b>       White balance gains (default: 1,1,1)\n"
+                "  -g, --gamma <g>        Output gamma (default: 2.2)\n",
+                argv0);
+        exit(1);
+}
+
+// Smooth colour gradients with a few sharp edges and some noise
+static void vc_fill_frame(const struct vc_pixfmt *pixfmt, bool packed, const struct vc_format *fmt,
+                          uint8_t *data)
+{
+        uint32_t max = (1u << pixfmt->bits) - 1;
+        uint16_t *line = malloc(fmt->width * sizeof(*line));
+        uint32_t seed = 1, x, y;
+
+        if (!line)
+                return;
+
+        for (y = 0; y < fmt->height; y++) {
+                for (x = 0; x < fmt->width; x++) {
+                        uint32_t v = (uint64_t)max * (x + y) / (fmt->width + fmt->height);
+
+                        if (((x / 64) ^ (y / 64)) & 1)
+                                v = v / 2;
+                        if ((x ^ y) & 1)
+                                v = v * 3 / 4;
+                        seed = seed * 1103515245 + 12345;
+                        v += (seed >> 16) % (max / 64 + 1);
+                        line[x] = v > max ? max : v;
+                }
+                vc_pixfmt_pack_line(pixfmt, packed, line, data + (size_t)y * fmt->bytesperline, fmt->width);
+        }
+        free(line);
+}
+
+static int vc_parse_size(const char **str, uint32_t *width, uint32_t *height)
+{
+        char *end;
+
+        *width = strtoul(*str, &end, 0);
+        if (*end != 'x')
+                return -EINVAL;
+        *height = strtoul(end + 1, &end, 0);
+        if (*end && *end != ',')
+                return -EINVAL;
+        *str = *end ? end + 1 : end;
+        return *width && *height ? 0 : -EINVAL;
+}
+
+static int vc_bench_size(const struct vc_pixfmt *pixfmt, bool packed, uint32_t width, uint32_t height,
+                         const struct vc_demosaic_params *params, unsigned int frames)
+{
+        struct vc_format fmt = {
+                .width = width,
+                .height = height,
+                .fourcc = packed || !pixfmt->fourcc_unpacked ? pixfmt->fourcc : pixfmt->fourcc_unpacked,
+        };
+        struct vc_demosaic_params scalar_params = *params;
+        struct vc_demosaic *dm = NULL, *ref = NULL;
+        struct vc_histogram time, copy_time;
+        uint8_t *raw = NULL, *out = NULL, *ref_out = NULL, *preview = NULL, *copy = NULL;
+        uint32_t pw = 0, ph = 0;
+        size_t stride, out_size;
+        unsigned int i;
+        bool match;
+        int ret = 0;
+
+        fmt.bytesperline = vc_pixfmt_line_bytes(pixfmt, packed, width);
+        fmt.sizeimage = fmt.bytesperline * height;
+
+        dm = vc_demosaic_create(&fmt, params);
+        scalar_params.kernel = "scalar";
+        ref = vc_demosaic_create(&fmt, &scalar_params);
+        if (!dm || !ref) {
+                ret = -errno;
+                fprintf(stderr, "%ux%u: %s\n", width, height, strerror(errno));
+                goto out;
+        }
+
+        stride = (size_t)width * vc_demosaic_pixel_bytes(dm);
+        out_size = stride * height;
+        vc_demosaic_preview_size(dm, &pw, &ph);
+
+        raw = malloc(fmt.sizeimage);
+        copy = malloc(fmt.sizeimage);
+        out = malloc(out_size);
+        ref_out = malloc(out_size);
+        preview = malloc((size_t)pw * ph * vc_demosaic_pixel_bytes(dm) + 1);
+        if (!raw || !copy || !out || !ref_out || !preview) {
+                ret = -ENOMEM;
+                goto out;
+        }
+        vc_fill_frame(pixfmt, packed, &fmt, raw);
+
+        vc_hist_reset(&time);
+        vc_hist_reset(&copy_time);
+        for (i = 0; i < frames; i++) {
+                uint64_t start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+
+                ret = vc_demosaic_process(dm, raw, fmt.sizeimage, out, stride,
+                                          pw ? preview : NULL, (size_t)pw * vc_demosaic_pixel_bytes(dm));
+                vc_hist_add(&time, vc_clock_ns(CLOCK_MONOTONIC) - start_ns);
+                if (ret < 0)
+                        goto out;
+
+                start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+                memcpy(copy, raw, fmt.sizeimage);
+                vc_hist_add(&copy_time, vc_clock_ns(CLOCK_MONOTONIC) - start_ns);
+        }
+
+        ret = vc_demosaic_process(ref, raw, fmt.sizeimage, ref_out, stride, NULL, 0);
+        if (ret < 0)
+                goto out;
+        match = !memcmp(out, ref_out, out_size);
+
+        printf("%5ux%-5u %-7s %8.2f ms %8.1f fps %7.1f MP/s   copy %6.2f ms   %s\n",
+               width, height, vc_demosaic_kernel(dm), vc_hist_mean(&time) / 1e6,
+               1e9 / vc_hist_mean(&time), width * (double)height * 1e3 / vc_hist_mean(&time),
+               vc_hist_mean(&copy_time) / 1e6, match ? "= scalar" : "DIFFERS from scalar");
+        if (!match)
+                ret = -EBADMSG;
+
+out:
+        free(raw);
+        free(copy);
+        free(out);
+        free(ref_out);
+        free(preview);
+        vc_demosaic_destroy(dm);
+        vc_demosaic_destroy(ref);
+        return ret;
+}
+
+static int vc_bench(const char *format, bool unpacked, const char *sizes,
+                    const struct vc_demosaic_params *params, unsigned int frames)
+{
+        const struct vc_pixfmt *pixfmt = vc_pixfmt_from_name(format);
+        bool packed = pixfmt && pixfmt->bits > 8 && pixfmt->bits < 16 && !unpacked;
+        const char *p = sizes;
+        int ret = 0;
+
+        if (!pixfmt || pixfmt->bayer == VC_BAYER_NONE || (unpacked && !pixfmt->fourcc_unpacked)) {
+                fprintf(stderr, "%s is not a Bayer format%s\n", format, unpacked ? " with 16 bit containers" : "");
+                return -EINVAL;
+        }
+        printf("%s%s, %s, %s output%s\n", format, packed ? " packed" : unpacked ? " in 16 bit" : "",
+               params->method == VC_DEMOSAIC_EDGE ? "edge-aware" : "bilinear",
+               params->output == VC_DEMOSAIC_YUYV ? "YUYV" : params->output == VC_DEMOSAIC_RGB24 ? "RGB" : "BGR",
+               params->preview_scale ? ", with preview" : "");
+
+        while (*p) {
+                uint32_t width, height;
+
+                if (vc_parse_size(&p, &width, &height) < 0) {
+                        fprintf(stderr, "Invalid size list %s\n", sizes);
+                        return -EINVAL;
+                }
+                ret = vc_bench_size(pixfmt, packed, width, height, params, frames);
+                if (ret < 0)
+                        break;
+        }
+        return ret;
+}
+
+static int vc_write_ppm(const char *path, const uint8_t *rgb, uint32_t width, uint32_t height)
+{
+        FILE *f = fopen(path, "wb");
+        int ret = 0;
+
+        if (!f)
+                return -errno;
+        fprintf(f, "P6\n%u %u\n255\n", width, height);
+        if (fwrite(rgb, 3, (size_t)width * height, f) != (size_t)width * height)
+                ret = -EIO;
+        if (fclose(f) && ret == 0)
+                ret = -errno;
+        return ret;
+}
+
+static int vc_convert(const char *input, uint32_t index, const char *output, const char *preview_output,
+                      const struct vc_demosaic_params *params)
+{
+        const struct vc_rawseq_header *info;
+        struct vc_format fmt;
+        struct vc_demosaic *dm = NULL;
+        struct vc_rawseq *seq;
+        uint8_t *raw = NULL, *rgb = NULL, *preview = NULL;
+        uint32_t pw, ph;
+        ssize_t len;
+        int ret = 0;
+
+        seq = vc_rawseq_open(input);
+        if (!seq) {
+                fprintf(stderr, "Failed to open %s: %s\n", input, strerror(errno));
+                return -errno;
+        }
+        info = vc_rawseq_info(seq);
+        fmt = (struct vc_format){
+                .width = info->width,
+                .height = info->height,
+                .fourcc = info->fourcc,
+                .bytesperline = info->bytesperline,
+                .sizeimage = info->frame_size,
+        };
+
+        if (index >= vc_rawseq_count(seq)) {
+                fprintf(stderr, "%s has %u frames\n", input, vc_rawseq_count(seq));
+                ret = -ERANGE;
+                goto out;
+        }
+
+        dm = vc_demosaic_create(&fmt, params);
+        if (!dm) {
+                char fcc[5];
+
+                ret = -errno;
+                fprintf(stderr, "Cannot demosaic %s %ux%u: %s\n", vc_fourcc_str(fmt.fourcc, fcc),
+                        fmt.width, fmt.height, strerror(errno));
+                goto out;
+        }
+        vc_demosaic_preview_size(dm, &pw, &ph);
+
+        raw = malloc(info->frame_size);
+        rgb = malloc((size_t)fmt.width * fmt.height * 3);
+        preview = malloc((size_t)pw * ph * 3 + 1);
+        if (!raw || !rgb || !preview) {
+                ret = -ENOMEM;
+                goto out;
+        }
+
+        len = vc_rawseq_read(seq, index, raw, info->frame_size);
+        if (len < 0) {
+                ret = len;
+                fprintf(stderr, "Failed to read frame %u: %s\n", index, strerror(-ret));
+                goto out;
+        }
+
+        ret = vc_demosaic_process(dm, raw, len, rgb, (size_t)fmt.width * 3, pw ? preview : NULL, (size_t)pw * 3);
+        if (ret < 0) {
+                fprintf(stderr, "Failed to demosaic frame %u: %s\n", index, strerror(-ret));
+                goto out;
+        }
+
+        ret = vc_write_ppm(output, rgb, fmt.width, fmt.height);
+        if (ret == 0 && preview_output && pw)
+                ret = vc_write_ppm(preview_output, preview, pw, ph);
+        if (ret < 0) {
+                fprintf(stderr, "Failed to write the image: %s\n", strerror(-ret));
+                goto out;
+        }
+        printf("Frame %u (%ux%u) written to %s", index, fmt.width, fmt.height, output);
+        if (preview_output && pw)
+                printf(", preview (%ux%u) to %s", pw, ph, preview_output);
+        printf("\n");
+
+out:
+        free(raw);
+        free(rgb);
+        free(preview);
+        vc_demosaic_destroy(dm);
+        vc_rawseq_close(seq);
+        return ret;
+}
+
+int main(int argc, char *argv[])
+{
+        enum { OPT_PREVIEW_OUT = 256 };
+        static const struct option options[] = {
+                { "method",      required_argument, NULL, 'm' },
+                { "preview",     required_argument, NULL, 'p' },
+                { "kernel",      required_argument, NULL, 'k' },
+                { "sizes",       required_argument, NULL, 's' },
+                { "format",      required_argument, NULL, 'F' },
+                { "unpacked",    no_argument,       NULL, 'u' },
+                { "output",      required_argument, NULL, 'O' },
+                { "frames",      required_argument, NULL, 'n' },
+                { "frame",       required_argument, NULL, 'f' },
+                { "out",         required_argument, NULL, 'o' },
+                { "preview-out", required_argument, NULL, OPT_PREVIEW_OUT },
+                { "black",       required_argument, NULL, 'b' },
+                { "wb",          required_argument, NULL, 'w' },
+                { "gamma",       required_argument, NULL, 'g' },
+                { "help",        no_argument,       NULL, 'h' },
+                { NULL, 0, NULL, 0 },
+        };
+        struct vc_demosaic_params params = VC_DEMOSAIC_PARAMS_DEFAULT;
+        const char *sizes = VC_BENCH_SIZES_DEFAULT, *format = "RGGB12";
+        const char *output = NULL, *preview_output = NULL, *mode;
+        unsigned int frames = 50;
+        uint32_t index = 0;
+        bool unpacked = false;
+        int opt, ret;
+
+        params.output = VC_DEMOSAIC_BGR24;
+
+        while ((opt = getopt_long(argc, argv, "m:p:k:s:F:uO:n:f:o:b:w:g:h", options, NULL)) != -1) {
+                switch (opt) {
+                case 'm':
+                        if (!strcmp(optarg, "bilinear"))
+                                params.method = VC_DEMOSAIC_BILINEAR;
+                        else if (!strcmp(optarg, "edge"))
+                                params.method = VC_DEMOSAIC_EDGE;
+                        else
+                                usage(argv[0]);
+                        break;
+                case 'O':
+                        if (!strcmp(optarg, "rgb"))
+                                params.output = VC_DEMOSAIC_RGB24;
+                        else if (!strcmp(optarg, "bgr"))
+                                params.output = VC_DEMOSAIC_BGR24;
+                        else if (!strcmp(optarg, "yuyv"))
+                                params.output = VC_DEMOSAIC_YUYV;
+                        else
+                                usage(argv[0]);
+                        break;
+                case 'w':
+                        if (sscanf(optarg, "%lf,%lf,%lf", &params.wb[0], &params.wb[1], &params.wb[2]) != 3)
+                                usage(argv[0]);
+                        break;
+                case 'p': params.preview_scale = strtoul(optarg, NULL, 0); break;
+                case 'k': params.kernel = optarg; break;
+                case 's': sizes = optarg; break;
+                case 'F': format = optarg; break;
+                case 'u': unpacked = true; break;
+                case 'n': frames = strtoul(optarg, NULL, 0); break;
+                case 'f': index = strtoul(optarg, NULL, 0); break;
+                case 'o': output = optarg; break;
+                case OPT_PREVIEW_OUT: preview_output = optarg; break;
+                case 'b': params.black_level = strtoul(optarg, NULL, 0); break;
+                case 'g': params.gamma = strtod(optarg, NULL); break;
+                default: usage(argv[0]);
+                }
+        }
+        if (optind >= argc || frames == 0)
+                usage(argv[0]);
+        mode = argv[optind];
+
+        if (!strcmp(mode, "bench") && optind + 1 == argc) {
+                ret = vc_bench(format, unpacked, sizes, &params, frames);
+        } else if (!strcmp(mode, "convert") && optind + 2 == argc && output) {
+                params.output = VC_DEMOSAIC_RGB24;
+                ret = vc_convert(argv[optind + 1], index, output, preview_output, &params);
+        } else {
+                usage(argv[0]);
+        }
+
+        return ret < 0 ? 1 : 0;
+}
@@ -0,0 +1,414 @@
+// vc_dpc - Defect pixel and column fixed pattern calibration
+//
+// calibrate  captures dark frames (cover the lens) at the given exposure,
+//            gain and black level, builds the defect map and the column
+//            offsets and stores them for the current sensor mode, keyed by
+//            sensor name, format, crop and binning mode.
+// info       prints a table.
+// bench      corrects the frames in place as they are dequeued and compares
+//            the time per frame with the frame interval.
+//
+// Usage:
+//   vc_dpc calibrate [-d /dev/video0] [-s /dev/v4l-subdevX] [-n 64]
+//                    [--exposure N] [--gain mdB] [--blacklevel N] [--dir D]
+//   vc_dpc info <file.vcdpc>
+//   vc_dpc bench [-d /dev/video0 | replay:file.vcraw] [-n 300] [--table file.vcdpc]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vc_capture.h"
+#include "vc_dpc.h"
+#include "vc_pixfmt.h"
+#include "vc_stats.h"
+#include "vc_v4l2.h"
+
+// Frames skipped after the controls were written
+#define VC_DPC_SETTLE_FRAMES            4
+
+static volatile sig_atomic_t stop;
+
+static void vc_handle_signal(int sig)
+{
+        stop = 1;
+}
+
+static void usage(const char *argv0)
+{
+        fprintf(stderr,
+                "Usage: %s (calibrate | info <file> | bench) [OPTIONS]\n"
+                "\n"
+                "  -d, --device <dev>     Video device or replay:<file> (default: /dev/video0)\n"
+                "  -s, --subdev <dev>     Sensor subdevice (auto-detected if omitted)\n"
+                "  -n, --frames <N>       Frames to average / correct (default: 64 / 300)\n"
+                "  -b, --buffers <N>      Number of capture buffers (default: 4)\n"
+                "      --dir <dir>        Table directory (default: " VC_DPC_DIR_DEFAULT ")\n"
+                "  -o, --output <file>    calibrate: write the table here instead\n"
+                "  -t, --table <file>     bench: use this table instead of the one for the mode\n"
+                "\n"
+                "calibrate:\n"
+                "      --exposure <N>     Exposure for the dark frames (default: current)\n"
+                "      --gain <mdB>       Analogue gain (default: current)\n"
+                "      --blacklevel <N>   Black level (default: current)\n"
+                "      --sigma <X>        Defect threshold in robust sigmas (default: 6)\n"
+                "      --min-level <X>    Minimum defect deviation, fraction of full scale (default: 0.01)\n"
+                "      --no-columns       Only detect defects, no column offsets\n",
+                argv0);
+        exit(1);
+}
+
+// Creates the table directory with its parents
+static int vc_mkdirs(const char *dir)
+{
+        char path[256];
+        char *p;
+
+        snprintf(path, sizeof(path), "%s", dir);
+        for (p = path + 1; *p; p++) {
+                if (*p != '/')
+                        continue;
+                *p = '\0';
+                if (mkdir(path, 0755) < 0 && errno != EEXIST)
+                        return -errno;
+                *p = '/';
+        }
+        if (mkdir(path, 0755) < 0 && errno != EEXIST)
+                return -errno;
+        return 0;
+}
+
+static void vc_print_table(const struct vc_dpc *dpc)
+{
+        const struct vc_dpc_header *info = vc_dpc_info(dpc);
+        const int16_t *offsets = vc_dpc_offsets(dpc);
+        int min = 0, max = 0;
+        uint32_t x;
+        char fcc[5];
+
+        for (x = 0; x < info->mode.width; x++) {
+                if (offsets[x] < min)
+                        min = offsets[x];
+                if (offsets[x] > max)
+                        max = offsets[x];
+        }
+
+        printf("Sensor      : %.*s\n", (int)sizeof(info->mode.sensor_name), info->mode.sensor_name);
+        printf("Mode        : %ux%u %s, crop (%d,%d)/%ux%u",
+               info->mode.width, info->mode.height, vc_fourcc_str(info->mode.fourcc, fcc),
+               info->mode.crop.left, info->mode.crop.top, info->mode.crop.width, info->mode.crop.height);
+        if (info->mode.binning_mode != VC_CTRL_UNAVAILABLE)
+                printf(", binning %d", info->mode.binning_mode);
+        printf("\n");
+        printf("Calibration : %u dark frames, exposure %d, gain %d mdB, black level %d\n",
+               info->frames, info->exposure, info->gain, info->blacklevel);
+        printf("Defects     : %u (%.4f %%)\n", info->num_defects,
+               100.0 * info->num_defects / ((double)info->mode.width * info->mode.height));
+        printf("Columns     : offsets %d..%d\n", min, max);
+}
+
+static int vc_set_ctrl(int fd, uint32_t id, const char *name, int64_t value)
+{
+        int ret;
+
+        if (value == INT64_MIN)
+                return 0;
+
+        ret = vc_ctrl_set(fd, id, value);
+        if (ret < 0)
+                fprintf(stderr, "Failed to set %s to %lld: %s\n", name, (long long)value, strerror(-ret));
+        return ret;
+}
+
+static int vc_calibrate(struct vc_capture *cap, unsigned int frames, const struct vc_dpc_params *params,
+                        const char *dir, const char *output)
+{
+        struct vc_dpc_calib *calib;
+        struct vc_dpc_mode mode;
+        struct vc_format fmt;
+        struct vc_frame frame;
+        struct vc_dpc *dpc;
+        char path[512];
+        unsigned int n = 0, skip = VC_DPC_SETTLE_FRAMES;
+        int ret;
+
+        vc_capture_get_format(cap, &fmt);
+        vc_dpc_mode_read(vc_capture_subdev_fd(cap), &fmt, &mode);
+
+        calib = vc_dpc_calib_create(&mode, &fmt);
+        if (!calib) {
+                fprintf(stderr, "Failed to set up the calibration: %s\n", strerror(errno));
+                return -errno;
+        }
+
+        ret = vc_capture_start(cap);
+        if (ret < 0) {
+                fprintf(stderr, "Failed to start streaming: %s\n", strerror(-ret));
+                goto out;
+        }
+
+        while (!stop && n < frames) {
+                ret = vc_capture_dequeue(cap, &frame, 2000);
+                if (ret == -ETIMEDOUT) {
+                        fprintf(stderr, "No frame within 2 s\n");
+                        continue;
+                }
+                if (ret < 0)
+                        break;
+
+                if (skip)
+                        skip--;
+                else if ((ret = vc_dpc_calib_add(calib, &frame)) == 0)
+                        n++;
+                vc_capture_release(cap, &frame);
+                if (ret < 0)
+                        break;
+        }
+        vc_capture_stop(cap);
+        if (ret == -ENODATA)
+                ret = 0;
+        if (ret < 0) {
+                fprintf(stderr, "Failed to capture: %s\n", strerror(-ret));
+                goto out;
+        }
+
+        dpc = vc_dpc_calib_finish(calib, params);
+        if (!dpc) {
+                ret = -errno;
+                fprintf(stderr, "Failed to build the table: %s\n", strerror(errno));
+                goto out;
+        }
+
+        if (output) {
+                snprintf(path, sizeof(path), "%s", output);
+        } else {
+                vc_dpc_path(dir, &mode, path, sizeof(path));
+                ret = vc_mkdirs(dir);
+                if (ret < 0)
+                        fprintf(stderr, "Failed to create %s: %s\n", dir, strerror(-ret));
+        }
+        ret = vc_dpc_save(dpc, path);
+        if (ret < 0) {
+                fprintf(stderr, "Failed to write %s: %s\n", path, strerror(-ret));
+        } else {
+                vc_print_table(dpc);
+                printf("Saved to    : %s\n", path);
+        }
+        vc_dpc_destroy(dpc);
+
+out:
+        vc_dpc_calib_destroy(calib);
+        return ret;
+}
+
+static int vc_bench(struct vc_capture *cap, unsigned int frames, const char *dir, const char *table)
+{
+        struct vc_histogram apply_time, interval;
+        struct vc_dpc_mode mode;
+        struct vc_format fmt;
+        struct vc_frame frame;
+        struct vc_dpc *dpc;
+        uint64_t last_ts = 0;
+        uint8_t *copy = NULL;
+        unsigned int n = 0;
+        char path[512];
+        int ret;
+
+        vc_capture_get_format(cap, &fmt);
+        vc_dpc_mode_read(vc_capture_subdev_fd(cap), &fmt, &mode);
+
+        if (table) {
+                dpc = vc_dpc_load(table);
+                snprintf(path, sizeof(path), "%s", table);
+        } else {
+                vc_dpc_path(dir, &mode, path, sizeof(path));
+                dpc = vc_dpc_load_mode(dir, &mode);
+        }
+        if (!dpc) {
+                fprintf(stderr, "Failed to load %s: %s\n", path, strerror(errno));
+                return -errno;
+        }
+        vc_print_table(dpc);
+
+        // Replayed frames point into the read-only file mapping
+        if (vc_capture_fd(cap) < 0) {
+                copy = malloc(fmt.sizeimage);
+                if (!copy) {
+                        vc_dpc_destroy(dpc);
+                        return -ENOMEM;
+                }
+        }
+
+        vc_hist_reset(&apply_time);
+        vc_hist_reset(&interval);
+
+        ret = vc_capture_start(cap);
+        if (ret < 0) {
+                fprintf(stderr, "Failed to start streaming: %s\n", strerror(-ret));
+                goto out;
+        }
+
+        while (!stop && n < frames) {
+                uint64_t start_ns;
+                void *data;
+
+                ret = vc_capture_dequeue(cap, &frame, 2000);
+                if (ret == -ETIMEDOUT) {
+                        fprintf(stderr, "No frame within 2 s\n");
+                        continue;
+                }
+                if (ret < 0)
+                        break;
+
+                data = (void *)frame.data;
+                if (copy) {
+                        memcpy(copy, frame.data, frame.bytesused);
+                        data = copy;
+                }
+
+                start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+                ret = vc_dpc_apply(dpc, &fmt, data, frame.bytesused);
+                vc_hist_add(&apply_time, vc_clock_ns(CLOCK_MONOTONIC) - start_ns);
+                if (last_ts && frame.timestamp_ns > last_ts)
+                        vc_hist_add(&interval, frame.timestamp_ns - last_ts);
+                last_ts = frame.timestamp_ns;
+
+                vc_capture_release(cap, &frame);
+                if (ret < 0)
+                        break;
+                n++;
+        }
+        vc_capture_stop(cap);
+        if (ret == -ENODATA)
+                ret = 0;
+        if (ret < 0) {
+                fprintf(stderr, "Failed to correct: %s\n", strerror(-ret));
+                goto out;
+        }
+
+        printf("Correction  : %u frames, %.3f ms per frame (p99 %.3f ms, max %.3f ms)\n", n,
+               vc_hist_mean(&apply_time) / 1e6, vc_hist_percentile(&apply_time, 99.0) / 1e6,
+               apply_time.count ? apply_time.max / 1e6 : 0.0);
+        if (interval.count)
+                printf("Budget      : %.3f ms frame interval, %.1f %% used\n", vc_hist_mean(&interval) / 1e6,
+                       100.0 * vc_hist_mean(&apply_time) / vc_hist_mean(&interval));
+
+out:
+        free(copy);
+        vc_dpc_destroy(dpc);
+        return ret;
+}
+
+int main(int argc, char *argv[])
+{
+        static const struct option options[] = {
+                { "device",     required_argument, NULL, 'd' },
+                { "subdev",     required_argument, NULL, 's' },
+                { "frames",     required_argument, NULL, 'n' },
+                { "buffers",    required_argument, NULL, 'b' },
+                { "dir",        required_argument, NULL, 'D' },
+                { "output",     required_argument, NULL, 'o' },
+                { "table",      required_argument, NULL, 't' },
+                { "exposure",   required_argument, NULL, 'E' },
+                { "gain",       required_argument, NULL, 'G' },
+                { "blacklevel", required_argument, NULL, 'K' },
+                { "sigma",      required_argument, NULL, 'S' },
+                { "min-level",  required_argument, NULL, 'M' },
+                { "no-columns", no_argument,       NULL, 'C' },
+                { "help",       no_argument,       NULL, 'h' },
+                { NULL, 0, NULL, 0 },
+        };
+        const char *device = "/dev/video0";
+        const char *dir = VC_DPC_DIR_DEFAULT, *output = NULL, *table = NULL, *mode;
+        struct vc_dpc_params params = VC_DPC_PARAMS_DEFAULT;
+        int64_t exposure = INT64_MIN, gain = INT64_MIN, blacklevel = INT64_MIN;
+        unsigned int frames = 0, buffers = 4;
+        struct vc_capture *cap;
+        char subdev[64] = "";
+        int opt, ret;
+
+        while ((opt = getopt_long(argc, argv, "d:s:n:b:o:t:h", options, NULL)) != -1) {
+                switch (opt) {
+                case 'd': device = optarg; break;
+                case 's': snprintf(subdev, sizeof(subdev), "%s", optarg); break;
+                case 'n': frames = strtoul(optarg, NULL, 0); break;
+                case 'b': buffers = strtoul(optarg, NULL, 0); break;
+                case 'D': dir = optarg; break;
+                case 'o': output = optarg; break;
+                case 't': table = optarg; break;
+                case 'E': exposure = strtoll(optarg, NULL, 0); break;
+                case 'G': gain = strtoll(optarg, NULL, 0); break;
+                case 'K': blacklevel = strtoll(optarg, NULL, 0); break;
+                case 'S': params.sigma = strtod(optarg, NULL); break;
+                case 'M': params.min_level = strtod(optarg, NULL); break;
+                case 'C': params.columns = false; break;
+                default: usage(argv[0]);
+                }
+        }
+        if (optind >= argc)
+                usage(argv[0]);
+        mode = argv[optind];
+
+        if (!strcmp(mode, "info")) {
+                struct vc_dpc *dpc;
+
+                if (optind + 1 >= argc)
+                        usage(argv[0]);
+                dpc = vc_dpc_load(argv[optind + 1]);
+                if (!dpc) {
+                        fprintf(stderr, "Failed to load %s: %s\n", argv[optind + 1], strerror(errno));
+                        return 1;
+                }
+                vc_print_table(dpc);
+                vc_dpc_destroy(dpc);
+                return 0;
+        }
+        if (strcmp(mode, "calibrate") && strcmp(mode, "bench"))
+                usage(argv[0]);
+        if (!frames)
+                frames = !strcmp(mode, "calibrate") ? 64 : 300;
+
+        // The sensor mode, and for calibrate the controls, need the subdevice
+        if (!subdev[0] && strncmp(device, VC_CAPTURE_REPLAY_PREFIX, strlen(VC_CAPTURE_REPLAY_PREFIX)) && vc_find_sensor_subdev(subdev, sizeof(subdev)) < 0)
+                fprintf(stderr, "No vc_mipi_camera subdevice found, the sensor mode is unknown\n");
+
+        cap = vc_capture_open(device, subdev[0] ? subdev : NULL, buffers);
+        if (!cap) {
+                fprintf(stderr, "Failed to open %s: %s\n", device, strerror(errno));
+                return 1;
+        }
+
+        if (!strcmp(mode, "calibrate")) {
+                int fd = vc_capture_subdev_fd(cap);
+
+                if (fd < 0 && (exposure != INT64_MIN || gain != INT64_MIN || blacklevel != INT64_MIN)) {
+                        fprintf(stderr, "Setting controls needs the sensor subdevice, use --subdev\n");
+                        vc_capture_close(cap);
+                        return 1;
+                }
+                if (fd >= 0 && (vc_set_ctrl(fd, V4L2_CID_EXPOSURE, "exposure", exposure) < 0 ||
+                                vc_set_ctrl(fd, V4L2_CID_ANALOGUE_GAIN, "gain", gain) < 0 ||
+                                vc_set_ctrl(fd, V4L2_CID_BLACK_LEVEL, "black level", blacklevel) < 0)) {
+                        vc_capture_close(cap);
+                        return 1;
+                }
+        }
+
+        signal(SIGINT, vc_handle_signal);
+        signal(SIGTERM, vc_handle_signal);
+
+        if (!strcmp(mode, "calibrate"))
+                ret = vc_calibrate(cap, frames, &params, dir, output);
+        else
+                ret = vc_bench(cap, frames, dir, table);
+
+        vc_capture_close(cap);
+        return ret < 0 ? 1 : 0;
+}
@@ -0,0 +1,601 @@
+// vc_fanout - Shares the frames of one video node with several local processes
+//
+// The server owns the video node and hands the dequeued buffers to every
+// subscribed client over a Unix socket, see lib/vc_fanout.h. The buffers are
+// exported as DMABUF, so no client costs a copy. A buffer is queued back to
+// the driver when the last client released it. A replay source
+// (replay:file.vcraw) has no DMABUF, its frames are copied once into memfd
+// buffers instead.
+//
+// With --client the tool runs as a client and reports the frame rate, the
+// gaps and the latency it sees, e.g. to check a deployment.
+//
+// Usage:
+//   vc_fanout [-d /dev/video0] [-S /tmp/vc_fanout.sock] [-b 12] [--stats 5]
+//   vc_fanout --client [--name rec] [--policy drop|disconnect] [--depth 2] [--hold-ms 0]
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vc_capture.h"
+#include "vc_fanout.h"
+#include "vc_stats.h"
+
+#define VC_FANOUT_MAX_CLIENTS           16
+// Buffers that are never handed to clients, so the driver always has some
+#define VC_FANOUT_RESERVE               2
+
+struct vc_fanout_slot {
+        int fd;
+        size_t length;
+        void *map;                      // memfd only
+        unsigned int refs;
+        bool captured;                  // DMABUF only, the capture buffer is held
+        struct vc_frame frame;
+};
+
+struct vc_fanout_client_state {
+        int sock;                       // -1 if unused
+        bool subscribed;
+        char name[VC_FANOUT_NAME_LEN];
+        enum vc_fanout_policy policy;
+        unsigned int depth;
+        unsigned int held;
+        uint8_t refs[VC_CAPTURE_MAX_BUFFERS];
+        uint64_t sent;
+        uint64_t dropped;
+        struct vc_histogram lag;        // release time - frame timestamp
+};
+
+struct vc_fanout_server {
+        struct vc_capture *cap;
+        struct vc_format fmt;
+        bool dmabuf;
+        struct vc_fanout_slot slots[VC_CAPTURE_MAX_BUFFERS];
+        unsigned int num_slots;
+        unsigned int granted;           // sum of the client depths
+        int listen_fd;
+        struct vc_fanout_client_state clients[VC_FANOUT_MAX_CLIENTS];
+        uint64_t frames;
+        uint64_t dropped;               // no free memfd slot
+};
+
+static volatile sig_atomic_t stop;
+static volatile sig_atomic_t print_stats;
+
+static void vc_handle_signal(int sig)
+{
+        if (sig == SIGUSR1)
+                print_stats = 1;
+        else
+                stop = 1;
+}
+
+static void usage(const char *argv0)
+{
+        fprintf(stderr,
+                "Usage: %s [OPTIONS]\n"
+                "\n"
+                "  -d, --device <dev>     Video device or replay:<file> (default: /dev/video0)\n"
+                "  -S, --socket <path>    Socket path (default: " VC_FANOUT_SOCKET_DEFAULT ")\n"
+                "  -b, --buffers <N>      Number of capture buffers (default: 12)\n"
+                "      --stats <s>        Print client statistics every s seconds, 0: on SIGUSR1 only (default: 5)\n"
+                "\n"
+                "  -c, --client           Run as client\n"
+                "      --name <name>      Client name (default: vc_fanout)\n"
+                "      --policy <policy>  drop or disconnect (default: drop)\n"
+                "      --depth <N>        Frames held at the same time (default: 2)\n"
+                "      --hold-ms <ms>     Time each frame is held, simulates a slow consumer (default: 0)\n"
+                "  -n, --frames <N>       Client: stop after N frames (default: run until Ctrl-C)\n",
+                argv0);
+        exit(1);
+}
+
+// --- Server ------------------------------------------------------------------
+
+static int vc_fanout_listen(const char *path)
+{
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        int fd;
+
+        fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+                return -errno;
+
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+        unlink(path);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, VC_FANOUT_MAX_CLIENTS) < 0) {
+                int ret = -errno;
+
+                close(fd);
+                return ret;
+        }
+        return fd;
+}
+
+// DMABUF export of the capture buffers, memfd buffers for replay
+static int vc_fanout_setup_slots(struct vc_fanout_server *server, unsigned int buffers)
+{
+        int fds[VC_CAPTURE_MAX_BUFFERS];
+        size_t lengths[VC_CAPTURE_MAX_BUFFERS];
+        unsigned int i;
+        int ret;
+
+        ret = vc_capture_export(server->cap, fds, lengths, VC_CAPTURE_MAX_BUFFERS);
+        if (ret > 0) {
+                server->dmabuf = true;
+                server->num_slots = ret;
+                for (i = 0; i < server->num_slots; i++) {
+                        server->slots[i].fd = fds[i];
+                        server->slots[i].length = lengths[i];
+                }
+                return 0;
+        }
+        if (ret != -ENOTSUP)
+                return ret;
+
+        server->num_slots = buffers;
+        for (i = 0; i < server->num_slots; i++) {
+                struct vc_fanout_slot *slot = &server->slots[i];
+
+                slot->length = server->fmt.sizeimage;
+                slot->fd = memfd_create("vc_fanout", MFD_CLOEXEC);
+                if (slot->fd < 0 || ftruncate(slot->fd, slot->length) < 0)
+                        return -errno;
+                slot->map = mmap(NULL, slot->length, PROT_READ | PROT_WRITE, MAP_SHARED, slot->fd, 0);
+                if (slot->map == MAP_FAILED) {
+                        slot->map = NULL;
+                        return -errno;
+                }
+        }
+        return 0;
+}
+
+static void vc_fanout_free_slots(struct vc_fanout_server *server)
+{
+        unsigned int i;
+
+        for (i = 0; i < server->num_slots; i++) {
+                struct vc_fanout_slot *slot = &server->slots[i];
+
+                if (slot->captured)
+                        vc_capture_release(server->cap, &slot->frame);
+                if (slot->map)
+                        munmap(slot->map, slot->length);
+                if (slot->fd >= 0)
+                        close(slot->fd);
+        }
+        server->num_slots = 0;
+}
+
+static void vc_fanout_unref(struct vc_fanout_server *server, unsigned int index)
+{
+        struct vc_fanout_slot *slot = &server->slots[index];
+
+        if (--slot->refs == 0 && slot->captured) {
+                vc_capture_release(server->cap, &slot->frame);
+                slot->captured = false;
+        }
+}
+
+static void vc_fanout_remove_client(struct vc_fanout_server *server, struct vc_fanout_client_state *client)
+{
+        unsigned int i;
+
+        for (i = 0; i < server->num_slots; i++) {
+                while (client->refs[i]) {
+                        client->refs[i]--;
+                        vc_fanout_unref(server, i);
+                }
+        }
+        if (client->subscribed) {
+                server->granted -= client->depth;
+                fprintf(stderr, "Client %s disconnected\n", client->name);
+        }
+        close(client->sock);
+        client->sock = -1;
+        client->subscribed = false;
+}
+
+static void vc_fanout_subscribe(struct vc_fanout_server *server, struct vc_fanout_client_state *client,
+                                const struct vc_fanout_msg *request)
+{
+        struct vc_fanout_msg msg = { .type = VC_FANOUT_MSG_SETUP };
+        unsigned int available = server->num_slots - VC_FANOUT_RESERVE - server->granted;
+        int fds[VC_CAPTURE_MAX_BUFFERS];
+        unsigned int i;
+
+        if (server->granted + VC_FANOUT_RESERVE >= server->num_slots)
+                available = 0;
+
+        snprintf(client->name, sizeof(client->name), "%.*s", VC_FANOUT_NAME_LEN - 1, request->subscribe.name);
+        client->policy = request->subscribe.policy;
+        client->depth = request->subscribe.depth ? request->subscribe.depth : 1;
+        if (client->depth > available)
+                client->depth = available;
+
+        msg.setup.format = server->fmt;
+        msg.setup.num_buffers = server->num_slots;
+        msg.setup.depth = client->depth;
+        msg.setup.dmabuf = server->dmabuf;
+        for (i = 0; i < server->num_slots; i++) {
+                fds[i] = server->slots[i].fd;
+                msg.setup.lengths[i] = server->slots[i].length;
+        }
+
+        if (vc_fanout_send(client->sock, &msg, fds, server->num_slots) < 0 || !client->depth) {
+                fprintf(stderr, "Client %s rejected, no buffers left\n", client->name);
+                vc_fanout_remove_client(server, client);
+                return;
+        }
+
+        client->subscribed = true;
+        server->granted += client->depth;
+        fprintf(stderr, "Client %s subscribed, depth %u, %s\n", client->name, client->depth,
+                client->policy == VC_FANOUT_POLICY_DISCONNECT ? "disconnect" : "drop");
+}
+
+static void vc_fanout_handle_client(struct vc_fanout_server *server, struct vc_fanout_client_state *client)
+{
+        struct vc_fanout_msg msg;
+        int ret;
+
+        while ((ret = vc_fanout_recv(client->sock, &msg, NULL, NULL)) == 0) {
+                if (msg.type == VC_FANOUT_MSG_SUBSCRIBE && !client->subscribed) {
+                        vc_fanout_subscribe(server, client, &msg);
+                        if (client->sock < 0)
+                                return;
+                } else if (msg.type == VC_FANOUT_MSG_RELEASE && msg.release.index < server->num_slots &&
+                           client->refs[msg.release.index]) {
+                        struct vc_fanout_slot *slot = &server->slots[msg.release.index];
+                        uint64_t now = vc_clock_ns(CLOCK_MONOTONIC);
+
+                        if (now >= slot->frame.timestamp_ns)
+                                vc_hist_add(&client->lag, now - slot->frame.timestamp_ns);
+                        client->refs[msg.release.index]--;
+                        client->held--;
+                        vc_fanout_unref(server, msg.release.index);
+                }
+        }
+        if (ret != -EAGAIN)
+                vc_fanout_remove_client(server, client);
+}
+
+static void vc_fanout_accept(struct vc_fanout_server *server)
+{
+        unsigned int i;
+        int fd;
+
+        while ((fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                for (i = 0; i < VC_FANOUT_MAX_CLIENTS; i++) {
+                        struct vc_fanout_client_state *client = &server->clients[i];
+
+                        if (client->sock >= 0)
+                                continue;
+                        memset(client, 0, sizeof(*client));
+                        client->sock = fd;
+                        vc_hist_reset(&client->lag);
+                        break;
+                }
+                if (i == VC_FANOUT_MAX_CLIENTS) {
+                        fprintf(stderr, "Too many clients\n");
+                        close(fd);
+                }
+        }
+}
+
+// Returns the slot that holds the frame or -1 if it was dropped
+static int vc_fanout_store(struct vc_fanout_server *server, struct vc_frame *frame)
+{
+        struct vc_fanout_slot *slot;
+        unsigned int i;
+
+        if (server->dmabuf) {
+                slot = &server->slots[frame->index];
+                slot->frame = *frame;
+                slot->captured = true;
+                return frame->index;
+        }
+
+        // One copy for all clients
+        for (i = 0; i < server->num_slots; i++) {
+                slot = &server->slots[i];
+                if (slot->refs)
+                        continue;
+                slot->frame = *frame;
+                slot->frame.bytesused = frame->bytesused < slot->length ? frame->bytesused : slot->length;
+                memcpy(slot->map, frame->data, slot->frame.bytesused);
+                vc_capture_release(server->cap, frame);
+                return i;
+        }
+
+        server->dropped++;
+        vc_capture_release(server->cap, frame);
+        return -1;
+}
+
+static void vc_fanout_distribute(struct vc_fanout_server *server, struct vc_frame *frame)
+{
+        struct vc_fanout_msg msg = { .type = VC_FANOUT_MSG_FRAME };
+        struct vc_fanout_slot *slot;
+        unsigned int i;
+        int index;
+
+        server->frames++;
+        index = vc_fanout_store(server, frame);
+        if (index < 0)
+                return;
+        slot = &server->slots[index];
+
+        msg.frame.index = index;
+        msg.frame.sequence = frame->sequence;
+        msg.frame.timestamp_ns = frame->timestamp_ns;
+        msg.frame.bytesused = slot->frame.bytesused;
+        msg.frame.flags = frame->flags;
+        msg.frame.ctrls = frame->ctrls;
+
+        // Keeps the slot until all clients have their message
+        slot->refs++;
+        for (i = 0; i < VC_FANOUT_MAX_CLIENTS; i++) {
+                struct vc_fanout_client_state *client = &server->clients[i];
+
+                if (client->sock < 0 || !client->subscribed)
+                        continue;
+
+                if (client->held >= client->depth || vc_fanout_send(client->sock, &msg, NULL, 0) < 0) {
+                        client->dropped++;
+                        if (client->policy == VC_FANOUT_POLICY_DISCONNECT) {
+                                fprintf(stderr, "Client %s fell behind\n", client->name);
+                                vc_fanout_remove_client(server, client);
+                        }
+                        continue;
+                }
+                client->sent++;
+                client->held++;
+                client->refs[index]++;
+                slot->refs++;
+        }
+        vc_fanout_unref(server, index);
+}
+
+static void vc_fanout_print_stats(struct vc_fanout_server *server)
+{
+        unsigned int i;
+
+        printf("%" PRIu64 " frames, %" PRIu64 " dropped without free buffer, %s\n", server->frames,
+               server->dropped, server->dmabuf ? "DMABUF" : "memfd");
+        for (i = 0; i < VC_FANOUT_MAX_CLIENTS; i++) {
+                struct vc_fanout_client_state *client = &server->clients[i];
+
+                if (client->sock < 0 || !client->subscribed)
+                        continue;
+                printf("  %-16s sent %8" PRIu64 "  dropped %6" PRIu64 "  held %u/%u  lag p50 %7.2f ms  p99 %7.2f ms  max %7.2f ms\n",
+                       client->name, client->sent, client->dropped, client->held, client->depth,
+                       vc_hist_percentile(&client->lag, 50) / 1e6, vc_hist_percentile(&client->lag, 99) / 1e6,
+                       client->lag.max / 1e6);
+        }
+        fflush(stdout);
+}
+
+static int vc_fanout_serve(const char *device, const char *path, unsigned int buffers, unsigned int stats_s)
+{
+        struct vc_fanout_server server = { .listen_fd = -1 };
+        struct pollfd pfds[VC_FANOUT_MAX_CLIENTS + 2];
+        struct vc_fanout_client_state *polled[VC_FANOUT_MAX_CLIENTS];
+        uint64_t last_stats = vc_clock_ns(CLOCK_MONOTONIC);
+        struct vc_frame frame;
+        unsigned int i, n;
+        int cap_fd, ret, status = 0;
+
+        for (i = 0; i < VC_FANOUT_MAX_CLIENTS; i++)
+                server.clients[i].sock = -1;
+        for (i = 0; i < VC_CAPTURE_MAX_BUFFERS; i++)
+                server.slots[i].fd = -1;
+
+        server.cap = vc_capture_open(device, NULL, buffers);
+        if (!server.cap) {
+                fprintf(stderr, "Failed to open %s: %s\n", device, strerror(errno));
+                return 1;
+        }
+        vc_capture_get_format(server.cap, &server.fmt);
+        cap_fd = vc_capture_fd(server.cap);
+
+        ret = vc_fanout_setup_slots(&server, buffers);
+        if (ret < 0) {
+                fprintf(stderr, "Failed to set up the shared buffers: %s\n", strerror(-ret));
+                status = 1;
+                goto out;
+        }
+
+        server.listen_fd = vc_fanout_listen(path);
+        if (server.listen_fd < 0) {
+                fprintf(stderr, "Failed to listen on %s: %s\n", path, strerror(-server.listen_fd));
+                status = 1;
+                goto out;
+        }
+
+        ret = vc_capture_start(server.cap);
+        if (ret < 0) {
+                fprintf(stderr, "Failed to start streaming: %s\n", strerror(-ret));
+                status = 1;
+                goto out;
+        }
+        fprintf(stderr, "Serving %ux%u from %s on %s, %u %s buffers\n", server.fmt.width, server.fmt.height,
+                device, path, server.num_slots, server.dmabuf ? "DMABUF" : "memfd");
+
+        while (!stop) {
+                n = 0;
+                pfds[n++] = (struct pollfd){ .fd = server.listen_fd, .events = POLLIN };
+                for (i = 0; i < VC_FANOUT_MAX_CLIENTS; i++) {
+                        if (server.clients[i].sock < 0)
+                                continue;
+                        polled[n - 1] = &server.clients[i];
+                        pfds[n++] = (struct pollfd){ .fd = server.clients[i].sock, .events = POLLIN };
+                }
+                if (cap_fd >= 0)
+                        pfds[n++] = (struct pollfd){ .fd = cap_fd, .events = POLLIN };
+
+                // Replay has no fd to wait on, it is polled every millisecond
+                ret = poll(pfds, n, cap_fd >= 0 ? 1000 : 1);
+                if (ret < 0 && errno != EINTR) {
+                        status = 1;
+                        break;
+                }
+
+                if (pfds[0].revents & POLLIN)
+                        vc_fanout_accept(&server);
+                for (i = 1; i < n - (cap_fd >= 0); i++) {
+                        if (pfds[i].revents && polled[i - 1]->sock >= 0)
+                                vc_fanout_handle_client(&server, polled[i - 1]);
+                }
+
+                while ((ret = vc_capture_dequeue(server.cap, &frame, 0)) == 0)
+                        vc_fanout_distribute(&server, &frame);
+                if (ret != -ETIMEDOUT && ret != -EAGAIN) {
+                        if (ret != -ENODATA)
+                                fprintf(stderr, "Failed to dequeue: %s\n", strerror(-ret));
+                        break;
+                }
+
+                if (print_stats || (stats_s && vc_clock_ns(CLOCK_MONOTONIC) - last_stats >= stats_s * 1000000000ULL)) {
+                        vc_fanout_print_stats(&server);
+                        last_stats = vc_clock_ns(CLOCK_MONOTONIC);
+                        print_stats = 0;
+                }
+        }
+
+        vc_fanout_print_stats(&server);
+        for (i = 0; i < VC_FANOUT_MAX_CLIENTS; i++) {
+                if (server.clients[i].sock >= 0)
+                        vc_fanout_remove_client(&server, &server.clients[i]);
+        }
+        vc_capture_stop(server.cap);
+
+out:
+        if (server.listen_fd >= 0) {
+                close(server.listen_fd);
+                unlink(path);
+        }
+        vc_fanout_free_slots(&server);
+        vc_capture_close(server.cap);
+        return status;
+}
+
+// --- Client ------------------------------------------------------------------
+
+static int vc_fanout_run_client(const char *path, const char *name, enum vc_fanout_policy policy,
+                                unsigned int depth, unsigned int hold_ms, unsigned int frames)
+{
+        const struct vc_fanout_client_stats *stats;
+        struct vc_fanout_client *client;
+        uint64_t start = 0, last = 0;
+        struct vc_format fmt;
+        struct vc_frame frame;
+        unsigned int count = 0;
+        int ret, status = 0;
+
+        client = vc_fanout_connect(path, name, policy, depth);
+        if (!client) {
+                fprintf(stderr, "Failed to connect to %s: %s\n", path, strerror(errno));
+                return 1;
+        }
+        vc_fanout_get_format(client, &fmt);
+        stats = vc_fanout_get_stats(client);
+        fprintf(stderr, "Connected, %ux%u, depth %u\n", fmt.width, fmt.height, vc_fanout_get_depth(client));
+
+        while (!stop && (!frames || count < frames)) {
+                ret = vc_fanout_dequeue(client, &frame, 2000);
+                if (ret < 0) {
+                        fprintf(stderr, "Failed to dequeue: %s\n", strerror(-ret));
+                        status = ret == -ECONNRESET ? 0 : 1;
+                        break;
+                }
+                if (hold_ms)
+                        usleep(hold_ms * 1000);
+                vc_fanout_release(client, &frame);
+
+                last = frame.timestamp_ns;
+                if (!start)
+                        start = last;
+                count++;
+        }
+
+        printf("%s: %" PRIu64 " frames, %.2f fps, %" PRIu64 " missing, latency p50 %.2f ms, p99 %.2f ms\n",
+               name, stats->frames, count > 1 && last > start ? (count - 1) * 1e9 / (last - start) : 0.0,
+               stats->gaps, vc_hist_percentile(&stats->latency, 50) / 1e6,
+               vc_hist_percentile(&stats->latency, 99) / 1e6);
+
+        vc_fanout_disconnect(client);
+        return status;
+}
+
+int main(int argc, char *argv[])
+{
+        static const struct option options[] = {
+                { "device",  required_argument, NULL, 'd' },
+                { "socket",  required_argument, NULL, 'S' },
+                { "buffers", required_argument, NULL, 'b' },
+                { "stats",   required_argument, NULL, 's' },
+                { "client",  no_argument,       NULL, 'c' },
+                { "name",    required_argument, NULL, 'N' },
+                { "policy",  required_argument, NULL, 'p' },
+                { "depth",   required_argument, NULL, 'D' },
+                { "hold-ms", required_argument, NULL, 'H' },
+                { "frames",  required_argument, NULL, 'n' },
+                { "help",    no_argument,       NULL, 'h' },
+                { NULL, 0, NULL, 0 },
+        };
+        const char *device = "/dev/video0", *path = VC_FANOUT_SOCKET_DEFAULT, *name = "vc_fanout";
+        enum vc_fanout_policy policy = VC_FANOUT_POLICY_DROP;
+        unsigned int buffers = 12, stats_s = 5, depth = 2, hold_ms = 0, frames = 0;
+        bool client = false;
+        int opt;
+
+        while ((opt = getopt_long(argc, argv, "d:S:b:cn:h", options, NULL)) != -1) {
+                switch (opt) {
+                case 'd': device = optarg; break;
+                case 'S': path = optarg; break;
+                case 'b': buffers = strtoul(optarg, NULL, 0); break;
+                case 's': stats_s = strtoul(optarg, NULL, 0); break;
+                case 'c': client = true; break;
+                case 'N': name = optarg; break;
+                case 'p':
+                        if (!strcmp(optarg, "drop"))
+                                policy = VC_FANOUT_POLICY_DROP;
+                        else if (!strcmp(optarg, "disconnect"))
+                                policy = VC_FANOUT_POLICY_DISCONNECT;
+                        else
+                                usage(argv[0]);
+                        break;
+                case 'D': depth = strtoul(optarg, NULL, 0); break;
+                case 'H': hold_ms = strtoul(optarg, NULL, 0); break;
+                case 'n': frames = strtoul(optarg, NULL, 0); break;
+                default: usage(argv[0]);
+                }
+        }
+        if (buffers > VC_CAPTURE_MAX_BUFFERS)
+                buffers = VC_CAPTURE_MAX_BUFFERS;
+
+        signal(SIGINT, vc_handle_signal);
+        signal(SIGTERM, vc_handle_signal);
+        signal(SIGUSR1, vc_handle_signal);
+        signal(SIGPIPE, SIG_IGN);
+
+        if (client)
+                return vc_fanout_run_client(path, name, policy, depth, hold_ms, frames);
+        return vc_fanout_serve(device, path, buffers, stats_s);
+}
@@ -0,0 +1,628 @@
+// vc_fps_bench - Frame rate, jitter and drop benchmark across sensor modes
+//
+// Sweeps media bus code x binning mode x crop width x crop height x frame
+// rate. For every point the pipeline is configured with direct subdevice and
+// video node ioctls (no media-ctl / v4l2-ctl processes), a fixed number of
+// frames is captured and the buffer timestamps are evaluated:
+//
+//   - mean frame rate and frame interval p50 / p99 / max
+//   - dropped frames (gaps in the buffer sequence numbers)
+//   - time from VIDIOC_STREAMON to the first dequeued frame
+//
+// The result is written as JSON to compare driver versions and to catch
+// throughput regressions. The original sensor configuration is restored at
+// the end.
+//
+// Usage:
+//   vc_fps_bench [-d /dev/video0] [-s /dev/v4l-subdevX] [-c /dev/v4l-subdevY]
+//                [--codes RGGB10,0x300f] [--binning 0,1] [--widths halve]
+//                [--heights 1080,540,halve] [--fps 0,30,60] [-n 200] [-o result.json]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vc_capture.h"
+#include "vc_pixfmt.h"
+#include "vc_stats.h"
+#include "vc_v4l2.h"
+
+#define VC_BENCH_MAX_VALUES             64
+#define VC_BENCH_MIN_SIZE               8
+#define VC_BENCH_CSI2_SINK_PAD          0
+#define VC_BENCH_CSI2_SOURCE_PAD        4       // rp1-cfe csi2, see set_rpi5_pipeline
+
+struct vc_bench_list {
+        uint32_t values[VC_BENCH_MAX_VALUES];
+        unsigned int count;
+        bool halve;                     // full size, halved down to VC_BENCH_MIN_SIZE
+};
+
+struct vc_bench {
+        const char *device;
+        char subdev[64];
+        char csi2[64];
+        int subdev_fd;
+        int csi2_fd;
+        unsigned int frames;
+        unsigned int skip;
+        unsigned int buffers;
+
+        struct vc_bench_list codes;
+        struct vc_bench_list binning;
+        struct vc_bench_list widths;
+        struct vc_bench_list heights;
+        double fps[VC_BENCH_MAX_VALUES];
+        unsigned int fps_count;
+
+        FILE *out;
+        unsigned int points;
+        unsigned int failed;
+};
+
+struct vc_bench_result {
+        struct v4l2_mbus_framefmt mbus;
+        struct v4l2_rect crop;
+        struct vc_format fmt;
+        int32_t binning;
+        int32_t frame_rate;             // read back, mHz
+        unsigned int frames;
+        uint64_t dropped;
+        double fps;
+        struct vc_histogram interval;
+        double streamon_ms;             // VIDIOC_STREAMON to first dequeued frame
+        double first_timestamp_ms;      // VIDIOC_STREAMON to first frame timestamp
+        const char *error;
+};
+
+static volatile sig_atomic_t stop;
+
+static void vc_handle_signal(int sig)
+{
+        stop = 1;
+}
+
+static void usage(const char *argv0)
+{
+        fprintf(stderr,
+                "Usage: %s [OPTIONS]\n"
+                "\n"
+                "  -d, --device <dev>      Video device (default: /dev/video0)\n"
+                "  -s, --subdev <dev>      Sensor subdevice (auto-detected if omitted)\n"
+                "  -c, --csi2 <dev>        CSI-2 receiver subdevice (auto-detected, 'none' to skip)\n"
+                "      --codes <list>      Media bus codes or format names (default: all supported)\n"
+                "      --binning <list>    Binning modes (default: current)\n"
+                "      --widths <list>     Crop widths, 'halve' = full, full/2, ... (default: full)\n"
+                "      --heights <list>    Crop heights, 'halve' = full, full/2, ... (default: full)\n"
+                "      --fps <list>        Frame rates in fps, 0 = sensor maximum (default: current)\n"
+                "  -n, --frames <N>        Frames per point (default: 200)\n"
+                "      --skip <N>          Frames ignored after stream on (default: 2)\n"
+                "  -b, --buffers <N>       Number of capture buffers (default: 8)\n"
+                "  -o, --output <file>     JSON output (default: stdout)\n",
+                argv0);
+        exit(1);
+}
+
+// --- Option parsing ----------------------------------------------------------
+
+static int vc_parse_list(const char *arg, struct vc_bench_list *list, bool codes)
+{
+        char *copy, *token, *save = NULL;
+        int ret = 0;
+
+        copy = strdup(arg);
+        if (!copy)
+                return -ENOMEM;
+
+        for (token = strtok_r(copy, ",", &save); token; token = strtok_r(NULL, ",", &save)) {
+                const struct vc_pixfmt *pixfmt;
+                char *end;
+                uint32_t value;
+
+                if (!codes && strcmp(token, "halve") == 0) {
+                        list->halve = true;
+                        continue;
+                }
+                if (codes && (pixfmt = vc_pixfmt_from_name(token)) != NULL) {
+                        value = pixfmt->mbus_code;
+                } else {
+                        value = strtoul(token, &end, 0);
+                        if (*end != '\0') {
+                                fprintf(stderr, "Invalid value '%s'\n", token);
+                                ret = -EINVAL;
+                                break;
+                        }
+                }
+                if (list->count == VC_BENCH_MAX_VALUES) {
+                        ret = -E2BIG;
+                        break;
+                }
+                list->values[list->count++] = value;
+        }
+
+        free(copy);
+        return ret;
+}
+
+static int vc_parse_fps(const char *arg, struct vc_bench *bench)
+{
+        const char *p = arg;
+        char *end;
+
+        while (*p) {
+                if (bench->fps_count == VC_BENCH_MAX_VALUES)
+                        return -E2BIG;
+                bench->fps[bench->fps_count++] = strtod(p, &end);
+                if (end == p || (*end != ',' && *end != '\0'))
+                        return -EINVAL;
+                p = *end ? end + 1 : end;
+        }
+        return 0;
+}
+
+// Explicit sizes plus optionally full, full/2, ... down to VC_BENCH_MIN_SIZE
+static unsigned int vc_expand_sizes(const struct vc_bench_list *list, uint32_t full,
+                                    uint32_t *sizes)
+{
+        unsigned int i, count = 0;
+        uint32_t size;
+
+        for (i = 0; i < list->count && count < VC_BENCH_MAX_VALUES; i++)
+                sizes[count++] = list->values[i];
+        if (list->halve) {
+                for (size = full; size >= VC_BENCH_MIN_SIZE && count < VC_BENCH_MAX_VALUES; size /= 2)
+                        sizes[count++] = size;
+        }
+        if (count == 0)
+                sizes[count++] = full;
+
+        return count;
+}
+
+// --- Measurement -------------------------------------------------------------
+
+static int vc_bench_configure(struct vc_bench *bench, uint32_t code, uint32_t full_width, uint32_t full_height,
+                              uint32_t width, uint32_t height, double fps, struct vc_bench_result *res)
+{
+        const struct vc_pixfmt *pixfmt;
+        int ret;
+
+        memset(&res->mbus, 0, sizeof(res->mbus));
+        res->mbus.code = code;
+        res->mbus.width = width;
+        res->mbus.height = height;
+        res->mbus.field = V4L2_FIELD_NONE;
+        res->mbus.colorspace = V4L2_COLORSPACE_SRGB;
+
+        // S_FMT resets the crop origin, so the centred crop is applied after it.
+        // Even offsets keep the Bayer order.
+        ret = vc_subdev_set_fmt(bench->subdev_fd, 0, &res->mbus);
+        if (ret < 0) {
+                res->error = "sensor format";
+                return ret;
+        }
+
+        res->crop.left = width < full_width ? ((full_width - width) / 2) & ~1 : 0;
+        res->crop.top = height < full_height ? ((full_height - height) / 2) & ~1 : 0;
+        res->crop.width = width;
+        res->crop.height = height;
+        ret = vc_subdev_set_crop(bench->subdev_fd, 0, &res->crop);
+        if (ret < 0) {
+                res->error = "sensor crop";
+                return ret;
+        }
+        vc_subdev_get_fmt(bench->subdev_fd, 0, &res->mbus);
+
+        if (bench->csi2_fd >= 0) {
+                struct v4l2_mbus_framefmt csi2 = res->mbus;
+
+                ret = vc_subdev_set_fmt(bench->csi2_fd, VC_BENCH_CSI2_SINK_PAD, &csi2);
+                if (ret == 0) {
+                        csi2 = res->mbus;
+                        ret = vc_subdev_set_fmt(bench->csi2_fd, VC_BENCH_CSI2_SOURCE_PAD, &csi2);
+                }
+                if (ret < 0) {
+                        res->error = "csi2 format";
+                        return ret;
+                }
+        }
+
+        pixfmt = vc_pixfmt_from_mbus(res->mbus.code);
+        if (!pixfmt) {
+                res->error = "unknown media bus code";
+                return -EINVAL;
+        }
+        res->fmt.width = res->mbus.width;
+        res->fmt.height = res->mbus.height;
+        res->fmt.fourcc = pixfmt->fourcc;
+        ret = vc_capture_set_format(bench->device, &res->fmt);
+        if (ret < 0) {
+                res->error = "video format";
+                return ret;
+        }
+
+        if (fps >= 0.0) {
+                ret = vc_ctrl_set(bench->subdev_fd, V4L2_CID_VC_FRAME_RATE, (int32_t)(fps * 1000.0 + 0.5));
+                if (ret < 0) {
+                        res->error = "frame rate";
+                        return ret;
+                }
+        }
+        if (vc_ctrl_get(bench->subdev_fd, V4L2_CID_VC_FRAME_RATE, &res->frame_rate) < 0)
+                res->frame_rate = VC_CTRL_UNAVAILABLE;
+
+        return 0;
+}
+
+static int vc_bench_measure(struct vc_bench *bench, double fps, struct vc_bench_result *res)
+{
+        struct vc_capture *cap;
+        struct vc_frame frame;
+        uint64_t streamon_ns, first_ts = 0, last_ts = 0;
+        uint32_t last_seq = 0;
+        unsigned int received = 0;
+        int timeout_ms, ret;
+
+        // Generous timeout for slow frame rates, long exposures need more
+        timeout_ms = fps > 0.0 ? (int)(3000.0 / fps) + 1000 : 2000;
+
+        cap = vc_capture_open(bench->device, NULL, bench->buffers);
+        if (!cap) {
+                res->error = "open";
+                return -errno;
+        }
+
+        streamon_ns = vc_clock_ns(CLOCK_MONOTONIC);
+        ret = vc_capture_start(cap);
+        if (ret < 0) {
+                res->error = "stream on";
+                goto out;
+        }
+
+        while (!stop && received < bench->skip + bench->frames) {
+                ret = vc_capture_dequeue(cap, &frame, timeout_ms);
+                if (ret < 0) {
+                        res->error = ret == -ETIMEDOUT ? "timeout" : "dequeue";
+                        break;
+                }
+                vc_capture_release(cap, &frame);
+
+                if (received == 0) {
+                        res->streamon_ms = (vc_clock_ns(CLOCK_MONOTONIC) - streamon_ns) / 1e6;
+                        res->first_timestamp_ms = ((int64_t)frame.timestamp_ns - (int64_t)streamon_ns) / 1e6;
+                }
+
+                if (received >= bench->skip) {
+                        if (res->frames == 0) {
+                                first_ts = frame.timestamp_ns;
+                        } else {
+                                if (frame.timestamp_ns > last_ts)
+                                        vc_hist_add(&res->interval, frame.timestamp_ns - last_ts);
+                                if (frame.sequence > last_seq + 1)
+                                        res->dropped += frame.sequence - last_seq - 1;
+                        }
+                        last_ts = frame.timestamp_ns;
+                        last_seq = frame.sequence;
+                        res->frames++;
+                }
+                received++;
+        }
+
+        if (res->frames > 1 && last_ts > first_ts)
+                res->fps = (res->frames - 1) * 1e9 / (double)(last_ts - first_ts);
+
+        vc_capture_stop(cap);
+out:
+        vc_capture_close(cap);
+        return ret;
+}
+
+// --- Output ------------------------------------------------------------------
+
+static void vc_json_string(FILE *out, const char *str)
+{
+        fputc('"', out);
+        for (; *str; str++) {
+                if (*str == '"' || *str == '\\')
+                        fputc('\\', out);
+                if ((unsigned char)*str >= 0x20)
+                        fputc(*str, out);
+        }
+        fputc('"', out);
+}
+
+static void vc_bench_write_header(struct vc_bench *bench)
+{
+        char sensor[VC_SENSOR_NAME_LEN + 1] = "";
+        char version[64] = "";
+        struct utsname uts;
+        FILE *file;
+
+        vc_ctrl_get_string(bench->subdev_fd, V4L2_CID_VC_NAME, sensor, VC_SENSOR_NAME_LEN);
+        file = fopen("/sys/module/vc_mipi_camera/version", "r");
+        if (file) {
+                if (fgets(version, sizeof(version), file))
+                        version[strcspn(version, "\n")] = '\0';
+                fclose(file);
+        }
+        if (uname(&uts) < 0)
+                memset(&uts, 0, sizeof(uts));
+
+        fprintf(bench->out, "{\n  \"sensor\": ");
+        vc_json_string(bench->out, sensor);
+        fprintf(bench->out, ",\n  \"driver_version\": ");
+        vc_json_string(bench->out, version);
+        fprintf(bench->out, ",\n  \"kernel\": ");
+        vc_json_string(bench->out, uts.release);
+        fprintf(bench->out, ",\n  \"created_ns\": %" PRIu64 ",\n", vc_clock_ns(CLOCK_REALTIME));
+        fprintf(bench->out, "  \"video_device\": ");
+        vc_json_string(bench->out, bench->device);
+        fprintf(bench->out, ",\n  \"frames_per_point\": %u,\n  \"skip\": %u,\n  \"buffers\": %u,\n",
+                bench->frames, bench->skip, bench->buffers);
+        fprintf(bench->out, "  \"points\": [");
+}
+
+static void vc_bench_write_point(struct vc_bench *bench, double fps, const struct vc_bench_result *res)
+{
+        const struct vc_pixfmt *pixfmt = vc_pixfmt_from_mbus(res->mbus.code);
+        const struct vc_histogram *hist = &res->interval;
+        char fcc[5];
+
+        fprintf(bench->out, "%s\n    {\n", bench->points ? "," : "");
+        fprintf(bench->out, "      \"mbus_code\": \"0x%04x\",\n", res->mbus.code);
+        fprintf(bench->out, "      \"format\": \"%s\",\n", pixfmt ? pixfmt->name : "unknown");
+        fprintf(bench->out, "      \"fourcc\": \"%s\",\n", vc_fourcc_str(res->fmt.fourcc, fcc));
+        fprintf(bench->out, "      \"binning\": %d,\n", res->binning);
+        fprintf(bench->out, "      \"crop\": { \"left\": %d, \"top\": %d, \"width\": %u, \"height\": %u },\n",
+                res->crop.left, res->crop.top, res->crop.width, res->crop.height);
+        fprintf(bench->out, "      \"fps_requested\": %.3f,\n", fps);
+        if (res->frame_rate != VC_CTRL_UNAVAILABLE)
+                fprintf(bench->out, "      \"frame_rate_ctrl\": %d,\n", res->frame_rate);
+        fprintf(bench->out, "      \"frames\": %u,\n", res->frames);
+        fprintf(bench->out, "      \"dropped\": %" PRIu64 ",\n", res->dropped);
+        fprintf(bench->out, "      \"fps\": %.3f,\n", res->fps);
+        fprintf(bench->out, "      \"interval_us\": { \"mean\": %.1f, \"stddev\": %.1f, \"min\": %.1f, "
+                "\"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f },\n",
+                vc_hist_mean(hist) / 1e3, vc_hist_stddev(hist) / 1e3,
+                hist->count ? hist->min / 1e3 : 0.0,
+                vc_hist_percentile(hist, 50) / 1e3, vc_hist_percentile(hist, 99) / 1e3,
+                hist->count ? hist->max / 1e3 : 0.0);
+        fprintf(bench->out, "      \"streamon_to_first_frame_ms\": %.3f,\n", res->streamon_ms);
+        fprintf(bench->out, "      \"streamon_to_first_timestamp_ms\": %.3f,\n", res->first_timestamp_ms);
+        fprintf(bench->out, "      \"error\": ");
+        if (res->error)
+                vc_json_string(bench->out, res->error);
+        else
+                fprintf(bench->out, "null");
+        fprintf(bench->out, "\n    }");
+        fflush(bench->out);
+
+        bench->points++;
+        if (res->error)
+                bench->failed++;
+}
+
+static void vc_bench_run_point(struct vc_bench *bench, uint32_t code, int32_t binning,
+                               uint32_t full_width, uint32_t full_height,
+                               uint32_t width, uint32_t height, double fps)
+{
+        const struct vc_pixfmt *pixfmt = vc_pixfmt_from_mbus(code);
+        struct vc_bench_result res;
+        int ret;
+
+        memset(&res, 0, sizeof(res));
+        vc_hist_reset(&res.interval);
+        res.binning = binning;
+
+        ret = vc_bench_configure(bench, code, full_width, full_height, width, height, fps, &res);
+        if (ret == 0)
+                ret = vc_bench_measure(bench, fps, &res);
+
+        fprintf(stderr, "%-8s bin %d %5ux%-5u %7.2f fps req: ", pixfmt ? pixfmt->name : "?", binning,
+                res.crop.width, res.crop.height, fps < 0.0 ? 0.0 : fps);
+        if (res.error)
+                fprintf(stderr, "FAILED (%s: %s)\n", res.error, strerror(ret < 0 ? -ret : EIO));
+        else
+                fprintf(stderr, "%8.2f fps, interval p50 %.1f p99 %.1f max %.1f us, %" PRIu64 " dropped, first frame %.1f ms\n",
+                        res.fps, vc_hist_percentile(&res.interval, 50) / 1e3,
+                        vc_hist_percentile(&res.interval, 99) / 1e3, res.interval.max / 1e3,
+                        res.dropped, res.streamon_ms);
+
+        vc_bench_write_point(bench, fps, &res);
+}
+
+static void vc_bench_run(struct vc_bench *bench)
+{
+        uint32_t widths[VC_BENCH_MAX_VALUES], heights[VC_BENCH_MAX_VALUES];
+        unsigned int c, b, w, h, f, num_widths, num_heights;
+
+        for (c = 0; c < bench->codes.count && !stop; c++) {
+                for (b = 0; b < bench->binning.count && !stop; b++) {
+                        int32_t binning = bench->binning.values[b];
+                        uint32_t code = bench->codes.values[c];
+                        uint32_t full_width, full_height;
+
+                        if (binning >= 0 && vc_ctrl_set(bench->subdev_fd, V4L2_CID_VC_BINNING_MODE, binning) < 0) {
+                                fprintf(stderr, "Failed to set binning mode %d\n", binning);
+                                continue;
+                        }
+                        if (binning < 0 && vc_ctrl_get(bench->subdev_fd, V4L2_CID_VC_BINNING_MODE, &binning) < 0)
+                                binning = 0;
+
+                        if (vc_subdev_get_max_size(bench->subdev_fd, 0, code, &full_width, &full_height) < 0) {
+                                fprintf(stderr, "Media bus code 0x%04x not supported\n", code);
+                                continue;
+                        }
+
+                        num_widths = vc_expand_sizes(&bench->widths, full_width, widths);
+                        num_heights = vc_expand_sizes(&bench->heights, full_height, heights);
+
+                        for (w = 0; w < num_widths && !stop; w++)
+                                for (h = 0; h < num_heights && !stop; h++)
+                                        for (f = 0; f < bench->fps_count && !stop; f++)
+                                                vc_bench_run_point(bench, code, binning, full_width, full_height,
+                                                                   widths[w], heights[h], bench->fps[f]);
+                }
+        }
+}
+
+int main(int argc, char *argv[])
+{
+        static const struct option options[] = {
+                { "device",  required_argument, NULL, 'd' },
+                { "subdev",  required_argument, NULL, 's' },
+                { "csi2",    required_argument, NULL, 'c' },
+                { "codes",   required_argument, NULL, 'C' },
+                { "binning", required_argument, NULL, 'B' },
+                { "widths",  required_argument, NULL, 'W' },
+                { "heights", required_argument, NULL, 'H' },
+                { "fps",     required_argument, NULL, 'F' },
+                { "frames",  required_argument, NULL, 'n' },
+                { "skip",    required_argument, NULL, 'k' },
+                { "buffers", required_argument, NULL, 'b' },
+                { "output",  required_argument, NULL, 'o' },
+                { "help",    no_argument,       NULL, 'h' },
+                { NULL, 0, NULL, 0 },
+        };
+        struct vc_bench bench = {
+                .device = "/dev/video0",
+                .subdev_fd = -1,
+                .csi2_fd = -1,
+                .frames = 200,
+                .skip = 2,
+                .buffers = 8,
+        };
+        const char *output = NULL;
+        struct v4l2_mbus_framefmt orig_mbus;
+        struct v4l2_rect orig_crop;
+        struct vc_format orig_fmt = { 0 };
+        int32_t orig_binning, orig_frame_rate;
+        bool have_orig_binning, have_orig_frame_rate;
+        int opt, ret = 0;
+        uint32_t code;
+
+        while ((opt = getopt_long(argc, argv, "d:s:c:n:b:o:h", options, NULL)) != -1) {
+                switch (opt) {
+                case 'd': bench.device = optarg; break;
+                case 's': snprintf(bench.subdev, sizeof(bench.subdev), "%s", optarg); break;
+                case 'c': snprintf(bench.csi2, sizeof(bench.csi2), "%s", optarg); break;
+                case 'C': ret = vc_parse_list(optarg, &bench.codes, true); break;
+                case 'B': ret = vc_parse_list(optarg, &bench.binning, false); break;
+                case 'W': ret = vc_parse_list(optarg, &bench.widths, false); break;
+                case 'H': ret = vc_parse_list(optarg, &bench.heights, false); break;
+                case 'F': ret = vc_parse_fps(optarg, &bench); break;
+                case 'n': bench.frames = strtoul(optarg, NULL, 0); break;
+                case 'k': bench.skip = strtoul(optarg, NULL, 0); break;
+                case 'b': bench.buffers = strtoul(optarg, NULL, 0); break;
+                case 'o': output = optarg; break;
+                default: usage(argv[0]);
+                }
+                if (ret < 0)
+                        usage(argv[0]);
+        }
+        if (bench.frames < 2)
+                usage(argv[0]);
+
+        if (!bench.subdev[0] && vc_find_sensor_subdev(bench.subdev, sizeof(bench.subdev)) < 0) {
+                fprintf(stderr, "No vc_mipi_camera subdevice found, use --subdev\n");
+                return 1;
+        }
+        bench.subdev_fd = open(bench.subdev, O_RDWR | O_CLOEXEC);
+        if (bench.subdev_fd < 0) {
+                fprintf(stderr, "Failed to open %s: %s\n", bench.subdev, strerror(errno));
+                return 1;
+        }
+
+        // Only the Raspberry Pi 5 front end has a separate CSI-2 subdevice
+        if (!bench.csi2[0])
+                vc_find_subdev("csi2", bench.csi2, sizeof(bench.csi2));
+        if (bench.csi2[0] && strcmp(bench.csi2, "none") != 0) {
+                bench.csi2_fd = open(bench.csi2, O_RDWR | O_CLOEXEC);
+                if (bench.csi2_fd < 0) {
+                        fprintf(stderr, "Failed to open %s: %s\n", bench.csi2, strerror(errno));
+                        close(bench.subdev_fd);
+                        return 1;
+                }
+        }
+
+        if (bench.codes.count == 0) {
+                while (bench.codes.count < VC_BENCH_MAX_VALUES &&
+                       vc_subdev_enum_mbus_code(bench.subdev_fd, 0, bench.codes.count, &code) == 0)
+                        bench.codes.values[bench.codes.count++] = code;
+        }
+        if (bench.binning.count == 0) {
+                bench.binning.values[0] = (uint32_t)-1;         // keep current
+                bench.binning.count = 1;
+        }
+        if (bench.fps_count == 0)
+                bench.fps[bench.fps_count++] = -1.0;            // keep current
+
+        // Remember the configuration to restore it afterwards
+        if (vc_subdev_get_fmt(bench.subdev_fd, 0, &orig_mbus) < 0 ||
+            vc_subdev_get_crop(bench.subdev_fd, 0, &orig_crop) < 0) {
+                fprintf(stderr, "Failed to read the sensor format from %s\n", bench.subdev);
+                ret = -EIO;
+                goto out_close;
+        }
+        have_orig_binning = vc_ctrl_get(bench.subdev_fd, V4L2_CID_VC_BINNING_MODE, &orig_binning) == 0;
+        have_orig_frame_rate = vc_ctrl_get(bench.subdev_fd, V4L2_CID_VC_FRAME_RATE, &orig_frame_rate) == 0;
+        {
+                struct vc_capture *cap = vc_capture_open(bench.device, NULL, 1);
+
+                if (cap) {
+                        vc_capture_get_format(cap, &orig_fmt);
+                        vc_capture_close(cap);
+                }
+        }
+
+        bench.out = output ? fopen(output, "w") : stdout;
+        if (!bench.out) {
+                fprintf(stderr, "Failed to create %s: %s\n", output, strerror(errno));
+                ret = -errno;
+                goto out_close;
+        }
+
+        signal(SIGINT, vc_handle_signal);
+        signal(SIGTERM, vc_handle_signal);
+
+        vc_bench_write_header(&bench);
+        vc_bench_run(&bench);
+        fprintf(bench.out, "\n  ],\n  \"interrupted\": %s\n}\n", stop ? "true" : "false");
+
+        fprintf(stderr, "%u points, %u failed%s\n", bench.points, bench.failed, stop ? ", interrupted" : "");
+
+        // Restore, binning first as it changes the frame size
+        if (have_orig_binning)
+                vc_ctrl_set(bench.subdev_fd, V4L2_CID_VC_BINNING_MODE, orig_binning);
+        vc_subdev_set_fmt(bench.subdev_fd, 0, &orig_mbus);
+        vc_subdev_set_crop(bench.subdev_fd, 0, &orig_crop);
+        if (bench.csi2_fd >= 0) {
+                struct v4l2_mbus_framefmt csi2 = orig_mbus;
+
+                vc_subdev_set_fmt(bench.csi2_fd, VC_BENCH_CSI2_SINK_PAD, &csi2);
+                csi2 = orig_mbus;
+                vc_subdev_set_fmt(bench.csi2_fd, VC_BENCH_CSI2_SOURCE_PAD, &csi2);
+        }
+        if (orig_fmt.fourcc)
+                vc_capture_set_format(bench.device, &orig_fmt);
+        if (have_orig_frame_rate)
+                vc_ctrl_set(bench.subdev_fd, V4L2_CID_VC_FRAME_RATE, orig_frame_rate);
+
+        if (output && fclose(bench.out) != 0)
+                ret = -EIO;
+
+out_close:
+        if (bench.csi2_fd >= 0)
+                close(bench.csi2_fd);
+        close(bench.subdev_fd);
+
+        return ret < 0 || bench.failed ? 1 : 0;
+}
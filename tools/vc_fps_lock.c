@@ -0,0 +1,216 @@
+// vc_fps_lock - Locks the frame rate and phase of a free-running sensor to a
+// reference clock
+//
+// Several cameras on separate hosts whose system clocks are disciplined by
+// PTP sample at the same instants when they run with the same period and
+// phase, without trigger wiring. The frame starts are measured from the
+// buffer timestamps and the sensor's VBLANK (VMAX) and HBLANK (HMAX) are
+// nudged to remove the phase error, see lib/vc_servo.h.
+//
+// Usage:
+//   vc_fps_lock --fps 30 [--phase-us 0] [--clock realtime|tai|/dev/ptp0]
+//               [-d /dev/video0] [-s /dev/v4l-subdevX] [-n frames]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vc_capture.h"
+#include "vc_servo.h"
+#include "vc_stats.h"
+#include "vc_v4l2.h"
+
+static volatile sig_atomic_t stop;
+
+static void vc_handle_signal(int sig)
+{
+        stop = 1;
+}
+
+static void usage(const char *argv0)
+{
+        fprintf(stderr,
+                "Usage: %s --fps <fps> [OPTIONS]\n"
+                "\n"
+                "  -d, --device <dev>     Video device (default: /dev/video0)\n"
+                "  -s, --subdev <dev>     Sensor subdevice (auto-detected if omitted)\n"
+                "  -f, --fps <fps>        Target frame rate\n"
+                "      --phase-us <us>    Frame start offset within the period (default: 0)\n"
+                "      --clock <clock>    realtime, tai, monotonic or a PHC node (default: realtime)\n"
+                "      --kp <value>       Proportional gain (default: 0.1)\n"
+                "      --ki <value>       Integral gain (default: 0.01)\n"
+                "      --latency <N>      Frames until a VBLANK/HBLANK write is visible (default: 2)\n"
+                "      --lock-us <us>     Phase error limit for the locked state (default: 50)\n"
+                "  -n, --frames <N>       Stop after N frames (default: run until Ctrl-C)\n"
+                "  -b, --buffers <N>      Number of capture buffers (default: 4)\n"
+                "  -q, --quiet            Only print the summary\n",
+                argv0);
+        exit(1);
+}
+
+static void vc_print_status(const struct vc_servo_status *status)
+{
+        if (!status->calibrated) {
+                printf("calibrating...\n");
+                return;
+        }
+        printf("phase error %+9.1f us  drift %+7.2f ppm  vblank %5d  hblank %5d  %s\n",
+               status->phase_error_ns / 1e3, status->drift_ppm, status->vblank, status->hblank,
+               status->locked ? "LOCKED" : "unlocked");
+        fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+        static const struct option options[] = {
+                { "device",   required_argument, NULL, 'd' },
+                { "subdev",   required_argument, NULL, 's' },
+                { "fps",      required_argument, NULL, 'f' },
+                { "phase-us", required_argument, NULL, 'P' },
+                { "clock",    required_argument, NULL, 'C' },
+                { "kp",       required_argument, NULL, 'K' },
+                { "ki",       required_argument, NULL, 'I' },
+                { "latency",  required_argument, NULL, 'L' },
+                { "lock-us",  required_argument, NULL, 'l' },
+                { "frames",   required_argument, NULL, 'n' },
+                { "buffers",  required_argument, NULL, 'b' },
+                { "quiet",    no_argument,       NULL, 'q' },
+                { "help",     no_argument,       NULL, 'h' },
+                { NULL, 0, NULL, 0 },
+        };
+        struct vc_servo_params params = VC_SERVO_PARAMS_DEFAULT;
+        const struct vc_servo_status *status;
+        const char *device = "/dev/video0", *clock_name = "realtime";
+        char subdev[64] = "";
+        unsigned int buffers = 4, frames = 0, count = 0;
+        int32_t frame_rate = 0, vblank = 0, hblank = 0;
+        uint64_t last_print = 0;
+        double fps = 0;
+        bool quiet = false;
+        struct vc_servo *servo;
+        struct vc_capture *cap;
+        struct vc_frame frame;
+        int clock_fd, fd, opt, ret, status_code = 0;
+
+        while ((opt = getopt_long(argc, argv, "d:s:f:n:b:qh", options, NULL)) != -1) {
+                switch (opt) {
+                case 'd': device = optarg; break;
+                case 's': snprintf(subdev, sizeof(subdev), "%s", optarg); break;
+                case 'f': fps = strtod(optarg, NULL); break;
+                case 'P': params.phase_ns = (uint64_t)(strtod(optarg, NULL) * 1e3); break;
+                case 'C': clock_name = optarg; break;
+                case 'K': params.kp = strtod(optarg, NULL); break;
+                case 'I': params.ki = strtod(optarg, NULL); break;
+                case 'L': params.latency = strtoul(optarg, NULL, 0); break;
+                case 'l': params.lock_ns = (uint64_t)(strtod(optarg, NULL) * 1e3); break;
+                case 'n': frames = strtoul(optarg, NULL, 0); break;
+                case 'b': buffers = strtoul(optarg, NULL, 0); break;
+                case 'q': quiet = true; break;
+                default: usage(argv[0]);
+                }
+        }
+        if (fps <= 0)
+                usage(argv[0]);
+        params.period_ns = llround(1e9 / fps);
+        params.phase_ns %= params.period_ns;
+
+        ret = vc_servo_open_clock(clock_name, &params.clock, &clock_fd);
+        if (ret < 0) {
+                fprintf(stderr, "Failed to open clock %s: %s\n", clock_name, strerror(-ret));
+                return 1;
+        }
+
+        if (!subdev[0] && vc_find_sensor_subdev(subdev, sizeof(subdev)) < 0) {
+                fprintf(stderr, "No vc_mipi_camera subdevice found, use --subdev\n");
+                return 1;
+        }
+        fd = open(subdev, O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+                fprintf(stderr, "Failed to open %s: %s\n", subdev, strerror(errno));
+                return 1;
+        }
+
+        // Restored at the end. The frame rate control gives the servo a
+        // VMAX close to the target to start from.
+        vc_ctrl_get(fd, V4L2_CID_VC_FRAME_RATE, &frame_rate);
+        vc_ctrl_get(fd, V4L2_CID_VBLANK, &vblank);
+        vc_ctrl_get(fd, V4L2_CID_HBLANK, &hblank);
+        ret = vc_ctrl_set(fd, V4L2_CID_VC_FRAME_RATE, (int32_t)llround(fps * 1000));
+        if (ret < 0)
+                fprintf(stderr, "Failed to set the frame rate: %s\n", strerror(-ret));
+
+        cap = vc_capture_open(device, NULL, buffers);
+        if (!cap) {
+                fprintf(stderr, "Failed to open %s: %s\n", device, strerror(errno));
+                status_code = 1;
+                goto out_fd;
+        }
+
+        signal(SIGINT, vc_handle_signal);
+        signal(SIGTERM, vc_handle_signal);
+
+        ret = vc_capture_start(cap);
+        if (ret < 0) {
+                fprintf(stderr, "Failed to start streaming: %s\n", strerror(-ret));
+                status_code = 1;
+                goto out_cap;
+        }
+
+        // The blanking is only final after stream on (link rate, HMAX)
+        servo = vc_servo_create(fd, &params);
+        if (!servo) {
+                fprintf(stderr, "Failed to set up the servo: %s\n", strerror(errno));
+                vc_capture_stop(cap);
+                status_code = 1;
+                goto out_cap;
+        }
+        status = vc_servo_get_status(servo);
+
+        while (!stop && (!frames || count < frames)) {
+                ret = vc_capture_dequeue(cap, &frame, 2000);
+                if (ret < 0) {
+                        fprintf(stderr, "Failed to dequeue: %s\n", strerror(-ret));
+                        status_code = 1;
+                        break;
+                }
+                vc_servo_process(servo, &frame);
+                vc_capture_release(cap, &frame);
+                count++;
+
+                if (!quiet && frame.timestamp_ns - last_print >= 1000000000ULL) {
+                        vc_print_status(status);
+                        last_print = frame.timestamp_ns;
+                }
+        }
+
+        vc_capture_stop(cap);
+
+        printf("%u frames, %s, %u lock losses, drift %+.2f ppm, %u writes (%u failed)\n",
+               status->frames, status->locked ? "locked" : "not locked", status->lock_losses,
+               status->drift_ppm, status->writes, status->write_errors);
+        if (status->locked_error.count)
+                printf("Phase error while locked: mean %.1f us, p99 %.1f us, max %.1f us\n",
+                       vc_hist_mean(&status->locked_error) / 1e3,
+                       vc_hist_percentile(&status->locked_error, 99) / 1e3,
+                       status->locked_error.max / 1e3);
+
+        vc_servo_destroy(servo);
+out_cap:
+        vc_capture_close(cap);
+out_fd:
+        vc_ctrl_set(fd, V4L2_CID_HBLANK, hblank);
+        vc_ctrl_set(fd, V4L2_CID_VBLANK, vblank);
+        vc_ctrl_set(fd, V4L2_CID_VC_FRAME_RATE, frame_rate);
+        close(fd);
+        if (clock_fd >= 0)
+                close(clock_fd);
+
+        return status_code;
+}
@@ -0,0 +1,517 @@
+// vc_pipeline - Configure the media pipeline of VC MIPI cameras
+//
+// Native replacement for set_rpi*_pipeline. The media graph is read once
+// with MEDIA_IOC_G_TOPOLOGY and formats and links are set with direct
+// ioctls, so a camera is ready within milliseconds after boot or hotplug.
+// The same steps are applied on all platforms:
+//
+//   1. reset all links (media-ctl -r)
+//   2. apply the preferred format stored by vc-config in
+//      /etc/vc-mipi/formats.d/<entity>.conf, if the sensor supports it
+//   3. Raspberry Pi 5: set the csi2 sink / source formats and link
+//      csi2 -> rp1-cfe-csi2_ch0, otherwise link sensor -> unicam-image
+//   4. set the video node format and capture a few test frames
+//
+// Usage:
+//   vc_pipeline                      all cameras
+//   vc_pipeline v4l-subdev2          one camera (as called from udev)
+//   vc_pipeline /dev/v4l-subdev2 /dev/video0
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vc_capture.h"
+#include "vc_media.h"
+#include "vc_pixfmt.h"
+#include "vc_stats.h"
+#include "vc_v4l2.h"
+
+#define VC_PIPELINE_CONFIG_DIR          "/etc/vc-mipi/formats.d"
+#define VC_PIPELINE_TEST_TIMEOUT_MS     5000
+#define VC_PIPELINE_MAX_MEDIA           16
+
+struct vc_pipeline_opts {
+        const char *frontend;
+        unsigned int test_frames;
+        int quiet;
+};
+
+struct vc_preferred {
+        char subdev[32];                // preferred_pixelformat_subdev, e.g. "SRGGB10"
+        char videodev[8];               // preferred_pixelformat_videodev, e.g. "pRAA"
+};
+
+static void usage(const char *argv0)
+{
+        fprintf(stderr,
+                "Usage: %s [OPTIONS] [subdev [videodev]]\n"
+                "\n"
+                "  -f, --frontend <name>  Receiver entity (default: rp1-cfe-csi2_ch0 or unicam-image)\n"
+                "  -t, --test <N>         Test frames to capture, 0 = no test (default: 3)\n"
+                "  -q, --quiet            Only print errors\n",
+                argv0);
+        exit(1);
+}
+
+static int vc_is_vc_mipi_camera(const char *devnode)
+{
+        char path[128], name[64] = "";
+        const char *base = strrchr(devnode, '/');
+        FILE *file;
+
+        snprintf(path, sizeof(path), "/sys/class/video4linux/%s/name", base ? base + 1 : devnode);
+        file = fopen(path, "r");
+        if (!file)
+                return 0;
+        if (!fgets(name, sizeof(name), file))
+                name[0] = '\0';
+        fclose(file);
+
+        return strstr(name, "vc_mipi_camera") || strstr(name, "vc-mipi-camera");
+}
+
+// --- Preferred format --------------------------------------------------------
+
+// Same file name as vc-config: the first two words of the entity name passed
+// through "tr -cs 'a-zA-Z0-9._-' '_' <<<$name", including the here-string's
+// trailing newline.
+static void vc_config_file_name(const char *entity, char *path, size_t len)
+{
+        char name[80], sanitized[80];
+        const char *p;
+        size_t n = 0, words = 0, i, out = 0;
+
+        for (p = entity; *p && words < 2 && n < sizeof(name) - 2; ) {
+                while (*p == ' ')
+                        p++;
+                if (!*p)
+                        break;
+                if (words)
+                        name[n++] = ' ';
+                while (*p && *p != ' ' && n < sizeof(name) - 2)
+                        name[n++] = *p++;
+                words++;
+        }
+        name[n++] = '\n';
+        name[n] = '\0';
+
+        for (i = 0; i < n && out < sizeof(sanitized) - 1; i++) {
+                char c = name[i];
+                bool keep = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                            (c >= '0' && c <= '9') || c == '.' || c == '_' || c == '-';
+
+                // tr -s squeezes every run of '_', replaced or not
+                if (!keep || c == '_') {
+                        if (out == 0 || sanitized[out - 1] != '_')
+                                sanitized[out++] = '_';
+                } else {
+                        sanitized[out++] = c;
+                }
+        }
+        sanitized[out] = '\0';
+
+        snprintf(path, len, "%s/%s.conf", VC_PIPELINE_CONFIG_DIR, sanitized);
+}
+
+static void vc_config_value(const char *line, const char *key, char *value, size_t len)
+{
+        size_t key_len = strlen(key), n;
+        const char *p;
+
+        if (strncmp(line, key, key_len) != 0 || line[key_len] != '=')
+                return;
+
+        p = line + key_len + 1;
+        if (*p == '"' || *p == '\'')
+                p++;
+        n = strcspn(p, "\"'\n");
+        if (n >= len)
+                n = len - 1;
+        memcpy(value, p, n);
+        value[n] = '\0';
+}
+
+static int vc_read_preferred(const char *entity, struct vc_preferred *pref)
+{
+        char path[160], line[160];
+        FILE *file;
+
+        memset(pref, 0, sizeof(*pref));
+        vc_config_file_name(entity, path, sizeof(path));
+
+        file = fopen(path, "r");
+        if (!file)
+                return -ENOENT;
+
+        while (fgets(line, sizeof(line), file)) {
+                vc_config_value(line, "preferred_pixelformat_subdev", pref->subdev, sizeof(pref->subdev));
+                vc_config_value(line, "preferred_pixelformat_videodev", pref->videodev, sizeof(pref->videodev));
+        }
+
+        fclose(file);
+        return 0;
+}
+
+// Accepts the short names used by vc-config and the pipeline scripts:
+// "RGGB10", "SRGGB10", "RGGB10P", "Y10P", ...
+static const struct vc_pixfmt *vc_pixfmt_from_short_name(const char *name)
+{
+        const struct vc_pixfmt *fmt;
+        char copy[32];
+        size_t len;
+
+        fmt = vc_pixfmt_from_name(name);
+        if (!fmt && name[0] == 'S')
+                fmt = vc_pixfmt_from_name(name + 1);
+        if (fmt)
+                return fmt;
+
+        snprintf(copy, sizeof(copy), "%s", name);
+        len = strlen(copy);
+        if (len > 1 && copy[len - 1] == 'P') {
+                copy[len - 1] = '\0';
+                return vc_pixfmt_from_short_name(copy);
+        }
+        return NULL;
+}
+
+static bool vc_subdev_supports(int fd, uint32_t code)
+{
+        uint32_t index, supported;
+
+        for (index = 0; vc_subdev_enum_mbus_code(fd, 0, index, &supported) == 0; index++) {
+                if (supported == code)
+                        return true;
+        }
+        return false;
+}
+
+static bool vc_video_supports(const char *device, uint32_t fourcc)
+{
+        struct v4l2_fmtdesc desc = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+        bool found = false;
+        int fd;
+
+        fd = open(device, O_RDWR | O_CLOEXEC);
+        if (fd < 0)
+                return false;
+
+        for (desc.index = 0; vc_xioctl(fd, VIDIOC_ENUM_FMT, &desc) == 0; desc.index++) {
+                if (desc.pixelformat == fourcc) {
+                        found = true;
+                        break;
+                }
+        }
+
+        close(fd);
+        return found;
+}
+
+static uint32_t vc_fourcc_from_string(const char *str)
+{
+        char fcc[4] = { ' ', ' ', ' ', ' ' };
+        size_t i;
+
+        for (i = 0; i < 4 && str[i]; i++)
+                fcc[i] = str[i];
+        return v4l2_fourcc(fcc[0], fcc[1], fcc[2], fcc[3]);
+}
+
+// --- Pipeline ----------------------------------------------------------------
+
+static int vc_test_stream(const char *video, unsigned int frames)
+{
+        struct vc_capture *cap;
+        struct vc_frame frame;
+        uint64_t deadline;
+        unsigned int received = 0;
+        int ret;
+
+        cap = vc_capture_open(video, NULL, 4);
+        if (!cap)
+                return -errno;
+
+        ret = vc_capture_start(cap);
+        deadline = vc_clock_ns(CLOCK_MONOTONIC) + VC_PIPELINE_TEST_TIMEOUT_MS * 1000000ULL;
+        while (ret == 0 && received < frames) {
+                int64_t left_ms = ((int64_t)deadline - (int64_t)vc_clock_ns(CLOCK_MONOTONIC)) / 1000000;
+
+                if (left_ms <= 0) {
+                        ret = -ETIMEDOUT;
+                        break;
+                }
+                ret = vc_capture_dequeue(cap, &frame, left_ms);
+                if (ret == 0) {
+                        vc_capture_release(cap, &frame);
+                        received++;
+                }
+        }
+
+        vc_capture_close(cap);
+        return ret;
+}
+
+static void vc_log_kmsg(const char *msg)
+{
+        int fd = open("/dev/kmsg", O_WRONLY | O_CLOEXEC);
+
+        if (fd < 0)
+                return;
+        // Best effort, like "echo ... > /dev/kmsg" in the scripts
+        (void)!write(fd, msg, strlen(msg));
+        close(fd);
+}
+
+static int vc_configure_camera(struct vc_media *media, const struct media_v2_entity *sensor,
+                               const char *video_arg, const struct vc_pipeline_opts *opts)
+{
+        const struct media_v2_entity *frontend = NULL;
+        const struct vc_pixfmt *pixfmt;
+        struct v4l2_mbus_framefmt sensor_fmt;
+        struct vc_preferred pref;
+        struct vc_format fmt;
+        char subdev[64], video[64];
+        uint64_t start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+        uint32_t source_code = 0, default_fourcc;
+        bool preferred = false;
+        int fd, ret;
+        char fcc[5];
+
+        ret = vc_media_entity_devnode(media, sensor->id, subdev, sizeof(subdev));
+        if (ret < 0) {
+                fprintf(stderr, "%s: no device node for '%s'\n", media->path, sensor->name);
+                return ret;
+        }
+
+        if (opts->frontend)
+                frontend = vc_media_find_entity(media, opts->frontend);
+        else
+                frontend = vc_media_find_frontend(media);
+        if (video_arg) {
+                snprintf(video, sizeof(video), "%s", video_arg);
+        } else if (!frontend || vc_media_entity_devnode(media, frontend->id, video, sizeof(video)) < 0) {
+                fprintf(stderr, "%s: no receiver video node found for %s\n", media->path, subdev);
+                return -ENODEV;
+        }
+        if (!frontend) {
+                frontend = vc_media_find_entity_by_devnode(media, video);
+                if (!frontend) {
+                        fprintf(stderr, "%s: %s is not part of this media device\n", media->path, video);
+                        return -ENODEV;
+                }
+        }
+
+        ret = vc_media_reset_links(media);
+        if (ret < 0) {
+                fprintf(stderr, "%s: failed to reset links: %s\n", media->path, strerror(-ret));
+                return ret;
+        }
+
+        fd = open(subdev, O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+                ret = -errno;
+                fprintf(stderr, "Failed to open %s: %s\n", subdev, strerror(errno));
+                return ret;
+        }
+
+        // Preferred sensor format, keeping the current resolution
+        if (vc_read_preferred(sensor->name, &pref) == 0 && pref.subdev[0]) {
+                pixfmt = vc_pixfmt_from_short_name(pref.subdev);
+                if (!pixfmt || !vc_subdev_supports(fd, pixfmt->mbus_code)) {
+                        fprintf(stderr, "Preferred format '%s' not supported by %s; keeping sensor default.\n",
+                                pref.subdev, subdev);
+                } else if (vc_subdev_get_fmt(fd, 0, &sensor_fmt) == 0) {
+                        sensor_fmt.code = pixfmt->mbus_code;
+                        preferred = vc_subdev_set_fmt(fd, 0, &sensor_fmt) == 0;
+                }
+        }
+
+        ret = vc_subdev_get_fmt(fd, 0, &sensor_fmt);
+        close(fd);
+        if (ret < 0) {
+                fprintf(stderr, "Failed to get the format of %s: %s\n", subdev, strerror(-ret));
+                return ret;
+        }
+
+        pixfmt = vc_pixfmt_from_mbus(sensor_fmt.code);
+        if (!pixfmt) {
+                fprintf(stderr, "Unknown mediabus code: 0x%04x\n", sensor_fmt.code);
+                return -EINVAL;
+        }
+        default_fourcc = pixfmt->fourcc;
+
+        fmt.width = sensor_fmt.width;
+        fmt.height = sensor_fmt.height;
+        fmt.fourcc = default_fourcc;
+        if (preferred && pref.videodev[0]) {
+                uint32_t fourcc = vc_fourcc_from_string(pref.videodev);
+
+                if (vc_video_supports(video, fourcc))
+                        fmt.fourcc = fourcc;
+                else
+                        fprintf(stderr, "Preferred video format '%s' not supported by %s; falling back.\n",
+                                pref.videodev, video);
+        }
+
+        if (fmt.fourcc != default_fourcc) {
+                const struct vc_pixfmt *out = vc_pixfmt_from_fourcc(fmt.fourcc, NULL);
+
+                if (out)
+                        source_code = out->mbus_code;
+        }
+        ret = vc_media_route_sensor(media, sensor->id, frontend->id, &sensor_fmt, source_code);
+        if (ret < 0) {
+                fprintf(stderr, "%s: failed to enable the links to '%s': %s\n", media->path, frontend->name,
+                        strerror(-ret));
+                return ret;
+        }
+
+        ret = vc_capture_set_format(video, &fmt);
+        if (ret < 0 && fmt.fourcc != default_fourcc) {
+                fprintf(stderr, "Failed to apply preferred pixelformat on %s; retrying with sensor default.\n",
+                        video);
+                fmt.width = sensor_fmt.width;
+                fmt.height = sensor_fmt.height;
+                fmt.fourcc = default_fourcc;
+                ret = vc_capture_set_format(video, &fmt);
+        }
+        if (ret < 0) {
+                fprintf(stderr, "Failed to configure %s with pixelformat '%s': %s\n", video,
+                        vc_fourcc_str(fmt.fourcc, fcc), strerror(-ret));
+                return ret;
+        }
+
+        if (!opts->quiet)
+                printf("%s: '%s' -> %s %ux%u %s (%s) in %.1f ms\n", media->path, sensor->name, video,
+                       fmt.width, fmt.height, vc_fourcc_str(fmt.fourcc, fcc), pixfmt->name,
+                       (vc_clock_ns(CLOCK_MONOTONIC) - start_ns) / 1e6);
+
+        if (opts->test_frames) {
+                ret = vc_test_stream(video, opts->test_frames);
+                if (ret < 0) {
+                        char msg[96];
+
+                        snprintf(msg, sizeof(msg), "No image recorded for %s\n", video);
+                        vc_log_kmsg(msg);
+                        fprintf(stderr, "%s", msg);
+                        // Configured, only the test failed like in the scripts
+                        return 0;
+                }
+        }
+
+        return 0;
+}
+
+static int vc_compare_names(const void *a, const void *b)
+{
+        return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int main(int argc, char *argv[])
+{
+        static const struct option options[] = {
+                { "frontend", required_argument, NULL, 'f' },
+                { "test",     required_argument, NULL, 't' },
+                { "quiet",    no_argument,       NULL, 'q' },
+                { "help",     no_argument,       NULL, 'h' },
+                { NULL, 0, NULL, 0 },
+        };
+        struct vc_pipeline_opts opts = { .test_frames = 3 };
+        char subdev[64] = "", *medias[VC_PIPELINE_MAX_MEDIA];
+        const char *video = NULL;
+        unsigned int num_medias = 0, configured = 0, failed = 0, i;
+        uint64_t start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+        struct dirent *entry;
+        DIR *dir;
+        int opt;
+
+        while ((opt = getopt_long(argc, argv, "f:t:qh", options, NULL)) != -1) {
+                switch (opt) {
+                case 'f': opts.frontend = optarg; break;
+                case 't': opts.test_frames = strtoul(optarg, NULL, 0); break;
+                case 'q': opts.quiet = 1; break;
+                default: usage(argv[0]);
+                }
+        }
+        if (argc - optind > 2)
+                usage(argv[0]);
+
+        if (optind < argc) {
+                if (strncmp(argv[optind], "/dev/", 5) == 0)
+                        snprintf(subdev, sizeof(subdev), "%s", argv[optind]);
+                else
+                        snprintf(subdev, sizeof(subdev), "/dev/%s", argv[optind]);
+                if (optind + 1 < argc)
+                        video = argv[optind + 1];
+
+                // udev calls this for every subdevice
+                if (!vc_is_vc_mipi_camera(subdev)) {
+                        if (!opts.quiet)
+                                printf("Device (%s) is not a vc_mipi_camera\n", subdev);
+                        return 0;
+                }
+        }
+
+        dir = opendir("/dev");
+        if (!dir) {
+                perror("/dev");
+                return 1;
+        }
+        while ((entry = readdir(dir)) != NULL && num_medias < VC_PIPELINE_MAX_MEDIA) {
+                if (strncmp(entry->d_name, "media", 5) != 0)
+                        continue;
+                char path[288];
+
+                snprintf(path, sizeof(path), "/dev/%s", entry->d_name);
+                medias[num_medias] = strdup(path);
+                if (medias[num_medias])
+                        num_medias++;
+        }
+        closedir(dir);
+        qsort(medias, num_medias, sizeof(medias[0]), vc_compare_names);
+
+        for (i = 0; i < num_medias; i++) {
+                struct vc_media *media = vc_media_open(medias[i]);
+                uint32_t e;
+
+                if (!media)
+                        continue;
+
+                for (e = 0; e < media->num_entities; e++) {
+                        const struct media_v2_entity *sensor = &media->entities[e];
+
+                        if (subdev[0]) {
+                                if (sensor != vc_media_find_entity_by_devnode(media, subdev))
+                                        continue;
+                        } else if (!strstr(sensor->name, "vc_mipi_camera") &&
+                                   !strstr(sensor->name, "vc-mipi-camera")) {
+                                continue;
+                        }
+
+                        if (vc_configure_camera(media, sensor, video, &opts) < 0)
+                                failed++;
+                        else
+                                configured++;
+                }
+                vc_media_close(media);
+        }
+
+        for (i = 0; i < num_medias; i++)
+                free(medias[i]);
+
+        if (!opts.quiet)
+                printf("%u camera(s) configured, %u failed, %.1f ms\n", configured, failed,
+                       (vc_clock_ns(CLOCK_MONOTONIC) - start_ns) / 1e6);
+
+        if (subdev[0] && configured == 0 && failed == 0)
+                fprintf(stderr, "No media device found for %s\n", subdev);
+
+        return failed || (subdev[0] && configured == 0) ? 1 : 0;
+}
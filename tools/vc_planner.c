@@ -0,0 +1,352 @@
+// vc_planner - Bandwidth and memory planner for one or two cameras
+//
+// Reads the modes of every sensor from the driver controls and prints the
+// CSI-2 bandwidth, ISP load and buffer memory of a requested configuration
+// (--format / --binning / --crop / --fps per camera, comma separated in the
+// order of the subdevices, or --current for the present sensor settings),
+// the configuration with the highest throughput
+// that fits all limits, and a CMA size for the contiguous memory overlay.
+//
+// Exit status: 0, 1 on errors, 2 if the requested configuration exceeds a
+// limit.
+//
+// Usage:
+//   vc_planner [-s /dev/v4l-subdev0 -s /dev/v4l-subdev2] [--format RGGB10,RGGB12]
+//              [--binning 0,0] [--crop 1920x1080,0x0] [--fps 60,30] [--isp]
+//   vc_planner --current [--isp]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vc_pixfmt.h"
+#include "vc_planner.h"
+#include "vc_v4l2.h"
+
+#define VC_MIB                          (1024.0 * 1024.0)
+
+struct vc_request {
+        const struct vc_pixfmt *pixfmt; // NULL: no request for this camera
+        int32_t binning;                // -1: any
+        uint32_t width;
+        uint32_t height;
+        double fps;
+};
+
+static void usage(const char *argv0)
+{
+        fprintf(stderr,
+                "Usage: %s [OPTIONS]\n"
+                "\n"
+                "  -s, --subdev <dev>      Sensor subdevice, twice for two cameras (default: all)\n"
+                "  -f, --format <list>     Requested format per camera, e.g. RGGB10,Y12\n"
+                "  -B, --binning <list>    Requested binning mode per camera (default: any)\n"
+                "  -r, --crop <list>       Crop per camera, WxH, 0x0 = full frame\n"
+                "  -F, --fps <list>        Frame rate per camera, 0 = maximum (caps the recommendation)\n"
+                "  -c, --current           Request the present settings of cameras without --format\n"
+                "  -b, --buffers <N>       Capture buffers per camera (default: 4)\n"
+                "  -i, --isp               Frames go through the ISP (libcamera)\n"
+                "  -u, --unpacked          16 bit buffers instead of CSI-2 packed ones\n"
+                "  -p, --platform <soc>    bcm2712, bcm2711, bcm2837 or rp3a0 (default: detected)\n"
+                "      --lane-rate <Mbps>  Bit rate per CSI-2 lane of the receiver\n"
+                "      --isp-rate <Mpix>   ISP throughput in Mpixel/s\n"
+                "      --cma <MiB>         Size of the CMA pool (default: CmaTotal)\n"
+                "  -m, --modes             List the modes of every sensor\n",
+                argv0);
+        exit(1);
+}
+
+// Splits a comma separated list, one value per camera
+static unsigned int vc_split(char *arg, char **values, unsigned int max)
+{
+        char *save = NULL, *token;
+        unsigned int count = 0;
+
+        for (token = strtok_r(arg, ",", &save); token && count < max; token = strtok_r(NULL, ",", &save))
+                values[count++] = token;
+        return count;
+}
+
+static void vc_print_modes(const char *subdev, const struct vc_planner_sensor *sensor)
+{
+        unsigned int i;
+
+        printf("%s (%s), %u modes\n", subdev, sensor->name[0] ? sensor->name : "?", sensor->count);
+        printf("  format   bin   width x height  lanes  Mbps/lane  Mpix/s  max fps\n");
+        for (i = 0; i < sensor->count; i++) {
+                const struct vc_planner_mode *mode = &sensor->modes[i];
+                const struct vc_pixfmt *pixfmt = vc_pixfmt_from_mbus(mode->code);
+
+                printf("  %-8s %3d  %6u x %-6u  %5u  %9.0f  %6.1f  %7.2f\n", pixfmt ? pixfmt->name : "?",
+                       mode->binning, mode->width, mode->height, mode->lanes, 2 * mode->link_freq / 1e6,
+                       mode->pixel_rate / 1e6, mode->max_fps);
+        }
+}
+
+static void vc_print_result(const char *title, const struct vc_planner_platform *platform,
+                            const struct vc_planner_params *params, const char subdevs[][64],
+                            const struct vc_planner_config *configs, const struct vc_planner_result *result)
+{
+        unsigned int i;
+        char limits[64];
+
+        printf("\n%s\n", title);
+        for (i = 0; i < result->count; i++) {
+                const struct vc_planner_config *config = &configs[i];
+                const struct vc_planner_load *load = &result->cameras[i];
+                const struct vc_pixfmt *pixfmt = vc_pixfmt_from_mbus(config->mode->code);
+
+                printf("  %s: %s bin %d %ux%u @ %.2f fps\n", subdevs[i], pixfmt ? pixfmt->name : "?",
+                       config->mode->binning, config->width ? config->width : config->mode->width,
+                       config->height ? config->height : config->mode->height, load->fps);
+                printf("    CSI-2   : %.1f Mbit/s on %u x %.0f Mbit/s lanes (%.0f %%)\n", load->payload_rate / 1e6,
+                       config->mode->lanes, load->lane_rate / 1e6, 100.0 * load->link_load);
+                printf("    Pixels  : %.1f Mpix/s, memory writes %.1f MiB/s\n", load->pixel_rate / 1e6,
+                       load->memory_rate / VC_MIB);
+                printf("    Buffers : %.1f MiB (%u x %.1f MiB%s)\n", load->buffer_bytes / VC_MIB, params->buffers,
+                       load->frame_bytes / VC_MIB, params->isp ? " + ISP output" : "");
+                if (load->limits)
+                        printf("    Exceeds : %s\n", vc_planner_limits_str(load->limits, limits, sizeof(limits)));
+        }
+        printf("  Total     : %.1f Mbit/s CSI-2, %.1f Mpix/s, %.1f MiB/s memory writes\n",
+               result->payload_rate / 1e6, result->pixel_rate / 1e6, result->memory_rate / VC_MIB);
+        if (params->isp)
+                printf("  ISP       : %.0f %% of %.0f Mpix/s\n", 100.0 * result->isp_load, platform->isp_rate / 1e6);
+        printf("  CMA       : %.0f MiB needed, %.0f MiB recommended", result->cma_needed / VC_MIB,
+               result->cma_recommended / VC_MIB);
+        if (platform->cma_total)
+                printf(" (pool %.0f MiB)", platform->cma_total / VC_MIB);
+        printf("\n  Limits    : %s\n", vc_planner_limits_str(result->limits, limits, sizeof(limits)));
+}
+
+// Present format, binning mode and frame rate of a sensor
+static int vc_read_current(int fd, struct vc_request *request)
+{
+        struct v4l2_mbus_framefmt fmt;
+        int32_t value;
+        int ret;
+
+        // The format is the output size, after crop and binning
+        ret = vc_subdev_get_fmt(fd, 0, &fmt);
+        if (ret < 0)
+                return ret;
+        request->pixfmt = vc_pixfmt_from_mbus(fmt.code);
+        if (!request->pixfmt)
+                return -EINVAL;
+        request->width = fmt.width;
+        request->height = fmt.height;
+        if (vc_ctrl_get(fd, V4L2_CID_VC_BINNING_MODE, &value) == 0)
+                request->binning = value;
+        // mHz, 0 is the sensor maximum
+        if (vc_ctrl_get(fd, V4L2_CID_VC_FRAME_RATE, &value) == 0 && value > 0)
+                request->fps = value / 1000.0;
+        return 0;
+}
+
+// Mode of a request, the first one with the format and binning mode
+static const struct vc_planner_mode *vc_find_mode(const struct vc_planner_sensor *sensor,
+                                                  const struct vc_request *request)
+{
+        unsigned int i;
+
+        for (i = 0; i < sensor->count; i++) {
+                const struct vc_planner_mode *mode = &sensor->modes[i];
+
+                if (mode->code == request->pixfmt->mbus_code &&
+                    (request->binning < 0 || mode->binning == request->binning))
+                        return mode;
+        }
+        return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+        enum { OPT_LANE_RATE = 0x100, OPT_ISP_RATE, OPT_CMA };
+        static const struct option options[] = {
+                { "subdev",    required_argument, NULL, 's' },
+                { "format",    required_argument, NULL, 'f' },
+                { "binning",   required_argument, NULL, 'B' },
+                { "crop",      required_argument, NULL, 'r' },
+                { "fps",       required_argument, NULL, 'F' },
+                { "current",   no_argument,       NULL, 'c' },
+                { "buffers",   required_argument, NULL, 'b' },
+                { "isp",       no_argument,       NULL, 'i' },
+                { "unpacked",  no_argument,       NULL, 'u' },
+                { "platform",  required_argument, NULL, 'p' },
+                { "lane-rate", required_argument, NULL, OPT_LANE_RATE },
+                { "isp-rate",  required_argument, NULL, OPT_ISP_RATE },
+                { "cma",       required_argument, NULL, OPT_CMA },
+                { "modes",     no_argument,       NULL, 'm' },
+                { "help",      no_argument,       NULL, 'h' },
+                { NULL, 0, NULL, 0 },
+        };
+        static struct vc_planner_sensor sensors[VC_PLANNER_MAX_CAMERAS];
+        struct vc_planner_params params = VC_PLANNER_PARAMS_DEFAULT;
+        struct vc_planner_config configs[VC_PLANNER_MAX_CAMERAS];
+        struct vc_request requests[VC_PLANNER_MAX_CAMERAS];
+        struct vc_planner_platform platform;
+        struct vc_planner_result result;
+        char subdevs[VC_PLANNER_MAX_CAMERAS][64];
+        char *values[VC_PLANNER_MAX_CAMERAS];
+        const char *platform_name = NULL;
+        double lane_rate = 0, isp_rate = 0, cma = 0;
+        unsigned int count = 0, n, i;
+        bool list_modes = false, current = false, requested = false;
+        int opt, ret, status = 0;
+
+        memset(requests, 0, sizeof(requests));
+        for (i = 0; i < VC_PLANNER_MAX_CAMERAS; i++)
+                requests[i].binning = -1;
+
+        while ((opt = getopt_long(argc, argv, "s:f:B:r:F:cb:iup:mh", options, NULL)) != -1) {
+                switch (opt) {
+                case 's':
+                        if (count == VC_PLANNER_MAX_CAMERAS)
+                                usage(argv[0]);
+                        snprintf(subdevs[count++], sizeof(subdevs[0]), "%s", optarg);
+                        break;
+                case 'f':
+                        n = vc_split(optarg, values, VC_PLANNER_MAX_CAMERAS);
+                        for (i = 0; i < n; i++) {
+                                requests[i].pixfmt = vc_pixfmt_from_name(values[i]);
+                                if (!requests[i].pixfmt) {
+                                        fprintf(stderr, "Unknown format '%s'\n", values[i]);
+                                        return 1;
+                                }
+                        }
+                        break;
+                case 'B':
+                        n = vc_split(optarg, values, VC_PLANNER_MAX_CAMERAS);
+                        for (i = 0; i < n; i++)
+                                requests[i].binning = strtol(values[i], NULL, 0);
+                        break;
+                case 'r':
+                        n = vc_split(optarg, values, VC_PLANNER_MAX_CAMERAS);
+                        for (i = 0; i < n; i++) {
+                                if (sscanf(values[i], "%ux%u", &requests[i].width, &requests[i].height) != 2)
+                                        usage(argv[0]);
+                        }
+                        break;
+                case 'F':
+                        n = vc_split(optarg, values, VC_PLANNER_MAX_CAMERAS);
+                        for (i = 0; i < n; i++)
+                                requests[i].fps = strtod(values[i], NULL);
+                        break;
+                case 'c': current = true; break;
+                case 'b': params.buffers = strtoul(optarg, NULL, 0); break;
+                case 'i': params.isp = true; break;
+                case 'u': params.packed = false; break;
+                case 'p': platform_name = optarg; break;
+                case OPT_LANE_RATE: lane_rate = strtod(optarg, NULL); break;
+                case OPT_ISP_RATE: isp_rate = strtod(optarg, NULL); break;
+                case OPT_CMA: cma = strtod(optarg, NULL); break;
+                case 'm': list_modes = true; break;
+                default: usage(argv[0]);
+                }
+        }
+        if (optind != argc)
+                usage(argv[0]);
+
+        if (platform_name) {
+                if (vc_planner_platform_get(platform_name, &platform) < 0) {
+                        fprintf(stderr, "Unknown platform '%s'\n", platform_name);
+                        return 1;
+                }
+        } else {
+                vc_planner_platform_detect(&platform);
+        }
+        if (lane_rate > 0)
+                platform.lane_rate = (uint64_t)(lane_rate * 1e6);
+        if (isp_rate > 0)
+                platform.isp_rate = (uint64_t)(isp_rate * 1e6);
+        if (cma > 0)
+                platform.cma_total = (uint64_t)(cma * VC_MIB);
+
+        if (count == 0) {
+                while (count < VC_PLANNER_MAX_CAMERAS &&
+                       vc_find_sensor_subdev_nth(count, subdevs[count], sizeof(subdevs[0])) == 0)
+                        count++;
+        }
+        if (count == 0) {
+                fprintf(stderr, "No camera found\n");
+                return 1;
+        }
+
+        for (i = 0; i < count; i++) {
+                int fd = open(subdevs[i], O_RDWR);
+
+                if (fd < 0) {
+                        fprintf(stderr, "Failed to open %s: %s\n", subdevs[i], strerror(errno));
+                        return 1;
+                }
+                ret = 0;
+                if (current && !requests[i].pixfmt)
+                        ret = vc_read_current(fd, &requests[i]);
+                if (ret == 0)
+                        ret = vc_planner_probe(fd, &sensors[i]);
+                close(fd);
+                if (ret < 0) {
+                        fprintf(stderr, "Failed to read %s: %s%s\n", subdevs[i], strerror(-ret),
+                                ret == -EBUSY ? " (stop streaming first)" : "");
+                        return 1;
+                }
+        }
+
+        printf("Platform    : %s (%s), %u x %u lanes, %.0f Mbit/s per lane, ISP %.0f Mpix/s",
+               platform.name, platform.frontend, platform.ports, platform.max_lanes, platform.lane_rate / 1e6,
+               platform.isp_rate / 1e6);
+        if (platform.cma_total)
+                printf(", CMA %.0f MiB", platform.cma_total / VC_MIB);
+        printf("\n");
+        for (i = 0; i < count; i++) {
+                if (list_modes)
+                        vc_print_modes(subdevs[i], &sensors[i]);
+                else
+                        printf("Camera %u    : %s (%s), %u modes\n", i, subdevs[i],
+                               sensors[i].name[0] ? sensors[i].name : "?", sensors[i].count);
+        }
+
+        // Requested configuration
+        for (i = 0; i < count; i++) {
+                configs[i] = (struct vc_planner_config){
+                        .width = requests[i].width,
+                        .height = requests[i].height,
+                        .fps = requests[i].fps,
+                };
+                if (!requests[i].pixfmt)
+                        continue;
+                configs[i].mode = vc_find_mode(&sensors[i], &requests[i]);
+                if (!configs[i].mode) {
+                        fprintf(stderr, "%s has no mode %s binning %d\n", subdevs[i], requests[i].pixfmt->name,
+                                requests[i].binning);
+                        return 1;
+                }
+                requested = true;
+        }
+        if (requested) {
+                for (i = 0; i < count; i++) {
+                        if (!configs[i].mode) {
+                                fprintf(stderr, "No format requested for %s\n", subdevs[i]);
+                                return 1;
+                        }
+                }
+                vc_planner_evaluate(&platform, &params, configs, count, &result);
+                vc_print_result("Requested", &platform, &params, subdevs, configs, &result);
+                if (result.limits)
+                        status = 2;
+        }
+
+        ret = vc_planner_recommend(&platform, &params, sensors, count, configs, &result);
+        if (ret < 0) {
+                printf("\nRecommended\n  No mode fits the limits of %s\n", platform.name);
+                return status ? status : 1;
+        }
+        vc_print_result("Recommended", &platform, &params, subdevs, configs, &result);
+        printf("\nconfig.txt  : dtoverlay=vc-mipi-common-memory-contiguous,cma-size=0x%llx\n",
+               (unsigned long long)result.cma_recommended);
+        return status;
+}
@@ -0,0 +1,199 @@
+// vc_pyramid - Preview pyramid of raw frames
+//
+// Builds the 2x / 4x / 8x preview levels of every dequeued frame and prints
+// the time per frame next to the frame interval and a plain frame copy.
+// With --snapshot the levels are written as PGM / PPM (<prefix>_2x.pgm,
+// ...) at most every 100 ms, for viewers that poll the files.
+//
+// Usage:
+//   vc_pyramid [-d /dev/video0 | replay:file.vcraw] [-n 300] [--levels 3] [--rgb]
+//              [--snapshot /tmp/preview]
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vc_capture.h"
+#include "vc_pixfmt.h"
+#include "vc_pyramid.h"
+#include "vc_stats.h"
+#include "vc_v4l2.h"
+
+// Minimum time between two snapshots
+#define VC_SNAPSHOT_INTERVAL_NS         100000000ull
+
+static volatile sig_atomic_t stop;
+
+static void vc_handle_signal(int sig)
+{
+        stop = 1;
+}
+
+static void usage(const char *argv0)
+{
+        fprintf(stderr,
+                "Usage: %s [OPTIONS]\n"
+                "\n"
+                "  -d, --device <dev>     Video device or replay:<file> (default: /dev/video0)\n"
+                "  -s, --subdev <dev>     Sensor subdevice (auto-detected if omitted)\n"
+                "  -n, --frames <N>       Number of frames, 0 = until Ctrl+C (default: 300)\n"
+                "  -b, --buffers <N>      Number of capture buffers (default: 4)\n"
+                "  -l, --levels <N>       Levels, 1 (2x) to 3 (8x) (default: 3)\n"
+                "  -c, --rgb              RGB levels for Bayer formats (default: grey)\n"
+                "  -k, --kernel <name>    Force scalar, sse2 or neon\n"
+                "  -o, --snapshot <pfx>   Write the levels to <pfx>_2x.pgm ... every 100 ms\n",
+                argv0);
+        exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+        static const struct option options[] = {
+                { "device",   required_argument, NULL, 'd' },
+                { "subdev",   required_argument, NULL, 's' },
+                { "frames",   required_argument, NULL, 'n' },
+                { "buffers",  required_argument, NULL, 'b' },
+                { "levels",   required_argument, NULL, 'l' },
+                { "rgb",      no_argument,       NULL, 'c' },
+                { "kernel",   required_argument, NULL, 'k' },
+                { "snapshot", required_argument, NULL, 'o' },
+                { "help",     no_argument,       NULL, 'h' },
+                { NULL, 0, NULL, 0 },
+        };
+        struct vc_pyramid_params params = VC_PYRAMID_PARAMS_DEFAULT;
+        const char *device = "/dev/video0", *snapshot = NULL;
+        struct vc_histogram build_time, copy_time, interval;
+        unsigned int frames = 300, buffers = 4, n = 0, k, snapshots = 0;
+        uint64_t last_ts = 0, last_snapshot_ns = 0;
+        struct vc_pyramid *pyr;
+        struct vc_capture *cap;
+        struct vc_format fmt;
+        struct vc_frame frame;
+        uint8_t *copy;
+        char subdev[64] = "";
+        char fcc[5];
+        int opt, ret;
+
+        while ((opt = getopt_long(argc, argv, "d:s:n:b:l:ck:o:h", options, NULL)) != -1) {
+                switch (opt) {
+                case 'd': device = optarg; break;
+                case 's': snprintf(subdev, sizeof(subdev), "%s", optarg); break;
+                case 'n': frames = strtoul(optarg, NULL, 0); break;
+                case 'b': buffers = strtoul(optarg, NULL, 0); break;
+                case 'l': params.levels = strtoul(optarg, NULL, 0); break;
+                case 'c': params.color = VC_PYRAMID_RGB; break;
+                case 'k': params.kernel = optarg; break;
+                case 'o': snapshot = optarg; break;
+                default: usage(argv[0]);
+                }
+        }
+        if (optind != argc)
+                usage(argv[0]);
+
+        if (!subdev[0] && strncmp(device, VC_CAPTURE_REPLAY_PREFIX, strlen(VC_CAPTURE_REPLAY_PREFIX)))
+                vc_find_sensor_subdev(subdev, sizeof(subdev));
+
+        cap = vc_capture_open(device, subdev[0] ? subdev : NULL, buffers);
+        if (!cap) {
+                fprintf(stderr, "Failed to open %s: %s\n", device, strerror(errno));
+                return 1;
+        }
+        vc_capture_get_format(cap, &fmt);
+
+        pyr = vc_pyramid_create(&fmt, &params);
+        if (!pyr) {
+                fprintf(stderr, "No %s pyramid of %s %ux%u: %s\n", params.color == VC_PYRAMID_RGB ? "RGB" : "grey",
+                        vc_fourcc_str(fmt.fourcc, fcc), fmt.width, fmt.height, strerror(errno));
+                vc_capture_close(cap);
+                return 1;
+        }
+        copy = malloc(fmt.sizeimage);
+        if (!copy) {
+                vc_pyramid_destroy(pyr);
+                vc_capture_close(cap);
+                return 1;
+        }
+
+        printf("Pyramid of %s %ux%u:", vc_fourcc_str(fmt.fourcc, fcc), fmt.width, fmt.height);
+        for (k = 0; k < vc_pyramid_levels(pyr); k++)
+                printf(" %ux%u", vc_pyramid_level(pyr, k)->width, vc_pyramid_level(pyr, k)->height);
+        printf(" (%s, %s)\n", params.color == VC_PYRAMID_RGB ? "RGB" : "grey", vc_pyramid_kernel(pyr));
+
+        vc_hist_reset(&build_time);
+        vc_hist_reset(&copy_time);
+        vc_hist_reset(&interval);
+
+        signal(SIGINT, vc_handle_signal);
+        signal(SIGTERM, vc_handle_signal);
+
+        ret = vc_capture_start(cap);
+        if (ret < 0) {
+                fprintf(stderr, "Failed to start streaming: %s\n", strerror(-ret));
+                goto out;
+        }
+
+        while (!stop && (frames == 0 || n < frames)) {
+                uint64_t start_ns;
+
+                ret = vc_capture_dequeue(cap, &frame, 2000);
+                if (ret == -ETIMEDOUT) {
+                        fprintf(stderr, "No frame within 2 s\n");
+                        continue;
+                }
+                if (ret < 0)
+                        break;
+
+                start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+                ret = vc_pyramid_process(pyr, frame.data, frame.bytesused);
+                vc_hist_add(&build_time, vc_clock_ns(CLOCK_MONOTONIC) - start_ns);
+
+                // Reference: one pass over the frame without any work
+                start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+                memcpy(copy, frame.data, frame.bytesused);
+                vc_hist_add(&copy_time, vc_clock_ns(CLOCK_MONOTONIC) - start_ns);
+
+                if (last_ts && frame.timestamp_ns > last_ts)
+                        vc_hist_add(&interval, frame.timestamp_ns - last_ts);
+                last_ts = frame.timestamp_ns;
+                vc_capture_release(cap, &frame);
+                if (ret < 0) {
+                        fprintf(stderr, "Failed to build the pyramid: %s\n", strerror(-ret));
+                        break;
+                }
+                n++;
+
+                start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+                if (snapshot && start_ns - last_snapshot_ns >= VC_SNAPSHOT_INTERVAL_NS) {
+                        ret = vc_pyramid_snapshot(pyr, snapshot);
+                        if (ret < 0) {
+                                fprintf(stderr, "Failed to write %s_*: %s\n", snapshot, strerror(-ret));
+                                break;
+                        }
+                        last_snapshot_ns = start_ns;
+                        snapshots++;
+                }
+        }
+        vc_capture_stop(cap);
+        if (ret == -ENODATA)
+                ret = 0;
+
+        printf("Pyramid     : %u frames, %.3f ms per frame (p99 %.3f ms, max %.3f ms)\n", n,
+               vc_hist_mean(&build_time) / 1e6, vc_hist_percentile(&build_time, 99.0) / 1e6,
+               build_time.count ? build_time.max / 1e6 : 0.0);
+        printf("Frame copy  : %.3f ms per frame\n", vc_hist_mean(&copy_time) / 1e6);
+        if (interval.count)
+                printf("Budget      : %.3f ms frame interval, %.1f %% used\n", vc_hist_mean(&interval) / 1e6,
+                       100.0 * vc_hist_mean(&build_time) / vc_hist_mean(&interval));
+        if (snapshot)
+                printf("Snapshots   : %u written to %s_*\n", snapshots, snapshot);
+
+out:
+        free(copy);
+        vc_pyramid_destroy(pyr);
+        vc_capture_close(cap);
+        return ret < 0 ? 1 : 0;
+}
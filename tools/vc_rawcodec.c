@@ -0,0 +1,278 @@
+// vc_rawcodec - Lossless compression of .vcraw recordings
+//
+// bench       encodes and decodes every frame of a recording, checks that the
+//             decoded frame is bit-exact and reports the compression ratio
+//             and the encode / decode throughput.
+// compress    rewrites a recording with compressed frames.
+// decompress  rewrites a compressed recording with raw frames, e.g. for
+//             tools that map the payload directly.
+//
+// Usage:
+//   vc_rawcodec bench capture.vcraw [--repeat N]
+//   vc_rawcodec compress capture.vcraw -o capture.z.vcraw
+//   vc_rawcodec decompress capture.z.vcraw -o capture.vcraw
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vc_codec.h"
+#include "vc_pixfmt.h"
+#include "vc_rawseq.h"
+#include "vc_stats.h"
+
+static void usage(const char *argv0)
+{
+        fprintf(stderr,
+                "Usage: %s (bench | compress | decompress) <file.vcraw> [OPTIONS]\n"
+                "\n"
+                "  -o, --output <file>   Output file (compress, decompress)\n"
+                "  -r, --repeat <N>      Encode / decode every frame N times (bench, default: 3)\n",
+                argv0);
+        exit(1);
+}
+
+static struct vc_format vc_rawseq_format(const struct vc_rawseq_header *info)
+{
+        struct vc_format fmt = {
+                .width = info->width,
+                .height = info->height,
+                .fourcc = info->fourcc,
+                .bytesperline = info->bytesperline,
+                .sizeimage = info->frame_size,
+        };
+
+        return fmt;
+}
+
+// Only the pixels count, the line padding is not kept by the codec
+static bool vc_frames_equal(const struct vc_rawseq_header *info, const uint8_t *a, const uint8_t *b,
+                            size_t bytesused)
+{
+        const struct vc_pixfmt *pixfmt;
+        size_t line_bytes;
+        bool packed;
+        uint32_t y;
+
+        pixfmt = vc_pixfmt_from_fourcc(info->fourcc, &packed);
+        line_bytes = vc_pixfmt_line_bytes(pixfmt, packed, info->width);
+        for (y = 0; y < info->height && (size_t)(y + 1) * info->bytesperline <= bytesused; y++) {
+                size_t offset = (size_t)y * info->bytesperline;
+
+                if (memcmp(a + offset, b + offset, line_bytes))
+                        return false;
+        }
+        return true;
+}
+
+static int vc_bench(struct vc_rawseq *seq, unsigned int repeat)
+{
+        const struct vc_rawseq_header *info = vc_rawseq_info(seq);
+        struct vc_format fmt = vc_rawseq_format(info);
+        struct vc_histogram encode_time, decode_time;
+        uint64_t raw_bytes = 0, encoded_bytes = 0;
+        uint8_t *raw = NULL, *encoded = NULL, *decoded = NULL;
+        struct vc_codec *codec;
+        uint32_t i, mismatches = 0;
+        size_t bound;
+        char fcc[5];
+        int ret = 0;
+
+        codec = vc_codec_create(&fmt);
+        if (!codec) {
+                fprintf(stderr, "Format %s is not supported\n", vc_fourcc_str(info->fourcc, fcc));
+                return -errno;
+        }
+        bound = vc_codec_bound(codec);
+
+        raw = malloc(info->frame_size);
+        decoded = malloc(info->frame_size);
+        encoded = malloc(bound);
+        if (!raw || !decoded || !encoded) {
+                ret = -ENOMEM;
+                goto out;
+        }
+
+        vc_hist_reset(&encode_time);
+        vc_hist_reset(&decode_time);
+
+        for (i = 0; i < vc_rawseq_count(seq); i++) {
+                ssize_t raw_len, len = 0, dec_len = 0;
+                unsigned int r;
+
+                raw_len = vc_rawseq_read(seq, i, raw, info->frame_size);
+                if (raw_len < 0) {
+                        fprintf(stderr, "Failed to read frame %u: %s\n", i, strerror(-raw_len));
+                        ret = raw_len;
+                        break;
+                }
+
+                for (r = 0; r < repeat; r++) {
+                        uint64_t start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+
+                        len = vc_codec_encode(codec, raw, raw_len, encoded, bound);
+                        vc_hist_add(&encode_time, vc_clock_ns(CLOCK_MONOTONIC) - start_ns);
+                        if (len < 0)
+                                break;
+
+                        start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+                        dec_len = vc_codec_decode(codec, encoded, len, decoded, info->frame_size);
+                        vc_hist_add(&decode_time, vc_clock_ns(CLOCK_MONOTONIC) - start_ns);
+                }
+                if (len < 0 || dec_len < 0) {
+                        fprintf(stderr, "Failed to %s frame %u: %s\n", len < 0 ? "encode" : "decode", i,
+                                strerror(len < 0 ? -len : -dec_len));
+                        ret = len < 0 ? len : dec_len;
+                        break;
+                }
+                if (dec_len != raw_len || !vc_frames_equal(info, raw, decoded, raw_len))
+                        mismatches++;
+
+                raw_bytes += raw_len;
+                encoded_bytes += len;
+        }
+
+        if (encoded_bytes) {
+                double frame_mb = raw_bytes / (double)vc_rawseq_count(seq) / 1e6;
+
+                printf("Frames      : %u, %ux%u %s\n", vc_rawseq_count(seq), info->width, info->height,
+                       vc_fourcc_str(info->fourcc, fcc));
+                printf("Ratio       : %.2f:1 (%.1f%% of the raw size)\n",
+                       raw_bytes / (double)encoded_bytes, 100.0 * encoded_bytes / raw_bytes);
+                printf("Encode      : %.3f ms per frame (p99 %.3f ms), %.0f MB/s, %.1f fps\n",
+                       vc_hist_mean(&encode_time) / 1e6, vc_hist_percentile(&encode_time, 99.0) / 1e6,
+                       frame_mb / (vc_hist_mean(&encode_time) / 1e9), 1e9 / vc_hist_mean(&encode_time));
+                printf("Decode      : %.3f ms per frame (p99 %.3f ms), %.0f MB/s, %.1f fps\n",
+                       vc_hist_mean(&decode_time) / 1e6, vc_hist_percentile(&decode_time, 99.0) / 1e6,
+                       frame_mb / (vc_hist_mean(&decode_time) / 1e9), 1e9 / vc_hist_mean(&decode_time));
+                printf("Lossless    : %s\n", mismatches ? "NO" : "yes");
+                if (mismatches) {
+                        fprintf(stderr, "%u frames differ after decoding\n", mismatches);
+                        ret = -EBADMSG;
+                }
+        }
+
+out:
+        free(raw);
+        free(encoded);
+        free(decoded);
+        vc_codec_destroy(codec);
+        return ret;
+}
+
+static int vc_convert(struct vc_rawseq *seq, const char *output, uint32_t compression)
+{
+        struct vc_rawseq_header info = *vc_rawseq_info(seq);
+        struct vc_rawseq_writer *writer;
+        uint8_t *buf;
+        uint32_t i;
+        int ret = 0;
+
+        buf = malloc(info.frame_size);
+        if (!buf)
+                return -ENOMEM;
+
+        info.compression = compression;
+        writer = vc_rawseq_create(output, &info);
+        if (!writer) {
+                ret = -errno;
+                fprintf(stderr, "Failed to create %s: %s\n", output, strerror(errno));
+                free(buf);
+                return ret;
+        }
+
+        for (i = 0; i < vc_rawseq_count(seq); i++) {
+                const struct vc_rawseq_frame *rec = vc_rawseq_frame(seq, i, NULL);
+                struct vc_frame frame = { 0 };
+                ssize_t len;
+
+                len = rec ? vc_rawseq_read(seq, i, buf, info.frame_size) : -EIO;
+                if (len < 0) {
+                        fprintf(stderr, "Failed to read frame %u: %s\n", i, strerror(-len));
+                        ret = len;
+                        break;
+                }
+
+                frame.data = buf;
+                frame.bytesused = len;
+                frame.index = i;
+                frame.sequence = rec->sequence;
+                frame.timestamp_ns = rec->timestamp_ns;
+                frame.flags = rec->flags;
+                frame.ctrls.exposure = rec->exposure;
+                frame.ctrls.gain = rec->gain;
+                frame.ctrls.blacklevel = rec->blacklevel;
+                frame.ctrls.live_roi = rec->live_roi;
+                frame.ctrls.binning_mode = rec->binning_mode;
+                frame.ctrls.frame_rate = rec->frame_rate;
+                frame.ctrls.bracket = rec->bracket ? rec->bracket - 1 : VC_CTRL_UNAVAILABLE;
+
+                ret = vc_rawseq_append(writer, &frame);
+                if (ret < 0) {
+                        fprintf(stderr, "Failed to write frame %u: %s\n", i, strerror(-ret));
+                        break;
+                }
+        }
+
+        if (vc_rawseq_finish(writer) < 0 && ret == 0)
+                ret = -EIO;
+        if (ret == 0)
+                printf("Wrote %u frames to %s\n", vc_rawseq_count(seq), output);
+
+        free(buf);
+        return ret;
+}
+
+int main(int argc, char *argv[])
+{
+        static const struct option options[] = {
+                { "output", required_argument, NULL, 'o' },
+                { "repeat", required_argument, NULL, 'r' },
+                { "help",   no_argument,       NULL, 'h' },
+                { NULL, 0, NULL, 0 },
+        };
+        const char *output = NULL, *mode, *input;
+        unsigned int repeat = 3;
+        struct vc_rawseq *seq;
+        int opt, ret;
+
+        while ((opt = getopt_long(argc, argv, "o:r:h", options, NULL)) != -1) {
+                switch (opt) {
+                case 'o': output = optarg; break;
+                case 'r': repeat = strtoul(optarg, NULL, 0); break;
+                default: usage(argv[0]);
+                }
+        }
+        if (optind + 2 != argc || repeat == 0)
+                usage(argv[0]);
+        mode = argv[optind];
+        input = argv[optind + 1];
+        if (strcmp(mode, "bench") && !output)
+                usage(argv[0]);
+
+        seq = vc_rawseq_open(input);
+        if (!seq) {
+                fprintf(stderr, "Failed to open %s: %s\n", input, strerror(errno));
+                return 1;
+        }
+        if (vc_rawseq_count(seq) == 0) {
+                fprintf(stderr, "%s contains no frames\n", input);
+                vc_rawseq_close(seq);
+                return 1;
+        }
+
+        if (!strcmp(mode, "bench"))
+                ret = vc_bench(seq, repeat);
+        else if (!strcmp(mode, "compress"))
+                ret = vc_convert(seq, output, VC_RAWSEQ_COMPRESSION_VCZ);
+        else if (!strcmp(mode, "decompress"))
+                ret = vc_convert(seq, output, VC_RAWSEQ_COMPRESSION_NONE);
+        else
+                usage(argv[0]);
+
+        vc_rawseq_close(seq);
+        return ret < 0 ? 1 : 0;
+}
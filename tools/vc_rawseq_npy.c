@@ -0,0 +1,258 @@
+// vc_rawseq_npy - Convert a .vcraw recording into a NumPy .npy array
+//
+// The frames are stacked into one array of shape (frames, height, width).
+// 8 bit formats are stored as uint8, everything else is unpacked into
+// uint16. The per-frame metadata can be written to a CSV file alongside.
+// Compressed recordings (vc_record --compress) are decoded on the fly.
+//
+// Usage:
+//   vc_rawseq_npy capture.vcraw -o capture.npy [--meta capture.csv]
+//                 [--first N] [--count M] [--info]
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vc_pixfmt.h"
+#include "vc_rawseq.h"
+
+static void usage(const char *argv0)
+{
+        fprintf(stderr,
+                "Usage: %s <file.vcraw> [OPTIONS]\n"
+                "\n"
+                "  -o, --output <file>   Output .npy file\n"
+                "  -m, --meta <file>     Write per-frame metadata as CSV\n"
+                "  -f, --first <N>       First frame to convert (default: 0)\n"
+                "  -n, --count <N>       Number of frames to convert (default: all)\n"
+                "  -i, --info            Print the container header and exit\n",
+                argv0);
+        exit(1);
+}
+
+static int vc_write_npy_header(FILE *file, const char *descr, uint32_t frames, uint32_t height, uint32_t width)
+{
+        char dict[128];
+        char header[256];
+        size_t len, total;
+
+        len = snprintf(dict, sizeof(dict),
+                       "{'descr': '%s', 'fortran_order': False, 'shape': (%u, %u, %u), }",
+                       descr, frames, height, width);
+
+        // magic (6) + version (2) + header length (2) + dict, padded to 64 with '\n' last
+        total = (10 + len + 1 + 63) / 64 * 64;
+        memset(header, ' ', total);
+        memcpy(header, "\x93NUMPY\x01\x00", 8);
+        header[8] = (total - 10) & 0xff;
+        header[9] = (total - 10) >> 8;
+        memcpy(header + 10, dict, len);
+        header[total - 1] = '\n';
+
+        return fwrite(header, 1, total, file) == total ? 0 : -EIO;
+}
+
+static void vc_print_info(const struct vc_rawseq *seq)
+{
+        const struct vc_rawseq_header *info = vc_rawseq_info(seq);
+        const struct vc_rawseq_frame *first, *last;
+        char fcc[5];
+
+        printf("Sensor      : %.*s\n", (int)sizeof(info->sensor_name), info->sensor_name);
+        printf("Format      : %s, mbus 0x%04x\n", vc_fourcc_str(info->fourcc, fcc), info->mbus_code);
+        printf("Geometry    : %ux%u, %u bytes per line, %u bytes per frame\n",
+               info->width, info->height, info->bytesperline, info->frame_size);
+        printf("Sensor crop : (%d,%d)/%ux%u\n", info->crop.left, info->crop.top,
+               info->crop.width, info->crop.height);
+        printf("Frames      : %u%s\n", vc_rawseq_count(seq),
+               info->index_offset ? "" : " (index recovered)");
+        if (vc_rawseq_compressed(seq)) {
+                uint64_t stored = 0, size = 0;
+                uint32_t i;
+
+                for (i = 0; i < vc_rawseq_count(seq); i++) {
+                        const struct vc_rawseq_frame *frame = vc_rawseq_frame(seq, i, NULL);
+
+                        if (frame) {
+                                stored += frame->bytesused;
+                                size += frame->size;
+                        }
+                }
+                printf("Compression : lossless, ratio %.2f:1\n", stored ? (double)size / stored : 0.0);
+        }
+
+        first = vc_rawseq_frame(seq, 0, NULL);
+        last = vc_rawseq_frame(seq, vc_rawseq_count(seq) - 1, NULL);
+        if (first && last && last != first && last->timestamp_ns > first->timestamp_ns)
+                printf("Frame rate  : %.2f fps, sequence %u..%u\n",
+                       (vc_rawseq_count(seq) - 1) * 1e9 / (double)(last->timestamp_ns - first->timestamp_ns),
+                       first->sequence, last->sequence);
+}
+
+int main(int argc, char *argv[])
+{
+        static const struct option options[] = {
+                { "output", required_argument, NULL, 'o' },
+                { "meta",   required_argument, NULL, 'm' },
+                { "first",  required_argument, NULL, 'f' },
+                { "count",  required_argument, NULL, 'n' },
+                { "info",   no_argument,       NULL, 'i' },
+                { "help",   no_argument,       NULL, 'h' },
+                { NULL, 0, NULL, 0 },
+        };
+        const char *output = NULL, *meta = NULL;
+        uint32_t first = 0, count = UINT32_MAX;
+        int info_only = 0;
+        const struct vc_rawseq_header *info;
+        const struct vc_pixfmt *pixfmt;
+        struct vc_rawseq *seq;
+        FILE *out = NULL, *csv = NULL;
+        uint16_t *line = NULL;
+        uint8_t *decoded = NULL;
+        bool packed = false;
+        uint32_t i, y, width;
+        int opt, ret = 0;
+
+        while ((opt = getopt_long(argc, argv, "o:m:f:n:ih", options, NULL)) != -1) {
+                switch (opt) {
+                case 'o': output = optarg; break;
+                case 'm': meta = optarg; break;
+                case 'f': first = strtoul(optarg, NULL, 0); break;
+                case 'n': count = strtoul(optarg, NULL, 0); break;
+                case 'i': info_only = 1; break;
+                default: usage(argv[0]);
+                }
+        }
+        if (optind >= argc || (!output && !meta && !info_only))
+                usage(argv[0]);
+
+        seq = vc_rawseq_open(argv[optind]);
+        if (!seq) {
+                fprintf(stderr, "Failed to open %s: %s\n", argv[optind], strerror(errno));
+                return 1;
+        }
+        info = vc_rawseq_info(seq);
+
+        if (info_only) {
+                vc_print_info(seq);
+                goto out;
+        }
+
+        if (first >= vc_rawseq_count(seq)) {
+                fprintf(stderr, "First frame %u out of range (%u frames)\n", first, vc_rawseq_count(seq));
+                ret = -EINVAL;
+                goto out;
+        }
+        if (count > vc_rawseq_count(seq) - first)
+                count = vc_rawseq_count(seq) - first;
+
+        pixfmt = vc_pixfmt_from_fourcc(info->fourcc, &packed);
+        width = info->width;
+
+        if (output) {
+                out = fopen(output, "wb");
+                if (!out) {
+                        ret = -errno;
+                        fprintf(stderr, "Failed to create %s: %s\n", output, strerror(errno));
+                        goto out;
+                }
+
+                if (!pixfmt) {
+                        // Unknown layout, keep the raw lines
+                        width = info->bytesperline;
+                        ret = vc_write_npy_header(out, "|u1", count, info->height, width);
+                } else if (pixfmt->bits == 8) {
+                        ret = vc_write_npy_header(out, "|u1", count, info->height, width);
+                } else {
+                        ret = vc_write_npy_header(out, "<u2", count, info->height, width);
+                        line = malloc((size_t)width * sizeof(*line));
+                        if (!line)
+                                ret = -ENOMEM;
+                }
+                if (ret < 0)
+                        goto out;
+        }
+
+        if (out && vc_rawseq_compressed(seq)) {
+                decoded = malloc(info->frame_size);
+                if (!decoded) {
+                        ret = -ENOMEM;
+                        goto out;
+                }
+        }
+
+        if (meta) {
+                csv = fopen(meta, "w");
+                if (!csv) {
+                        ret = -errno;
+                        fprintf(stderr, "Failed to create %s: %s\n", meta, strerror(errno));
+                        goto out;
+                }
+                fprintf(csv, "frame,sequence,timestamp_ns,bytesused,exposure,gain,blacklevel,live_roi,binning_mode,frame_rate,flags\n");
+        }
+
+        for (i = first; i < first + count; i++) {
+                const struct vc_rawseq_frame *frame;
+                const uint8_t *data;
+
+                frame = vc_rawseq_frame(seq, i, (const void **)&data);
+                if (!frame) {
+                        fprintf(stderr, "Frame %u is truncated\n", i);
+                        ret = -EIO;
+                        break;
+                }
+
+                if (csv)
+                        fprintf(csv, "%u,%u,%" PRIu64 ",%u,%d,%d,%d,%d,%d,%d,0x%x\n",
+                                i, frame->sequence, frame->timestamp_ns, frame->bytesused,
+                                frame->exposure, frame->gain, frame->blacklevel, frame->live_roi,
+                                frame->binning_mode, frame->frame_rate, frame->flags);
+
+                if (!out)
+                        continue;
+
+                if (decoded) {
+                        ssize_t len = vc_rawseq_read(seq, i, decoded, info->frame_size);
+
+                        if (len < 0) {
+                                fprintf(stderr, "Failed to decode frame %u: %s\n", i, strerror(-len));
+                                ret = len;
+                                break;
+                        }
+                        data = decoded;
+                }
+
+                for (y = 0; y < info->height; y++) {
+                        const uint8_t *src = data + (size_t)y * info->bytesperline;
+
+                        if (line) {
+                                vc_pixfmt_unpack_line(pixfmt, packed, src, line, width);
+                                if (fwrite(line, sizeof(*line), width, out) != width)
+                                        ret = -EIO;
+                        } else if (fwrite(src, 1, width, out) != width) {
+                                ret = -EIO;
+                        }
+                }
+                if (ret < 0) {
+                        fprintf(stderr, "Failed to write %s\n", output);
+                        break;
+                }
+        }
+
+        if (ret == 0)
+                printf("Converted %u frames (%ux%u)\n", count, width, info->height);
+
+out:
+        free(decoded);
+        free(line);
+        if (out && fclose(out) != 0 && ret == 0)
+                ret = -EIO;
+        if (csv)
+                fclose(csv);
+        vc_rawseq_close(seq);
+
+        return ret < 0 ? 1 : 0;
+}
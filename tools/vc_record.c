@@ -0,0 +1,418 @@
+// vc_record - Record raw frames of a VC MIPI camera into a .vcraw container
+//
+// Every frame is stored page aligned together with its timestamp, sequence
+// number and the sensor control state (exposure, gain, black level, live ROI,
+// binning mode, frame rate) at the time it was dequeued. With --ae the
+// exposure and gain are regulated from the recorded frames, with --bracket
+// they cycle through a list of settings and every frame records the setting
+// it was exposed with. With --compress the frames are stored with the
+// lossless vc_codec, about half the size of the raw data for typical scenes.
+// With --dpc the defect pixel / column offset table of the sensor mode (see
+// vc_dpc) is applied to every frame in place before it is stored. With
+// --preview the grey 2x / 4x / 8x levels of a frame (see vc_pyramid) are
+// written to <prefix>_2x.pgm, ... every 100 ms while recording.
+//
+// Usage:
+//   vc_record -o capture.vcraw [-d /dev/video0] [-s /dev/v4l-subdevX] [-n 100]
+//             [--ae[=target] | --bracket=exp:gain,exp:gain[,...]] [--compress] [--dpc[=dir]]
+//             [--preview /tmp/preview]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vc_ae.h"
+#include "vc_bracket.h"
+#include "vc_capture.h"
+#include "vc_dpc.h"
+#include "vc_pixfmt.h"
+#include "vc_pyramid.h"
+#include "vc_rawseq.h"
+#include "vc_stats.h"
+
+// Minimum time between two preview snapshots
+#define VC_PREVIEW_INTERVAL_NS          100000000ull
+
+static volatile sig_atomic_t stop;
+
+static void vc_handle_signal(int sig)
+{
+        stop = 1;
+}
+
+static void usage(const char *argv0)
+{
+        fprintf(stderr,
+                "Usage: %s -o <file.vcraw> [OPTIONS]\n"
+                "\n"
+                "  -d, --device <dev>    Video device (default: /dev/video0)\n"
+                "  -s, --subdev <dev>    Sensor subdevice (auto-detected if omitted)\n"
+                "  -n, --count <N>       Number of frames, 0 = until Ctrl+C (default: 100)\n"
+                "  -b, --buffers <N>     Number of capture buffers (default: 8)\n"
+                "  -o, --output <file>   Output file\n"
+                "      --no-ctrls        Do not sample sensor controls per frame\n"
+                "      --ae[=target]     Auto exposure / gain, target mean level (default: 0.25)\n"
+                "      --bracket <list>  Cycle exposure:gain settings per frame, e.g. 1000:0,4000:0,16000:6000\n"
+                "      --bracket-latency <N>  Frames until a setting takes effect (default: 2)\n"
+                "  -z, --compress        Lossless compression of the frames\n"
+                "      --dpc[=dir]       Correct defect pixels and column offsets (default: " VC_DPC_DIR_DEFAULT ")\n"
+                "      --preview <pfx>   Write preview levels to <pfx>_2x.pgm ... every 100 ms\n"
+                "      --recover         Restart the sensor after receiver errors or missing frames\n",
+                argv0);
+        exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+        static const struct option options[] = {
+                { "device",   required_argument, NULL, 'd' },
+                { "subdev",   required_argument, NULL, 's' },
+                { "count",    required_argument, NULL, 'n' },
+                { "buffers",  required_argument, NULL, 'b' },
+                { "output",   required_argument, NULL, 'o' },
+                { "no-ctrls", no_argument,       NULL, 'C' },
+                { "ae",       optional_argument, NULL, 'A' },
+                { "bracket",  required_argument, NULL, 'B' },
+                { "bracket-latency", required_argument, NULL, 'L' },
+                { "compress", no_argument,       NULL, 'z' },
+                { "dpc",      optional_argument, NULL, 'P' },
+                { "preview",  required_argument, NULL, 'V' },
+                { "recover",  no_argument,       NULL, 'R' },
+                { "help",     no_argument,       NULL, 'h' },
+                { NULL, 0, NULL, 0 },
+        };
+        const char *device = "/dev/video0";
+        const char *output = NULL;
+        char subdev[64] = "";
+        unsigned int count = 100, buffers = 8;
+        int no_ctrls = 0, use_ae = 0, compress = 0, recover = 0;
+        int recover_fd = -1;
+        struct vc_histogram write_time;
+        uint64_t raw_bytes = 0, start_ns;
+        struct stat st;
+        const char *dpc_dir = NULL;
+        struct vc_dpc *dpc = NULL;
+        struct vc_pyramid_params pyramid_params = VC_PYRAMID_PARAMS_DEFAULT;
+        struct vc_pyramid *pyramid = NULL;
+        const char *preview = NULL;
+        uint64_t last_preview_ns = 0;
+        struct vc_ae_params ae_params = VC_AE_PARAMS_DEFAULT;
+        struct vc_histogram ae_time;
+        struct vc_ae *ae = NULL;
+        int ae_fd = -1;
+        struct vc_bracket_entry bracket_entries[VC_BRACKET_MAX_ENTRIES];
+        struct vc_bracket *bracket = NULL;
+        unsigned int bracket_latency = VC_BRACKET_LATENCY_DEFAULT;
+        int bracket_count = 0;
+        struct vc_rawseq_header info;
+        struct vc_rawseq_writer *writer;
+        struct vc_capture *cap;
+        struct vc_format fmt;
+        struct vc_frame frame;
+        uint64_t first_ts = 0, last_ts = 0;
+        uint32_t last_seq = 0, frames = 0, dropped = 0;
+        char fcc[5];
+        int opt, ret, status = 0;
+
+        while ((opt = getopt_long(argc, argv, "d:s:n:b:o:zh", options, NULL)) != -1) {
+                switch (opt) {
+                case 'd': device = optarg; break;
+                case 's': snprintf(subdev, sizeof(subdev), "%s", optarg); break;
+                case 'n': count = strtoul(optarg, NULL, 0); break;
+                case 'b': buffers = strtoul(optarg, NULL, 0); break;
+                case 'o': output = optarg; break;
+                case 'C': no_ctrls = 1; break;
+                case 'A':
+                        use_ae = 1;
+                        if (optarg)
+                                ae_params.target = strtod(optarg, NULL);
+                        break;
+                case 'B':
+                        bracket_count = vc_bracket_parse(optarg, bracket_entries, VC_BRACKET_MAX_ENTRIES);
+                        if (bracket_count < 0) {
+                                fprintf(stderr, "Invalid bracket list '%s' (up to %u exposure:gain entries)\n",
+                                        optarg, VC_BRACKET_MAX_ENTRIES);
+                                return 1;
+                        }
+                        break;
+                case 'L': bracket_latency = strtoul(optarg, NULL, 0); break;
+                case 'z': compress = 1; break;
+                case 'P': dpc_dir = optarg ? optarg : VC_DPC_DIR_DEFAULT; break;
+                case 'V': preview = optarg; break;
+                case 'R': recover = 1; break;
+                default: usage(argv[0]);
+                }
+        }
+        if (!output)
+                usage(argv[0]);
+        if (use_ae && bracket_count) {
+                fprintf(stderr, "--ae and --bracket can not be combined\n");
+                return 1;
+        }
+
+        if (!subdev[0] && vc_find_sensor_subdev(subdev, sizeof(subdev)) < 0)
+                fprintf(stderr, "No vc_mipi_camera subdevice found, recording without sensor metadata\n");
+
+        cap = vc_capture_open(device, subdev[0] && !no_ctrls ? subdev : NULL, buffers);
+        if (!cap) {
+                fprintf(stderr, "Failed to open %s: %s\n", device, strerror(errno));
+                return 1;
+        }
+        vc_capture_get_format(cap, &fmt);
+
+        memset(&info, 0, sizeof(info));
+        info.fourcc = fmt.fourcc;
+        info.width = fmt.width;
+        info.height = fmt.height;
+        info.bytesperline = fmt.bytesperline;
+        info.frame_size = fmt.sizeimage;
+        if (compress)
+                info.compression = VC_RAWSEQ_COMPRESSION_VCZ;
+
+        if (subdev[0]) {
+                struct v4l2_mbus_framefmt mbus;
+                struct v4l2_rect crop;
+                int fd = vc_capture_subdev_fd(cap);
+                int own_fd = -1;
+
+                // Without per-frame controls the subdevice is only opened here
+                if (fd < 0)
+                        fd = own_fd = open(subdev, O_RDWR | O_CLOEXEC);
+                if (fd >= 0) {
+                        vc_ctrl_get_string(fd, V4L2_CID_VC_NAME, info.sensor_name, sizeof(info.sensor_name));
+                        if (vc_subdev_get_fmt(fd, 0, &mbus) == 0)
+                                info.mbus_code = mbus.code;
+                        if (vc_subdev_get_crop(fd, 0, &crop) == 0) {
+                                info.crop.left = crop.left;
+                                info.crop.top = crop.top;
+                                info.crop.width = crop.width;
+                                info.crop.height = crop.height;
+                        }
+                }
+                if (own_fd >= 0)
+                        close(own_fd);
+        }
+
+        if (use_ae || bracket_count) {
+                if (!subdev[0]) {
+                        fprintf(stderr, "%s needs the sensor subdevice, use --subdev\n",
+                                use_ae ? "Auto exposure" : "Bracketing");
+                        vc_capture_close(cap);
+                        return 1;
+                }
+                ae_fd = open(subdev, O_RDWR | O_CLOEXEC);
+        }
+        if (bracket_count) {
+                bracket = ae_fd >= 0 ? vc_bracket_create(ae_fd, bracket_entries, bracket_count,
+                                                         bracket_latency) : NULL;
+                if (!bracket) {
+                        fprintf(stderr, "Failed to set up bracketing on %s: %s\n", subdev, strerror(errno));
+                        if (ae_fd >= 0)
+                                close(ae_fd);
+                        vc_capture_close(cap);
+                        return 1;
+                }
+        }
+        if (use_ae) {
+                ae = ae_fd >= 0 ? vc_ae_create(ae_fd, &ae_params) : NULL;
+                if (!ae) {
+                        fprintf(stderr, "Failed to set up auto exposure on %s: %s\n", subdev, strerror(errno));
+                        if (ae_fd >= 0)
+                                close(ae_fd);
+                        vc_capture_close(cap);
+                        return 1;
+                }
+                vc_hist_reset(&ae_time);
+        }
+
+        if (recover) {
+                struct vc_recovery_params recovery = VC_RECOVERY_PARAMS_DEFAULT;
+
+                // Without per-frame controls the subdevice is opened for the restarts
+                if (subdev[0] && vc_capture_subdev_fd(cap) < 0)
+                        recover_fd = open(subdev, O_RDWR | O_CLOEXEC);
+                ret = vc_capture_set_recovery(cap, recover_fd, &recovery);
+                if (ret < 0) {
+                        fprintf(stderr, "Stream recovery not possible%s%s: %s\n",
+                                subdev[0] ? " on " : "", subdev, strerror(-ret));
+                        status = ret;
+                        goto out_close;
+                }
+        }
+
+        if (dpc_dir) {
+                struct vc_dpc_mode mode;
+                int fd = subdev[0] ? open(subdev, O_RDWR | O_CLOEXEC) : -1;
+
+                vc_dpc_mode_read(fd, &fmt, &mode);
+                if (fd >= 0)
+                        close(fd);
+                dpc = vc_dpc_load_mode(dpc_dir, &mode);
+                if (!dpc) {
+                        char path[512];
+
+                        vc_dpc_path(dpc_dir, &mode, path, sizeof(path));
+                        fprintf(stderr, "No defect table for this mode (%s): %s, run vc_dpc calibrate\n",
+                                path, strerror(errno));
+                        status = -ENOENT;
+                        goto out_close;
+                }
+        }
+
+        if (preview) {
+                pyramid = vc_pyramid_create(&fmt, &pyramid_params);
+                if (!pyramid) {
+                        fprintf(stderr, "No preview of %s %ux%u: %s\n", vc_fourcc_str(fmt.fourcc, fcc),
+                                fmt.width, fmt.height, strerror(errno));
+                        status = -errno;
+                        goto out_close;
+                }
+        }
+
+        writer = vc_rawseq_create(output, &info);
+        if (!writer) {
+                status = -errno;
+                fprintf(stderr, "Failed to create %s: %s\n", output, strerror(-status));
+                goto out_close;
+        }
+
+        printf("Recording %s %ux%u (%s) from %s to %s%s\n",
+               info.sensor_name[0] ? info.sensor_name : "unknown sensor",
+               fmt.width, fmt.height, vc_fourcc_str(fmt.fourcc, fcc), device, output,
+               compress ? " (compressed)" : "");
+        vc_hist_reset(&write_time);
+
+        signal(SIGINT, vc_handle_signal);
+        signal(SIGTERM, vc_handle_signal);
+
+        ret = vc_capture_start(cap);
+        if (ret < 0) {
+                fprintf(stderr, "Failed to start streaming: %s\n", strerror(-ret));
+                status = ret;
+                goto out;
+        }
+
+        while (!stop && (count == 0 || frames < count)) {
+                ret = vc_capture_dequeue(cap, &frame, 2000);
+                if (ret == -ETIMEDOUT) {
+                        fprintf(stderr, "No frame within 2 s\n");
+                        continue;
+                }
+                if (ret == -EPIPE && recover) {
+                        fprintf(stderr, "Stream did not recover, restart the pipeline\n");
+                        status = ret;
+                        break;
+                }
+                if (ret < 0) {
+                        fprintf(stderr, "Failed to dequeue: %s\n", strerror(-ret));
+                        status = ret;
+                        break;
+                }
+
+                if (frames == 0)
+                        first_ts = frame.timestamp_ns;
+                else if (frame.sequence > last_seq + 1)
+                        dropped += frame.sequence - last_seq - 1;
+                last_seq = frame.sequence;
+                last_ts = frame.timestamp_ns;
+
+                // The capture buffers are mapped writable
+                if (dpc)
+                        vc_dpc_apply(dpc, &fmt, (void *)frame.data, frame.bytesused);
+                if (ae) {
+                        vc_ae_process(ae, &fmt, frame.data);
+                        vc_hist_add(&ae_time, vc_ae_get_status(ae)->process_ns);
+                }
+                if (bracket)
+                        vc_bracket_process(bracket, &frame);
+
+                start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+                if (pyramid && start_ns - last_preview_ns >= VC_PREVIEW_INTERVAL_NS) {
+                        // A failing preview does not stop the recording, it is reported once
+                        if (vc_pyramid_process(pyramid, frame.data, frame.bytesused) == 0 &&
+                            (ret = vc_pyramid_snapshot(pyramid, preview)) < 0 && !last_preview_ns)
+                                fprintf(stderr, "Failed to write %s_*: %s\n", preview, strerror(-ret));
+                        last_preview_ns = start_ns;
+                        start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+                }
+
+                ret = vc_rawseq_append(writer, &frame);
+                vc_hist_add(&write_time, vc_clock_ns(CLOCK_MONOTONIC) - start_ns);
+                raw_bytes += frame.bytesused;
+                vc_capture_release(cap, &frame);
+                if (ret < 0) {
+                        fprintf(stderr, "Failed to write frame: %s\n", strerror(-ret));
+                        status = ret;
+                        break;
+                }
+                frames++;
+        }
+
+        vc_capture_stop(cap);
+
+out:
+        ret = vc_rawseq_finish(writer);
+        if (ret < 0) {
+                fprintf(stderr, "Failed to finish %s: %s\n", output, strerror(-ret));
+                status = ret;
+        }
+
+        printf("Recorded %u frames, %u dropped", frames, dropped);
+        if (frames > 1 && last_ts > first_ts)
+                printf(", %.2f fps", (frames - 1) * 1e9 / (double)(last_ts - first_ts));
+        printf("\n");
+        if (recover) {
+                const struct vc_capture_stats *stats = vc_capture_get_stats(cap);
+
+                printf("Recovery: %llu receiver errors, %llu timeouts, %llu restarts",
+                       (unsigned long long)stats->errors, (unsigned long long)stats->timeouts,
+                       (unsigned long long)stats->restarts);
+                if (stats->recovery.count)
+                        printf(", back after %.1f ms (max %.1f ms)", vc_hist_mean(&stats->recovery) / 1e6,
+                               stats->recovery.max / 1e6);
+                printf("\n");
+        }
+        if (compress && frames && stat(output, &st) == 0 && st.st_size > 0)
+                printf("Compression: ratio %.2f:1, %.3f ms per frame (max %.3f ms)\n",
+                       raw_bytes / (double)st.st_size, vc_hist_mean(&write_time) / 1e6,
+                       write_time.max / 1e6);
+
+out_close:
+        if (ae) {
+                const struct vc_ae_status *ae_status = vc_ae_get_status(ae);
+
+                printf("Auto exposure: exposure %d, gain %d mdB, mean %.3f, %s after %u updates, "
+                       "%.3f ms per frame (max %.3f ms)\n",
+                       ae_status->exposure, ae_status->gain, ae_status->mean,
+                       ae_status->converged ? "converged" : "not converged", ae_status->updates,
+                       vc_hist_mean(&ae_time) / 1e6, ae_time.count ? ae_time.max / 1e6 : 0.0);
+                vc_ae_destroy(ae);
+        }
+        if (bracket) {
+                const struct vc_bracket_stats *bracket_stats = vc_bracket_get_stats(bracket);
+
+                printf("Bracketing: %d entries, %u frames tagged, %u untagged, %u repeated, %u write errors, "
+                       "%u stale\n",
+                       bracket_count, bracket_stats->frames - bracket_stats->untagged, bracket_stats->untagged,
+                       bracket_stats->repeated, bracket_stats->write_errors, bracket_stats->stale);
+                if (bracket_stats->stale)
+                        printf("Bracketing: frames were dequeued too late, the tags are not reliable\n");
+                vc_bracket_destroy(bracket);
+        }
+        if (ae_fd >= 0)
+                close(ae_fd);
+        vc_dpc_destroy(dpc);
+        vc_capture_close(cap);
+        if (recover_fd >= 0)
+                close(recover_fd);
+        vc_pyramid_destroy(pyramid);
+
+        return status < 0 ? 1 : 0;
+}
@@ -0,0 +1,222 @@
+// vc_replay - Replay a .vcraw recording through the capture interface
+//
+// The frames are delivered by the replay backend of libvcmipi with the
+// recorded timing (or a fixed frame rate), so a processing stage can be
+// exercised without a camera attached. The built-in consumer simulates a
+// processing load per frame and reports what a real pipeline would see:
+// delivered frames, sequence gaps, dequeue latency and buffer backlog.
+//
+// Usage:
+//   vc_replay capture.vcraw [--speed 1.0 | --fast | --fps 60] [--loops N]
+//             [--work-us 5000] [--drop-rate 0.01] [--buffers 4]
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vc_capture.h"
+#include "vc_pixfmt.h"
+
+static volatile sig_atomic_t stop;
+
+static void vc_handle_signal(int sig)
+{
+        stop = 1;
+}
+
+static void usage(const char *argv0)
+{
+        fprintf(stderr,
+                "Usage: %s <file.vcraw> [OPTIONS]\n"
+                "\n"
+                "  -s, --speed <X>       Replay speed, 1.0 = recorded timing (default: 1.0)\n"
+                "  -F, --fast            Deliver frames as fast as they are consumed\n"
+                "  -f, --fps <N>         Replay at a fixed frame rate instead\n"
+                "  -l, --loops <N>       Passes over the file, 0 = endless (default: 1)\n"
+                "  -b, --buffers <N>     Number of replay buffers (default: 4)\n"
+                "  -w, --work-us <N>     Simulated processing time per frame (default: 0)\n"
+                "  -j, --jitter-us <N>   Random extra processing time, 0..N (default: 0)\n"
+                "  -D, --drop-rate <P>   Drop frames with probability P before delivery\n"
+                "      --seed <N>        Seed for --drop-rate and --jitter-us (default: 1)\n"
+                "  -p, --preload         Read the file into the page cache before replay\n"
+                "  -r, --report <s>      Print statistics every s seconds (default: 1)\n"
+                "      --json            Print the final statistics as JSON\n",
+                argv0);
+        exit(1);
+}
+
+// Busy wait, a sleeping consumer would not load the CPU like real processing
+static void vc_simulate_work(uint64_t duration_ns)
+{
+        uint64_t end = vc_clock_ns(CLOCK_MONOTONIC) + duration_ns;
+
+        while (vc_clock_ns(CLOCK_MONOTONIC) < end)
+                ;
+}
+
+static void vc_print_report(const struct vc_capture_stats *stats, double elapsed_s)
+{
+        printf("%8.1f s: %8" PRIu64 " frames %7.2f fps, %" PRIu64 " gaps (%" PRIu64 " overrun, %" PRIu64
+               " injected), latency p50 %.2f p99 %.2f max %.2f ms, backlog max %u\n",
+               elapsed_s, stats->frames, elapsed_s > 0.0 ? stats->frames / elapsed_s : 0.0,
+               stats->dropped, stats->overruns, stats->injected,
+               vc_hist_percentile(&stats->latency, 50) / 1e6,
+               vc_hist_percentile(&stats->latency, 99) / 1e6,
+               stats->latency.count ? stats->latency.max / 1e6 : 0.0,
+               stats->backlog_max);
+        if (stats->decode.count)
+                printf("%8s  decode p50 %.2f max %.2f ms, %" PRIu64 " decoded on delivery\n", "",
+                       vc_hist_percentile(&stats->decode, 50) / 1e6, stats->decode.max / 1e6,
+                       stats->late_decodes);
+}
+
+static void vc_print_json(const char *path, const struct vc_capture_stats *stats, double elapsed_s)
+{
+        printf("{\n");
+        printf("  \"file\": \"%s\",\n", path);
+        printf("  \"elapsed_s\": %.3f,\n", elapsed_s);
+        printf("  \"frames\": %" PRIu64 ",\n", stats->frames);
+        printf("  \"fps\": %.3f,\n", elapsed_s > 0.0 ? stats->frames / elapsed_s : 0.0);
+        printf("  \"dropped\": %" PRIu64 ",\n", stats->dropped);
+        printf("  \"overruns\": %" PRIu64 ",\n", stats->overruns);
+        printf("  \"injected\": %" PRIu64 ",\n", stats->injected);
+        printf("  \"latency_ms\": { \"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n",
+               stats->latency.count ? stats->latency.min / 1e6 : 0.0,
+               vc_hist_mean(&stats->latency) / 1e6,
+               vc_hist_percentile(&stats->latency, 50) / 1e6,
+               vc_hist_percentile(&stats->latency, 99) / 1e6,
+               stats->latency.count ? stats->latency.max / 1e6 : 0.0);
+        printf("  \"decode_ms\": { \"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n",
+               vc_hist_mean(&stats->decode) / 1e6,
+               vc_hist_percentile(&stats->decode, 50) / 1e6,
+               vc_hist_percentile(&stats->decode, 99) / 1e6,
+               stats->decode.count ? stats->decode.max / 1e6 : 0.0);
+        printf("  \"late_decodes\": %" PRIu64 ",\n", stats->late_decodes);
+        printf("  \"backlog\": { \"mean\": %.3f, \"max\": %u }\n",
+               stats->frames ? (double)stats->backlog_sum / stats->frames : 0.0, stats->backlog_max);
+        printf("}\n");
+}
+
+int main(int argc, char *argv[])
+{
+        static const struct option options[] = {
+                { "speed",     required_argument, NULL, 's' },
+                { "fast",      no_argument,       NULL, 'F' },
+                { "fps",       required_argument, NULL, 'f' },
+                { "loops",     required_argument, NULL, 'l' },
+                { "buffers",   required_argument, NULL, 'b' },
+                { "work-us",   required_argument, NULL, 'w' },
+                { "jitter-us", required_argument, NULL, 'j' },
+                { "drop-rate", required_argument, NULL, 'D' },
+                { "seed",      required_argument, NULL, 'S' },
+                { "preload",   no_argument,       NULL, 'p' },
+                { "report",    required_argument, NULL, 'r' },
+                { "json",      no_argument,       NULL, 'J' },
+                { "help",      no_argument,       NULL, 'h' },
+                { NULL, 0, NULL, 0 },
+        };
+        struct vc_replay_params params = VC_REPLAY_PARAMS_DEFAULT;
+        unsigned int buffers = 4, work_us = 0, jitter_us = 0;
+        double report_s = 1.0;
+        int json = 0;
+        const struct vc_capture_stats *stats;
+        struct vc_capture *cap;
+        struct vc_format fmt;
+        struct vc_frame frame;
+        uint64_t start_ns, next_report_ns, now_ns;
+        char fcc[5];
+        int opt, ret, status = 0;
+
+        while ((opt = getopt_long(argc, argv, "s:Ff:l:b:w:j:D:pr:h", options, NULL)) != -1) {
+                switch (opt) {
+                case 's': params.speed = strtod(optarg, NULL); break;
+                case 'F': params.speed = 0.0; break;
+                case 'f': params.fps = strtod(optarg, NULL); break;
+                case 'l': params.loops = strtoul(optarg, NULL, 0); break;
+                case 'b': buffers = strtoul(optarg, NULL, 0); break;
+                case 'w': work_us = strtoul(optarg, NULL, 0); break;
+                case 'j': jitter_us = strtoul(optarg, NULL, 0); break;
+                case 'D': params.drop_rate = strtod(optarg, NULL); break;
+                case 'S': params.seed = strtoul(optarg, NULL, 0); break;
+                case 'p': params.preload = true; break;
+                case 'r': report_s = strtod(optarg, NULL); break;
+                case 'J': json = 1; break;
+                default: usage(argv[0]);
+                }
+        }
+        if (optind >= argc)
+                usage(argv[0]);
+
+        cap = vc_capture_open_replay(argv[optind], &params, buffers);
+        if (!cap) {
+                fprintf(stderr, "Failed to open %s: %s\n", argv[optind], strerror(errno));
+                return 1;
+        }
+        vc_capture_get_format(cap, &fmt);
+        srand(params.seed);
+
+        if (!json) {
+                printf("Replaying %s %ux%u (%s), ", argv[optind], fmt.width, fmt.height,
+                       vc_fourcc_str(fmt.fourcc, fcc));
+                if (params.fps > 0.0)
+                        printf("%.2f fps", params.fps);
+                else if (params.speed > 0.0)
+                        printf("%.2fx recorded timing", params.speed);
+                else
+                        printf("as fast as possible");
+                printf(", %u buffers, %u us work per frame\n", buffers, work_us);
+        }
+
+        signal(SIGINT, vc_handle_signal);
+        signal(SIGTERM, vc_handle_signal);
+
+        ret = vc_capture_start(cap);
+        if (ret < 0) {
+                fprintf(stderr, "Failed to start replay: %s\n", strerror(-ret));
+                vc_capture_close(cap);
+                return 1;
+        }
+        stats = vc_capture_get_stats(cap);
+        start_ns = vc_clock_ns(CLOCK_MONOTONIC);
+        next_report_ns = start_ns + (uint64_t)(report_s * 1e9);
+
+        while (!stop) {
+                ret = vc_capture_dequeue(cap, &frame, 2000);
+                if (ret == -ENODATA)
+                        break;
+                if (ret == -ETIMEDOUT)
+                        continue;
+                if (ret < 0) {
+                        fprintf(stderr, "Failed to dequeue: %s\n", strerror(-ret));
+                        status = ret;
+                        break;
+                }
+
+                if (work_us || jitter_us)
+                        vc_simulate_work((work_us + (jitter_us ? rand() % (jitter_us + 1) : 0)) * 1000ULL);
+                vc_capture_release(cap, &frame);
+
+                now_ns = vc_clock_ns(CLOCK_MONOTONIC);
+                if (!json && report_s > 0.0 && now_ns >= next_report_ns) {
+                        vc_print_report(stats, (now_ns - start_ns) / 1e9);
+                        next_report_ns += (uint64_t)(report_s * 1e9);
+                }
+        }
+
+        vc_capture_stop(cap);
+        now_ns = vc_clock_ns(CLOCK_MONOTONIC);
+
+        if (json)
+                vc_print_json(argv[optind], stats, (now_ns - start_ns) / 1e9);
+        else
+                vc_print_report(stats, (now_ns - start_ns) / 1e9);
+
+        vc_capture_close(cap);
+
+        return status < 0 ? 1 : 0;
+}
@@ -0,0 +1,299 @@
+// vc_switch_bench - Frames lost per binning / crop switch while streaming
+//
+// Streams from the video node and switches the sensor between binning modes
+// or crop windows every N frames without stopping the stream. The driver
+// restarts only the sensor readout and signals V4L2_EVENT_SOURCE_CHANGE on
+// the subdevice. For every switch the tool measures:
+//
+//   - frames lost, from the gap in the buffer timestamps (the receiver
+//     sequence does not count frames the sensor never sent)
+//   - time spent in the control / selection ioctl
+//   - time until the source change event arrives
+//
+// Usage:
+//   vc_switch_bench --binning 0,1 [-d /dev/video0] [-s /dev/v4l-subdevX]
+//   vc_switch_bench --crop 1920x1080+0+0,960x540+480+270 [--every 30] [--switches 20]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vc_capture.h"
+#include "vc_pixfmt.h"
+#include "vc_stats.h"
+#include "vc_v4l2.h"
+
+#define VC_SWITCH_MAX_STEPS             8
+#define VC_SWITCH_WARMUP                10
+
+struct vc_switch_step {
+        int32_t binning;                // binning mode, or -1 for a crop step
+        struct v4l2_rect crop;
+};
+
+static volatile sig_atomic_t stop;
+
+static void vc_handle_signal(int sig)
+{
+        stop = 1;
+}
+
+static void usage(const char *argv0)
+{
+        fprintf(stderr,
+                "Usage: %s (--binning <list> | --crop <list>) [OPTIONS]\n"
+                "\n"
+                "  -d, --device <dev>     Video device (default: /dev/video0)\n"
+                "  -s, --subdev <dev>     Sensor subdevice (auto-detected if omitted)\n"
+                "      --binning <list>   Binning modes to cycle, the largest first, e.g. 0,1\n"
+                "      --crop <list>      Crop windows to cycle, the largest first, WxH+X+Y,...\n"
+                "      --every <N>        Frames between switches (default: 30)\n"
+                "      --switches <N>     Number of switches (default: 20)\n"
+                "  -b, --buffers <N>      Number of capture buffers (default: 4)\n",
+                argv0);
+        exit(1);
+}
+
+static int vc_parse_binning(const char *str, struct vc_switch_step *steps)
+{
+        unsigned int count = 0;
+        char *end;
+
+        while (*str && count < VC_SWITCH_MAX_STEPS) {
+                steps[count].binning = strtol(str, &end, 0);
+                if (end == str)
+                        return -EINVAL;
+                count++;
+                str = *end == ',' ? end + 1 : end;
+        }
+        return count >= 2 ? (int)count : -EINVAL;
+}
+
+static int vc_parse_crop(const char *str, struct vc_switch_step *steps)
+{
+        unsigned int count = 0;
+        int n;
+
+        while (*str && count < VC_SWITCH_MAX_STEPS) {
+                struct v4l2_rect *r = &steps[count].crop;
+
+                if (sscanf(str, "%ux%u+%d+%d%n", &r->width, &r->height, &r->left, &r->top, &n) != 4)
+                        return -EINVAL;
+                steps[count].binning = -1;
+                count++;
+                str += n;
+                if (*str == ',')
+                        str++;
+        }
+        return count >= 2 ? (int)count : -EINVAL;
+}
+
+static int vc_subscribe_source_change(int fd)
+{
+        struct v4l2_event_subscription sub = { .type = V4L2_EVENT_SOURCE_CHANGE };
+
+        return vc_xioctl(fd, VIDIOC_SUBSCRIBE_EVENT, &sub);
+}
+
+// Returns the event arrival time or 0 if there was none
+static uint64_t vc_wait_source_change(int fd, int timeout_ms)
+{
+        struct pollfd pfd = { .fd = fd, .events = POLLPRI };
+        struct v4l2_event event;
+        uint64_t now = 0;
+
+        while (poll(&pfd, 1, timeout_ms) > 0) {
+                if (vc_xioctl(fd, VIDIOC_DQEVENT, &event) < 0)
+                        break;
+                if (event.type == V4L2_EVENT_SOURCE_CHANGE) {
+                        now = vc_clock_ns(CLOCK_MONOTONIC);
+                        timeout_ms = 0;         // drain
+                }
+        }
+        return now;
+}
+
+static int vc_apply_step(int fd, const struct vc_switch_step *step)
+{
+        struct v4l2_rect rect = step->crop;
+
+        if (step->binning >= 0)
+                return vc_ctrl_set(fd, V4L2_CID_VC_BINNING_MODE, step->binning);
+        return vc_subdev_set_crop(fd, 0, &rect);
+}
+
+int main(int argc, char *argv[])
+{
+        static const struct option options[] = {
+                { "device",   required_argument, NULL, 'd' },
+                { "subdev",   required_argument, NULL, 's' },
+                { "binning",  required_argument, NULL, 'B' },
+                { "crop",     required_argument, NULL, 'C' },
+                { "every",    required_argument, NULL, 'e' },
+                { "switches", required_argument, NULL, 'n' },
+                { "buffers",  required_argument, NULL, 'b' },
+                { "help",     no_argument,       NULL, 'h' },
+                { NULL, 0, NULL, 0 },
+        };
+        const char *device = "/dev/video0";
+        char subdev[64] = "";
+        struct vc_switch_step steps[VC_SWITCH_MAX_STEPS];
+        unsigned int every = 30, switches = 20, buffers = 4, done = 0, failed = 0, frames = 0, step = 0;
+        struct vc_histogram interval, lost, ioctl_time, event_time;
+        struct v4l2_mbus_framefmt mbus;
+        struct v4l2_rect crop;
+        int32_t binning = 0;
+        uint64_t last_ts = 0, switch_ns = 0;
+        bool pending = false, have_event;
+        struct vc_capture *cap;
+        struct vc_frame frame;
+        int num_steps = 0, fd, opt, ret, status = 0;
+
+        while ((opt = getopt_long(argc, argv, "d:s:b:h", options, NULL)) != -1) {
+                switch (opt) {
+                case 'd': device = optarg; break;
+                case 's': snprintf(subdev, sizeof(subdev), "%s", optarg); break;
+                case 'B': num_steps = vc_parse_binning(optarg, steps); break;
+                case 'C': num_steps = vc_parse_crop(optarg, steps); break;
+                case 'e': every = strtoul(optarg, NULL, 0); break;
+                case 'n': switches = strtoul(optarg, NULL, 0); break;
+                case 'b': buffers = strtoul(optarg, NULL, 0); break;
+                default: usage(argv[0]);
+                }
+        }
+        if (num_steps < 2 || every < 2) {
+                fprintf(stderr, "Need at least two binning modes or crop windows\n");
+                usage(argv[0]);
+        }
+
+        if (!subdev[0] && vc_find_sensor_subdev(subdev, sizeof(subdev)) < 0) {
+                fprintf(stderr, "No vc_mipi_camera subdevice found, use --subdev\n");
+                return 1;
+        }
+        fd = open(subdev, O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+                fprintf(stderr, "Failed to open %s: %s\n", subdev, strerror(errno));
+                return 1;
+        }
+        have_event = vc_subscribe_source_change(fd) == 0;
+        if (!have_event)
+                fprintf(stderr, "Driver does not signal source changes, event latency not measured\n");
+
+        // Restored at the end
+        vc_ctrl_get(fd, V4L2_CID_VC_BINNING_MODE, &binning);
+        vc_subdev_get_crop(fd, 0, &crop);
+
+        // The stream is set up for the first step, the others must fit into it
+        ret = vc_apply_step(fd, &steps[0]);
+        if (ret == 0 && vc_subdev_get_fmt(fd, 0, &mbus) == 0) {
+                struct vc_format fmt = { .width = mbus.width, .height = mbus.height };
+                const struct vc_pixfmt *pixfmt = vc_pixfmt_from_mbus(mbus.code);
+
+                fmt.fourcc = pixfmt ? pixfmt->fourcc : 0;
+                ret = vc_capture_set_format(device, &fmt);
+        }
+        if (ret < 0) {
+                fprintf(stderr, "Failed to configure the first step: %s\n", strerror(-ret));
+                close(fd);
+                return 1;
+        }
+
+        cap = vc_capture_open(device, NULL, buffers);
+        if (!cap) {
+                fprintf(stderr, "Failed to open %s: %s\n", device, strerror(errno));
+                close(fd);
+                return 1;
+        }
+
+        vc_hist_reset(&interval);
+        vc_hist_reset(&lost);
+        vc_hist_reset(&ioctl_time);
+        vc_hist_reset(&event_time);
+
+        signal(SIGINT, vc_handle_signal);
+        signal(SIGTERM, vc_handle_signal);
+
+        ret = vc_capture_start(cap);
+        if (ret < 0) {
+                fprintf(stderr, "Failed to start streaming: %s\n", strerror(-ret));
+                status = ret;
+                goto out;
+        }
+
+        while (!stop && done < switches) {
+                ret = vc_capture_dequeue(cap, &frame, 2000);
+                if (ret < 0) {
+                        fprintf(stderr, "Failed to dequeue: %s\n", strerror(-ret));
+                        status = ret;
+                        break;
+                }
+                vc_capture_release(cap, &frame);
+
+                if (last_ts) {
+                        uint64_t delta = frame.timestamp_ns - last_ts;
+
+                        if (pending) {
+                                // Frame period from the undisturbed intervals
+                                double period = vc_hist_percentile(&interval, 50);
+
+                                vc_hist_add(&lost, period > 0 ? (uint64_t)fmax(0.0, round(delta / period) - 1) : 0);
+                                pending = false;
+                        } else if (frames > VC_SWITCH_WARMUP) {
+                                vc_hist_add(&interval, delta);
+                        }
+                }
+                last_ts = frame.timestamp_ns;
+                frames++;
+
+                if (frames < VC_SWITCH_WARMUP || frames % every)
+                        continue;
+
+                step = (step + 1) % num_steps;
+                switch_ns = vc_clock_ns(CLOCK_MONOTONIC);
+                ret = vc_apply_step(fd, &steps[step]);
+                vc_hist_add(&ioctl_time, vc_clock_ns(CLOCK_MONOTONIC) - switch_ns);
+                if (ret < 0) {
+                        failed++;
+                        fprintf(stderr, "Switch %u failed: %s\n", done, strerror(-ret));
+                } else if (have_event) {
+                        uint64_t event_ns = vc_wait_source_change(fd, 0);
+
+                        if (event_ns)
+                                vc_hist_add(&event_time, event_ns - switch_ns);
+                }
+                pending = ret == 0;
+                done++;
+        }
+
+        vc_capture_stop(cap);
+
+        printf("%u switches (%u failed), %.2f fps between switches\n", done, failed,
+               interval.count ? 1e9 / vc_hist_percentile(&interval, 50) : 0.0);
+        if (lost.count)
+                printf("Frames lost per switch: mean %.2f, max %" PRIu64 "\n", vc_hist_mean(&lost), lost.max);
+        if (ioctl_time.count)
+                printf("Switch ioctl:           mean %.2f ms, max %.2f ms\n",
+                       vc_hist_mean(&ioctl_time) / 1e6, ioctl_time.max / 1e6);
+        if (event_time.count)
+                printf("Source change event:    mean %.2f ms, max %.2f ms\n",
+                       vc_hist_mean(&event_time) / 1e6, event_time.max / 1e6);
+
+out:
+        vc_capture_close(cap);
+
+        vc_ctrl_set(fd, V4L2_CID_VC_BINNING_MODE, binning);
+        vc_subdev_set_crop(fd, 0, &crop);
+        close(fd);
+
+        return status < 0 || failed ? 1 : 0;
+}